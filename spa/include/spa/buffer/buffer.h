@@ -96,18 +96,25 @@ struct spa_buffer {
 	uint32_t n_datas;		/**< number of data members */
 };
 
-/** Find metadata in a buffer */
-static inline void *spa_buffer_find_meta(struct spa_buffer *b, uint32_t type)
+/** Find the metadata of \a type in a buffer, NULL when not found */
+static inline struct spa_meta *spa_buffer_get_meta(struct spa_buffer *b, uint32_t type)
 {
 	uint32_t i;
 
 	for (i = 0; i < b->n_metas; i++)
 		if (b->metas[i].type == type)
-			return b->metas[i].data;
+			return &b->metas[i];
 
 	return NULL;
 }
 
+/** Find metadata in a buffer */
+static inline void *spa_buffer_find_meta(struct spa_buffer *b, uint32_t type)
+{
+	struct spa_meta *m = spa_buffer_get_meta(b, type);
+	return m ? m->data : NULL;
+}
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
@@ -38,6 +38,8 @@ extern "C" {
 #define SPA_TYPE_META__VideoCrop	SPA_TYPE_META_BASE "VideoCrop"
 #define SPA_TYPE_META__Bitmap		SPA_TYPE_META_BASE "Bitmap"
 #define SPA_TYPE_META__Cursor		SPA_TYPE_META_BASE "Cursor"
+#define SPA_TYPE_META__VideoDamage	SPA_TYPE_META_BASE "VideoDamage"
+#define SPA_TYPE_META__Timing		SPA_TYPE_META_BASE "Timing"
 
 /**
  * A metadata element.
@@ -78,6 +80,59 @@ struct spa_meta_video_crop {
 	int32_t width, height;	/**< width and height */
 };
 
+#define spa_meta_region_is_valid(r)	((r)->region.size.width != 0 && (r)->region.size.height != 0)
+
+/**
+ * A region in a frame
+ *
+ * The VideoDamage meta is an array of regions of the frame that changed
+ * since the previous buffer. The array ends at the first invalid region or
+ * at the end of the meta, a first invalid region means that nothing changed.
+ * A producer that can't track damage adds one region with the size of the
+ * frame.
+ */
+struct spa_meta_region {
+	struct spa_region region;
+};
+
+/** Iterate the valid regions in \a meta, a VideoDamage \ref spa_meta */
+#define spa_meta_for_each_region(pos,meta)						\
+	for (pos = (struct spa_meta_region *)(meta)->data;				\
+	     (void *)(pos + 1) <= SPA_MEMBER((meta)->data, (meta)->size, void) &&	\
+	     spa_meta_region_is_valid(pos);						\
+	     pos++)
+
+/** The max number of regions that fit in \a meta */
+#define spa_meta_n_regions(meta)	((meta)->size / sizeof(struct spa_meta_region))
+
+/**
+ * Processing times of a buffer
+ *
+ * The producer sets \a create_time, every node that processes the buffer
+ * after that updates \a process_time and increments \a n_nodes so that
+ * consumers can see how long the buffer spent in the graph.
+ */
+struct spa_meta_timing {
+	int64_t create_time;		/**< monotonic time in nsec the data was produced */
+	int64_t process_time;		/**< monotonic time in nsec the buffer was last processed */
+	uint32_t n_nodes;		/**< number of nodes that processed the buffer */
+	uint32_t padding;
+};
+
+/** Mark \a timing as produced at \a now */
+static inline void spa_meta_timing_create(struct spa_meta_timing *timing, int64_t now)
+{
+	timing->create_time = timing->process_time = now;
+	timing->n_nodes = 1;
+}
+
+/** Mark \a timing as processed by one more node at \a now */
+static inline void spa_meta_timing_process(struct spa_meta_timing *timing, int64_t now)
+{
+	timing->process_time = now;
+	timing->n_nodes++;
+}
+
 /**
  * Describes a control location in the buffer.
  */
@@ -115,6 +170,8 @@ struct spa_meta_cursor {
 struct spa_type_meta {
 	uint32_t Header;
 	uint32_t VideoCrop;
+	uint32_t VideoDamage;
+	uint32_t Timing;
 };
 
 static inline void spa_type_meta_map(struct spa_type_map *map, struct spa_type_meta *type)
@@ -122,6 +179,8 @@ static inline void spa_type_meta_map(struct spa_type_map *map, struct spa_type_m
 	if (type->Header == 0) {
 		type->Header = spa_type_map_get_id(map, SPA_TYPE_META__Header);
 		type->VideoCrop = spa_type_map_get_id(map, SPA_TYPE_META__VideoCrop);
+		type->VideoDamage = spa_type_map_get_id(map, SPA_TYPE_META__VideoDamage);
+		type->Timing = spa_type_map_get_id(map, SPA_TYPE_META__Timing);
 	}
 }
 
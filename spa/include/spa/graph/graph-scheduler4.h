@@ -52,13 +52,13 @@ static inline void check_input(struct spa_graph_node *node)
 			continue;
 
 		pnode = pport->node;
-		debug("node %p input peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p input peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		pnode->ready[SPA_DIRECTION_OUTPUT]++;
 		if (pport->io->status == SPA_STATUS_OK)
 			node->ready[SPA_DIRECTION_INPUT]++;
 
-		debug("node %p input peer %p out %d %d\n", node, pnode,
+		spa_debug("node %p input peer %p out %d %d\n", node, pnode,
 				pnode->required[SPA_DIRECTION_OUTPUT],
 				pnode->ready[SPA_DIRECTION_OUTPUT]);
 	}
@@ -79,13 +79,13 @@ static inline void check_output(struct spa_graph_node *node)
 			continue;
 
 		pnode = pport->node;
-		debug("node %p output peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p output peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		if (pport->io->status == SPA_STATUS_HAVE_BUFFER) {
 			pnode->ready[SPA_DIRECTION_INPUT]++;
 			node->required[SPA_DIRECTION_OUTPUT]++;
 		}
-		debug("node %p output peer %p out %d %d\n", node, pnode,
+		spa_debug("node %p output peer %p out %d %d\n", node, pnode,
 				pnode->required[SPA_DIRECTION_INPUT],
 				pnode->ready[SPA_DIRECTION_INPUT]);
 	}
@@ -96,14 +96,14 @@ static inline void spa_graph_impl_activate(void *data, struct spa_graph_node *no
 {
 	int res;
 
-	debug("node %p activate %d\n", node, node->state);
+	spa_debug("node %p activate %d\n", node, node->state);
 	if (node->state == SPA_STATUS_NEED_BUFFER) {
                 res = spa_node_process_input(node->implementation);
-		debug("node %p process in %d\n", node, res);
+		spa_debug("node %p process in %d\n", node, res);
 	}
 	else if (node->state == SPA_STATUS_HAVE_BUFFER) {
                 res = spa_node_process_output(node->implementation);
-		debug("node %p process out %d\n", node, res);
+		spa_debug("node %p process out %d\n", node, res);
 	}
 	else
 		return;
@@ -116,14 +116,14 @@ static inline void spa_graph_impl_activate(void *data, struct spa_graph_node *no
 	}
 	node->state = res;
 
-	debug("node %p activate end %d\n", node, res);
+	spa_debug("node %p activate end %d\n", node, res);
 }
 
 static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
 
-	debug("node %p start pull\n", node);
+	spa_debug("node %p start pull\n", node);
 
 	node->state = SPA_STATUS_NEED_BUFFER;
 	node->ready[SPA_DIRECTION_INPUT] = 0;
@@ -137,20 +137,20 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 			continue;
 		pnode = pport->node;
 		prequired = pnode->required[SPA_DIRECTION_OUTPUT];
-		debug("node %p pull peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p pull peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		pnode->ready[SPA_DIRECTION_OUTPUT]++;
 		if (pport->io->status == SPA_STATUS_OK)
 			node->ready[SPA_DIRECTION_INPUT]++;
 
-		debug("node %p pull peer %p out %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_OUTPUT]);
+		spa_debug("node %p pull peer %p out %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_OUTPUT]);
 		if (prequired > 0 && pnode->ready[SPA_DIRECTION_OUTPUT] >= prequired) {
 			pnode->state = SPA_STATUS_HAVE_BUFFER;
 			spa_graph_impl_activate(data, pnode);
 		}
 	}
 
-	debug("node %p end pull\n", node);
+	spa_debug("node %p end pull\n", node);
 
 	return 0;
 }
@@ -160,7 +160,7 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 	struct spa_graph_port *p;
 	uint32_t required;
 
-	debug("node %p start push\n", node);
+	spa_debug("node %p start push\n", node);
 
 	node->state = SPA_STATUS_HAVE_BUFFER;
 
@@ -177,13 +177,13 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 
 		pnode = pport->node;
 		prequired = pnode->required[SPA_DIRECTION_INPUT];
-		debug("node %p push peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
+		spa_debug("node %p push peer %p io %d %d\n", node, pnode, pport->io->status, pport->io->buffer_id);
 
 		if (pport->io->status == SPA_STATUS_HAVE_BUFFER) {
 			pnode->ready[SPA_DIRECTION_INPUT]++;
 			node->required[SPA_DIRECTION_OUTPUT]++;
 		}
-		debug("node %p push peer %p in %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_INPUT]);
+		spa_debug("node %p push peer %p in %d %d\n", node, pnode, prequired, pnode->ready[SPA_DIRECTION_INPUT]);
 		if (prequired > 0 && pnode->ready[SPA_DIRECTION_INPUT] >= prequired) {
 			pnode->state = SPA_STATUS_NEED_BUFFER;
 			spa_graph_impl_activate(data, pnode);
@@ -193,7 +193,7 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 	if (required > 0 && node->ready[SPA_DIRECTION_OUTPUT] >= required) {
 
 	}
-	debug("node %p end push\n", node);
+	spa_debug("node %p end push\n", node);
 
 	return 0;
 }
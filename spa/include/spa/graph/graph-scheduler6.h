@@ -36,6 +36,21 @@ static inline void spa_graph_data_init(struct spa_graph_data *data,
 	data->graph = graph;
 }
 
+static inline int spa_graph_impl_process(struct spa_graph_node *node, enum spa_direction direction)
+{
+	struct spa_graph *graph = node->graph;
+	int res;
+
+	spa_graph_profile(graph, process_start, node);
+	if (direction == SPA_DIRECTION_INPUT)
+		res = spa_node_process_input(node->implementation);
+	else
+		res = spa_node_process_output(node->implementation);
+	spa_graph_profile(graph, process_end, node, res);
+
+	return res;
+}
+
 static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
@@ -69,7 +84,7 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 				pport->io->buffer_id, pready, prequired);
 
 		if (prequired > 0 && pready >= prequired) {
-			pnode->state = spa_node_process_output(pnode->implementation);
+			pnode->state = spa_graph_impl_process(pnode, SPA_DIRECTION_OUTPUT);
 
 			spa_debug("peer %p processed out %d", pnode, pnode->state);
 			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
@@ -117,7 +132,7 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 				pport->io->buffer_id, pready, prequired);
 
 		if (prequired > 0 && pready >= prequired) {
-			pnode->state = spa_node_process_input(pnode->implementation);
+			pnode->state = spa_graph_impl_process(pnode, SPA_DIRECTION_INPUT);
 
 			spa_debug("peer %p processed in %d", pnode, pnode->state);
 			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
@@ -45,16 +45,42 @@ struct spa_graph_callbacks {
 	int (*have_output) (void *data, struct spa_graph_node *node);
 };
 
+/** Optional profiler callbacks, called from the thread that runs the graph */
+struct spa_graph_profiler {
+#define SPA_VERSION_GRAPH_PROFILER	0
+	uint32_t version;
+
+	/** a driver node starts a new cycle */
+	void (*cycle_start) (void *data, struct spa_graph_node *driver);
+	/** the cycle started by \a driver completed */
+	void (*cycle_end) (void *data, struct spa_graph_node *driver);
+	/** \a node is about to be processed */
+	void (*process_start) (void *data, struct spa_graph_node *node);
+	/** \a node was processed and returned \a status */
+	void (*process_end) (void *data, struct spa_graph_node *node, int status);
+};
+
 struct spa_graph {
 	struct spa_list nodes;
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
+	const struct spa_graph_profiler *profiler;
+	void *profiler_data;
 };
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
 #define spa_graph_have_output(g,n)	((g)->callbacks->have_output((g)->callbacks_data, (n)))
 #define spa_graph_reuse_buffer(g,n,p,i)	((g)->callbacks->reuse_buffer((g)->callbacks_data, (n),(p),(i)))
 
+#define spa_graph_profile(g,m,...)						\
+do {										\
+	if (SPA_UNLIKELY((g)->profiler != NULL))				\
+		(g)->profiler->m((g)->profiler_data, __VA_ARGS__);		\
+} while (0)
+
+#define spa_graph_cycle_start(g,n)	spa_graph_profile(g, cycle_start, n)
+#define spa_graph_cycle_end(g,n)	spa_graph_profile(g, cycle_end, n)
+
 struct spa_graph_node {
 	struct spa_list link;		/**< link in graph nodes list */
 	struct spa_graph *graph;	/**< owner graph */
@@ -67,6 +93,7 @@ struct spa_graph_node {
 	int state;			/**< state of the node */
 	struct spa_node *implementation;/**< node implementation */
 	void *scheduler_data;		/**< scheduler private data */
+	void *profiler_data;		/**< profiler private data */
 };
 
 struct spa_graph_port {
@@ -84,6 +111,8 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->profiler = NULL;
+	graph->profiler_data = NULL;
 }
 
 static inline void
@@ -95,6 +124,17 @@ spa_graph_set_callbacks(struct spa_graph *graph,
 	graph->callbacks_data = data;
 }
 
+/** Set the profiler of the graph, this should be called from the
+ * thread that runs the graph. Pass NULL to disable profiling. */
+static inline void
+spa_graph_set_profiler(struct spa_graph *graph,
+		       const struct spa_graph_profiler *profiler,
+		       void *data)
+{
+	graph->profiler_data = data;
+	graph->profiler = profiler;
+}
+
 static inline void
 spa_graph_node_init(struct spa_graph_node *node)
 {
@@ -103,6 +143,7 @@ spa_graph_node_init(struct spa_graph_node *node)
 	node->flags = 0;
 	node->required[SPA_DIRECTION_INPUT] = node->ready[SPA_DIRECTION_INPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = node->ready[SPA_DIRECTION_OUTPUT] = 0;
+	node->profiler_data = NULL;
 	spa_debug("node %p init", node);
 }
 
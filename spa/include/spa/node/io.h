@@ -24,7 +24,10 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+
 #include <spa/support/type-map.h>
+#include <spa/utils/ringbuffer.h>
 
 /** Base for IO structures to interface with node ports */
 #define SPA_TYPE__IO			SPA_TYPE_POINTER_BASE "IO"
@@ -59,6 +62,59 @@ struct spa_io_buffers {
 
 #define SPA_IO_BUFFERS_INIT  (struct spa_io_buffers) { SPA_STATUS_OK, SPA_ID_INVALID, }
 
+/** An io area to keep several buffers in flight on a port */
+#define SPA_TYPE_IO__BufferRing		SPA_TYPE_IO_BASE "BufferRing"
+
+/** Buffer ring IO area
+ *
+ * A single producer, single consumer ring of buffer ids. Where
+ * \ref spa_io_buffers holds one buffer per cycle, the producer can
+ * queue up to \ref SPA_IO_BUFFER_RING_SIZE buffers ahead and the
+ * consumer takes them at its own rate.
+ */
+struct spa_io_buffer_ring {
+#define SPA_IO_BUFFER_RING_SIZE		16
+	struct spa_ringbuffer ring;
+	uint32_t ids[SPA_IO_BUFFER_RING_SIZE];
+};
+
+/** The number of buffer ids in \a ring */
+static inline uint32_t spa_io_buffer_ring_avail(struct spa_io_buffer_ring *ring)
+{
+	uint32_t index;
+	int32_t avail = spa_ringbuffer_get_read_index(&ring->ring, &index);
+	return avail > 0 ? avail : 0;
+}
+
+/** Add \a id to \a ring, only called by the producer
+ * \return 0 on success, -ENOSPC when the ring is full */
+static inline int spa_io_buffer_ring_push(struct spa_io_buffer_ring *ring, uint32_t id)
+{
+	uint32_t index;
+	int32_t filled = spa_ringbuffer_get_write_index(&ring->ring, &index);
+
+	if (filled < 0 || filled >= SPA_IO_BUFFER_RING_SIZE)
+		return -ENOSPC;
+
+	ring->ids[index & (SPA_IO_BUFFER_RING_SIZE - 1)] = id;
+	spa_ringbuffer_write_update(&ring->ring, index + 1);
+	return 0;
+}
+
+/** Take the oldest id from \a ring, only called by the consumer
+ * \return the buffer id or SPA_ID_INVALID when the ring is empty */
+static inline uint32_t spa_io_buffer_ring_pop(struct spa_io_buffer_ring *ring)
+{
+	uint32_t index, id;
+
+	if (spa_ringbuffer_get_read_index(&ring->ring, &index) <= 0)
+		return SPA_ID_INVALID;
+
+	id = ring->ids[index & (SPA_IO_BUFFER_RING_SIZE - 1)];
+	spa_ringbuffer_read_update(&ring->ring, index + 1);
+	return id;
+}
+
 /** Information about requested range */
 #define SPA_TYPE_IO_CONTROL__Range	SPA_TYPE_IO_CONTROL_BASE "Range"
 
@@ -69,10 +125,101 @@ struct spa_io_control_range {
 	uint32_t max_size;	/**< maximum size of data */
 };
 
+/** The clock of the driver of a graph */
+#define SPA_TYPE_IO__Clock		SPA_TYPE_IO_BASE "Clock"
+
+/** Clock IO area
+ *
+ * Written by the driver of the graph once every cycle and read from any
+ * thread without locking. The writer makes \a seq odd while it updates the
+ * fields, readers use \ref spa_io_clock_read to get a consistent snapshot.
+ */
+struct spa_io_clock {
+	uint32_t seq;			/**< update sequence number, odd while updating */
+#define SPA_IO_CLOCK_FLAG_LIVE	(1 << 0)
+	uint32_t flags;			/**< clock flags */
+	int32_t rate;			/**< the rate of \a ticks, 0 when unknown */
+	int32_t scale;			/**< the scale as a 16.16 fraction */
+	int64_t ticks;			/**< the ticks at \a monotonic_time */
+	int64_t monotonic_time;		/**< the monotonic time in nanoseconds */
+	int64_t latency;		/**< the latency of the driver in ticks */
+};
+
+/** Publish new values in \a clock, must only be called by one writer */
+static inline void spa_io_clock_write(struct spa_io_clock *clock, const struct spa_io_clock *values)
+{
+	uint32_t seq = __atomic_load_n(&clock->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&clock->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock->flags = values->flags;
+	clock->rate = values->rate;
+	clock->scale = values->scale;
+	clock->ticks = values->ticks;
+	clock->monotonic_time = values->monotonic_time;
+	clock->latency = values->latency;
+
+	__atomic_store_n(&clock->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/** Read a consistent snapshot of \a clock into \a values, retries while
+ * the writer is busy */
+static inline void spa_io_clock_read(const struct spa_io_clock *clock, struct spa_io_clock *values)
+{
+	uint32_t seq1, seq2;
+
+	do {
+		seq1 = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+
+		values->flags = clock->flags;
+		values->rate = clock->rate;
+		values->scale = clock->scale;
+		values->ticks = clock->ticks;
+		values->monotonic_time = clock->monotonic_time;
+		values->latency = clock->latency;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&clock->seq, __ATOMIC_RELAXED);
+	} while ((seq1 & 1) || seq1 != seq2);
+
+	values->seq = seq1;
+}
+
+/** The number of frames the graph processes in one cycle */
+#define SPA_TYPE_IO__Quantum		SPA_TYPE_IO_BASE "Quantum"
+
+/** Quantum IO area
+ *
+ * Shared by the host with all ports of the graph. Nodes read \a size at
+ * the start of every cycle and produce or consume that many frames. The
+ * host only changes \a size between cycles and reallocates the buffers
+ * of links when they are too small for the new quantum.
+ */
+struct spa_io_quantum {
+	uint32_t size;			/**< frames per cycle */
+	uint32_t padding;
+};
+
+/** The current quantum in \a quantum or \a def when there is no quantum */
+static inline uint32_t spa_io_quantum_get(const struct spa_io_quantum *quantum, uint32_t def)
+{
+	uint32_t size;
+
+	if (quantum == NULL)
+		return def;
+
+	size = __atomic_load_n(&quantum->size, __ATOMIC_RELAXED);
+	return size > 0 ? size : def;
+}
+
 struct spa_type_io {
 	uint32_t Buffers;
 	uint32_t ControlRange;
 	uint32_t Prop;
+	uint32_t Clock;
+	uint32_t BufferRing;
+	uint32_t Quantum;
 };
 
 static inline void spa_type_io_map(struct spa_type_map *map, struct spa_type_io *type)
@@ -81,6 +228,9 @@ static inline void spa_type_io_map(struct spa_type_map *map, struct spa_type_io
 		type->Buffers = spa_type_map_get_id(map, SPA_TYPE_IO__Buffers);
 		type->ControlRange = spa_type_map_get_id(map, SPA_TYPE_IO_CONTROL__Range);
 		type->Prop = spa_type_map_get_id(map, SPA_TYPE_IO__Prop);
+		type->Clock = spa_type_map_get_id(map, SPA_TYPE_IO__Clock);
+		type->BufferRing = spa_type_map_get_id(map, SPA_TYPE_IO__BufferRing);
+		type->Quantum = spa_type_map_get_id(map, SPA_TYPE_IO__Quantum);
 	}
 }
 
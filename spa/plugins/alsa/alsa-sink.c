@@ -192,11 +192,16 @@ static int impl_node_send_command(struct spa_node *node, const struct spa_comman
 		if (this->n_buffers == 0)
 			return -EIO;
 
+		if ((res = spa_alsa_resume(this)) < 0)
+			return res;
 		if ((res = spa_alsa_start(this, false)) < 0)
 			return res;
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
 		if ((res = spa_alsa_pause(this, false)) < 0)
 			return res;
+	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Suspend) {
+		if ((res = spa_alsa_suspend(this)) < 0)
+			return res;
 	} else
 		return -ENOTSUP;
 
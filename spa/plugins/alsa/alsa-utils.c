@@ -749,3 +749,32 @@ int spa_alsa_pause(struct state *state, bool xrun_recover)
 
 	return 0;
 }
+
+int spa_alsa_suspend(struct state *state)
+{
+	int err;
+
+	if ((err = spa_alsa_pause(state, false)) < 0)
+		return err;
+
+	spa_log_debug(state->log, "alsa %p: suspend", state);
+
+	return spa_alsa_close(state);
+}
+
+int spa_alsa_resume(struct state *state)
+{
+	int err;
+
+	if (state->opened || !state->have_format)
+		return 0;
+
+	spa_log_debug(state->log, "alsa %p: resume", state);
+
+	/* reopen the device with the format that was negotiated before the
+	 * suspend, the buffers are still there */
+	if ((err = spa_alsa_set_format(state, &state->current_format, 0)) < 0)
+		spa_log_error(state->log, "alsa %p: resume failed: %s", state, snd_strerror(err));
+
+	return err;
+}
@@ -183,6 +183,11 @@ int spa_alsa_start(struct state *state, bool xrun_recover);
 int spa_alsa_pause(struct state *state, bool xrun_recover);
 int spa_alsa_close(struct state *state);
 
+/** close the device but keep the format and buffers */
+int spa_alsa_suspend(struct state *state);
+/** open the device again after \ref spa_alsa_suspend */
+int spa_alsa_resume(struct state *state);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
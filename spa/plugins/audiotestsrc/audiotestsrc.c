@@ -101,6 +101,10 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 enum wave_type {
 	WAVE_SINE,
 	WAVE_SQUARE,
+	WAVE_SAW,
+	WAVE_WHITE_NOISE,
+	WAVE_PINK_NOISE,
+	WAVE_SILENCE,
 };
 
 #define DEFAULT_LIVE false
@@ -125,6 +129,7 @@ static void reset_props(struct props *props)
 
 #define MAX_BUFFERS 16
 #define MAX_PORTS 1
+#define MAX_CHANNELS 64
 
 struct buffer {
 	struct spa_buffer *outbuf;
@@ -135,7 +140,7 @@ struct buffer {
 
 struct impl;
 
-typedef int (*render_func_t) (struct impl *this, void *samples, size_t n_samples);
+typedef void (*fill_func_t) (void *dst, const float *src, uint32_t n_samples, uint32_t channels);
 
 struct impl {
 	struct spa_handle handle;
@@ -167,8 +172,12 @@ struct impl {
 	bool have_format;
 	struct spa_audio_info current_format;
 	size_t bpf;
-	render_func_t render_func;
+	size_t sample_size;
+	bool planar;
+	fill_func_t fill_func;
 	double accumulator;
+	uint32_t noise_seed;
+	float pink[3];
 
 	struct buffer buffers[MAX_BUFFERS];
 	uint32_t n_buffers;
@@ -233,8 +242,12 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propName, "s", "Select the waveform",
 				":", t->param.propType, "i", p->wave,
 				":", t->param.propLabels, "[-i",
-					"i", WAVE_SINE, "s", "Sine wave",
-					"i", WAVE_SQUARE, "s", "Square wave", "]");
+					"i", WAVE_SINE,   "s", "Sine wave",
+					"i", WAVE_SQUARE, "s", "Square wave",
+					"i", WAVE_SAW,    "s", "Saw wave",
+					"i", WAVE_WHITE_NOISE, "s", "White noise",
+					"i", WAVE_PINK_NOISE,  "s", "Pink noise",
+					"i", WAVE_SILENCE, "s", "Silence", "]");
 			break;
 		case 2:
 			param = spa_pod_builder_object(&b,
@@ -356,12 +369,9 @@ static int make_buffer(struct impl *this)
 	struct buffer *b;
 	struct spa_io_buffers *io = this->io;
 	struct spa_io_control_range *range = this->io_range;
-	int n_bytes, n_samples;
-	uint32_t maxsize;
-	void *data;
+	uint32_t n_bytes, n_samples, maxsize, n_datas, channels, n_planes, i;
+	void *planes[MAX_CHANNELS];
 	struct spa_data *d;
-	int32_t filled, avail;
-	uint32_t index, offset, l0, l1;
 
 	read_timer(this);
 
@@ -375,8 +385,8 @@ static int make_buffer(struct impl *this)
 	b->outstanding = true;
 
 	d = b->outbuf->datas;
+	n_datas = b->outbuf->n_datas;
 	maxsize = d[0].maxsize;
-	data = d[0].data;
 
 	n_bytes = maxsize;
 	if (range && range->min_size != 0) {
@@ -388,25 +398,43 @@ static int make_buffer(struct impl *this)
 	spa_log_trace(this->log, NAME " %p: dequeue buffer %d %d %d", this, b->outbuf->id,
 		      maxsize, n_bytes);
 
-	filled = 0;
-	index = 0;
-	avail = maxsize - filled;
-	n_bytes = SPA_MIN(avail, n_bytes);
-
-	offset = index % maxsize;
-
-	n_samples = n_bytes / this->bpf;
+	n_bytes = SPA_MIN(maxsize, n_bytes);
+	channels = this->current_format.info.raw.channels;
 
-	l0 = SPA_MIN(n_bytes, maxsize - offset) / this->bpf;
-	l1 = n_samples - l0;
-
-	this->render_func(this, SPA_MEMBER(data, offset, void), l0);
-	if (l1 > 0)
-		this->render_func(this, data, l1);
+	if (this->planar && n_datas >= channels) {
+		/* one data per channel */
+		n_samples = n_bytes / this->sample_size;
+		for (i = 0; i < channels; i++) {
+			n_samples = SPA_MIN(n_samples, d[i].maxsize / this->sample_size);
+			planes[i] = d[i].data;
+		}
+		for (i = 0; i < channels; i++) {
+			d[i].chunk->offset = 0;
+			d[i].chunk->size = n_samples * this->sample_size;
+			d[i].chunk->stride = this->sample_size;
+		}
+		n_planes = channels;
+	}
+	else if (this->planar) {
+		/* the planes of the channels follow each other in the data */
+		n_samples = n_bytes / this->bpf;
+		for (i = 0; i < channels; i++)
+			planes[i] = SPA_MEMBER(d[0].data, i * n_samples * this->sample_size, void);
+		d[0].chunk->offset = 0;
+		d[0].chunk->size = n_samples * this->bpf;
+		d[0].chunk->stride = this->sample_size;
+		n_planes = channels;
+	}
+	else {
+		n_samples = n_bytes / this->bpf;
+		planes[0] = d[0].data;
+		d[0].chunk->offset = 0;
+		d[0].chunk->size = n_samples * this->bpf;
+		d[0].chunk->stride = this->bpf;
+		n_planes = 1;
+	}
 
-	d[0].chunk->offset = index;
-	d[0].chunk->size = n_bytes;
-	d[0].chunk->stride = this->bpf;
+	render_samples(this, planes, n_planes, n_samples);
 
 	if (b->h) {
 		b->h->seq = this->sample_count;
@@ -586,6 +614,9 @@ port_enum_formats(struct impl *this,
 						     t->audio_format.S32,
 						     t->audio_format.F32,
 						     t->audio_format.F64),
+			":", t->format_audio.layout,   "ieu", SPA_AUDIO_LAYOUT_INTERLEAVED,
+				SPA_POD_PROP_ENUM(2, SPA_AUDIO_LAYOUT_INTERLEAVED,
+						     SPA_AUDIO_LAYOUT_NON_INTERLEAVED),
 			":", t->format_audio.rate,     "iru", 44100,
 				SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 			":", t->format_audio.channels, "iru", 2,
@@ -617,6 +648,7 @@ port_get_format(struct impl *this,
 		"I", t->media_type.audio,
 		"I", t->media_subtype.raw,
 		":", t->format_audio.format,   "I", this->current_format.info.raw.format,
+		":", t->format_audio.layout,   "i", this->current_format.info.raw.layout,
 		":", t->format_audio.rate,     "i", this->current_format.info.raw.rate,
 		":", t->format_audio.channels, "i", this->current_format.info.raw.channels);
 
@@ -740,7 +772,11 @@ impl_node_port_enum_params(struct spa_node *node,
 				":", t->param.propType,   "i", p->wave,
 				":", t->param.propLabels, "[-i",
 					"i", WAVE_SINE,   "s", "Sine wave",
-					"i", WAVE_SQUARE, "s", "Square wave", "]");
+					"i", WAVE_SQUARE, "s", "Square wave",
+					"i", WAVE_SAW,    "s", "Saw wave",
+					"i", WAVE_WHITE_NOISE, "s", "White noise",
+					"i", WAVE_PINK_NOISE,  "s", "Pink noise",
+					"i", WAVE_SILENCE, "s", "Silence", "]");
 			break;
 		case 1:
 			param = spa_pod_builder_object(&b,
@@ -826,10 +862,18 @@ port_set_format(struct impl *this,
 		else
 			return -EINVAL;
 
+		if (info.info.raw.channels == 0)
+			return -EINVAL;
+		if (info.info.raw.layout == SPA_AUDIO_LAYOUT_NON_INTERLEAVED &&
+		    info.info.raw.channels > MAX_CHANNELS)
+			return -EINVAL;
+
+		this->sample_size = sizes[idx];
 		this->bpf = sizes[idx] * info.info.raw.channels;
+		this->planar = info.info.raw.layout == SPA_AUDIO_LAYOUT_NON_INTERLEAVED;
 		this->current_format = info;
 		this->have_format = true;
-		this->render_func = sine_funcs[idx];
+		this->fill_func = fill_funcs[idx];
 	}
 
 	if (this->have_format) {
@@ -1190,6 +1234,7 @@ impl_init(const struct spa_handle_factory *factory,
 	this->io_wave = &this->props.wave;
 	this->io_freq = &this->props.freq;
 	this->io_volume = &this->props.volume;
+	this->noise_seed = 0x9e3779b9;
 
 	spa_list_init(&this->empty);
 
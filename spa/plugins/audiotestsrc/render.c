@@ -19,40 +19,280 @@
 
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define M_PI_M2 ( M_PI + M_PI )
 
-#define DEFINE_SINE(type,scale)								\
-static void										\
-audio_test_src_create_sine_##type (struct impl *this, type *samples, size_t n_samples)	\
-{											\
-	int i, c, channels;								\
-	double step, amp;								\
-	double freq = *this->io_freq;							\
-	double volume = *this->io_volume;						\
-											\
-	channels = this->current_format.info.raw.channels;				\
-	step = M_PI_M2 * freq / this->current_format.info.raw.rate;			\
-	amp = volume * scale;								\
-											\
-	for (i = 0; i < n_samples; i++) {						\
-		type val;								\
-		this->accumulator += step;						\
-		if (this->accumulator >= M_PI_M2)					\
-			this->accumulator -= M_PI_M2;					\
-		val = (type) (sin (this->accumulator) * amp);				\
-		for (c = 0; c < channels; ++c)						\
-			*samples++ = val;						\
-	}										\
-}
-
-DEFINE_SINE(int16_t, 32767.0);
-DEFINE_SINE(int32_t, 2147483647.0);
-DEFINE_SINE(float, 1.0);
-DEFINE_SINE(double, 1.0);
-
-static const render_func_t sine_funcs[] = {
-	(render_func_t) audio_test_src_create_sine_int16_t,
-	(render_func_t) audio_test_src_create_sine_int32_t,
-	(render_func_t) audio_test_src_create_sine_float,
-	(render_func_t) audio_test_src_create_sine_double
+/* samples are generated as float in blocks of this size and then
+ * converted to the sample format */
+#define BLOCK_SIZE	256
+
+/* largest float below 2^31 */
+#define S32_SCALE	2147483520.0f
+
+typedef void (*wave_func_t) (struct impl *this, float *samples, uint32_t n_samples,
+			     double step, float amp);
+
+static void
+wave_sine(struct impl *this, float *samples, uint32_t n_samples, double step, float amp)
+{
+	double k, y0, y1, y2;
+	uint32_t i;
+
+	/* recursive oscillator y[n] = 2 cos(step) y[n-1] - y[n-2]. It is
+	 * restarted from the phase for each block so that errors don't
+	 * accumulate */
+	k = 2.0 * cos(step);
+	y0 = sin(this->accumulator) * amp;
+	y1 = sin(this->accumulator - step) * amp;
+
+	for (i = 0; i < n_samples; i++) {
+		samples[i] = y0;
+		y2 = k * y0 - y1;
+		y1 = y0;
+		y0 = y2;
+	}
+	this->accumulator = fmod(this->accumulator + n_samples * step, M_PI_M2);
+}
+
+static void
+wave_square(struct impl *this, float *samples, uint32_t n_samples, double step, float amp)
+{
+	double phase = this->accumulator;
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++) {
+		samples[i] = phase < M_PI ? amp : -amp;
+		phase += step;
+		if (phase >= M_PI_M2)
+			phase -= M_PI_M2;
+	}
+	this->accumulator = phase;
+}
+
+static void
+wave_saw(struct impl *this, float *samples, uint32_t n_samples, double step, float amp)
+{
+	double phase = this->accumulator;
+	float scale = amp / M_PI;
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++) {
+		samples[i] = phase * scale - amp;
+		phase += step;
+		if (phase >= M_PI_M2)
+			phase -= M_PI_M2;
+	}
+	this->accumulator = phase;
+}
+
+static inline float noise_next(struct impl *this)
+{
+	/* xorshift32 */
+	uint32_t x = this->noise_seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	this->noise_seed = x;
+
+	return (int32_t) x * (1.0f / 2147483648.0f);
+}
+
+static void
+wave_white_noise(struct impl *this, float *samples, uint32_t n_samples, double step, float amp)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_samples; i++)
+		samples[i] = noise_next(this) * amp;
+}
+
+static void
+wave_pink_noise(struct impl *this, float *samples, uint32_t n_samples, double step, float amp)
+{
+	float *b = this->pink;
+	float white;
+	uint32_t i;
+
+	/* Paul Kellet's economy filter, -3dB/octave. The output is scaled
+	 * to keep the peaks below 1.0 */
+	for (i = 0; i < n_samples; i++) {
+		white = noise_next(this);
+		b[0] = 0.99765f * b[0] + white * 0.0990460f;
+		b[1] = 0.96300f * b[1] + white * 0.2965164f;
+		b[2] = 0.57000f * b[2] + white * 1.0526913f;
+		samples[i] = (b[0] + b[1] + b[2] + white * 0.1848f) * 0.11f * amp;
+	}
+}
+
+static const wave_func_t wave_funcs[] = {
+	[WAVE_SINE] = wave_sine,
+	[WAVE_SQUARE] = wave_square,
+	[WAVE_SAW] = wave_saw,
+	[WAVE_WHITE_NOISE] = wave_white_noise,
+	[WAVE_PINK_NOISE] = wave_pink_noise,
+	[WAVE_SILENCE] = NULL,
+};
+
+/* the fill functions convert n_samples of src to the sample format and
+ * write each of them to channels consecutive samples of dst */
+static void fill_s16(void *dst, const float *src, uint32_t n_samples, uint32_t channels)
+{
+	int16_t *d = dst, v;
+	uint32_t i = 0, c;
+
+#if defined(__SSE2__)
+	if (channels <= 2) {
+		const __m128 scale = _mm_set1_ps(32767.0f);
+		const __m128 min = _mm_set1_ps(-1.0f), max = _mm_set1_ps(1.0f);
+		__m128i a, b, out;
+
+		for (; i + 8 <= n_samples; i += 8) {
+			a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+					_mm_loadu_ps(&src[i]), min), max), scale));
+			b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+					_mm_loadu_ps(&src[i + 4]), min), max), scale));
+			out = _mm_packs_epi32(a, b);
+			if (channels == 1) {
+				_mm_storeu_si128((__m128i*)&d[i], out);
+			} else {
+				_mm_storeu_si128((__m128i*)&d[2 * i], _mm_unpacklo_epi16(out, out));
+				_mm_storeu_si128((__m128i*)&d[2 * i + 8], _mm_unpackhi_epi16(out, out));
+			}
+		}
+	}
+#endif
+	for (; i < n_samples; i++) {
+		v = (int16_t) lrintf(SPA_CLAMP(src[i], -1.0f, 1.0f) * 32767.0f);
+		for (c = 0; c < channels; c++)
+			d[i * channels + c] = v;
+	}
+}
+
+static void fill_s32(void *dst, const float *src, uint32_t n_samples, uint32_t channels)
+{
+	int32_t *d = dst, v;
+	uint32_t i = 0, c;
+
+#if defined(__SSE2__)
+	if (channels <= 2) {
+		const __m128 scale = _mm_set1_ps(S32_SCALE);
+		const __m128 min = _mm_set1_ps(-1.0f), max = _mm_set1_ps(1.0f);
+		__m128i out;
+
+		for (; i + 4 <= n_samples; i += 4) {
+			out = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(
+					_mm_loadu_ps(&src[i]), min), max), scale));
+			if (channels == 1) {
+				_mm_storeu_si128((__m128i*)&d[i], out);
+			} else {
+				_mm_storeu_si128((__m128i*)&d[2 * i], _mm_unpacklo_epi32(out, out));
+				_mm_storeu_si128((__m128i*)&d[2 * i + 4], _mm_unpackhi_epi32(out, out));
+			}
+		}
+	}
+#endif
+	for (; i < n_samples; i++) {
+		v = (int32_t) lrintf(SPA_CLAMP(src[i], -1.0f, 1.0f) * S32_SCALE);
+		for (c = 0; c < channels; c++)
+			d[i * channels + c] = v;
+	}
+}
+
+static void fill_f32(void *dst, const float *src, uint32_t n_samples, uint32_t channels)
+{
+	float *d = dst;
+	uint32_t i = 0, c;
+
+	if (channels == 1) {
+		memcpy(d, src, n_samples * sizeof(float));
+		return;
+	}
+#if defined(__SSE2__)
+	if (channels == 2) {
+		__m128 in;
+
+		for (; i + 4 <= n_samples; i += 4) {
+			in = _mm_loadu_ps(&src[i]);
+			_mm_storeu_ps(&d[2 * i], _mm_unpacklo_ps(in, in));
+			_mm_storeu_ps(&d[2 * i + 4], _mm_unpackhi_ps(in, in));
+		}
+	}
+#endif
+	for (; i < n_samples; i++) {
+		for (c = 0; c < channels; c++)
+			d[i * channels + c] = src[i];
+	}
+}
+
+static void fill_f64(void *dst, const float *src, uint32_t n_samples, uint32_t channels)
+{
+	double *d = dst;
+	uint32_t i = 0, c;
+
+#if defined(__SSE2__)
+	if (channels <= 2) {
+		__m128d in;
+
+		for (; i + 2 <= n_samples; i += 2) {
+			in = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)&src[i])));
+			if (channels == 1) {
+				_mm_storeu_pd(&d[i], in);
+			} else {
+				_mm_storeu_pd(&d[2 * i], _mm_unpacklo_pd(in, in));
+				_mm_storeu_pd(&d[2 * i + 2], _mm_unpackhi_pd(in, in));
+			}
+		}
+	}
+#endif
+	for (; i < n_samples; i++) {
+		for (c = 0; c < channels; c++)
+			d[i * channels + c] = src[i];
+	}
+}
+
+static const fill_func_t fill_funcs[] = {
+	fill_s16,
+	fill_s32,
+	fill_f32,
+	fill_f64,
 };
+
+/** render n_samples to the planes, there is 1 plane for interleaved
+ * formats and one plane per channel for planar formats */
+static void render_samples(struct impl *this, void **planes, uint32_t n_planes, uint32_t n_samples)
+{
+	float samples[BLOCK_SIZE];
+	uint32_t wave = *this->io_wave, channels, stride, i, n;
+	double step;
+	float amp;
+
+	channels = this->planar ? 1 : this->current_format.info.raw.channels;
+	stride = this->sample_size * channels;
+
+	if (wave >= SPA_N_ELEMENTS(wave_funcs) || wave_funcs[wave] == NULL) {
+		for (i = 0; i < n_planes; i++)
+			memset(planes[i], 0, n_samples * stride);
+		return;
+	}
+
+	step = fmod(M_PI_M2 * *this->io_freq / this->current_format.info.raw.rate, M_PI_M2);
+	amp = *this->io_volume;
+
+	for (; n_samples > 0; n_samples -= n) {
+		n = SPA_MIN(n_samples, BLOCK_SIZE);
+
+		wave_funcs[wave](this, samples, n, step, amp);
+		this->fill_func(planes[0], samples, n, channels);
+
+		/* all channels have the same signal */
+		for (i = 1; i < n_planes; i++) {
+			memcpy(planes[i], planes[0], n * stride);
+			planes[i] = SPA_MEMBER(planes[i], n * stride, void);
+		}
+		planes[0] = SPA_MEMBER(planes[0], n * stride, void);
+	}
+}
@@ -17,10 +17,14 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 
@@ -44,14 +48,70 @@
 #include "rtp.h"
 #include "a2dp-codecs.h"
 
+#define PROP_BATCH		SPA_TYPE_PROPS_BASE "batch"
+#define PROP_ENCODE_TIME	SPA_TYPE_PROPS_BASE "encodeTime"
+#define PROP_SEND_TIME		SPA_TYPE_PROPS_BASE "sendTime"
+#define PROP_SENT_PACKETS	SPA_TYPE_PROPS_BASE "sentPackets"
+#define PROP_SEND_CALLS		SPA_TYPE_PROPS_BASE "sendCalls"
+#define PROP_SILENCE_PACKETS	SPA_TYPE_PROPS_BASE "silencePackets"
+#define PROP_ADAPTIVE		SPA_TYPE_PROPS_BASE "adaptive"
+#define PROP_BITPOOL		SPA_TYPE_PROPS_BASE "bitpool"
+#define PROP_FILL_LEVEL		SPA_TYPE_PROPS_BASE "fillLevel"
+#define PROP_THROUGHPUT		SPA_TYPE_PROPS_BASE "throughput"
+#define PROP_OUTQ		SPA_TYPE_PROPS_BASE "outq"
+#define PROP_LINK_LATENCY	SPA_TYPE_PROPS_BASE "linkLatency"
+
 struct props {
 	uint32_t min_latency;
 	uint32_t max_latency;
+	uint32_t batch;
+	bool adaptive;
 };
 
 #define FILL_FRAMES 2
+#define MAX_FILL_FRAMES 8
 #define MAX_FRAME_COUNT 32
 #define MAX_BUFFERS 32
+#define MAX_PACKETS 16
+#define MAX_PACKET_SIZE 4096
+#define MAX_SILENCE_SIZE 1024
+
+/* an encoded rtp packet, packets are encoded ahead in a ring and sent in
+ * batches */
+struct packet {
+	uint32_t size;			/* used bytes, including the rtp headers */
+	uint32_t frame_count;
+	uint32_t timestamp;		/* sample position of the first frame */
+	uint8_t data[MAX_PACKET_SIZE];
+};
+
+struct stats {
+	uint64_t encode_time;		/* nsec spent in the encoder */
+	uint64_t send_time;		/* nsec spent sending */
+	uint64_t sent_packets;
+	uint64_t send_calls;
+	uint64_t silence_packets;
+};
+
+/* estimates the throughput of the link from the amount of data that left
+ * the socket queue and adapts the bitpool and the fill level to it */
+struct controller {
+	uint64_t last_time;		/* time of the last update */
+	uint32_t last_outq;		/* bytes in the socket queue at the last update */
+	uint64_t sent_bytes;		/* bytes written since the last update */
+	double throughput;		/* smoothed bytes per second the link drains */
+	uint32_t outq;			/* bytes in the socket queue */
+	uint64_t latency;		/* nsec to drain the socket queue */
+	uint32_t fill_frames;		/* packets to keep in the socket */
+	uint64_t last_change;		/* time of the last bitpool change */
+	uint64_t last_congestion;	/* time the link last couldn't keep up */
+	uint64_t last_underrun;		/* time of the last underrun or fill change */
+};
+
+#define CONTROLLER_MIN_INTERVAL		(10 * SPA_NSEC_PER_MSEC)
+#define CONTROLLER_DOWN_HOLD		(200 * SPA_NSEC_PER_MSEC)
+#define CONTROLLER_UP_HOLD		(2 * SPA_NSEC_PER_SEC)
+#define CONTROLLER_FILL_HOLD		(10 * SPA_NSEC_PER_SEC)
 
 struct buffer {
 	struct spa_buffer *outbuf;
@@ -67,6 +127,18 @@ struct type {
 	uint32_t props;
 	uint32_t prop_min_latency;
 	uint32_t prop_max_latency;
+	uint32_t prop_batch;
+	uint32_t prop_encode_time;
+	uint32_t prop_send_time;
+	uint32_t prop_sent_packets;
+	uint32_t prop_send_calls;
+	uint32_t prop_silence_packets;
+	uint32_t prop_adaptive;
+	uint32_t prop_bitpool;
+	uint32_t prop_fill_level;
+	uint32_t prop_throughput;
+	uint32_t prop_outq;
+	uint32_t prop_link_latency;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
@@ -90,6 +162,18 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
 	type->prop_min_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__minLatency);
 	type->prop_max_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__maxLatency);
+	type->prop_batch = spa_type_map_get_id(map, PROP_BATCH);
+	type->prop_encode_time = spa_type_map_get_id(map, PROP_ENCODE_TIME);
+	type->prop_send_time = spa_type_map_get_id(map, PROP_SEND_TIME);
+	type->prop_sent_packets = spa_type_map_get_id(map, PROP_SENT_PACKETS);
+	type->prop_send_calls = spa_type_map_get_id(map, PROP_SEND_CALLS);
+	type->prop_silence_packets = spa_type_map_get_id(map, PROP_SILENCE_PACKETS);
+	type->prop_adaptive = spa_type_map_get_id(map, PROP_ADAPTIVE);
+	type->prop_bitpool = spa_type_map_get_id(map, PROP_BITPOOL);
+	type->prop_fill_level = spa_type_map_get_id(map, PROP_FILL_LEVEL);
+	type->prop_throughput = spa_type_map_get_id(map, PROP_THROUGHPUT);
+	type->prop_outq = spa_type_map_get_id(map, PROP_OUTQ);
+	type->prop_link_latency = spa_type_map_get_id(map, PROP_LINK_LATENCY);
 
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
@@ -156,11 +240,13 @@ struct impl {
 	int write_samples;
 	int frame_length;
 	int codesize;
-	uint8_t buffer[4096];
-	int buffer_used;
-	int frame_count;
+	struct packet packets[MAX_PACKETS];
+	uint32_t packet_read;		/* first packet to send */
+	uint32_t packet_write;		/* packet being encoded */
+	bool use_sendmmsg;
+	uint8_t silence[MAX_SILENCE_SIZE];	/* one frame of silence for the bitpool */
+	int silence_size;
 	uint16_t seqnum;
-	uint32_t timestamp;
 
 	int min_bitpool;
 	int max_bitpool;
@@ -176,6 +262,9 @@ struct impl {
 	int64_t last_monotonic;
 
 	uint64_t underrun;
+
+	struct stats stats;
+	struct controller ctl;
 };
 
 #define NAME "a2dp-sink"
@@ -184,11 +273,15 @@ struct impl {
 
 static const uint32_t default_min_latency = 1024;
 static const uint32_t default_max_latency = 1024;
+static const uint32_t default_batch = 1;
+static const bool default_adaptive = true;
 
 static void reset_props(struct props *props)
 {
 	props->min_latency = default_min_latency;
 	props->max_latency = default_max_latency;
+	props->batch = default_batch;
+	props->adaptive = default_adaptive;
 }
 
 static int impl_node_enum_params(struct spa_node *node,
@@ -243,6 +336,21 @@ static int impl_node_enum_params(struct spa_node *node,
 				":", t->param.propType, "ir", p->max_latency,
 					SPA_POD_PROP_MIN_MAX(1, INT32_MAX));
 			break;
+		case 2:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_batch,
+				":", t->param.propName, "s", "Packets to encode ahead and send at once",
+				":", t->param.propType, "ir", p->batch,
+					SPA_POD_PROP_MIN_MAX(1, MAX_PACKETS - 1));
+			break;
+		case 3:
+			param = spa_pod_builder_object(&b,
+				id, t->param.PropInfo,
+				":", t->param.propId,   "I", t->prop_adaptive,
+				":", t->param.propName, "s", "Adapt the bitpool to the link throughput",
+				":", t->param.propType, "b", p->adaptive);
+			break;
 		default:
 			return 0;
 		}
@@ -255,7 +363,19 @@ static int impl_node_enum_params(struct spa_node *node,
 			param = spa_pod_builder_object(&b,
 				id, t->props,
 				":", t->prop_min_latency, "i",   p->min_latency,
-				":", t->prop_max_latency, "i",   p->max_latency);
+				":", t->prop_max_latency, "i",   p->max_latency,
+				":", t->prop_batch,       "i",   p->batch,
+				":", t->prop_encode_time, "l",   this->stats.encode_time,
+				":", t->prop_send_time,   "l",   this->stats.send_time,
+				":", t->prop_sent_packets, "l",  this->stats.sent_packets,
+				":", t->prop_send_calls,  "l",   this->stats.send_calls,
+				":", t->prop_silence_packets, "l", this->stats.silence_packets,
+				":", t->prop_adaptive,    "b",   p->adaptive,
+				":", t->prop_bitpool,     "i",   (int) this->sbc.bitpool,
+				":", t->prop_fill_level,  "i",   this->ctl.fill_frames,
+				":", t->prop_throughput,  "i",   (int) this->ctl.throughput,
+				":", t->prop_outq,        "i",   this->ctl.outq,
+				":", t->prop_link_latency, "l",  this->ctl.latency);
 			break;
 		default:
 			return 0;
@@ -292,7 +412,10 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 		}
 		spa_pod_object_parse(param,
 			":", t->prop_min_latency, "?i", &p->min_latency,
-			":", t->prop_max_latency, "?i", &p->max_latency, NULL);
+			":", t->prop_max_latency, "?i", &p->max_latency,
+			":", t->prop_batch,       "?i", &p->batch,
+			":", t->prop_adaptive,    "?b", &p->adaptive, NULL);
+		p->batch = SPA_CLAMP(p->batch, 1, MAX_PACKETS - 1);
 	}
 	else
 		return -ENOENT;
@@ -331,141 +454,279 @@ static inline void calc_timeout(size_t target, size_t current,
 	}
 }
 
-static int reset_buffer(struct impl *this)
+static inline uint64_t get_time_ns(void)
 {
-	this->buffer_used = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
-	this->frame_count = 0;
-	return 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static inline struct packet *current_packet(struct impl *this)
+{
+	return &this->packets[this->packet_write % MAX_PACKETS];
+}
+
+static void begin_packet(struct impl *this)
+{
+	struct packet *p = current_packet(this);
+
+	p->size = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	p->frame_count = 0;
+	p->timestamp = this->sample_count;
 }
 
-static int send_buffer(struct impl *this)
+/* complete the current packet and queue it for sending */
+static void finish_packet(struct impl *this)
 {
-	int val, written;
+	struct packet *p = current_packet(this);
 	struct rtp_header *header;
 	struct rtp_payload *payload;
 
-	header = (struct rtp_header *)this->buffer;
-	payload = (struct rtp_payload *)(this->buffer + sizeof(struct rtp_header));
-	memset(this->buffer, 0, sizeof(struct rtp_header)+sizeof(struct rtp_payload));
+	header = (struct rtp_header *)p->data;
+	payload = (struct rtp_payload *)(p->data + sizeof(struct rtp_header));
+	memset(p->data, 0, sizeof(struct rtp_header)+sizeof(struct rtp_payload));
 
-	payload->frame_count = this->frame_count;
+	payload->frame_count = p->frame_count;
 	header->v = 2;
 	header->pt = 1;
 	header->sequence_number = htons(this->seqnum);
-	header->timestamp = htonl(this->timestamp);
+	header->timestamp = htonl(p->timestamp);
 	header->ssrc = htonl(1);
 
-	ioctl(this->transport->fd, TIOCOUTQ, &val);
+	this->seqnum++;
+	this->packet_write++;
+	begin_packet(this);
+}
 
-	spa_log_trace(this->log, "a2dp-sink %p: send %d %u %u %u %lu %d",
-			this, this->frame_count, this->seqnum, this->timestamp, this->buffer_used,
-			this->sample_time, val);
+static int reset_buffer(struct impl *this)
+{
+	this->packet_read = this->packet_write = 0;
+	begin_packet(this);
+	return 0;
+}
+
+static int send_packet(struct impl *this, struct packet *p)
+{
+	int written;
 
-	written = write(this->transport->fd, this->buffer, this->buffer_used);
+	written = write(this->transport->fd, p->data, p->size);
 	spa_log_trace(this->log, "a2dp-sink %p: send %d", this, written);
 	if (written < 0)
 		return -errno;
+	return written;
+}
 
-	this->timestamp = this->sample_count;
-	this->seqnum++;
-	reset_buffer(this);
+/* send the queued packets, with one sendmmsg when there is more than one.
+ * Returns the number of bytes written or -EAGAIN when not all packets
+ * could be sent. */
+static int send_packets(struct impl *this)
+{
+	struct mmsghdr msgs[MAX_PACKETS];
+	struct iovec iov[MAX_PACKETS];
+	uint32_t i, n_packets;
+	int res = 0, val, written = 0;
+	uint64_t t0;
+
+	t0 = get_time_ns();
+
+	while ((n_packets = this->packet_write - this->packet_read) > 0) {
+		ioctl(this->transport->fd, TIOCOUTQ, &val);
+
+		spa_log_trace(this->log, "a2dp-sink %p: send %u packets from %u %lu %d",
+				this, n_packets, this->packet_read, this->sample_time, val);
+
+		if (n_packets == 1 || !this->use_sendmmsg) {
+			struct packet *p = &this->packets[this->packet_read % MAX_PACKETS];
+
+			n_packets = 1;
+
+			if ((res = send_packet(this, p)) >= 0) {
+				written += res;
+				res = 1;
+			}
+		} else {
+			for (i = 0; i < n_packets; i++) {
+				struct packet *p = &this->packets[(this->packet_read + i) % MAX_PACKETS];
+
+				iov[i].iov_base = p->data;
+				iov[i].iov_len = p->size;
+				spa_zero(msgs[i]);
+				msgs[i].msg_hdr.msg_iov = &iov[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			if ((res = sendmmsg(this->transport->fd, msgs, n_packets, MSG_DONTWAIT)) < 0) {
+				res = -errno;
+				if (res == -ENOTSOCK) {
+					spa_log_debug(this->log, "a2dp-sink %p: no sendmmsg", this);
+					this->use_sendmmsg = false;
+					continue;
+				}
+			} else {
+				for (i = 0; i < res; i++)
+					written += msgs[i].msg_len;
+			}
+		}
+		this->stats.send_calls++;
 
-	return written;
+		if (res < 0)
+			break;
+
+		this->packet_read += res;
+		this->stats.sent_packets += res;
+
+		if (res < n_packets) {
+			res = -EAGAIN;
+			break;
+		}
+	}
+	this->stats.send_time += get_time_ns() - t0;
+	this->ctl.sent_bytes += written;
+
+	return this->packet_read != this->packet_write ? res : written;
 }
 
 static int encode_buffer(struct impl *this, const void *data, int size)
 {
+	struct packet *p = current_packet(this);
 	int processed;
 	ssize_t out_encoded;
 
 	spa_log_trace(this->log, "a2dp-sink %p: encode %d used %d, %d %d",
-			this, size, this->buffer_used, this->frame_size, this->write_size);
+			this, size, p->size, this->frame_size, this->write_size);
+
+	/* the frames get longer when the bitpool was raised, the packet that
+	 * was started before can be too full for the next frame */
+	if (p->frame_count > 0 && p->size + this->frame_length > this->write_size) {
+		finish_packet(this);
+		p = current_packet(this);
+	}
 
-	if (this->frame_count > MAX_FRAME_COUNT)
+	/* the ring holds the complete packets of a batch and the packet
+	 * that is being encoded */
+	if (this->packet_write - this->packet_read >= this->props.batch)
 		return -ENOSPC;
 
 	processed = sbc_encode(&this->sbc, data, size,
-			       this->buffer + this->buffer_used,
-			       this->write_size - this->buffer_used,
+			       p->data + p->size,
+			       this->write_size - p->size,
 			       &out_encoded);
 	if (processed < 0)
 		return processed;
 
 	this->sample_count += processed / this->frame_size;
 	this->sample_time += processed / this->frame_size;
-	this->frame_count += processed / this->codesize;
-	this->buffer_used += out_encoded;
+	p->frame_count += processed / this->codesize;
+	p->size += out_encoded;
 
 	spa_log_trace(this->log, "a2dp-sink %p: processed %d %ld used %d",
-			this, processed, out_encoded, this->buffer_used);
+			this, processed, out_encoded, p->size);
 
-	return processed;
-}
+	if (p->size + this->frame_length > this->write_size ||
+	    p->frame_count > MAX_FRAME_COUNT)
+		finish_packet(this);
 
-static bool need_flush(struct impl *this)
-{
-	return (this->buffer_used + this->frame_length > this->write_size) ||
-		this->frame_count > MAX_FRAME_COUNT;
+	return processed;
 }
 
-static int flush_buffer(struct impl *this, bool force)
+/* prefill the socket with packets made from the precomputed silence frame */
+static int fill_socket(struct impl *this, uint64_t now_time)
 {
-	spa_log_trace(this->log, "%d %d %d", this->buffer_used, this->frame_length,
-			this->write_size);
-
-	if (force || need_flush(this))
-		return send_buffer(this);
+	struct packet *p;
+	uint32_t i, j, n_frames, n_samples, unsent;
+	int res;
 
-	return 0;
-}
+	if (this->silence_size == 0)
+		return 0;
 
-static int fill_socket(struct impl *this, uint64_t now_time)
-{
-	static const uint8_t zero_buffer[1024 * 4] = { 0, };
-	int frames = 0;
+	n_frames = (this->write_size - sizeof(struct rtp_header) - sizeof(struct rtp_payload)) /
+		this->silence_size;
+	n_frames = SPA_MIN(n_frames, MAX_FRAME_COUNT);
+	n_samples = n_frames * (this->codesize / this->frame_size);
 
-	while (frames < FILL_FRAMES) {
-		int processed, written;
+	for (i = 0; i < this->ctl.fill_frames; i++) {
+		p = current_packet(this);
+		for (j = 0; j < n_frames; j++) {
+			memcpy(p->data + p->size, this->silence, this->silence_size);
+			p->size += this->silence_size;
+		}
+		p->frame_count = n_frames;
+		this->sample_count += n_samples;
+		this->sample_time += n_samples;
+		finish_packet(this);
+	}
 
-		processed = encode_buffer(this, zero_buffer, sizeof(zero_buffer));
-		if (processed < 0)
-			return processed;
-		if (processed == 0)
-			break;
+	res = send_packets(this);
 
-		written = flush_buffer(this, false);
-		if (written == -EAGAIN)
-			break;
-		else if (written < 0)
-			return written;
-		else if (written > 0)
-			frames++;
+	/* drop the silence that did not fit in the socket */
+	unsent = this->packet_write - this->packet_read;
+	this->stats.silence_packets += this->ctl.fill_frames - unsent;
+	if (unsent > 0) {
+		this->sample_count = this->packets[this->packet_read % MAX_PACKETS].timestamp;
+		this->sample_time -= unsent * n_samples;
+		this->seqnum -= unsent;
 	}
 	reset_buffer(this);
-	this->sample_count = this->timestamp;
 
-	return 0;
+	return res == -EAGAIN ? 0 : SPA_MIN(res, 0);
 }
 
 static int add_data(struct impl *this, const void *data, int size)
 {
 	int processed, total = 0;
+	uint64_t t0;
+
+	t0 = get_time_ns();
 
 	while (size > 0) {
 		processed = encode_buffer(this, data, size);
 
 		if (processed == -ENOSPC || processed == 0)
 			break;
-		if (processed < 0)
-			return 0;
+		if (processed < 0) {
+			total = 0;
+			break;
+		}
 
 		data += processed;
 		size -= processed;
 		total += processed;
 	}
+	this->stats.encode_time += get_time_ns() - t0;
+
 	return total;
 }
 
+static int update_silence(struct impl *this)
+{
+	static const uint8_t zero_buffer[1024 * 4] = { 0, };
+	ssize_t encoded;
+	sbc_t sbc;
+	int res;
+
+	/* use a separate encoder so that the state of the stream is kept */
+	sbc_init(&sbc, 0);
+	sbc.frequency = this->sbc.frequency;
+	sbc.blocks = this->sbc.blocks;
+	sbc.subbands = this->sbc.subbands;
+	sbc.mode = this->sbc.mode;
+	sbc.allocation = this->sbc.allocation;
+	sbc.bitpool = this->sbc.bitpool;
+	sbc.endian = this->sbc.endian;
+
+	res = sbc_encode(&sbc, zero_buffer, SPA_MIN(this->codesize, sizeof(zero_buffer)),
+			 this->silence, sizeof(this->silence), &encoded);
+	sbc_finish(&sbc);
+
+	if (res < 0) {
+		spa_log_warn(this->log, "a2dp-sink %p: can't encode silence: %d", this, res);
+		this->silence_size = 0;
+		return res;
+	}
+	this->silence_size = encoded;
+
+	return 0;
+}
+
 static int set_bitpool(struct impl *this, int bitpool)
 {
 	if (bitpool < this->min_bitpool)
@@ -489,6 +750,8 @@ static int set_bitpool(struct impl *this, int bitpool)
 		- sizeof(struct rtp_header) - sizeof(struct rtp_payload) - 24;
 	this->write_samples = (this->write_size / this->frame_length) * (this->codesize / this->frame_size);
 
+	update_silence(this);
+
 	return 0;
 }
 
@@ -502,9 +765,150 @@ static int increase_bitpool(struct impl *this)
 	return set_bitpool(this, this->sbc.bitpool + 1);
 }
 
+static void set_send_buffer(struct impl *this)
+{
+	int val;
+	socklen_t len;
+
+	/* room for the fill level and for a batch of packets */
+	val = (this->ctl.fill_frames + this->props.batch - 1) * this->transport->write_mtu;
+	if (setsockopt(this->transport->fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) < 0)
+		spa_log_warn(this->log, "a2dp-sink %p: SO_SNDBUF %m", this);
+
+	len = sizeof(val);
+	if (getsockopt(this->transport->fd, SOL_SOCKET, SO_SNDBUF, &val, &len) < 0) {
+		spa_log_warn(this->log, "a2dp-sink %p: SO_SNDBUF %m", this);
+	}
+	else {
+		spa_log_debug(this->log, "a2dp-sink %p: SO_SNDBUF: %d", this, val);
+	}
+}
+
+/* bytes per second that the stream needs with the given bitpool */
+static double bitpool_throughput(struct impl *this, int bitpool)
+{
+	int save = this->sbc.bitpool, frame_length, packets;
+	double frames_per_sec;
+
+	this->sbc.bitpool = bitpool;
+	frame_length = sbc_get_frame_length(&this->sbc);
+	this->sbc.bitpool = save;
+
+	frames_per_sec = (double) this->current_format.info.raw.rate * this->frame_size /
+		this->codesize;
+	packets = SPA_MAX(1, this->write_size / frame_length);
+
+	return frames_per_sec * (frame_length +
+		(sizeof(struct rtp_header) + sizeof(struct rtp_payload)) / (double) packets);
+}
+
+static void controller_reset(struct impl *this)
+{
+	struct controller *c = &this->ctl;
+
+	spa_zero(*c);
+	c->fill_frames = FILL_FRAMES;
+}
+
+/* called after every flush with the socket queue telemetry */
+static void controller_update(struct impl *this, uint64_t now_time, bool congested)
+{
+	struct controller *c = &this->ctl;
+	int outq, bitpool;
+	int64_t drained;
+	uint64_t dt;
+	double rate;
+
+	/* SIOCOUTQ, the unsent bytes in the socket */
+	if (ioctl(this->transport->fd, TIOCOUTQ, &outq) < 0)
+		return;
+
+	c->outq = outq;
+
+	if (c->last_time == 0) {
+		c->last_time = now_time;
+		c->last_outq = outq;
+		c->sent_bytes = 0;
+		return;
+	}
+	if ((dt = now_time - c->last_time) < CONTROLLER_MIN_INTERVAL && !congested)
+		return;
+
+	drained = (int64_t) c->last_outq + c->sent_bytes - outq;
+	rate = SPA_MAX(drained, 0) * (double) SPA_NSEC_PER_SEC / SPA_MAX(dt, 1);
+
+	/* with an empty queue the link was waiting for us and the rate is only
+	 * a lower bound of what it can do */
+	if (c->throughput == 0.0)
+		c->throughput = rate;
+	else if (outq > 0 || rate > c->throughput)
+		c->throughput += (rate - c->throughput) / 8.0;
+
+	c->last_time = now_time;
+	c->last_outq = outq;
+	c->sent_bytes = 0;
+
+	c->latency = c->throughput > 0.0 ? outq * SPA_NSEC_PER_SEC / c->throughput : 0;
+
+	if (!this->props.adaptive || c->throughput == 0.0)
+		return;
+
+	bitpool = this->sbc.bitpool;
+
+	if (congested || (outq > (c->fill_frames + this->props.batch) * this->transport->write_mtu)) {
+		c->last_congestion = now_time;
+		if (now_time - c->last_change >= CONTROLLER_DOWN_HOLD) {
+			/* find the largest bitpool that fits in the link with some headroom */
+			while (bitpool > this->min_bitpool &&
+			       bitpool_throughput(this, bitpool) > c->throughput * 0.9)
+				bitpool--;
+			if (bitpool == this->sbc.bitpool)
+				bitpool--;
+		}
+	}
+	else if (outq < this->transport->write_mtu &&
+		 now_time - c->last_change > CONTROLLER_UP_HOLD &&
+		 now_time - c->last_congestion > CONTROLLER_UP_HOLD) {
+		/* while the link keeps up, the throughput only measures what we
+		 * send, so probe for more */
+		bitpool++;
+	}
+	bitpool = SPA_CLAMP(bitpool, this->min_bitpool, this->max_bitpool);
+	if (bitpool != this->sbc.bitpool) {
+		spa_log_debug(this->log, "a2dp-sink %p: throughput %f outq %d bitpool %d -> %d",
+				this, c->throughput, outq, this->sbc.bitpool, bitpool);
+		set_bitpool(this, bitpool);
+		c->last_change = now_time;
+	}
+
+	/* give back the extra fill when the link was stable for a while */
+	if (c->fill_frames > FILL_FRAMES &&
+	    now_time - c->last_underrun > CONTROLLER_FILL_HOLD) {
+		c->fill_frames--;
+		c->last_underrun = now_time;
+		set_send_buffer(this);
+	}
+}
+
+static void controller_underrun(struct impl *this, uint64_t now_time)
+{
+	struct controller *c = &this->ctl;
+
+	if (now_time - c->last_underrun < CONTROLLER_DOWN_HOLD)
+		return;
+
+	c->last_underrun = now_time;
+	if (c->fill_frames < MAX_FILL_FRAMES) {
+		c->fill_frames++;
+		spa_log_debug(this->log, "a2dp-sink %p: fill level %d", this, c->fill_frames);
+		set_send_buffer(this);
+	}
+}
+
 static int flush_data(struct impl *this, uint64_t now_time)
 {
-	uint32_t total_frames, written;
+	uint32_t total_frames;
+	int written;
 	uint64_t elapsed;
 	int64_t queued;
 	struct itimerspec ts;
@@ -557,7 +961,7 @@ static int flush_data(struct impl *this, uint64_t now_time)
 		spa_log_trace(this->log, "a2dp-sink %p: written %u frames", this, total_frames);
 	}
 
-	written = flush_buffer(this, false);
+	written = send_packets(this);
 	if (written == -EAGAIN) {
 		spa_log_trace(this->log, "delay flush %ld", this->sample_time);
 		if ((this->flush_source.mask & SPA_IO_OUT) == 0) {
@@ -565,6 +969,7 @@ static int flush_data(struct impl *this, uint64_t now_time)
 			spa_loop_update_source(this->data_loop, &this->flush_source);
 			this->source.mask = 0;
 			spa_loop_update_source(this->data_loop, &this->source);
+			controller_update(this, now_time, true);
 			return 0;
 		}
 	}
@@ -572,7 +977,7 @@ static int flush_data(struct impl *this, uint64_t now_time)
 		spa_log_trace(this->log, "error flushing %s", spa_strerror(written));
 		return written;
 	}
-	else if (written > 0) {
+	else if (written > 0 && !this->props.adaptive) {
 		if (now_time - this->last_error > SPA_NSEC_PER_SEC * 3) {
 			increase_bitpool(this);
 			this->last_error = now_time;
@@ -582,6 +987,8 @@ static int flush_data(struct impl *this, uint64_t now_time)
 	this->flush_source.mask = 0;
 	spa_loop_update_source(this->data_loop, &this->flush_source);
 
+	controller_update(this, now_time, false);
+
 	if (now_time > this->start_time)
 		elapsed = now_time - this->start_time;
 	else
@@ -594,13 +1001,15 @@ static int flush_data(struct impl *this, uint64_t now_time)
 	spa_log_trace(this->log, "%ld %ld %ld %ld %d",
 			now_time, queued, this->sample_time, elapsed, this->write_samples);
 
-	if (queued < FILL_FRAMES * this->write_samples) {
-		queued = (FILL_FRAMES + 1) * this->write_samples;
+	if (queued < this->ctl.fill_frames * this->write_samples) {
+		queued = (this->ctl.fill_frames + 1) * this->write_samples;
 		if (this->sample_time < elapsed) {
 			this->sample_time = queued;
 			this->start_time = now_time;
 		}
-		if (!spa_list_is_empty(&this->ready) &&
+		if (this->props.adaptive)
+			controller_underrun(this, now_time);
+		else if (!spa_list_is_empty(&this->ready) &&
 		    now_time - this->last_error > SPA_NSEC_PER_SEC / 2) {
 			reduce_bitpool(this);
 			this->last_error = now_time;
@@ -608,7 +1017,7 @@ static int flush_data(struct impl *this, uint64_t now_time)
 
 	}
 	calc_timeout(queued,
-		     FILL_FRAMES * this->write_samples,
+		     this->ctl.fill_frames * this->write_samples,
 		     this->current_format.info.raw.rate,
 		     &this->now, &ts.it_value);
 	ts.it_interval.tv_sec = 0;
@@ -748,7 +1157,6 @@ static int init_sbc(struct impl *this)
 static int do_start(struct impl *this)
 {
 	int res, val;
-	socklen_t len;
 	struct itimerspec ts;
 
 	if (this->started)
@@ -761,17 +1169,8 @@ static int do_start(struct impl *this)
 
 	init_sbc(this);
 
-	val = FILL_FRAMES * this->transport->write_mtu;
-	if (setsockopt(this->transport->fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) < 0)
-		spa_log_warn(this->log, "a2dp-sink %p: SO_SNDBUF %m", this);
-
-	len = sizeof(val);
-	if (getsockopt(this->transport->fd, SOL_SOCKET, SO_SNDBUF, &val, &len) < 0) {
-		spa_log_warn(this->log, "a2dp-sink %p: SO_SNDBUF %m", this);
-	}
-	else {
-		spa_log_debug(this->log, "a2dp-sink %p: SO_SNDBUF: %d", this, val);
-	}
+	controller_reset(this);
+	set_send_buffer(this);
 
 	val = FILL_FRAMES * this->transport->read_mtu;
 	if (setsockopt(this->transport->fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) < 0)
@@ -781,6 +1180,7 @@ static int do_start(struct impl *this)
 	if (setsockopt(this->transport->fd, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val)) < 0)
 		spa_log_warn(this->log, "SO_PRIORITY failed: %m");
 
+	this->use_sendmmsg = true;
 	reset_buffer(this);
 
 	this->source.data = this;
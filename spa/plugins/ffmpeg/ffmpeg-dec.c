@@ -19,58 +19,92 @@
 
 #include <errno.h>
 #include <stddef.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <spa/support/type-map.h>
 #include <spa/support/log.h>
+#include <spa/support/loop.h>
+#include <spa/utils/list.h>
 #include <spa/node/node.h>
 #include <spa/node/io.h>
 #include <spa/param/video/format-utils.h>
+#include <spa/param/buffers.h>
+#include <spa/param/meta.h>
 #include <spa/pod/filter.h>
 
+#include <libavutil/imgutils.h>
+
+#include "ffmpeg-utils.h"
+
+#define NAME "ffmpeg-dec"
+
 #define IS_VALID_PORT(this,d,id)	((id) == 0)
 #define GET_IN_PORT(this,p)		(&this->in_ports[p])
 #define GET_OUT_PORT(this,p)		(&this->out_ports[p])
 #define GET_PORT(this,d,p)		(d == SPA_DIRECTION_INPUT ? GET_IN_PORT(this,p) : GET_OUT_PORT(this,p))
 
 #define MAX_BUFFERS    32
+/* headers of the packets in the decoder, indexed with the packet pts */
+#define MAX_HEADERS    64
+/* the output stride is aligned so that the decoder can use the buffers */
+#define STRIDE_ALIGN   128
 
 struct buffer {
 	struct spa_buffer *outbuf;
+	struct spa_meta_header *h;
+	struct impl *impl;
+	struct spa_list link;
 	bool outstanding;
-	struct buffer *next;
+	AVFrame *frame;		/**< decoded frame in this buffer */
 };
 
+/* on the input port, queue holds the packets for the decoder and done the
+ * packets that the decoder released. On the output port, queue holds the
+ * free buffers and done the decoded buffers. Both are protected with the
+ * worker lock. */
 struct port {
 	bool have_format;
 	struct spa_video_info current_format;
-	bool have_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+	uint32_t n_buffers;
 	struct spa_port_info info;
 	struct spa_io_buffers *io;
+	struct spa_list queue;
+	struct spa_list done;
 };
 
 struct type {
 	uint32_t node;
+	uint32_t format;
 	struct spa_type_io io;
 	struct spa_type_param param;
+	struct spa_type_meta meta;
+	struct spa_type_data data;
 	struct spa_type_media_type media_type;
 	struct spa_type_media_subtype media_subtype;
 	struct spa_type_format_video format_video;
+	struct spa_type_video_format video_format;
 	struct spa_type_command_node command_node;
+	struct spa_type_param_buffers param_buffers;
+	struct spa_type_param_meta param_meta;
 };
 
 static inline void init_type(struct type *type, struct spa_type_map *map)
 {
 	type->node = spa_type_map_get_id(map, SPA_TYPE__Node);
+	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
+	spa_type_meta_map(map, &type->meta);
+	spa_type_data_map(map, &type->data);
 	spa_type_media_type_map(map, &type->media_type);
 	spa_type_media_subtype_map(map, &type->media_subtype);
 	spa_type_format_video_map(map, &type->format_video);
+	spa_type_video_format_map(map, &type->video_format);
 	spa_type_command_node_map(map, &type->command_node);
+	spa_type_param_buffers_map(map, &type->param_buffers);
+	spa_type_param_meta_map(map, &type->param_meta);
 }
 
 struct impl {
@@ -80,6 +114,7 @@ struct impl {
 	struct type type;
 	struct spa_type_map *map;
 	struct spa_log *log;
+	struct spa_loop *data_loop;
 
 	const struct spa_node_callbacks *callbacks;
 	void *user_data;
@@ -87,20 +122,436 @@ struct impl {
 	struct port in_ports[1];
 	struct port out_ports[1];
 
+	const AVCodec *codec;
+	uint32_t subtype;
+	uint32_t n_threads;
+
+	int stride;
+	int size;
+
+	struct spa_ffmpeg_worker worker;
+	AVCodecContext *context;
+	AVPacket *packet;		/**< the next packet to decode */
+	AVFrame *frame;
+	bool drained;			/**< no frames to receive until a new packet */
+	int64_t packet_count;
+	struct spa_meta_header headers[MAX_HEADERS];
+
 	bool started;
 };
 
+static void release_packet(void *opaque, uint8_t *data)
+{
+	struct buffer *b = opaque;
+	struct impl *this = b->impl;
+
+	pthread_mutex_lock(&this->worker.lock);
+	spa_list_append(&GET_IN_PORT(this, 0)->done, &b->link);
+	pthread_mutex_unlock(&this->worker.lock);
+
+	spa_ffmpeg_worker_notify(&this->worker);
+}
+
+/* called when the decoder and downstream are both done with the buffer */
+static void release_output(void *opaque, uint8_t *data)
+{
+	struct buffer *b = opaque;
+	struct impl *this = b->impl;
+
+	pthread_mutex_lock(&this->worker.lock);
+	spa_list_append(&GET_OUT_PORT(this, 0)->queue, &b->link);
+	spa_ffmpeg_worker_signal(&this->worker);
+	pthread_mutex_unlock(&this->worker.lock);
+}
+
+/* wrap the input buffer in the packet when there is room for the padding
+ * that the decoder needs, else copy */
+static int wrap_packet(struct impl *this, struct buffer *b, AVPacket *packet)
+{
+	struct spa_data *d = &b->outbuf->datas[0];
+	uint32_t offset, size;
+	uint8_t *data;
+	int res;
+
+	offset = SPA_MIN(d->chunk->offset, d->maxsize);
+	size = SPA_MIN(d->chunk->size, d->maxsize - offset);
+	data = SPA_MEMBER(d->data, offset, uint8_t);
+
+	/* an empty packet would drain the decoder */
+	if (size == 0) {
+		release_packet(b, NULL);
+		return -EINVAL;
+	}
+
+	if (d->maxsize - offset - size >= AV_INPUT_BUFFER_PADDING_SIZE) {
+		memset(data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+		packet->buf = av_buffer_create(data, size + AV_INPUT_BUFFER_PADDING_SIZE,
+					       release_packet, b, AV_BUFFER_FLAG_READONLY);
+		if (packet->buf == NULL) {
+			release_packet(b, NULL);
+			return -ENOMEM;
+		}
+		packet->data = data;
+		packet->size = size;
+	} else {
+		if ((res = av_new_packet(packet, size)) >= 0)
+			memcpy(packet->data, data, size);
+		release_packet(b, NULL);
+		if (res < 0)
+			return res;
+	}
+
+	packet->pts = this->packet_count++;
+	if (b->h)
+		this->headers[packet->pts % MAX_HEADERS] = *b->h;
+
+	return 0;
+}
+
+/* let the decoder write into the free output buffers when it supports
+ * direct rendering and the negotiated layout is one it can work with */
+static int get_buffer(AVCodecContext *context, AVFrame *frame, int flags)
+{
+	struct impl *this = context->opaque;
+	struct port *out = GET_OUT_PORT(this, 0);
+	struct spa_video_info_raw *info = &out->current_format.info.raw;
+	struct buffer *b = NULL;
+	struct spa_data *d;
+	uint8_t *data[4], *end[4];
+	int linesize[4], end_linesize[4], align[AV_NUM_DATA_POINTERS];
+	int i, width = frame->width, height = frame->height, size;
+
+	if (!(context->codec->capabilities & AV_CODEC_CAP_DR1))
+		goto fallback;
+
+	if (spa_ffmpeg_video_format(this->map, frame->format) != info->format ||
+	    frame->width != info->size.width || frame->height != info->size.height)
+		goto fallback;
+
+	/* the decoder can write up to the aligned height, only allow the lines
+	 * that some decoders read past the image */
+	avcodec_align_dimensions2(context, &width, &height, align);
+	if (height > frame->height + 2)
+		goto fallback;
+
+	pthread_mutex_lock(&this->worker.lock);
+	if (!spa_list_is_empty(&out->queue)) {
+		b = spa_list_first(&out->queue, struct buffer, link);
+		spa_list_remove(&b->link);
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (b == NULL)
+		goto fallback;
+
+	d = &b->outbuf->datas[0];
+
+	spa_ffmpeg_image_fill(data, linesize, frame->format,
+			      width, frame->height, this->stride, d->data);
+	size = spa_ffmpeg_image_fill(end, end_linesize, frame->format,
+				     width, height, this->stride, d->data);
+	if (size < 0 || size > d->maxsize || linesize[0] != this->stride)
+		goto fallback_buffer;
+
+	for (i = 0; i < 4 && data[i]; i++) {
+		if (linesize[i] % align[i] != 0 || (uintptr_t) data[i] % align[i] != 0)
+			goto fallback_buffer;
+	}
+
+	if ((frame->buf[0] = av_buffer_create(d->data, d->maxsize,
+					      release_output, b, 0)) == NULL)
+		goto fallback_buffer;
+
+	for (i = 0; i < 4; i++) {
+		frame->data[i] = data[i];
+		frame->linesize[i] = linesize[i];
+	}
+	frame->extended_data = frame->data;
+
+	return 0;
+
+      fallback_buffer:
+	pthread_mutex_lock(&this->worker.lock);
+	spa_list_prepend(&out->queue, &b->link);
+	pthread_mutex_unlock(&this->worker.lock);
+      fallback:
+	return avcodec_default_get_buffer2(context, frame, flags);
+}
+
+static struct buffer *frame_buffer(struct impl *this, AVFrame *frame)
+{
+	struct port *out = GET_OUT_PORT(this, 0);
+	void *opaque = av_buffer_get_opaque(frame->buf[0]);
+
+	if (opaque >= (void *) &out->buffers[0] && opaque < (void *) &out->buffers[MAX_BUFFERS])
+		return opaque;
+	return NULL;
+}
+
+/* place the decoded frame in an output buffer, the frame is either already
+ * in one of our buffers or it is copied into b */
+static struct buffer *output_frame(struct impl *this, struct buffer *b, AVFrame *frame)
+{
+	struct spa_video_info_raw *info = &GET_OUT_PORT(this, 0)->current_format.info.raw;
+	struct buffer *fb;
+	struct spa_data *d;
+	uint8_t *data[4];
+	int linesize[4], size;
+
+	if (spa_ffmpeg_video_format(this->map, frame->format) != info->format ||
+	    frame->width != info->size.width || frame->height != info->size.height) {
+		spa_log_warn(this->log, NAME " %p: dropping %dx%d frame with format %d",
+			     this, frame->width, frame->height, frame->format);
+		return NULL;
+	}
+
+	if ((fb = frame_buffer(this, frame)) != NULL) {
+		/* decoded in place, keep the frame until downstream is done */
+		d = &fb->outbuf->datas[0];
+		size = spa_ffmpeg_image_fill(data, linesize, frame->format,
+					     frame->width, frame->height, this->stride, d->data);
+		av_frame_move_ref(fb->frame, frame);
+	} else {
+		fb = b;
+		d = &fb->outbuf->datas[0];
+		size = spa_ffmpeg_image_fill(data, linesize, frame->format,
+					     frame->width, frame->height, this->stride, d->data);
+		if (size < 0 || size > d->maxsize)
+			return NULL;
+
+		av_image_copy(data, linesize, (const uint8_t **) frame->data, frame->linesize,
+			      frame->format, frame->width, frame->height);
+	}
+
+	d->chunk->offset = 0;
+	d->chunk->size = size;
+	d->chunk->stride = this->stride;
+
+	if (fb->h && frame->pts != AV_NOPTS_VALUE)
+		*fb->h = this->headers[frame->pts % MAX_HEADERS];
+
+	return fb;
+}
+
+/* called from the worker with the lock held, the lock is released while
+ * the codec runs */
+static bool decode(void *data)
+{
+	struct impl *this = data;
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	struct buffer *b, *ob = NULL;
+	int res;
+
+	if (this->context == NULL)
+		return false;
+
+	/* get the decoded frames out first, one free buffer is kept aside for
+	 * when the frame needs to be copied */
+	if (!this->drained && !spa_list_is_empty(&out->queue)) {
+		b = spa_list_first(&out->queue, struct buffer, link);
+		spa_list_remove(&b->link);
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if ((res = avcodec_receive_frame(this->context, this->frame)) == 0) {
+			ob = output_frame(this, b, this->frame);
+			av_frame_unref(this->frame);
+		}
+		pthread_mutex_lock(&this->worker.lock);
+
+		if (res == 0 && ob != NULL) {
+			spa_list_append(&out->done, &ob->link);
+			spa_ffmpeg_worker_notify(&this->worker);
+		}
+		if (res != 0 || ob != b)
+			spa_list_prepend(&out->queue, &b->link);
+
+		if (res == 0)
+			return true;
+
+		if (res != AVERROR(EAGAIN))
+			spa_log_error(this->log, NAME " %p: receive frame error %d", this, res);
+		this->drained = true;
+	}
+	if (!this->drained)
+		return false;
+
+	if (this->packet->data == NULL) {
+		if (spa_list_is_empty(&in->queue))
+			return false;
+
+		b = spa_list_first(&in->queue, struct buffer, link);
+		spa_list_remove(&b->link);
+
+		pthread_mutex_unlock(&this->worker.lock);
+		res = wrap_packet(this, b, this->packet);
+		pthread_mutex_lock(&this->worker.lock);
+
+		if (res < 0)
+			return true;
+	}
+
+	pthread_mutex_unlock(&this->worker.lock);
+	/* the decoder keeps a reference to the packet memory when it needs it */
+	if ((res = avcodec_send_packet(this->context, this->packet)) != AVERROR(EAGAIN))
+		av_packet_unref(this->packet);
+	pthread_mutex_lock(&this->worker.lock);
+
+	if (res < 0 && res != AVERROR(EAGAIN))
+		spa_log_error(this->log, NAME " %p: send packet error %d", this, res);
+	this->drained = false;
+
+	return true;
+}
+
+static void reuse_buffer(struct impl *this, struct port *port, uint32_t id)
+{
+	struct buffer *b = &port->buffers[id];
+
+	if (!b->outstanding)
+		return;
+
+	spa_log_trace(this->log, NAME " %p: reuse buffer %d", this, id);
+
+	b->outstanding = false;
+	if (b->frame->buf[0] != NULL) {
+		/* release_output is called when the decoder is also done */
+		av_frame_unref(b->frame);
+	} else {
+		pthread_mutex_lock(&this->worker.lock);
+		spa_list_append(&port->queue, &b->link);
+		spa_ffmpeg_worker_signal(&this->worker);
+		pthread_mutex_unlock(&this->worker.lock);
+	}
+}
+
+/* called from the data loop with buffers that need to be given back to
+ * upstream and buffers with decoded frames */
+static void decode_done(void *data)
+{
+	struct impl *this = data;
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	struct spa_io_buffers *output = out->io;
+	struct buffer *b;
+	bool have_output = false;
+
+	if (output && output->status != SPA_STATUS_HAVE_BUFFER &&
+	    output->buffer_id < out->n_buffers) {
+		reuse_buffer(this, out, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
+	pthread_mutex_lock(&this->worker.lock);
+	while (!spa_list_is_empty(&in->done)) {
+		b = spa_list_first(&in->done, struct buffer, link);
+		spa_list_remove(&b->link);
+		b->outstanding = false;
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if (this->callbacks && this->callbacks->reuse_buffer)
+			this->callbacks->reuse_buffer(this->user_data, 0, b->outbuf->id);
+		pthread_mutex_lock(&this->worker.lock);
+	}
+	if (output && output->status != SPA_STATUS_HAVE_BUFFER && !spa_list_is_empty(&out->done)) {
+		b = spa_list_first(&out->done, struct buffer, link);
+		spa_list_remove(&b->link);
+		b->outstanding = true;
+
+		output->buffer_id = b->outbuf->id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		have_output = true;
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (have_output && this->callbacks && this->callbacks->have_output)
+		this->callbacks->have_output(this->user_data);
+}
+
+static int codec_open(struct impl *this)
+{
+	struct spa_video_info_raw *info = &GET_OUT_PORT(this, 0)->current_format.info.raw;
+	AVCodecContext *context;
+	int res;
+
+	if (this->context)
+		return 0;
+
+	if ((context = avcodec_alloc_context3(this->codec)) == NULL)
+		return -ENOMEM;
+
+	context->width = info->size.width;
+	context->height = info->size.height;
+	context->get_buffer2 = get_buffer;
+	context->opaque = this;
+#if LIBAVCODEC_VERSION_MAJOR < 60
+	/* newer versions always call get_buffer2 from any thread */
+	context->thread_safe_callbacks = 1;
+#endif
+
+	spa_ffmpeg_setup_threads(context, this->n_threads);
+
+	if ((res = avcodec_open2(context, this->codec, NULL)) < 0) {
+		spa_log_error(this->log, NAME " %p: can't open codec %s: %d", this,
+			      this->codec->name, res);
+		avcodec_free_context(&context);
+		return -EIO;
+	}
+	spa_log_info(this->log, NAME " %p: opened %s, %d threads type %d", this,
+		     this->codec->name, context->thread_count, context->active_thread_type);
+
+	pthread_mutex_lock(&this->worker.lock);
+	this->context = context;
+	this->packet_count = 0;
+	this->drained = true;
+	pthread_mutex_unlock(&this->worker.lock);
+
+	return spa_ffmpeg_worker_start(&this->worker);
+}
+
+static void codec_close(struct impl *this)
+{
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	struct buffer *b;
+
+	spa_ffmpeg_worker_stop(&this->worker);
+
+	/* this releases the packets and frames that the decoder holds */
+	av_packet_unref(this->packet);
+	if (this->context)
+		avcodec_free_context(&this->context);
+
+	pthread_mutex_lock(&this->worker.lock);
+	if (!spa_list_is_empty(&in->queue)) {
+		spa_list_insert_list(&in->done, &in->queue);
+		spa_list_init(&in->queue);
+	}
+	while (!spa_list_is_empty(&out->done)) {
+		b = spa_list_first(&out->done, struct buffer, link);
+		spa_list_remove(&b->link);
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if (b->frame->buf[0] != NULL)
+			av_frame_unref(b->frame);
+		else
+			release_output(b, NULL);
+		pthread_mutex_lock(&this->worker.lock);
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (!spa_list_is_empty(&in->done))
+		spa_ffmpeg_worker_notify(&this->worker);
+}
+
 static int spa_ffmpeg_dec_node_enum_params(struct spa_node *node,
 					   uint32_t id, uint32_t *index,
 					   const struct spa_pod *filter,
-					   struct spa_pod **result,
+					   struct spa_pod **param,
 					   struct spa_pod_builder *builder)
 {
 	return -ENOTSUP;
 }
 
-static int spa_ffmpeg_dec_node_set_param(struct spa_node *node,
-					 uint32_t id, uint32_t flags,
+static int spa_ffmpeg_dec_node_set_param(struct spa_node *node, uint32_t id, uint32_t flags,
 					 const struct spa_pod *param)
 {
 	return -ENOTSUP;
@@ -109,6 +560,7 @@ static int spa_ffmpeg_dec_node_set_param(struct spa_node *node,
 static int spa_ffmpeg_dec_node_send_command(struct spa_node *node, const struct spa_command *command)
 {
 	struct impl *this;
+	int res;
 
 	if (node == NULL || command == NULL)
 		return -EINVAL;
@@ -116,8 +568,17 @@ static int spa_ffmpeg_dec_node_send_command(struct spa_node *node, const struct
 	this = SPA_CONTAINER_OF(node, struct impl, node);
 
 	if (SPA_COMMAND_TYPE(command) == this->type.command_node.Start) {
+		if (!this->in_ports[0].have_format || !this->out_ports[0].have_format)
+			return -EIO;
+		if (this->in_ports[0].n_buffers == 0 || this->out_ports[0].n_buffers == 0)
+			return -EIO;
+
+		if ((res = codec_open(this)) < 0)
+			return res;
+
 		this->started = true;
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
+		codec_close(this);
 		this->started = false;
 	} else
 		return -ENOTSUP;
@@ -191,9 +652,7 @@ spa_ffmpeg_dec_node_add_port(struct spa_node *node, enum spa_direction direction
 }
 
 static int
-spa_ffmpeg_dec_node_remove_port(struct spa_node *node,
-				enum spa_direction direction,
-				uint32_t port_id)
+spa_ffmpeg_dec_node_remove_port(struct spa_node *node, enum spa_direction direction, uint32_t port_id)
 {
 	return -ENOTSUP;
 }
@@ -216,7 +675,6 @@ spa_ffmpeg_dec_node_port_get_info(struct spa_node *node,
 		return -EINVAL;
 
 	port = GET_PORT(this, direction, port_id);
-
 	*info = &port->info;
 
 	return 0;
@@ -229,22 +687,82 @@ static int port_enum_formats(struct spa_node *node,
 			     struct spa_pod **param,
 			     struct spa_pod_builder *builder)
 {
-	//struct impl *this;
+	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
+	struct type *t = &this->type;
+	struct port *in = GET_IN_PORT(this, 0);
+	struct spa_video_info_raw *info = &in->current_format.info.raw;
+	struct spa_pod_prop *prop;
 
-	if (node == NULL || index == NULL)
-		return -EINVAL;
+	if (*index > 0)
+		return 0;
 
-	//this = SPA_CONTAINER_OF (node, struct impl, node);
+	if (direction == SPA_DIRECTION_INPUT) {
+		if (this->subtype == SPA_ID_INVALID)
+			return 0;
 
-	if (!IS_VALID_PORT(this, direction, port_id))
-		return -EINVAL;
+		*param = spa_pod_builder_object(builder,
+			t->param.idEnumFormat, t->format,
+			"I", t->media_type.video,
+			"I", this->subtype,
+			":", t->format_video.size,      "Rru", &SPA_RECTANGLE(320, 240),
+				SPA_POD_PROP_MIN_MAX(&SPA_RECTANGLE(1, 1),
+						     &SPA_RECTANGLE(INT32_MAX, INT32_MAX)),
+			":", t->format_video.framerate, "Fru", &SPA_FRACTION(25,1),
+				SPA_POD_PROP_MIN_MAX(&SPA_FRACTION(0, 1),
+						     &SPA_FRACTION(INT32_MAX, 1)));
+	}
+	else {
+		const enum AVPixelFormat *pix_fmts = this->codec->pix_fmts;
+		uint32_t i, n_formats = 0;
+
+		spa_pod_builder_push_object(builder, t->param.idEnumFormat, t->format);
+		spa_pod_builder_add(builder,
+			"I", t->media_type.video,
+			"I", t->media_subtype.raw, 0);
+
+		prop = spa_pod_builder_deref(builder,
+			spa_pod_builder_push_prop(builder, t->format_video.format,
+						  SPA_POD_PROP_RANGE_NONE));
+		if (pix_fmts) {
+			for (i = 0; pix_fmts[i] != AV_PIX_FMT_NONE; i++) {
+				uint32_t format = spa_ffmpeg_video_format(this->map, pix_fmts[i]);
+				if (format == SPA_ID_INVALID)
+					continue;
+				if (n_formats++ == 0)
+					spa_pod_builder_id(builder, format);
+				spa_pod_builder_id(builder, format);
+			}
+		} else {
+			/* the format is only known after decoding, most
+			 * decoders make one of these */
+			spa_pod_builder_id(builder, t->video_format.I420);
+			spa_pod_builder_id(builder, t->video_format.I420);
+			spa_pod_builder_id(builder, t->video_format.Y42B);
+			spa_pod_builder_id(builder, t->video_format.Y444);
+			spa_pod_builder_id(builder, t->video_format.NV12);
+			n_formats = 4;
+		}
+		if (n_formats > 1)
+			prop->body.flags |= SPA_POD_PROP_RANGE_ENUM | SPA_POD_PROP_FLAG_UNSET;
+		spa_pod_builder_pop(builder);
+
+		if (in->have_format && info->size.width > 0 && info->size.height > 0)
+			spa_pod_builder_add(builder,
+				":", t->format_video.size,      "R", &info->size,
+				":", t->format_video.framerate, "F", &info->framerate, 0);
+		else
+			spa_pod_builder_add(builder,
+				":", t->format_video.size,      "Rru", &SPA_RECTANGLE(320, 240),
+					SPA_POD_PROP_MIN_MAX(&SPA_RECTANGLE(1, 1),
+							     &SPA_RECTANGLE(INT32_MAX, INT32_MAX)),
+				":", t->format_video.framerate, "Fru", &SPA_FRACTION(25,1),
+					SPA_POD_PROP_MIN_MAX(&SPA_FRACTION(0, 1),
+							     &SPA_FRACTION(INT32_MAX, 1)), 0);
 
-	switch (*index) {
-	case 0:
-		*param = NULL;
-		break;
-	default:
-		return 0;
+		*param = spa_pod_builder_pop(builder);
+
+		if (n_formats == 0)
+			return 0;
 	}
 	return 1;
 }
@@ -257,6 +775,7 @@ static int port_get_format(struct spa_node *node,
 			   struct spa_pod_builder *builder)
 {
 	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
+	struct type *t = &this->type;
 	struct port *port;
 
 	port = GET_PORT(this, direction, port_id);
@@ -267,7 +786,21 @@ static int port_get_format(struct spa_node *node,
 	if (*index > 0)
 		return 0;
 
-	*param = NULL;
+	if (direction == SPA_DIRECTION_INPUT)
+		*param = spa_pod_builder_object(builder,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", this->subtype,
+			":", t->format_video.size,      "R", &port->current_format.info.raw.size,
+			":", t->format_video.framerate, "F", &port->current_format.info.raw.framerate);
+	else
+		*param = spa_pod_builder_object(builder,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", t->media_subtype.raw,
+			":", t->format_video.format,    "I", port->current_format.info.raw.format,
+			":", t->format_video.size,      "R", &port->current_format.info.raw.size,
+			":", t->format_video.framerate, "F", &port->current_format.info.raw.framerate);
 
 	return 1;
 }
@@ -285,14 +818,22 @@ spa_ffmpeg_dec_node_port_enum_params(struct spa_node *node,
 	struct spa_pod_builder b = { 0 };
 	uint8_t buffer[1024];
 	struct spa_pod *param;
+	struct port *port;
 	int res;
 
+	if (!IS_VALID_PORT(this, direction, port_id))
+		return -EINVAL;
+
+	port = GET_PORT(this, direction, port_id);
+
       next:
 	spa_pod_builder_init(&b, buffer, sizeof(buffer));
 
 	if (id == t->param.idList) {
 		uint32_t list[] = { t->param.idEnumFormat,
-				    t->param.idFormat };
+				    t->param.idFormat,
+				    t->param.idBuffers,
+				    t->param.idMeta };
 
 		if (*index < SPA_N_ELEMENTS(list))
 			param = spa_pod_builder_object(&b, id, t->param.List,
@@ -308,6 +849,46 @@ spa_ffmpeg_dec_node_port_enum_params(struct spa_node *node,
 		if ((res = port_get_format(node, direction, port_id, index, filter, &param, &b)) <= 0)
 			return res;
 	}
+	else if (id == t->param.idBuffers) {
+		if (!port->have_format)
+			return -EIO;
+		if (*index > 0)
+			return 0;
+
+		/* the decoder holds on to the input buffers for as long as it
+		 * needs them */
+		if (direction == SPA_DIRECTION_INPUT)
+			param = spa_pod_builder_object(&b,
+				id, t->param_buffers.Buffers,
+				":", t->param_buffers.size,    "iru", 64 * 1024,
+					SPA_POD_PROP_MIN_MAX(4096, INT32_MAX),
+				":", t->param_buffers.buffers, "ir", 8,
+					SPA_POD_PROP_MIN_MAX(2, MAX_BUFFERS),
+				":", t->param_buffers.align,   "i", 16);
+		else
+			param = spa_pod_builder_object(&b,
+				id, t->param_buffers.Buffers,
+				":", t->param_buffers.size,    "i", this->size,
+				":", t->param_buffers.stride,  "i", this->stride,
+				":", t->param_buffers.buffers, "ir", 4,
+					SPA_POD_PROP_MIN_MAX(2, MAX_BUFFERS),
+				":", t->param_buffers.align,   "i", 16);
+	}
+	else if (id == t->param.idMeta) {
+		if (!port->have_format)
+			return -EIO;
+
+		switch (*index) {
+		case 0:
+			param = spa_pod_builder_object(&b,
+				id, t->param_meta.Meta,
+				":", t->param_meta.type, "I", t->meta.Header,
+				":", t->param_meta.size, "i", sizeof(struct spa_meta_header));
+			break;
+		default:
+			return 0;
+		}
+	}
 	else
 		return -ENOENT;
 
@@ -319,26 +900,38 @@ spa_ffmpeg_dec_node_port_enum_params(struct spa_node *node,
 	return 1;
 }
 
+static int clear_buffers(struct impl *this, struct port *port)
+{
+	uint32_t i;
+
+	if (port->n_buffers > 0) {
+		spa_log_info(this->log, NAME " %p: clear buffers", this);
+		codec_close(this);
+		for (i = 0; i < port->n_buffers; i++)
+			av_frame_unref(port->buffers[i].frame);
+
+		pthread_mutex_lock(&this->worker.lock);
+		port->n_buffers = 0;
+		spa_list_init(&port->queue);
+		spa_list_init(&port->done);
+		pthread_mutex_unlock(&this->worker.lock);
+	}
+	return 0;
+}
+
 static int port_set_format(struct spa_node *node,
 			   enum spa_direction direction, uint32_t port_id,
 			   uint32_t flags,
 			   const struct spa_pod *format)
 {
-	struct impl *this;
+	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
 	struct port *port;
 
-	if (node == NULL || format == NULL)
-		return -EINVAL;
-
-	this = SPA_CONTAINER_OF(node, struct impl, node);
-
-	if (!IS_VALID_PORT(this, direction, port_id))
-		return -EINVAL;
-
 	port = GET_PORT(this, direction, port_id);
 
 	if (format == NULL) {
 		port->have_format = false;
+		clear_buffers(this, port);
 		return 0;
 	} else {
 		struct spa_video_info info = { 0 };
@@ -347,12 +940,52 @@ static int port_set_format(struct spa_node *node,
 			"I", &info.media_type,
 			"I", &info.media_subtype);
 
-		if (info.media_type != this->type.media_type.video &&
-		    info.media_subtype != this->type.media_subtype.raw)
+		if (info.media_type != this->type.media_type.video)
 			return -EINVAL;
 
-		if (spa_format_video_raw_parse(format, &info.info.raw, &this->type.format_video) < 0)
-			return -EINVAL;
+		if (direction == SPA_DIRECTION_INPUT) {
+			if (info.media_subtype != this->subtype)
+				return -EINVAL;
+
+			/* the encoded size and rate are kept in the raw info */
+			if (spa_pod_object_parse(format,
+				":", this->type.format_video.size, "?R", &info.info.raw.size,
+				":", this->type.format_video.framerate, "?F", &info.info.raw.framerate,
+				NULL) < 0)
+				return -EINVAL;
+		}
+		else {
+			enum AVPixelFormat pix_fmt;
+			uint8_t *data[4];
+			int linesize[4], stride, size;
+
+			if (info.media_subtype != this->type.media_subtype.raw)
+				return -EINVAL;
+
+			if (spa_format_video_raw_parse(format, &info.info.raw,
+						       &this->type.format_video) < 0)
+				return -EINVAL;
+
+			if ((pix_fmt = spa_ffmpeg_pix_fmt(this->map, info.info.raw.format)) == AV_PIX_FMT_NONE)
+				return -ENOTSUP;
+
+			/* make room for the lines that the decoder writes
+			 * and reads past the image */
+			if (spa_ffmpeg_image_fill(data, linesize, pix_fmt,
+						  info.info.raw.size.width, info.info.raw.size.height,
+						  0, NULL) < 0)
+				return -EINVAL;
+			stride = SPA_ROUND_UP_N(linesize[0], STRIDE_ALIGN);
+			size = spa_ffmpeg_image_fill(data, linesize, pix_fmt,
+						     info.info.raw.size.width,
+						     SPA_ROUND_UP_N(info.info.raw.size.height, 64),
+						     stride, NULL);
+
+			if (!(flags & SPA_NODE_PARAM_FLAG_TEST_ONLY)) {
+				this->stride = stride;
+				this->size = size;
+			}
+		}
 
 		if (!(flags & SPA_NODE_PARAM_FLAG_TEST_ONLY)) {
 			port->current_format = info;
@@ -371,6 +1004,9 @@ spa_ffmpeg_dec_node_port_set_param(struct spa_node *node,
 	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
 	struct type *t = &this->type;
 
+	if (!IS_VALID_PORT(this, direction, port_id))
+		return -EINVAL;
+
 	if (id == t->param.idFormat) {
 		return port_set_format(node, direction, port_id, flags, param);
 	}
@@ -385,13 +1021,50 @@ spa_ffmpeg_dec_node_port_use_buffers(struct spa_node *node,
 				     struct spa_buffer **buffers,
 				     uint32_t n_buffers)
 {
+	struct impl *this;
+	struct port *port;
+	uint32_t i;
+
 	if (node == NULL)
 		return -EINVAL;
 
-	if (!IS_VALID_PORT(node, direction, port_id))
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+
+	if (!IS_VALID_PORT(this, direction, port_id))
 		return -EINVAL;
 
-	return -ENOTSUP;
+	port = GET_PORT(this, direction, port_id);
+
+	if (!port->have_format)
+		return -EIO;
+	if (n_buffers > MAX_BUFFERS)
+		return -EINVAL;
+
+	clear_buffers(this, port);
+
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *b = &port->buffers[i];
+		struct spa_data *d = buffers[i]->datas;
+
+		if (buffers[i]->n_datas < 1 ||
+		    (d[0].type != this->type.data.MemPtr &&
+		     d[0].type != this->type.data.MemFd) ||
+		    d[0].data == NULL) {
+			spa_log_error(this->log, NAME " %p: invalid memory on buffer %p", this,
+				      buffers[i]);
+			return -EINVAL;
+		}
+		b->outbuf = buffers[i];
+		b->h = spa_buffer_find_meta(buffers[i], this->type.meta.Header);
+		b->impl = this;
+		b->outstanding = false;
+
+		if (direction == SPA_DIRECTION_OUTPUT)
+			spa_list_append(&port->queue, &b->link);
+	}
+	port->n_buffers = n_buffers;
+
+	return 0;
 }
 
 static int
@@ -436,57 +1109,137 @@ spa_ffmpeg_dec_node_port_set_io(struct spa_node *node,
 	return 0;
 }
 
-static int spa_ffmpeg_dec_node_process_input(struct spa_node *node)
+static int
+spa_ffmpeg_dec_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t buffer_id)
 {
-	return -EINVAL;
+	struct impl *this;
+	struct port *port;
+
+	if (node == NULL)
+		return -EINVAL;
+
+	if (port_id != 0)
+		return -EINVAL;
+
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+	port = GET_OUT_PORT(this, 0);
+
+	if (buffer_id >= port->n_buffers)
+		return -EINVAL;
+
+	reuse_buffer(this, port, buffer_id);
+
+	return 0;
 }
 
-static int spa_ffmpeg_dec_node_process_output(struct spa_node *node)
+static int
+spa_ffmpeg_dec_node_port_send_command(struct spa_node *node,
+				      enum spa_direction direction,
+				      uint32_t port_id, const struct spa_command *command)
+{
+	return -ENOTSUP;
+}
+
+static int spa_ffmpeg_dec_node_process_input(struct spa_node *node)
 {
 	struct impl *this;
 	struct port *port;
-	struct spa_io_buffers *output;
+	struct spa_io_buffers *input, *output;
+	struct buffer *b;
 
 	if (node == NULL)
 		return -EINVAL;
 
 	this = SPA_CONTAINER_OF(node, struct impl, node);
 
-	port = &this->out_ports[0];
-
-	if ((output = port->io) == NULL)
+	if ((input = this->in_ports[0].io) == NULL ||
+	    (output = this->out_ports[0].io) == NULL)
 		return -EIO;
 
-	if (!port->have_format) {
-		output->status = -EIO;
+	port = GET_IN_PORT(this, 0);
+
+	if (!port->have_format || this->context == NULL) {
+		input->status = -EIO;
 		return -EIO;
 	}
-	output->status = SPA_STATUS_OK;
+	if (this->callbacks == NULL || this->callbacks->reuse_buffer == NULL) {
+		spa_log_error(this->log, NAME " %p: can't give buffers back", this);
+		input->status = -ENOTSUP;
+		return -ENOTSUP;
+	}
+
+	if (input->status == SPA_STATUS_HAVE_BUFFER) {
+		if (input->buffer_id >= port->n_buffers) {
+			input->status = -EINVAL;
+			return -EINVAL;
+		}
+		b = &port->buffers[input->buffer_id];
+		b->outstanding = true;
+
+		/* the buffer is given back with reuse_buffer when the decoder
+		 * is done with it */
+		input->buffer_id = SPA_ID_INVALID;
+		input->status = SPA_STATUS_OK;
+
+		pthread_mutex_lock(&this->worker.lock);
+		spa_list_append(&port->queue, &b->link);
+		spa_ffmpeg_worker_signal(&this->worker);
+		pthread_mutex_unlock(&this->worker.lock);
+	}
 
-	return SPA_STATUS_OK;
+	/* decoded buffers are pushed from decode_done when they are ready */
+	return output->status == SPA_STATUS_HAVE_BUFFER ?
+		SPA_STATUS_HAVE_BUFFER : SPA_STATUS_OK;
 }
 
-static int
-spa_ffmpeg_dec_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t buffer_id)
+static int spa_ffmpeg_dec_node_process_output(struct spa_node *node)
 {
+	struct impl *this;
+	struct port *port;
+	struct spa_io_buffers *input, *output;
+	struct buffer *b = NULL;
+
 	if (node == NULL)
 		return -EINVAL;
 
-	if (port_id != 0)
-		return -EINVAL;
+	this = SPA_CONTAINER_OF(node, struct impl, node);
 
-	return -ENOTSUP;
-}
+	if ((input = this->in_ports[0].io) == NULL ||
+	    (output = this->out_ports[0].io) == NULL)
+		return -EIO;
 
-static int
-spa_ffmpeg_dec_node_port_send_command(struct spa_node *node,
-				      enum spa_direction direction,
-				      uint32_t port_id,
-				      const struct spa_command *command)
-{
-	return -ENOTSUP;
-}
+	port = GET_OUT_PORT(this, 0);
 
+	if (!port->have_format) {
+		output->status = -EIO;
+		return -EIO;
+	}
+	if (output->status == SPA_STATUS_HAVE_BUFFER)
+		return SPA_STATUS_HAVE_BUFFER;
+
+	/* recycle */
+	if (output->buffer_id < port->n_buffers) {
+		reuse_buffer(this, port, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
+	pthread_mutex_lock(&this->worker.lock);
+	if (!spa_list_is_empty(&port->done)) {
+		b = spa_list_first(&port->done, struct buffer, link);
+		spa_list_remove(&b->link);
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (b) {
+		b->outstanding = true;
+		output->buffer_id = b->outbuf->id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		return SPA_STATUS_HAVE_BUFFER;
+	}
+	input->status = SPA_STATUS_NEED_BUFFER;
+
+	return SPA_STATUS_NEED_BUFFER;
+}
 
 static const struct spa_node ffmpeg_dec_node = {
 	SPA_VERSION_NODE,
@@ -529,16 +1282,49 @@ spa_ffmpeg_dec_get_interface(struct spa_handle *handle, uint32_t interface_id, v
 	return 0;
 }
 
+static void free_frames(struct impl *this)
+{
+	uint32_t i;
+
+	for (i = 0; i < MAX_BUFFERS; i++)
+		av_frame_free(&this->out_ports[0].buffers[i].frame);
+	av_frame_free(&this->frame);
+	av_packet_free(&this->packet);
+}
+
+static int spa_ffmpeg_dec_clear(struct spa_handle *handle)
+{
+	struct impl *this;
+
+	if (handle == NULL)
+		return -EINVAL;
+
+	this = (struct impl *) handle;
+
+	clear_buffers(this, GET_OUT_PORT(this, 0));
+	codec_close(this);
+	spa_ffmpeg_worker_clear(&this->worker);
+	free_frames(this);
+
+	return 0;
+}
+
+size_t spa_ffmpeg_dec_get_size(void)
+{
+	return sizeof(struct impl);
+}
+
 int
-spa_ffmpeg_dec_init(struct spa_handle *handle,
+spa_ffmpeg_dec_init(struct spa_handle *handle, const AVCodec *codec,
 		    const struct spa_dict *info,
-		    const struct spa_support *support,
-		    uint32_t n_support)
+		    const struct spa_support *support, uint32_t n_support)
 {
 	struct impl *this;
 	uint32_t i;
+	int res;
 
 	handle->get_interface = spa_ffmpeg_dec_get_interface;
+	handle->clear = spa_ffmpeg_dec_clear;
 
 	this = (struct impl *) handle;
 
@@ -547,17 +1333,54 @@ spa_ffmpeg_dec_init(struct spa_handle *handle,
 			this->map = support[i].data;
 		else if (strcmp(support[i].type, SPA_TYPE__Log) == 0)
 			this->log = support[i].data;
+		else if (strcmp(support[i].type, SPA_TYPE_LOOP__DataLoop) == 0)
+			this->data_loop = support[i].data;
 	}
 	if (this->map == NULL) {
 		spa_log_error(this->log, "a type-map is needed");
 		return -EINVAL;
 	}
+	if (this->data_loop == NULL) {
+		spa_log_error(this->log, "a data-loop is needed");
+		return -EINVAL;
+	}
 	init_type(&this->type, this->map);
 
+	for (i = 0; info && i < info->n_items; i++) {
+		if (strcmp(info->items[i].key, "ffmpeg.threads") == 0)
+			this->n_threads = atoi(info->items[i].value);
+	}
+
+	this->codec = codec;
+	this->subtype = spa_ffmpeg_media_subtype(this->map, codec->id);
+
+	if ((this->frame = av_frame_alloc()) == NULL ||
+	    (this->packet = av_packet_alloc()) == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+	for (i = 0; i < MAX_BUFFERS; i++) {
+		if ((this->out_ports[0].buffers[i].frame = av_frame_alloc()) == NULL) {
+			res = -ENOMEM;
+			goto error;
+		}
+	}
+	if ((res = spa_ffmpeg_worker_init(&this->worker, this->data_loop,
+					  decode, decode_done, this)) < 0)
+		goto error;
+
 	this->node = ffmpeg_dec_node;
 
 	this->in_ports[0].info.flags = 0;
+	spa_list_init(&this->in_ports[0].queue);
+	spa_list_init(&this->in_ports[0].done);
 	this->out_ports[0].info.flags = 0;
+	spa_list_init(&this->out_ports[0].queue);
+	spa_list_init(&this->out_ports[0].done);
 
 	return 0;
+
+      error:
+	free_frames(this);
+	return res;
 }
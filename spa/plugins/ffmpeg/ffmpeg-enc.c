@@ -19,17 +19,26 @@
 
 #include <errno.h>
 #include <stddef.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <spa/support/log.h>
+#include <spa/support/loop.h>
 #include <spa/support/type-map.h>
+#include <spa/utils/list.h>
 #include <spa/node/node.h>
 #include <spa/node/io.h>
 #include <spa/param/video/format-utils.h>
+#include <spa/param/buffers.h>
+#include <spa/param/meta.h>
 #include <spa/pod/filter.h>
 
+#include <libavutil/imgutils.h>
+
+#include "ffmpeg-utils.h"
+
+#define NAME "ffmpeg-enc"
 
 #define IS_VALID_PORT(this,d,id)	((id) == 0)
 #define GET_IN_PORT(this,p)		(&this->in_ports[p])
@@ -37,45 +46,63 @@
 #define GET_PORT(this,d,p)		(d == SPA_DIRECTION_INPUT ? GET_IN_PORT(this,p) : GET_OUT_PORT(this,p))
 
 #define MAX_BUFFERS    32
+/* headers and timing of the frames in the encoder, indexed with the frame pts */
+#define MAX_HEADERS    64
 
 struct buffer {
-	struct spa_buffer buffer;
-	struct spa_meta metas[1];
-	struct spa_meta_header header;
-	struct spa_data datas[1];
-	struct spa_buffer *imported;
+	struct spa_buffer *outbuf;
+	struct spa_meta_header *h;
+	struct spa_meta_timing *timing;
+	struct impl *impl;
+	struct spa_list link;
 	bool outstanding;
-	struct buffer *next;
 };
 
+/* on the input port, queue holds the frames for the encoder and done the
+ * frames that the encoder released. On the output port, queue holds the
+ * empty buffers and done the encoded buffers. queue is filled by the
+ * data thread, done by the worker, both are protected with the worker
+ * lock. */
 struct port {
 	bool have_format;
 	struct spa_video_info current_format;
-	bool have_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+	uint32_t n_buffers;
 	struct spa_port_info info;
 	struct spa_io_buffers *io;
+	struct spa_list queue;
+	struct spa_list done;
 };
 
 struct type {
 	uint32_t node;
+	uint32_t format;
 	struct spa_type_io io;
 	struct spa_type_param param;
+	struct spa_type_meta meta;
+	struct spa_type_data data;
 	struct spa_type_media_type media_type;
 	struct spa_type_media_subtype media_subtype;
 	struct spa_type_format_video format_video;
 	struct spa_type_command_node command_node;
+	struct spa_type_param_buffers param_buffers;
+	struct spa_type_param_meta param_meta;
 };
 
 static inline void init_type(struct type *type, struct spa_type_map *map)
 {
 	type->node = spa_type_map_get_id(map, SPA_TYPE__Node);
+	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
+	spa_type_meta_map(map, &type->meta);
+	spa_type_data_map(map, &type->data);
 	spa_type_media_type_map(map, &type->media_type);
 	spa_type_media_subtype_map(map, &type->media_subtype);
 	spa_type_format_video_map(map, &type->format_video);
 	spa_type_command_node_map(map, &type->command_node);
+	spa_type_param_buffers_map(map, &type->param_buffers);
+	spa_type_param_meta_map(map, &type->param_meta);
 }
 
 struct impl {
@@ -85,6 +112,7 @@ struct impl {
 	struct type type;
 	struct spa_type_map *map;
 	struct spa_log *log;
+	struct spa_loop *data_loop;
 
 	const struct spa_node_callbacks *callbacks;
 	void *user_data;
@@ -92,9 +120,321 @@ struct impl {
 	struct port in_ports[1];
 	struct port out_ports[1];
 
+	const AVCodec *codec;
+	uint32_t subtype;
+	uint32_t n_threads;
+
+	struct spa_ffmpeg_worker worker;
+	AVCodecContext *context;
+	AVFrame *frame;			/**< the next frame to encode */
+	AVPacket *packet;
+	bool drained;			/**< no packets to receive until a new frame */
+	int64_t frame_count;
+	struct spa_meta_header headers[MAX_HEADERS];
+	struct spa_meta_timing timings[MAX_HEADERS];
+
 	bool started;
 };
 
+/* the pixel format of the codec for a spa video format, this can be
+ * one of the full range formats */
+static enum AVPixelFormat codec_pix_fmt(struct impl *this, uint32_t format)
+{
+	const enum AVPixelFormat *pix_fmts = this->codec->pix_fmts;
+	uint32_t i;
+
+	for (i = 0; pix_fmts && pix_fmts[i] != AV_PIX_FMT_NONE; i++) {
+		if (spa_ffmpeg_video_format(this->map, pix_fmts[i]) == format)
+			return pix_fmts[i];
+	}
+	return AV_PIX_FMT_NONE;
+}
+
+static void release_frame(void *opaque, uint8_t *data)
+{
+	struct buffer *b = opaque;
+	struct impl *this = b->impl;
+
+	pthread_mutex_lock(&this->worker.lock);
+	spa_list_append(&GET_IN_PORT(this, 0)->done, &b->link);
+	pthread_mutex_unlock(&this->worker.lock);
+
+	spa_ffmpeg_worker_notify(&this->worker);
+}
+
+/* wrap the memory of the input buffer in the frame, the buffer is given
+ * back when the encoder releases the last reference to the frame */
+static int wrap_frame(struct impl *this, struct buffer *b, AVFrame *frame)
+{
+	struct spa_video_info_raw *info = &GET_IN_PORT(this, 0)->current_format.info.raw;
+	struct spa_data *d = &b->outbuf->datas[0];
+	uint32_t offset, size;
+	int res;
+
+	offset = SPA_MIN(d->chunk->offset, d->maxsize);
+	size = d->maxsize - offset;
+
+	frame->buf[0] = av_buffer_create(SPA_MEMBER(d->data, offset, uint8_t), size,
+					 release_frame, b, AV_BUFFER_FLAG_READONLY);
+	if (frame->buf[0] == NULL) {
+		release_frame(b, NULL);
+		return -ENOMEM;
+	}
+
+	frame->format = this->context->pix_fmt;
+	frame->width = info->size.width;
+	frame->height = info->size.height;
+
+	if ((res = spa_ffmpeg_image_fill(frame->data, frame->linesize, frame->format,
+					 frame->width, frame->height, d->chunk->stride,
+					 frame->buf[0]->data)) < 0)
+		return res;
+	if (res > size)
+		return -EINVAL;
+
+	frame->pts = this->frame_count++;
+	if (b->h)
+		this->headers[frame->pts % MAX_HEADERS] = *b->h;
+	if (b->timing)
+		this->timings[frame->pts % MAX_HEADERS] = *b->timing;
+	else
+		spa_zero(this->timings[frame->pts % MAX_HEADERS]);
+
+	return 0;
+}
+
+static void fill_buffer(struct impl *this, struct buffer *b, AVPacket *packet)
+{
+	struct spa_data *d = &b->outbuf->datas[0];
+	uint32_t size = packet->size;
+
+	if (size > d->maxsize) {
+		spa_log_warn(this->log, NAME " %p: packet of %u bytes truncated", this, size);
+		size = d->maxsize;
+	}
+	memcpy(d->data, packet->data, size);
+	d->chunk->offset = 0;
+	d->chunk->size = size;
+	d->chunk->stride = 0;
+
+	if (b->h) {
+		*b->h = this->headers[packet->pts % MAX_HEADERS];
+		b->h->flags &= ~SPA_META_HEADER_FLAG_DELTA_UNIT;
+		if (!(packet->flags & AV_PKT_FLAG_KEY))
+			b->h->flags |= SPA_META_HEADER_FLAG_DELTA_UNIT;
+	}
+	if (b->timing) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		*b->timing = this->timings[packet->pts % MAX_HEADERS];
+		if (b->timing->n_nodes == 0)
+			spa_meta_timing_create(b->timing, SPA_TIMESPEC_TO_TIME(&now));
+		else
+			spa_meta_timing_process(b->timing, SPA_TIMESPEC_TO_TIME(&now));
+	}
+}
+
+/* called from the worker with the lock held, the lock is released while
+ * the codec runs */
+static bool encode(void *data)
+{
+	struct impl *this = data;
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	struct buffer *b;
+	int res;
+
+	if (this->context == NULL)
+		return false;
+
+	/* get the encoded packets out first, this makes room for new frames */
+	if (!this->drained && !spa_list_is_empty(&out->queue)) {
+		b = spa_list_first(&out->queue, struct buffer, link);
+		spa_list_remove(&b->link);
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if ((res = avcodec_receive_packet(this->context, this->packet)) == 0) {
+			fill_buffer(this, b, this->packet);
+			av_packet_unref(this->packet);
+		}
+		pthread_mutex_lock(&this->worker.lock);
+
+		if (res == 0) {
+			spa_list_append(&out->done, &b->link);
+			spa_ffmpeg_worker_notify(&this->worker);
+			return true;
+		}
+		spa_list_prepend(&out->queue, &b->link);
+
+		if (res != AVERROR(EAGAIN))
+			spa_log_error(this->log, NAME " %p: receive packet error %d", this, res);
+		this->drained = true;
+	}
+	if (!this->drained)
+		return false;
+
+	if (this->frame->buf[0] == NULL) {
+		if (spa_list_is_empty(&in->queue))
+			return false;
+
+		b = spa_list_first(&in->queue, struct buffer, link);
+		spa_list_remove(&b->link);
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if ((res = wrap_frame(this, b, this->frame)) < 0) {
+			spa_log_error(this->log, NAME " %p: invalid frame in buffer %d: %d",
+				      this, b->outbuf->id, res);
+			av_frame_unref(this->frame);
+		}
+		pthread_mutex_lock(&this->worker.lock);
+
+		if (res < 0)
+			return true;
+	}
+
+	pthread_mutex_unlock(&this->worker.lock);
+	/* the encoder keeps a reference to the frame memory when it needs it */
+	if ((res = avcodec_send_frame(this->context, this->frame)) != AVERROR(EAGAIN))
+		av_frame_unref(this->frame);
+	pthread_mutex_lock(&this->worker.lock);
+
+	if (res < 0 && res != AVERROR(EAGAIN))
+		spa_log_error(this->log, NAME " %p: send frame error %d", this, res);
+	this->drained = false;
+
+	return true;
+}
+
+static void reuse_buffer(struct impl *this, struct port *port, uint32_t id)
+{
+	struct buffer *b = &port->buffers[id];
+
+	if (!b->outstanding)
+		return;
+
+	spa_log_trace(this->log, NAME " %p: reuse buffer %d", this, id);
+
+	b->outstanding = false;
+	pthread_mutex_lock(&this->worker.lock);
+	spa_list_append(&port->queue, &b->link);
+	spa_ffmpeg_worker_signal(&this->worker);
+	pthread_mutex_unlock(&this->worker.lock);
+}
+
+/* called from the data loop with buffers that need to be given back to
+ * upstream and buffers with encoded data */
+static void encode_done(void *data)
+{
+	struct impl *this = data;
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	struct spa_io_buffers *output = out->io;
+	struct buffer *b;
+	bool have_output = false;
+
+	if (output && output->status != SPA_STATUS_HAVE_BUFFER &&
+	    output->buffer_id < out->n_buffers) {
+		reuse_buffer(this, out, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
+	pthread_mutex_lock(&this->worker.lock);
+	while (!spa_list_is_empty(&in->done)) {
+		b = spa_list_first(&in->done, struct buffer, link);
+		spa_list_remove(&b->link);
+		b->outstanding = false;
+
+		pthread_mutex_unlock(&this->worker.lock);
+		if (this->callbacks && this->callbacks->reuse_buffer)
+			this->callbacks->reuse_buffer(this->user_data, 0, b->outbuf->id);
+		pthread_mutex_lock(&this->worker.lock);
+	}
+	if (output && output->status != SPA_STATUS_HAVE_BUFFER && !spa_list_is_empty(&out->done)) {
+		b = spa_list_first(&out->done, struct buffer, link);
+		spa_list_remove(&b->link);
+		b->outstanding = true;
+
+		output->buffer_id = b->outbuf->id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		have_output = true;
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (have_output && this->callbacks && this->callbacks->have_output)
+		this->callbacks->have_output(this->user_data);
+}
+
+static int codec_open(struct impl *this)
+{
+	struct spa_video_info_raw *info = &GET_IN_PORT(this, 0)->current_format.info.raw;
+	AVCodecContext *context;
+	int res;
+
+	if (this->context)
+		return 0;
+
+	if ((context = avcodec_alloc_context3(this->codec)) == NULL)
+		return -ENOMEM;
+
+	context->pix_fmt = codec_pix_fmt(this, info->format);
+	context->width = info->size.width;
+	context->height = info->size.height;
+	if (info->framerate.num > 0 && info->framerate.denom > 0) {
+		context->framerate = (AVRational) { info->framerate.num, info->framerate.denom };
+		context->time_base = (AVRational) { info->framerate.denom, info->framerate.num };
+	} else
+		context->time_base = (AVRational) { 1, 25 };
+
+	spa_ffmpeg_setup_threads(context, this->n_threads);
+
+	if ((res = avcodec_open2(context, this->codec, NULL)) < 0) {
+		spa_log_error(this->log, NAME " %p: can't open codec %s: %d", this,
+			      this->codec->name, res);
+		avcodec_free_context(&context);
+		return -EIO;
+	}
+	spa_log_info(this->log, NAME " %p: opened %s, %d threads type %d", this,
+		     this->codec->name, context->thread_count, context->active_thread_type);
+
+	pthread_mutex_lock(&this->worker.lock);
+	this->context = context;
+	this->frame_count = 0;
+	this->drained = true;
+	pthread_mutex_unlock(&this->worker.lock);
+
+	return spa_ffmpeg_worker_start(&this->worker);
+}
+
+static void codec_close(struct impl *this)
+{
+	struct port *in = GET_IN_PORT(this, 0), *out = GET_OUT_PORT(this, 0);
+	uint32_t i;
+
+	spa_ffmpeg_worker_stop(&this->worker);
+
+	/* this releases the frames that the encoder holds */
+	av_frame_unref(this->frame);
+	if (this->context)
+		avcodec_free_context(&this->context);
+
+	pthread_mutex_lock(&this->worker.lock);
+	if (!spa_list_is_empty(&in->queue)) {
+		spa_list_insert_list(&in->done, &in->queue);
+		spa_list_init(&in->queue);
+	}
+
+	spa_list_init(&out->queue);
+	spa_list_init(&out->done);
+	for (i = 0; i < out->n_buffers; i++) {
+		struct buffer *b = &out->buffers[i];
+		if (!b->outstanding)
+			spa_list_append(&out->queue, &b->link);
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (!spa_list_is_empty(&in->done))
+		spa_ffmpeg_worker_notify(&this->worker);
+}
+
 static int spa_ffmpeg_enc_node_enum_params(struct spa_node *node,
 					   uint32_t id, uint32_t *index,
 					   const struct spa_pod *filter,
@@ -113,6 +453,7 @@ static int spa_ffmpeg_enc_node_set_param(struct spa_node *node, uint32_t id, uin
 static int spa_ffmpeg_enc_node_send_command(struct spa_node *node, const struct spa_command *command)
 {
 	struct impl *this;
+	int res;
 
 	if (node == NULL || command == NULL)
 		return -EINVAL;
@@ -120,8 +461,17 @@ static int spa_ffmpeg_enc_node_send_command(struct spa_node *node, const struct
 	this = SPA_CONTAINER_OF(node, struct impl, node);
 
 	if (SPA_COMMAND_TYPE(command) == this->type.command_node.Start) {
+		if (!this->in_ports[0].have_format || !this->out_ports[0].have_format)
+			return -EIO;
+		if (this->in_ports[0].n_buffers == 0 || this->out_ports[0].n_buffers == 0)
+			return -EIO;
+
+		if ((res = codec_open(this)) < 0)
+			return res;
+
 		this->started = true;
 	} else if (SPA_COMMAND_TYPE(command) == this->type.command_node.Pause) {
+		codec_close(this);
 		this->started = false;
 	} else
 		return -ENOTSUP;
@@ -230,18 +580,78 @@ static int port_enum_formats(struct spa_node *node,
 			     struct spa_pod **param,
 			     struct spa_pod_builder *builder)
 {
-	//struct impl *this = SPA_CONTAINER_OF (node, struct impl, node);
-	//struct port *port;
+	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
+	struct type *t = &this->type;
+	struct port *in = GET_IN_PORT(this, 0);
+	struct spa_pod_prop *prop;
+
+	if (*index > 0)
+		return 0;
 
-	//port = GET_PORT(this, direction, port_id);
+	if (direction == SPA_DIRECTION_INPUT) {
+		const enum AVPixelFormat *pix_fmts = this->codec->pix_fmts;
+		uint32_t i, n_formats = 0;
 
-	switch (*index) {
-	case 0:
-		*param = NULL;
-		break;
-	default:
+		if (pix_fmts == NULL)
+			return 0;
+
+		spa_pod_builder_push_object(builder, t->param.idEnumFormat, t->format);
+		spa_pod_builder_add(builder,
+			"I", t->media_type.video,
+			"I", t->media_subtype.raw, 0);
+
+		prop = spa_pod_builder_deref(builder,
+			spa_pod_builder_push_prop(builder, t->format_video.format,
+						  SPA_POD_PROP_RANGE_NONE));
+		for (i = 0; pix_fmts[i] != AV_PIX_FMT_NONE; i++) {
+			uint32_t format = spa_ffmpeg_video_format(this->map, pix_fmts[i]);
+			if (format == SPA_ID_INVALID)
+				continue;
+			if (n_formats++ == 0)
+				spa_pod_builder_id(builder, format);
+			spa_pod_builder_id(builder, format);
+		}
+		if (n_formats > 1)
+			prop->body.flags |= SPA_POD_PROP_RANGE_ENUM | SPA_POD_PROP_FLAG_UNSET;
+		spa_pod_builder_pop(builder);
+
+		spa_pod_builder_add(builder,
+			":", t->format_video.size,      "Rru", &SPA_RECTANGLE(320, 240),
+				SPA_POD_PROP_MIN_MAX(&SPA_RECTANGLE(1, 1),
+						     &SPA_RECTANGLE(INT32_MAX, INT32_MAX)),
+			":", t->format_video.framerate, "Fru", &SPA_FRACTION(25,1),
+				SPA_POD_PROP_MIN_MAX(&SPA_FRACTION(0, 1),
+						     &SPA_FRACTION(INT32_MAX, 1)), 0);
+
+		*param = spa_pod_builder_pop(builder);
+
+		if (n_formats == 0)
+			return 0;
+	}
+	else if (this->subtype == SPA_ID_INVALID) {
 		return 0;
 	}
+	else if (in->have_format) {
+		/* the encoded stream has the size and rate of the raw video */
+		*param = spa_pod_builder_object(builder,
+			t->param.idEnumFormat, t->format,
+			"I", t->media_type.video,
+			"I", this->subtype,
+			":", t->format_video.size,      "R", &in->current_format.info.raw.size,
+			":", t->format_video.framerate, "F", &in->current_format.info.raw.framerate);
+	}
+	else {
+		*param = spa_pod_builder_object(builder,
+			t->param.idEnumFormat, t->format,
+			"I", t->media_type.video,
+			"I", this->subtype,
+			":", t->format_video.size,      "Rru", &SPA_RECTANGLE(320, 240),
+				SPA_POD_PROP_MIN_MAX(&SPA_RECTANGLE(1, 1),
+						     &SPA_RECTANGLE(INT32_MAX, INT32_MAX)),
+			":", t->format_video.framerate, "Fru", &SPA_FRACTION(25,1),
+				SPA_POD_PROP_MIN_MAX(&SPA_FRACTION(0, 1),
+						     &SPA_FRACTION(INT32_MAX, 1)));
+	}
 	return 1;
 }
 
@@ -253,6 +663,7 @@ static int port_get_format(struct spa_node *node,
 			   struct spa_pod_builder *builder)
 {
 	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
+	struct type *t = &this->type;
 	struct port *port;
 
 	port = GET_PORT(this, direction, port_id);
@@ -263,11 +674,35 @@ static int port_get_format(struct spa_node *node,
 	if (*index > 0)
 		return 0;
 
-	*param = NULL;
+	if (direction == SPA_DIRECTION_INPUT)
+		*param = spa_pod_builder_object(builder,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", t->media_subtype.raw,
+			":", t->format_video.format,    "I", port->current_format.info.raw.format,
+			":", t->format_video.size,      "R", &port->current_format.info.raw.size,
+			":", t->format_video.framerate, "F", &port->current_format.info.raw.framerate);
+	else
+		*param = spa_pod_builder_object(builder,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", this->subtype,
+			":", t->format_video.size,      "R", &port->current_format.info.raw.size,
+			":", t->format_video.framerate, "F", &port->current_format.info.raw.framerate);
 
 	return 1;
 }
 
+/* the size of a raw frame, this is also the upper bound of the encoded
+ * frames */
+static int frame_size(struct impl *this)
+{
+	struct spa_video_info_raw *info = &GET_IN_PORT(this, 0)->current_format.info.raw;
+	enum AVPixelFormat pix_fmt = codec_pix_fmt(this, info->format);
+
+	return av_image_get_buffer_size(pix_fmt, info->size.width, info->size.height, 4);
+}
+
 static int
 spa_ffmpeg_enc_node_port_enum_params(struct spa_node *node,
 				     enum spa_direction direction, uint32_t port_id,
@@ -281,14 +716,22 @@ spa_ffmpeg_enc_node_port_enum_params(struct spa_node *node,
 	struct spa_pod_builder b = { 0 };
 	uint8_t buffer[1024];
 	struct spa_pod *param;
+	struct port *port;
 	int res;
 
+	if (!IS_VALID_PORT(this, direction, port_id))
+		return -EINVAL;
+
+	port = GET_PORT(this, direction, port_id);
+
       next:
 	spa_pod_builder_init(&b, buffer, sizeof(buffer));
 
 	if (id == t->param.idList) {
 		uint32_t list[] = { t->param.idEnumFormat,
-				    t->param.idFormat };
+				    t->param.idFormat,
+				    t->param.idBuffers,
+				    t->param.idMeta };
 
 		if (*index < SPA_N_ELEMENTS(list))
 			param = spa_pod_builder_object(&b, id, t->param.List,
@@ -304,6 +747,52 @@ spa_ffmpeg_enc_node_port_enum_params(struct spa_node *node,
 		if ((res = port_get_format(node, direction, port_id, index, filter, &param, &b)) <= 0)
 			return res;
 	}
+	else if (id == t->param.idBuffers) {
+		if (!port->have_format || !this->in_ports[0].have_format)
+			return -EIO;
+		if (*index > 0)
+			return 0;
+
+		/* the encoder holds on to the input buffers for as long as it
+		 * needs them, ask for enough of them to keep the threads busy */
+		if (direction == SPA_DIRECTION_INPUT)
+			param = spa_pod_builder_object(&b,
+				id, t->param_buffers.Buffers,
+				":", t->param_buffers.size,    "iru", frame_size(this),
+					SPA_POD_PROP_MIN_MAX(frame_size(this), INT32_MAX),
+				":", t->param_buffers.buffers, "ir", 8,
+					SPA_POD_PROP_MIN_MAX(2, MAX_BUFFERS),
+				":", t->param_buffers.align,   "i", 16);
+		else
+			param = spa_pod_builder_object(&b,
+				id, t->param_buffers.Buffers,
+				":", t->param_buffers.size,    "i", frame_size(this),
+				":", t->param_buffers.stride,  "i", 0,
+				":", t->param_buffers.buffers, "ir", 4,
+					SPA_POD_PROP_MIN_MAX(2, MAX_BUFFERS),
+				":", t->param_buffers.align,   "i", 16);
+	}
+	else if (id == t->param.idMeta) {
+		if (!port->have_format)
+			return -EIO;
+
+		switch (*index) {
+		case 0:
+			param = spa_pod_builder_object(&b,
+				id, t->param_meta.Meta,
+				":", t->param_meta.type, "I", t->meta.Header,
+				":", t->param_meta.size, "i", sizeof(struct spa_meta_header));
+			break;
+		case 1:
+			param = spa_pod_builder_object(&b,
+				id, t->param_meta.Meta,
+				":", t->param_meta.type, "I", t->meta.Timing,
+				":", t->param_meta.size, "i", sizeof(struct spa_meta_timing));
+			break;
+		default:
+			return 0;
+		}
+	}
 	else
 		return -ENOENT;
 
@@ -315,6 +804,20 @@ spa_ffmpeg_enc_node_port_enum_params(struct spa_node *node,
 	return 1;
 }
 
+static int clear_buffers(struct impl *this, struct port *port)
+{
+	if (port->n_buffers > 0) {
+		spa_log_info(this->log, NAME " %p: clear buffers", this);
+		codec_close(this);
+		pthread_mutex_lock(&this->worker.lock);
+		port->n_buffers = 0;
+		spa_list_init(&port->queue);
+		spa_list_init(&port->done);
+		pthread_mutex_unlock(&this->worker.lock);
+	}
+	return 0;
+}
+
 static int port_set_format(struct spa_node *node,
 			   enum spa_direction direction, uint32_t port_id,
 			   uint32_t flags, const struct spa_pod *format)
@@ -326,6 +829,7 @@ static int port_set_format(struct spa_node *node,
 
 	if (format == NULL) {
 		port->have_format = false;
+		clear_buffers(this, port);
 		return 0;
 	} else {
 		struct spa_video_info info = { 0 };
@@ -334,12 +838,31 @@ static int port_set_format(struct spa_node *node,
 			"I", &info.media_type,
 			"I", &info.media_subtype);
 
-		if (info.media_type != this->type.media_type.video &&
-		    info.media_subtype != this->type.media_subtype.raw)
+		if (info.media_type != this->type.media_type.video)
 			return -EINVAL;
 
-		if (spa_format_video_raw_parse(format, &info.info.raw, &this->type.format_video) < 0)
-			return -EINVAL;
+		if (direction == SPA_DIRECTION_INPUT) {
+			if (info.media_subtype != this->type.media_subtype.raw)
+				return -EINVAL;
+
+			if (spa_format_video_raw_parse(format, &info.info.raw,
+						       &this->type.format_video) < 0)
+				return -EINVAL;
+
+			if (codec_pix_fmt(this, info.info.raw.format) == AV_PIX_FMT_NONE)
+				return -ENOTSUP;
+		}
+		else {
+			if (info.media_subtype != this->subtype)
+				return -EINVAL;
+
+			/* the encoded size and rate are kept in the raw info */
+			if (spa_pod_object_parse(format,
+				":", this->type.format_video.size, "?R", &info.info.raw.size,
+				":", this->type.format_video.framerate, "?F", &info.info.raw.framerate,
+				NULL) < 0)
+				return -EINVAL;
+		}
 
 		if (!(flags & SPA_NODE_PARAM_FLAG_TEST_ONLY)) {
 			port->current_format = info;
@@ -358,6 +881,9 @@ spa_ffmpeg_enc_node_port_set_param(struct spa_node *node,
 	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
 	struct type *t = &this->type;
 
+	if (!IS_VALID_PORT(this, direction, port_id))
+		return -EINVAL;
+
 	if (id == t->param.idFormat) {
 		return port_set_format(node, direction, port_id, flags, param);
 	}
@@ -371,13 +897,51 @@ spa_ffmpeg_enc_node_port_use_buffers(struct spa_node *node,
 				     uint32_t port_id,
 				     struct spa_buffer **buffers, uint32_t n_buffers)
 {
+	struct impl *this;
+	struct port *port;
+	uint32_t i;
+
 	if (node == NULL)
 		return -EINVAL;
 
-	if (!IS_VALID_PORT(node, direction, port_id))
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+
+	if (!IS_VALID_PORT(this, direction, port_id))
 		return -EINVAL;
 
-	return -ENOTSUP;
+	port = GET_PORT(this, direction, port_id);
+
+	if (!port->have_format)
+		return -EIO;
+	if (n_buffers > MAX_BUFFERS)
+		return -EINVAL;
+
+	clear_buffers(this, port);
+
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *b = &port->buffers[i];
+		struct spa_data *d = buffers[i]->datas;
+
+		if (buffers[i]->n_datas < 1 ||
+		    (d[0].type != this->type.data.MemPtr &&
+		     d[0].type != this->type.data.MemFd) ||
+		    d[0].data == NULL) {
+			spa_log_error(this->log, NAME " %p: invalid memory on buffer %p", this,
+				      buffers[i]);
+			return -EINVAL;
+		}
+		b->outbuf = buffers[i];
+		b->h = spa_buffer_find_meta(buffers[i], this->type.meta.Header);
+		b->timing = spa_buffer_find_meta(buffers[i], this->type.meta.Timing);
+		b->impl = this;
+		b->outstanding = false;
+
+		if (direction == SPA_DIRECTION_OUTPUT)
+			spa_list_append(&port->queue, &b->link);
+	}
+	port->n_buffers = n_buffers;
+
+	return 0;
 }
 
 static int
@@ -425,13 +989,24 @@ spa_ffmpeg_enc_node_port_set_io(struct spa_node *node,
 static int
 spa_ffmpeg_enc_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t buffer_id)
 {
+	struct impl *this;
+	struct port *port;
+
 	if (node == NULL)
 		return -EINVAL;
 
 	if (port_id != 0)
 		return -EINVAL;
 
-	return -ENOTSUP;
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+	port = GET_OUT_PORT(this, 0);
+
+	if (buffer_id >= port->n_buffers)
+		return -EINVAL;
+
+	reuse_buffer(this, port, buffer_id);
+
+	return 0;
 }
 
 static int
@@ -444,32 +1019,103 @@ spa_ffmpeg_enc_node_port_send_command(struct spa_node *node,
 
 static int spa_ffmpeg_enc_node_process_input(struct spa_node *node)
 {
-	return -EINVAL;
+	struct impl *this;
+	struct port *port;
+	struct spa_io_buffers *input, *output;
+	struct buffer *b;
+
+	if (node == NULL)
+		return -EINVAL;
+
+	this = SPA_CONTAINER_OF(node, struct impl, node);
+
+	if ((input = this->in_ports[0].io) == NULL ||
+	    (output = this->out_ports[0].io) == NULL)
+		return -EIO;
+
+	port = GET_IN_PORT(this, 0);
+
+	if (!port->have_format || this->context == NULL) {
+		input->status = -EIO;
+		return -EIO;
+	}
+	if (this->callbacks == NULL || this->callbacks->reuse_buffer == NULL) {
+		spa_log_error(this->log, NAME " %p: can't give buffers back", this);
+		input->status = -ENOTSUP;
+		return -ENOTSUP;
+	}
+
+	if (input->status == SPA_STATUS_HAVE_BUFFER) {
+		if (input->buffer_id >= port->n_buffers) {
+			input->status = -EINVAL;
+			return -EINVAL;
+		}
+		b = &port->buffers[input->buffer_id];
+		b->outstanding = true;
+
+		/* the buffer is given back with reuse_buffer when the encoder
+		 * is done with it */
+		input->buffer_id = SPA_ID_INVALID;
+		input->status = SPA_STATUS_OK;
+
+		pthread_mutex_lock(&this->worker.lock);
+		spa_list_append(&port->queue, &b->link);
+		spa_ffmpeg_worker_signal(&this->worker);
+		pthread_mutex_unlock(&this->worker.lock);
+	}
+
+	/* encoded buffers are pushed from encode_done when they are ready */
+	return output->status == SPA_STATUS_HAVE_BUFFER ?
+		SPA_STATUS_HAVE_BUFFER : SPA_STATUS_OK;
 }
 
 static int spa_ffmpeg_enc_node_process_output(struct spa_node *node)
 {
 	struct impl *this;
 	struct port *port;
-	struct spa_io_buffers *output;
+	struct spa_io_buffers *input, *output;
+	struct buffer *b = NULL;
 
 	if (node == NULL)
 		return -EINVAL;
 
 	this = SPA_CONTAINER_OF(node, struct impl, node);
 
-	if ((output = this->out_ports[0].io) == NULL)
+	if ((input = this->in_ports[0].io) == NULL ||
+	    (output = this->out_ports[0].io) == NULL)
 		return -EIO;
 
-	port = &this->out_ports[0];
+	port = GET_OUT_PORT(this, 0);
 
 	if (!port->have_format) {
 		output->status = -EIO;
 		return -EIO;
 	}
-	output->status = SPA_STATUS_OK;
+	if (output->status == SPA_STATUS_HAVE_BUFFER)
+		return SPA_STATUS_HAVE_BUFFER;
 
-	return SPA_STATUS_OK;
+	/* recycle */
+	if (output->buffer_id < port->n_buffers) {
+		reuse_buffer(this, port, output->buffer_id);
+		output->buffer_id = SPA_ID_INVALID;
+	}
+
+	pthread_mutex_lock(&this->worker.lock);
+	if (!spa_list_is_empty(&port->done)) {
+		b = spa_list_first(&port->done, struct buffer, link);
+		spa_list_remove(&b->link);
+	}
+	pthread_mutex_unlock(&this->worker.lock);
+
+	if (b) {
+		b->outstanding = true;
+		output->buffer_id = b->outbuf->id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		return SPA_STATUS_HAVE_BUFFER;
+	}
+	input->status = SPA_STATUS_NEED_BUFFER;
+
+	return SPA_STATUS_NEED_BUFFER;
 }
 
 static const struct spa_node ffmpeg_enc_node = {
@@ -513,15 +1159,39 @@ spa_ffmpeg_enc_get_interface(struct spa_handle *handle, uint32_t interface_id, v
 	return 0;
 }
 
+static int spa_ffmpeg_enc_clear(struct spa_handle *handle)
+{
+	struct impl *this;
+
+	if (handle == NULL)
+		return -EINVAL;
+
+	this = (struct impl *) handle;
+
+	codec_close(this);
+	spa_ffmpeg_worker_clear(&this->worker);
+	av_packet_free(&this->packet);
+	av_frame_free(&this->frame);
+
+	return 0;
+}
+
+size_t spa_ffmpeg_enc_get_size(void)
+{
+	return sizeof(struct impl);
+}
+
 int
-spa_ffmpeg_enc_init(struct spa_handle *handle,
+spa_ffmpeg_enc_init(struct spa_handle *handle, const AVCodec *codec,
 		    const struct spa_dict *info,
 		    const struct spa_support *support, uint32_t n_support)
 {
 	struct impl *this;
 	uint32_t i;
+	int res;
 
 	handle->get_interface = spa_ffmpeg_enc_get_interface;
+	handle->clear = spa_ffmpeg_enc_clear;
 
 	this = (struct impl *) handle;
 
@@ -530,16 +1200,49 @@ spa_ffmpeg_enc_init(struct spa_handle *handle,
 			this->map = support[i].data;
 		else if (strcmp(support[i].type, SPA_TYPE__Log) == 0)
 			this->log = support[i].data;
+		else if (strcmp(support[i].type, SPA_TYPE_LOOP__DataLoop) == 0)
+			this->data_loop = support[i].data;
 	}
 	if (this->map == NULL) {
 		spa_log_error(this->log, "a type-map is needed");
 		return -EINVAL;
 	}
+	if (this->data_loop == NULL) {
+		spa_log_error(this->log, "a data-loop is needed");
+		return -EINVAL;
+	}
+	init_type(&this->type, this->map);
+
+	for (i = 0; info && i < info->n_items; i++) {
+		if (strcmp(info->items[i].key, "ffmpeg.threads") == 0)
+			this->n_threads = atoi(info->items[i].value);
+	}
+
+	this->codec = codec;
+	this->subtype = spa_ffmpeg_media_subtype(this->map, codec->id);
+
+	if ((this->frame = av_frame_alloc()) == NULL ||
+	    (this->packet = av_packet_alloc()) == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+	if ((res = spa_ffmpeg_worker_init(&this->worker, this->data_loop,
+					  encode, encode_done, this)) < 0)
+		goto error;
 
 	this->node = ffmpeg_enc_node;
 
 	this->in_ports[0].info.flags = 0;
+	spa_list_init(&this->in_ports[0].queue);
+	spa_list_init(&this->in_ports[0].done);
 	this->out_ports[0].info.flags = 0;
+	spa_list_init(&this->out_ports[0].queue);
+	spa_list_init(&this->out_ports[0].done);
 
 	return 0;
+
+      error:
+	av_packet_free(&this->packet);
+	av_frame_free(&this->frame);
+	return res;
 }
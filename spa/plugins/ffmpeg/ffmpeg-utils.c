@@ -0,0 +1,243 @@
+/* Spa FFMpeg support
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <spa/param/format.h>
+#include <spa/param/video/raw.h>
+
+#include <libavutil/imgutils.h>
+
+#include "ffmpeg-utils.h"
+
+static const struct {
+	const char *format;
+	enum AVPixelFormat pix_fmt;
+} pix_fmt_map[] = {
+	{ SPA_TYPE_VIDEO_FORMAT__I420, AV_PIX_FMT_YUV420P },
+	{ SPA_TYPE_VIDEO_FORMAT__Y41B, AV_PIX_FMT_YUV411P },
+	{ SPA_TYPE_VIDEO_FORMAT__Y42B, AV_PIX_FMT_YUV422P },
+	{ SPA_TYPE_VIDEO_FORMAT__Y444, AV_PIX_FMT_YUV444P },
+	{ SPA_TYPE_VIDEO_FORMAT__YUV9, AV_PIX_FMT_YUV410P },
+	{ SPA_TYPE_VIDEO_FORMAT__NV12, AV_PIX_FMT_NV12 },
+	{ SPA_TYPE_VIDEO_FORMAT__NV21, AV_PIX_FMT_NV21 },
+	{ SPA_TYPE_VIDEO_FORMAT__NV16, AV_PIX_FMT_NV16 },
+	{ SPA_TYPE_VIDEO_FORMAT__YUY2, AV_PIX_FMT_YUYV422 },
+	{ SPA_TYPE_VIDEO_FORMAT__UYVY, AV_PIX_FMT_UYVY422 },
+	{ SPA_TYPE_VIDEO_FORMAT__YVYU, AV_PIX_FMT_YVYU422 },
+	{ SPA_TYPE_VIDEO_FORMAT__RGB, AV_PIX_FMT_RGB24 },
+	{ SPA_TYPE_VIDEO_FORMAT__BGR, AV_PIX_FMT_BGR24 },
+	{ SPA_TYPE_VIDEO_FORMAT__RGBx, AV_PIX_FMT_RGB0 },
+	{ SPA_TYPE_VIDEO_FORMAT__BGRx, AV_PIX_FMT_BGR0 },
+	{ SPA_TYPE_VIDEO_FORMAT__xRGB, AV_PIX_FMT_0RGB },
+	{ SPA_TYPE_VIDEO_FORMAT__xBGR, AV_PIX_FMT_0BGR },
+	{ SPA_TYPE_VIDEO_FORMAT__RGBA, AV_PIX_FMT_RGBA },
+	{ SPA_TYPE_VIDEO_FORMAT__BGRA, AV_PIX_FMT_BGRA },
+	{ SPA_TYPE_VIDEO_FORMAT__ARGB, AV_PIX_FMT_ARGB },
+	{ SPA_TYPE_VIDEO_FORMAT__ABGR, AV_PIX_FMT_ABGR },
+	{ SPA_TYPE_VIDEO_FORMAT__GRAY8, AV_PIX_FMT_GRAY8 },
+	{ SPA_TYPE_VIDEO_FORMAT__GRAY16_LE, AV_PIX_FMT_GRAY16LE },
+	{ SPA_TYPE_VIDEO_FORMAT__GRAY16_BE, AV_PIX_FMT_GRAY16BE },
+	/* full range variants, only used to map to spa formats */
+	{ SPA_TYPE_VIDEO_FORMAT__I420, AV_PIX_FMT_YUVJ420P },
+	{ SPA_TYPE_VIDEO_FORMAT__Y42B, AV_PIX_FMT_YUVJ422P },
+	{ SPA_TYPE_VIDEO_FORMAT__Y444, AV_PIX_FMT_YUVJ444P },
+};
+
+static const struct {
+	const char *subtype;
+	enum AVCodecID codec_id;
+} codec_map[] = {
+	{ SPA_TYPE_MEDIA_SUBTYPE__h264, AV_CODEC_ID_H264 },
+	{ SPA_TYPE_MEDIA_SUBTYPE__mjpg, AV_CODEC_ID_MJPEG },
+	{ SPA_TYPE_MEDIA_SUBTYPE__dv, AV_CODEC_ID_DVVIDEO },
+	{ SPA_TYPE_MEDIA_SUBTYPE__h263, AV_CODEC_ID_H263 },
+	{ SPA_TYPE_MEDIA_SUBTYPE__mpeg1, AV_CODEC_ID_MPEG1VIDEO },
+	{ SPA_TYPE_MEDIA_SUBTYPE__mpeg2, AV_CODEC_ID_MPEG2VIDEO },
+	{ SPA_TYPE_MEDIA_SUBTYPE__mpeg4, AV_CODEC_ID_MPEG4 },
+	{ SPA_TYPE_MEDIA_SUBTYPE__vc1, AV_CODEC_ID_VC1 },
+	{ SPA_TYPE_MEDIA_SUBTYPE__vp8, AV_CODEC_ID_VP8 },
+	{ SPA_TYPE_MEDIA_SUBTYPE__vp9, AV_CODEC_ID_VP9 },
+};
+
+enum AVPixelFormat spa_ffmpeg_pix_fmt(struct spa_type_map *map, uint32_t format)
+{
+	int i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(pix_fmt_map); i++) {
+		if (spa_type_map_get_id(map, pix_fmt_map[i].format) == format)
+			return pix_fmt_map[i].pix_fmt;
+	}
+	return AV_PIX_FMT_NONE;
+}
+
+uint32_t spa_ffmpeg_video_format(struct spa_type_map *map, enum AVPixelFormat pix_fmt)
+{
+	int i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(pix_fmt_map); i++) {
+		if (pix_fmt_map[i].pix_fmt == pix_fmt)
+			return spa_type_map_get_id(map, pix_fmt_map[i].format);
+	}
+	return SPA_ID_INVALID;
+}
+
+uint32_t spa_ffmpeg_media_subtype(struct spa_type_map *map, enum AVCodecID codec_id)
+{
+	int i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(codec_map); i++) {
+		if (codec_map[i].codec_id == codec_id)
+			return spa_type_map_get_id(map, codec_map[i].subtype);
+	}
+	return SPA_ID_INVALID;
+}
+
+int spa_ffmpeg_image_fill(uint8_t *data[4], int linesize[4],
+			  enum AVPixelFormat format, int width, int height,
+			  int stride, void *ptr)
+{
+	int i, res, stride0;
+
+	if ((res = av_image_fill_linesizes(linesize, format, width)) < 0)
+		return res;
+
+	/* planes are padded to 4 bytes like the video sources do, a larger
+	 * stride scales all the planes */
+	for (i = 0; i < 4; i++)
+		linesize[i] = SPA_ROUND_UP_N(linesize[i], 4);
+
+	if ((stride0 = linesize[0]) > 0 && stride > stride0) {
+		for (i = 0; i < 4; i++)
+			linesize[i] = linesize[i] * stride / stride0;
+	}
+	return av_image_fill_pointers(data, format, height, ptr, linesize);
+}
+
+void spa_ffmpeg_setup_threads(AVCodecContext *ctx, uint32_t n_threads)
+{
+	const AVCodec *codec = ctx->codec;
+
+	ctx->thread_count = n_threads;
+	ctx->thread_type = 0;
+	if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+		ctx->thread_type |= FF_THREAD_FRAME;
+	if (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+		ctx->thread_type |= FF_THREAD_SLICE;
+}
+
+static void on_worker_wakeup(struct spa_source *source)
+{
+	struct spa_ffmpeg_worker *worker = source->data;
+	uint64_t count;
+
+	if (read(source->fd, &count, sizeof(count)) != sizeof(count))
+		return;
+
+	worker->wakeup(worker->data);
+}
+
+static void *worker_thread(void *data)
+{
+	struct spa_ffmpeg_worker *worker = data;
+
+	pthread_mutex_lock(&worker->lock);
+	while (worker->running) {
+		if (!worker->process(worker->data))
+			pthread_cond_wait(&worker->cond, &worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+int spa_ffmpeg_worker_init(struct spa_ffmpeg_worker *worker, struct spa_loop *data_loop,
+			   bool (*process) (void *data), void (*wakeup) (void *data),
+			   void *data)
+{
+	int fd;
+
+	if ((fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+		return -errno;
+
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+	worker->running = false;
+	worker->data_loop = data_loop;
+	worker->process = process;
+	worker->wakeup = wakeup;
+	worker->data = data;
+
+	worker->source.func = on_worker_wakeup;
+	worker->source.data = worker;
+	worker->source.fd = fd;
+	worker->source.mask = SPA_IO_IN;
+	worker->source.rmask = 0;
+	spa_loop_add_source(data_loop, &worker->source);
+
+	return 0;
+}
+
+void spa_ffmpeg_worker_clear(struct spa_ffmpeg_worker *worker)
+{
+	spa_ffmpeg_worker_stop(worker);
+	spa_loop_remove_source(worker->data_loop, &worker->source);
+	close(worker->source.fd);
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+}
+
+int spa_ffmpeg_worker_start(struct spa_ffmpeg_worker *worker)
+{
+	int res;
+
+	if (worker->running)
+		return 0;
+
+	worker->running = true;
+	if ((res = pthread_create(&worker->thread, NULL, worker_thread, worker)) != 0) {
+		worker->running = false;
+		return -res;
+	}
+	return 0;
+}
+
+void spa_ffmpeg_worker_stop(struct spa_ffmpeg_worker *worker)
+{
+	if (!worker->running)
+		return;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->running = false;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_join(worker->thread, NULL);
+}
+
+void spa_ffmpeg_worker_notify(struct spa_ffmpeg_worker *worker)
+{
+	uint64_t count = 1;
+
+	if (write(worker->source.fd, &count, sizeof(count)) != sizeof(count))
+		return;
+}
@@ -0,0 +1,93 @@
+/* Spa FFMpeg support
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_FFMPEG_UTILS_H__
+#define __SPA_FFMPEG_UTILS_H__
+
+#include <pthread.h>
+
+#include <spa/support/plugin.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map.h>
+
+#include <libavcodec/avcodec.h>
+
+size_t spa_ffmpeg_dec_get_size(void);
+int spa_ffmpeg_dec_init(struct spa_handle *handle, const AVCodec *codec,
+			const struct spa_dict *info,
+			const struct spa_support *support, uint32_t n_support);
+
+size_t spa_ffmpeg_enc_get_size(void);
+int spa_ffmpeg_enc_init(struct spa_handle *handle, const AVCodec *codec,
+			const struct spa_dict *info,
+			const struct spa_support *support, uint32_t n_support);
+
+/** map between spa video formats and ffmpeg pixel formats, AV_PIX_FMT_NONE
+ * and SPA_ID_INVALID are returned for unknown formats */
+enum AVPixelFormat spa_ffmpeg_pix_fmt(struct spa_type_map *map, uint32_t format);
+uint32_t spa_ffmpeg_video_format(struct spa_type_map *map, enum AVPixelFormat pix_fmt);
+
+/** the media subtype of the codec or SPA_ID_INVALID */
+uint32_t spa_ffmpeg_media_subtype(struct spa_type_map *map, enum AVCodecID codec_id);
+
+/** set up the planes of an image of \a format in the memory at \a ptr.
+ * \return the size of the image or < 0 on error */
+int spa_ffmpeg_image_fill(uint8_t *data[4], int linesize[4],
+			  enum AVPixelFormat format, int width, int height,
+			  int stride, void *ptr);
+
+/** enable all threading types the codec supports, \a n_threads of 0
+ * selects the number of threads automatically */
+void spa_ffmpeg_setup_threads(AVCodecContext *ctx, uint32_t n_threads);
+
+/** Runs a codec away from the data thread
+ *
+ * The process function is called from the worker thread with the lock
+ * held until it returns false, after which the worker sleeps until it is
+ * signaled. The wakeup function is called from the data loop after
+ * a notify.
+ */
+struct spa_ffmpeg_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+
+	struct spa_loop *data_loop;
+	struct spa_source source;
+
+	bool (*process) (void *data);
+	void (*wakeup) (void *data);
+	void *data;
+};
+
+int spa_ffmpeg_worker_init(struct spa_ffmpeg_worker *worker, struct spa_loop *data_loop,
+			   bool (*process) (void *data), void (*wakeup) (void *data),
+			   void *data);
+void spa_ffmpeg_worker_clear(struct spa_ffmpeg_worker *worker);
+
+int spa_ffmpeg_worker_start(struct spa_ffmpeg_worker *worker);
+void spa_ffmpeg_worker_stop(struct spa_ffmpeg_worker *worker);
+
+/** wake up the worker, must be called with the lock held */
+#define spa_ffmpeg_worker_signal(w)	pthread_cond_signal(&(w)->cond)
+/** wake up the data loop, can be called from any thread */
+void spa_ffmpeg_worker_notify(struct spa_ffmpeg_worker *worker);
+
+#endif /* __SPA_FFMPEG_UTILS_H__ */
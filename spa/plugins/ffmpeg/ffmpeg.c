@@ -19,17 +19,21 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <spa/support/plugin.h>
 #include <spa/node/node.h>
 
-#include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 
-int spa_ffmpeg_dec_init(struct spa_handle *handle, const struct spa_dict *info,
-			const struct spa_support *support, uint32_t n_support);
-int spa_ffmpeg_enc_init(struct spa_handle *handle, const struct spa_dict *info,
-			const struct spa_support *support, uint32_t n_support);
+#include "ffmpeg-utils.h"
+
+struct factory {
+	struct spa_handle_factory factory;
+	const AVCodec *codec;
+	char name[128];
+};
 
 static int
 ffmpeg_dec_init(const struct spa_handle_factory *factory,
@@ -38,10 +42,14 @@ ffmpeg_dec_init(const struct spa_handle_factory *factory,
 		const struct spa_support *support,
 		uint32_t n_support)
 {
+	struct factory *f;
+
 	if (factory == NULL || handle == NULL)
 		return -EINVAL;
 
-	return spa_ffmpeg_dec_init(handle, info, support, n_support);
+	f = SPA_CONTAINER_OF(factory, struct factory, factory);
+
+	return spa_ffmpeg_dec_init(handle, f->codec, info, support, n_support);
 }
 
 static int
@@ -51,10 +59,14 @@ ffmpeg_enc_init(const struct spa_handle_factory *factory,
 		const struct spa_support *support,
 		uint32_t n_support)
 {
+	struct factory *f;
+
 	if (factory == NULL || handle == NULL)
 		return -EINVAL;
 
-	return spa_ffmpeg_enc_init(handle, info, support, n_support);
+	f = SPA_CONTAINER_OF(factory, struct factory, factory);
+
+	return spa_ffmpeg_enc_init(handle, f->codec, info, support, n_support);
 }
 
 static const struct spa_interface_info ffmpeg_interfaces[] = {
@@ -77,39 +89,76 @@ ffmpeg_enum_interface_info(const struct spa_handle_factory *factory,
 	return 1;
 }
 
-int spa_handle_factory_enum(const struct spa_handle_factory **factory, uint32_t *index)
+/* the factories are made once for all video codecs, they need to stay
+ * valid for as long as the plugin is loaded */
+static struct factory *factories;
+static uint32_t n_factories;
+
+/* av_codec_next() was replaced with av_codec_iterate() in ffmpeg 4.0 and
+ * removed in 5.0 */
+static const AVCodec *next_codec(void **state)
 {
-	static const AVCodec *c = NULL;
-	static int ci = 0;
-	static struct spa_handle_factory f;
-	static char name[128];
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 10, 100)
+	return av_codec_iterate(state);
+#else
+	const AVCodec *c = av_codec_next(*state);
+	*state = (void *) c;
+	return c;
+#endif
+}
 
-	av_register_all();
+static int make_factories(void)
+{
+	const AVCodec *c;
+	void *state;
+	uint32_t n = 0;
 
-	if (*index == 0) {
-		c = av_codec_next(NULL);
-		ci = 0;
-	}
-	while (*index > ci && c) {
-		c = av_codec_next(c);
-		ci++;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+	av_register_all();
+#endif
+
+	for (state = NULL; (c = next_codec(&state)); )
+		n++;
+
+	if ((factories = calloc(n, sizeof(struct factory))) == NULL)
+		return -ENOMEM;
+
+	for (state = NULL; (c = next_codec(&state)); ) {
+		struct factory *f = &factories[n_factories];
+		bool enc = av_codec_is_encoder(c);
+		const struct spa_handle_factory factory = {
+			SPA_VERSION_HANDLE_FACTORY,
+			.name = f->name,
+			.size = enc ? spa_ffmpeg_enc_get_size() : spa_ffmpeg_dec_get_size(),
+			.init = enc ? ffmpeg_enc_init : ffmpeg_dec_init,
+			.enum_interface_info = ffmpeg_enum_interface_info,
+		};
+
+		if (c->type != AVMEDIA_TYPE_VIDEO)
+			continue;
+
+		snprintf(f->name, sizeof(f->name), "%s_%s", enc ? "ffenc" : "ffdec", c->name);
+		memcpy(&f->factory, &factory, sizeof(factory));
+		f->codec = c;
+		n_factories++;
 	}
-	if (c == NULL)
-		return 0;
+	return 0;
+}
 
-	if (av_codec_is_encoder(c)) {
-		snprintf(name, 128, "ffenc_%s", c->name);
-		f.init = ffmpeg_enc_init;
-	} else {
-		snprintf(name, 128, "ffdec_%s", c->name);
-		f.init = ffmpeg_dec_init;
-	}
-	f.name = name;
-	f.info = NULL;
-	f.enum_interface_info = ffmpeg_enum_interface_info;
+int spa_handle_factory_enum(const struct spa_handle_factory **factory, uint32_t *index)
+{
+	int res;
+
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+
+	if (factories == NULL && (res = make_factories()) < 0)
+		return res;
+
+	if (*index >= n_factories)
+		return 0;
 
-	*factory = &f;
-	(*index)++;
+	*factory = &factories[(*index)++].factory;
 
 	return 1;
 }
@@ -0,0 +1,226 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_INVOKE_QUEUE_H__
+#define __SPA_INVOKE_QUEUE_H__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <spa/support/loop.h>
+
+/** \cond */
+
+/* Multi-producer, single-consumer queue of invoke items used by the loop
+ * implementations. It is a bounded array of cells with a sequence number
+ * per cell. Producers claim a cell with a CAS on the enqueue position and
+ * publish it by updating the cell sequence, the loop thread consumes the
+ * cells in order. Producers never take a lock and never wait for each
+ * other except for the CAS retry. */
+
+#define INVOKE_QUEUE_SIZE	256	/* must be a power of 2 */
+#define INVOKE_QUEUE_MASK	(INVOKE_QUEUE_SIZE - 1)
+#define INVOKE_DATA_SIZE	128	/* larger data is allocated */
+
+#define INVOKE_COMPLETION_PENDING	0
+#define INVOKE_COMPLETION_WAITING	1
+#define INVOKE_COMPLETION_DONE		2
+
+/* completion of a blocking invoke, lives on the stack of the caller */
+struct invoke_completion {
+	int32_t state;		/* futex word */
+	int res;
+};
+
+struct invoke_item {
+	uint32_t sequence;
+	uint32_t seq;
+	spa_invoke_func_t func;
+	void *data;
+	size_t size;
+	void *user_data;
+	struct invoke_completion *completion;
+	uint64_t inline_data[INVOKE_DATA_SIZE / sizeof(uint64_t)];
+};
+
+struct invoke_queue {
+	uint32_t enqueue_pos SPA_ALIGNED(64);
+	uint32_t dequeue_pos SPA_ALIGNED(64);
+	int32_t wakeup_pending SPA_ALIGNED(64);
+	struct invoke_item items[INVOKE_QUEUE_SIZE];
+};
+
+static inline void invoke_queue_init(struct invoke_queue *q)
+{
+	uint32_t i;
+
+	for (i = 0; i < INVOKE_QUEUE_SIZE; i++)
+		q->items[i].sequence = i;
+	q->enqueue_pos = 0;
+	q->dequeue_pos = 0;
+	q->wakeup_pending = 0;
+}
+
+/** Queue an item
+ * \param wakeup set to true when the consumer needs to be woken up. Only
+ *        the first producer after the consumer started draining the queue
+ *        gets true, the others piggyback on that wakeup.
+ * \return 0 on success, -EPIPE when the queue is full, -ENOMEM when the
+ *        data could not be allocated.
+ */
+static inline int
+invoke_queue_push(struct invoke_queue *q,
+		  spa_invoke_func_t func,
+		  uint32_t seq,
+		  const void *data,
+		  size_t size,
+		  void *user_data,
+		  struct invoke_completion *completion,
+		  bool *wakeup)
+{
+	struct invoke_item *item;
+	uint32_t pos, sequence;
+	int32_t diff;
+
+	pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		item = &q->items[pos & INVOKE_QUEUE_MASK];
+		sequence = __atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE);
+		diff = (int32_t) (sequence - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -EPIPE;
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	item->func = func;
+	item->seq = seq;
+	item->size = size;
+	item->user_data = user_data;
+	item->completion = completion;
+
+	if (size <= INVOKE_DATA_SIZE)
+		item->data = item->inline_data;
+	else if ((item->data = malloc(size)) == NULL)
+		item->func = NULL;
+	if (item->data && size > 0)
+		memcpy(item->data, data, size);
+
+	/* publish, a NULL func is consumed as a no-op so that the cell is
+	 * released in order */
+	__atomic_store_n(&item->sequence, pos + 1, __ATOMIC_RELEASE);
+
+	*wakeup = __atomic_exchange_n(&q->wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0;
+
+	return item->func ? 0 : -ENOMEM;
+}
+
+static inline void invoke_completion_init(struct invoke_completion *c)
+{
+	c->state = INVOKE_COMPLETION_PENDING;
+	c->res = 0;
+}
+
+static inline void invoke_completion_complete(struct invoke_completion *c, int res)
+{
+	c->res = res;
+	/* only make the syscall when the caller is sleeping */
+	if (__atomic_exchange_n(&c->state, INVOKE_COMPLETION_DONE, __ATOMIC_ACQ_REL) ==
+	    INVOKE_COMPLETION_WAITING)
+		syscall(SYS_futex, &c->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline int invoke_completion_wait(struct invoke_completion *c)
+{
+	int32_t state = INVOKE_COMPLETION_PENDING;
+
+	if (__atomic_compare_exchange_n(&c->state, &state, INVOKE_COMPLETION_WAITING, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) != INVOKE_COMPLETION_DONE)
+			syscall(SYS_futex, &c->state, FUTEX_WAIT_PRIVATE,
+				INVOKE_COMPLETION_WAITING, NULL, NULL, 0);
+	}
+	return c->res;
+}
+
+/** Run all published items, called from the loop thread */
+static inline void invoke_queue_dispatch(struct invoke_queue *q, struct spa_loop *loop)
+{
+	struct invoke_item *item;
+	struct invoke_completion *completion;
+	uint32_t pos;
+	int res;
+
+	/* producers that queue after this will wake us up again */
+	__atomic_store_n(&q->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+
+	for (pos = q->dequeue_pos;; pos++) {
+		item = &q->items[pos & INVOKE_QUEUE_MASK];
+		if (__atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+
+		res = item->func ?
+			item->func(loop, true, item->seq, item->data, item->size, item->user_data) :
+			-ENOMEM;
+
+		if (item->data != item->inline_data)
+			free(item->data);
+		completion = item->completion;
+
+		q->dequeue_pos = pos + 1;
+		__atomic_store_n(&item->sequence, pos + INVOKE_QUEUE_SIZE, __ATOMIC_RELEASE);
+
+		if (completion)
+			invoke_completion_complete(completion, res);
+	}
+}
+
+/** Free the data of the items that were never dispatched */
+static inline void invoke_queue_clear(struct invoke_queue *q)
+{
+	struct invoke_item *item;
+	uint32_t pos;
+
+	for (pos = q->dequeue_pos;; pos++) {
+		item = &q->items[pos & INVOKE_QUEUE_MASK];
+		if (__atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+		if (item->data != item->inline_data)
+			free(item->data);
+		if (item->completion)
+			invoke_completion_complete(item->completion, -EPIPE);
+		item->sequence = pos + INVOKE_QUEUE_SIZE;
+	}
+	q->dequeue_pos = pos;
+}
+
+/** \endcond */
+
+#endif /* __SPA_INVOKE_QUEUE_H__ */
@@ -0,0 +1,443 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_LOG_TRACE_H__
+#define __SPA_LOG_TRACE_H__
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <spa/utils/defs.h>
+
+/** \cond */
+
+/* Binary trace records.
+ *
+ * In binary trace mode the logger does not format the message when it is
+ * logged. It copies the format string, the location and the raw arguments
+ * in a record, the message is formatted later outside of the realtime
+ * thread or by spa-trace-dump from a trace file. The strings are copied
+ * because the plugin that logged the message can be unloaded before the
+ * record is formatted.
+ *
+ * A trace file starts with TRACE_FILE_MAGIC followed by records. Each
+ * record starts with a struct trace_record header, the size includes the
+ * header and is a multiple of 8.
+ */
+
+#define TRACE_FILE_MAGIC	"SPATRC02"
+
+#define TRACE_RECORD_EVENT	1
+
+#define TRACE_MAX_RECORD	1024
+#define TRACE_MAX_STRING	256
+
+struct trace_record {
+	uint32_t size;
+	uint32_t type;
+};
+
+struct trace_event {
+	struct trace_record record;
+	uint32_t line;
+	uint32_t level;
+	uint64_t time;		/**< CLOCK_MONOTONIC in nanoseconds */
+	/* the format string, the file and the function name follow, encoded
+	 * like string arguments, then the encoded arguments */
+};
+
+enum trace_arg_type {
+	TRACE_ARG_NONE,
+	TRACE_ARG_INT,
+	TRACE_ARG_LONG,
+	TRACE_ARG_LLONG,
+	TRACE_ARG_SIZE,
+	TRACE_ARG_PTRDIFF,
+	TRACE_ARG_INTMAX,
+	TRACE_ARG_DOUBLE,
+	TRACE_ARG_LDOUBLE,
+	TRACE_ARG_STRING,
+	TRACE_ARG_POINTER,
+	TRACE_ARG_ERRNO,	/**< %m, captured as a string */
+	TRACE_ARG_SKIP,		/**< %n, consumed but not stored */
+};
+
+struct trace_spec {
+	const char *start;	/**< the '%' */
+	const char *end;	/**< after the conversion */
+	uint32_t n_star;	/**< number of '*' width or precision args */
+	enum trace_arg_type type;
+};
+
+#define TRACE_ALIGN(s)	SPA_ROUND_UP_N(s, 8)
+
+/* parse the conversion spec starting at the '%' in p. Returns false
+ * for specs we can't handle, like positional arguments */
+static inline bool trace_parse_spec(const char *p, struct trace_spec *s)
+{
+	int l = 0;
+	char c;
+
+	s->start = p++;
+	s->n_star = 0;
+	s->type = TRACE_ARG_NONE;
+
+	while (*p && strchr("-+ #0'I", *p))
+		p++;
+	if (*p == '*') {
+		s->n_star++;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p == '$')
+			return false;
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			s->n_star++;
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+	}
+	switch (*p) {
+	case 'h':
+		p += p[1] == 'h' ? 2 : 1;
+		break;
+	case 'l':
+		if (p[1] == 'l') {
+			l = 'q';
+			p += 2;
+		} else {
+			l = 'l';
+			p++;
+		}
+		break;
+	case 'q': case 'L': case 'j': case 'z': case 'Z': case 't':
+		l = *p++;
+		break;
+	}
+
+	switch ((c = *p++)) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		switch (l) {
+		case 'l': s->type = TRACE_ARG_LONG; break;
+		case 'q': case 'L': s->type = TRACE_ARG_LLONG; break;
+		case 'j': s->type = TRACE_ARG_INTMAX; break;
+		case 'z': case 'Z': s->type = TRACE_ARG_SIZE; break;
+		case 't': s->type = TRACE_ARG_PTRDIFF; break;
+		default: s->type = TRACE_ARG_INT; break;
+		}
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		s->type = l == 'L' ? TRACE_ARG_LDOUBLE : TRACE_ARG_DOUBLE;
+		break;
+	case 's':
+		s->type = TRACE_ARG_STRING;
+		break;
+	case 'p':
+		s->type = TRACE_ARG_POINTER;
+		break;
+	case 'm':
+		s->type = TRACE_ARG_ERRNO;
+		break;
+	case 'n':
+		s->type = TRACE_ARG_SKIP;
+		break;
+	case '%':
+		break;
+	default:
+		return false;
+	}
+	s->end = p;
+	return true;
+}
+
+static inline int trace_put_string(uint8_t *data, uint32_t offset, uint32_t maxsize, const char *str)
+{
+	uint32_t len, avail;
+
+	if (str == NULL)
+		str = "(null)";
+
+	if (offset + 8 >= maxsize)
+		return -ENOSPC;
+
+	avail = SPA_MIN(maxsize - offset - 5, TRACE_MAX_STRING);
+	len = strnlen(str, avail - 1);
+	*(uint32_t*)(data + offset) = len;
+	memcpy(data + offset + 4, str, len);
+	data[offset + 4 + len] = '\0';
+
+	return TRACE_ALIGN(4 + len + 1);
+}
+
+/** Get the string encoded at \a offset in \a data.
+ * \returns the encoded size or < 0 when there is no valid string */
+static inline int trace_get_string(const uint8_t *data, uint32_t offset, uint32_t size,
+				   const char **str)
+{
+	uint32_t len;
+
+	if (offset + 5 > size)
+		return -EINVAL;
+
+	len = *(const uint32_t*)(data + offset);
+	if (len > size - offset - 5 || data[offset + 4 + len] != '\0')
+		return -EINVAL;
+
+	*str = (const char *)(data + offset + 4);
+	return TRACE_ALIGN(4 + len + 1);
+}
+
+/** Encode the format string, file and function of an event in \a data.
+ * \returns the encoded size or < 0 when the strings don't fit */
+static inline int trace_encode_location(uint8_t *data, uint32_t maxsize, const char *fmt,
+					const char *file, const char *func)
+{
+	const char *str[3] = { fmt, file, func };
+	uint32_t i, offset = 0;
+	int res;
+
+	/* a truncated format would not match the arguments */
+	if (strlen(fmt) >= TRACE_MAX_STRING)
+		return -ENOSPC;
+
+	for (i = 0; i < 3; i++) {
+		if ((res = trace_put_string(data, offset, maxsize, str[i])) < 0)
+			return res;
+		offset += res;
+	}
+	return offset;
+}
+
+/** Get the strings encoded by trace_encode_location() from \a ev.
+ * \returns the offset of the arguments in \a ev or < 0 on error */
+static inline int trace_event_location(const struct trace_event *ev, const char **fmt,
+				       const char **file, const char **func)
+{
+	const uint8_t *data = (const uint8_t *) ev;
+	const char **str[3] = { fmt, file, func };
+	uint32_t i, offset = sizeof(*ev);
+	int res;
+
+	for (i = 0; i < 3; i++) {
+		if ((res = trace_get_string(data, offset, ev->record.size, str[i])) < 0)
+			return res;
+		offset += res;
+	}
+	return offset;
+}
+
+/** Encode the arguments of \a fmt in \a data.
+ * \returns the size of the encoded arguments or < 0 when the format
+ *      can't be encoded and should be formatted directly. */
+static inline int trace_encode_args(uint8_t *data, uint32_t maxsize, const char *fmt, va_list args)
+{
+	struct trace_spec s;
+	uint32_t i, offset = 0;
+	const char *p;
+	int res, errnum = errno;
+
+	for (p = fmt; (p = strchr(p, '%')) != NULL; p = s.end) {
+		if (!trace_parse_spec(p, &s))
+			return -EINVAL;
+
+		for (i = 0; i < s.n_star; i++) {
+			if (offset + 8 > maxsize)
+				return -ENOSPC;
+			*(int64_t*)(data + offset) = va_arg(args, int);
+			offset += 8;
+		}
+		if (s.type == TRACE_ARG_NONE)
+			continue;
+
+		if (offset + 8 > maxsize)
+			return -ENOSPC;
+
+		switch (s.type) {
+		case TRACE_ARG_INT:
+			*(int64_t*)(data + offset) = va_arg(args, int);
+			break;
+		case TRACE_ARG_LONG:
+			*(int64_t*)(data + offset) = va_arg(args, long);
+			break;
+		case TRACE_ARG_LLONG:
+			*(int64_t*)(data + offset) = va_arg(args, long long);
+			break;
+		case TRACE_ARG_SIZE:
+			*(int64_t*)(data + offset) = va_arg(args, size_t);
+			break;
+		case TRACE_ARG_PTRDIFF:
+			*(int64_t*)(data + offset) = va_arg(args, ptrdiff_t);
+			break;
+		case TRACE_ARG_INTMAX:
+			*(int64_t*)(data + offset) = va_arg(args, intmax_t);
+			break;
+		case TRACE_ARG_DOUBLE:
+			*(double*)(data + offset) = va_arg(args, double);
+			break;
+		case TRACE_ARG_LDOUBLE:
+			*(double*)(data + offset) = va_arg(args, long double);
+			break;
+		case TRACE_ARG_POINTER:
+			*(uint64_t*)(data + offset) = (uintptr_t) va_arg(args, void *);
+			break;
+		case TRACE_ARG_STRING:
+			if ((res = trace_put_string(data, offset, maxsize, va_arg(args, const char *))) < 0)
+				return res;
+			offset += res;
+			continue;
+		case TRACE_ARG_ERRNO:
+			if ((res = trace_put_string(data, offset, maxsize, strerror(errnum))) < 0)
+				return res;
+			offset += res;
+			continue;
+		case TRACE_ARG_SKIP:
+			va_arg(args, void *);
+			continue;
+		default:
+			continue;
+		}
+		offset += 8;
+	}
+	return offset;
+}
+
+/** Format \a fmt with the arguments encoded by trace_encode_args() */
+static inline int trace_format(char *buffer, size_t size, const char *fmt,
+			       const uint8_t *data, uint32_t data_size)
+{
+	struct trace_spec s;
+	uint32_t i, offset = 0;
+	const char *p, *last;
+	size_t pos = 0;
+	char spec[64];
+	int len;
+
+#define TRACE_ADVANCE(n)	(pos = SPA_MIN(size - 1, pos + SPA_MAX(n, 0)))
+
+	buffer[0] = '\0';
+
+	for (last = p = fmt; (p = strchr(p, '%')) != NULL; last = p = s.end) {
+		size_t n;
+		char *sp = spec;
+		const char *q;
+
+		len = SPA_MIN((size_t)(p - last), size - 1 - pos);
+		memcpy(buffer + pos, last, len);
+		TRACE_ADVANCE(len);
+
+		if (!trace_parse_spec(p, &s))
+			break;
+
+		/* copy the spec and replace the '*' with the encoded values */
+		for (q = s.start, i = 0; q < s.end && sp < spec + sizeof(spec) - 24; q++) {
+			if (*q == '*' && i < s.n_star) {
+				if (offset + 8 > data_size)
+					goto done;
+				sp += sprintf(sp, "%d", (int) *(const int64_t*)(data + offset));
+				offset += 8;
+				i++;
+			} else if (*q == 'm' && s.type == TRACE_ARG_ERRNO && q == s.end - 1) {
+				*sp++ = 's';
+			} else {
+				*sp++ = *q;
+			}
+		}
+		*sp = '\0';
+
+		if (s.type == TRACE_ARG_NONE) {
+			len = snprintf(buffer + pos, size - pos, spec, 0);
+			TRACE_ADVANCE(len);
+			continue;
+		}
+		if (s.type == TRACE_ARG_SKIP)
+			continue;
+
+		if (offset + 8 > data_size)
+			break;
+
+		n = 8;
+		switch (s.type) {
+		case TRACE_ARG_INT:
+			len = snprintf(buffer + pos, size - pos, spec, (int) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_LONG:
+			len = snprintf(buffer + pos, size - pos, spec, (long) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_LLONG:
+			len = snprintf(buffer + pos, size - pos, spec, (long long) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_SIZE:
+			len = snprintf(buffer + pos, size - pos, spec, (size_t) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_PTRDIFF:
+			len = snprintf(buffer + pos, size - pos, spec, (ptrdiff_t) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_INTMAX:
+			len = snprintf(buffer + pos, size - pos, spec, (intmax_t) *(const int64_t*)(data + offset));
+			break;
+		case TRACE_ARG_DOUBLE:
+			len = snprintf(buffer + pos, size - pos, spec, *(const double*)(data + offset));
+			break;
+		case TRACE_ARG_LDOUBLE:
+			len = snprintf(buffer + pos, size - pos, spec, (long double) *(const double*)(data + offset));
+			break;
+		case TRACE_ARG_POINTER:
+			len = snprintf(buffer + pos, size - pos, spec,
+					(void *)(uintptr_t) *(const uint64_t*)(data + offset));
+			break;
+		case TRACE_ARG_STRING:
+		case TRACE_ARG_ERRNO:
+		{
+			uint32_t slen = *(const uint32_t*)(data + offset);
+			if (offset + 4 + slen + 1 > data_size)
+				goto done;
+			len = snprintf(buffer + pos, size - pos, spec, (const char *)(data + offset + 4));
+			n = TRACE_ALIGN(4 + slen + 1);
+			break;
+		}
+		default:
+			len = 0;
+			break;
+		}
+		TRACE_ADVANCE(len);
+		offset += n;
+	}
+	if (p == NULL) {
+		len = snprintf(buffer + pos, size - pos, "%s", last);
+		TRACE_ADVANCE(len);
+	}
+      done:
+	buffer[pos] = '\0';
+#undef TRACE_ADVANCE
+	return pos;
+}
+
+/** \endcond */
+
+#endif /* __SPA_LOG_TRACE_H__ */
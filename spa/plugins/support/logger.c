@@ -22,6 +22,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/eventfd.h>
 
 #include <spa/support/type-map.h>
@@ -30,12 +34,18 @@
 #include <spa/support/plugin.h>
 #include <spa/utils/ringbuffer.h>
 
+#include "log-trace.h"
+
 #define NAME "logger"
 
 #define DEFAULT_LOG_LEVEL SPA_LOG_LEVEL_INFO
 
 #define TRACE_BUFFER (16*1024)
 
+/* binary trace mode, one ring per thread */
+#define TRACE_RINGS		32
+#define TRACE_RING_SIZE		(64*1024)
+
 struct type {
 	uint32_t log;
 };
@@ -45,6 +55,13 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->log = spa_type_map_get_id(map, SPA_TYPE__Log);
 }
 
+struct trace_ring {
+	struct spa_ringbuffer rb;
+	int32_t owner;
+	uint32_t dropped;
+	uint8_t data[TRACE_RING_SIZE];
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_log log;
@@ -57,8 +74,123 @@ struct impl {
 
 	bool have_source;
 	struct spa_source source;
+
+	bool binary;
+	struct trace_ring *rings;
+	pthread_key_t ring_key;
+	int32_t wakeup_pending;
+	FILE *trace_file;
+
+	bool have_thread;
+	bool running;
+	pthread_t thread;
 };
 
+static const char *levels[] = { "-", "E", "W", "I", "D", "T", "*T*" };
+
+static inline const char *base_name(const char *file)
+{
+	const char *p = strrchr(file, '/');
+	return p ? p + 1 : file;
+}
+
+static void release_ring(void *data)
+{
+	struct trace_ring *ring = data;
+	__atomic_store_n(&ring->owner, 0, __ATOMIC_RELEASE);
+}
+
+static struct trace_ring *get_ring(struct impl *impl)
+{
+	struct trace_ring *ring;
+	uint32_t i;
+
+	if ((ring = pthread_getspecific(impl->ring_key)) != NULL)
+		return ring;
+
+	/* first trace message from this thread, claim a free ring. The ring
+	 * is released again when the thread exits */
+	for (i = 0; i < TRACE_RINGS; i++) {
+		int32_t owner = 0;
+
+		ring = &impl->rings[i];
+		if (__atomic_compare_exchange_n(&ring->owner, &owner, 1, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			pthread_setspecific(impl->ring_key, ring);
+			return ring;
+		}
+	}
+	return NULL;
+}
+
+static void signal_trace(struct impl *impl)
+{
+	uint64_t count = 1;
+
+	if (write(impl->source.fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+		fprintf(stderr, "error signaling eventfd: %s\n", strerror(errno));
+}
+
+/* record the message without formatting it. Returns < 0 when the message
+ * could not be recorded and needs to be formatted right away */
+static int
+log_trace_binary(struct impl *impl,
+		 const char *file,
+		 int line,
+		 const char *func,
+		 const char *fmt,
+		 va_list args)
+{
+	uint64_t buffer[TRACE_MAX_RECORD / sizeof(uint64_t)];
+	struct trace_event *ev = (struct trace_event *) buffer;
+	struct trace_ring *ring;
+	struct timespec ts;
+	uint32_t index, size;
+	int32_t filled;
+	va_list copy;
+	int res;
+
+	if ((ring = get_ring(impl)) == NULL)
+		return -EBUSY;
+
+	size = sizeof(*ev);
+	if ((res = trace_encode_location((uint8_t *) buffer + size,
+					 sizeof(buffer) - size, fmt, file, func)) < 0)
+		return res;
+	size += res;
+
+	va_copy(copy, args);
+	res = trace_encode_args((uint8_t *) buffer + size,
+				sizeof(buffer) - size, fmt, copy);
+	va_end(copy);
+	if (res < 0)
+		return res;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	size += res;
+	ev->record.size = size;
+	ev->record.type = TRACE_RECORD_EVENT;
+	ev->line = line;
+	ev->level = SPA_LOG_LEVEL_TRACE;
+	ev->time = SPA_TIMESPEC_TO_TIME(&ts);
+
+	filled = spa_ringbuffer_get_write_index(&ring->rb, &index);
+	if (filled < 0 || filled + size > TRACE_RING_SIZE) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	spa_ringbuffer_write_data(&ring->rb, ring->data, TRACE_RING_SIZE,
+				  index & (TRACE_RING_SIZE - 1), buffer, size);
+	spa_ringbuffer_write_update(&ring->rb, index + size);
+
+	/* only wake up the consumer once until it starts reading */
+	if (__atomic_exchange_n(&impl->wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0)
+		signal_trace(impl);
+
+	return 0;
+}
+
 static void
 impl_log_logv(struct spa_log *log,
 	      enum spa_log_level level,
@@ -69,29 +201,35 @@ impl_log_logv(struct spa_log *log,
 	      va_list args)
 {
 	struct impl *impl = SPA_CONTAINER_OF(log, struct impl, log);
-	char text[512], location[1024];
-	static const char *levels[] = { "-", "E", "W", "I", "D", "T", "*T*" };
+	char location[1024];
 	int size;
 	bool do_trace;
 
-	if ((do_trace = (level == SPA_LOG_LEVEL_TRACE && impl->have_source)))
+	if (level == SPA_LOG_LEVEL_TRACE && impl->binary &&
+	    log_trace_binary(impl, file, line, func, fmt, args) >= 0)
+		return;
+
+	if ((do_trace = (level == SPA_LOG_LEVEL_TRACE && impl->have_source && !impl->binary)))
 		level++;
 
-	vsnprintf(text, sizeof(text), fmt, args);
-	size = snprintf(location, sizeof(location), "[%s][%s:%i %s()] %s\n",
-		levels[level], strrchr(file, '/') + 1, line, func, text);
+	/* format everything in one buffer, leave room for the newline */
+	size = snprintf(location, sizeof(location) - 1, "[%s][%s:%i %s()] ",
+		levels[level], base_name(file), line, func);
+	size = SPA_MIN(size, (int) sizeof(location) - 2);
+	size += vsnprintf(location + size, sizeof(location) - 1 - size, fmt, args);
+	size = SPA_MIN(size, (int) sizeof(location) - 2);
+	location[size++] = '\n';
+	location[size] = '\0';
 
 	if (SPA_UNLIKELY(do_trace)) {
 		uint32_t index;
-		uint64_t count = 1;
 
 		spa_ringbuffer_get_write_index(&impl->trace_rb, &index);
 		spa_ringbuffer_write_data(&impl->trace_rb, impl->trace_data, TRACE_BUFFER,
 					  index & (TRACE_BUFFER - 1), location, size);
 		spa_ringbuffer_write_update(&impl->trace_rb, index + size);
 
-		if (write(impl->source.fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-			fprintf(stderr, "error signaling eventfd: %s\n", strerror(errno));
+		signal_trace(impl);
 	} else
 		fputs(location, stderr);
 }
@@ -111,6 +249,65 @@ impl_log_log(struct spa_log *log,
 	va_end(args);
 }
 
+static void emit_trace_event(struct impl *impl, struct trace_event *ev)
+{
+	const char *fmt, *file, *func;
+	char text[1024];
+	int offset;
+
+	if (impl->trace_file) {
+		fwrite(ev, ev->record.size, 1, impl->trace_file);
+		return;
+	}
+	if ((offset = trace_event_location(ev, &fmt, &file, &func)) < 0)
+		return;
+
+	trace_format(text, sizeof(text), fmt, SPA_MEMBER(ev, offset, uint8_t),
+		     ev->record.size - offset);
+
+	fprintf(stderr, "[%s][%" PRIu64 ".%06" PRIu64 "][%s:%i %s()] %s\n",
+		levels[ev->level + 1],
+		(uint64_t)(ev->time / SPA_NSEC_PER_SEC),
+		(uint64_t)((ev->time % SPA_NSEC_PER_SEC) / 1000),
+		base_name(file), ev->line, func, text);
+}
+
+static void flush_trace_binary(struct impl *impl)
+{
+	uint64_t buffer[TRACE_MAX_RECORD / sizeof(uint64_t)];
+	struct trace_record *rec = (struct trace_record *) buffer;
+	uint32_t i, index, dropped;
+	int32_t avail;
+
+	/* producers that write after this will wake us up again */
+	__atomic_store_n(&impl->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < TRACE_RINGS; i++) {
+		struct trace_ring *ring = &impl->rings[i];
+
+		while ((avail = spa_ringbuffer_get_read_index(&ring->rb, &index)) >=
+		       (int32_t) sizeof(struct trace_record)) {
+			spa_ringbuffer_read_data(&ring->rb, ring->data, TRACE_RING_SIZE,
+						 index & (TRACE_RING_SIZE - 1), rec, sizeof(*rec));
+			if (rec->size > sizeof(buffer) || rec->size > avail) {
+				/* can't happen, skip everything */
+				spa_ringbuffer_read_update(&ring->rb, index + avail);
+				break;
+			}
+			spa_ringbuffer_read_data(&ring->rb, ring->data, TRACE_RING_SIZE,
+						 index & (TRACE_RING_SIZE - 1), buffer, rec->size);
+			spa_ringbuffer_read_update(&ring->rb, index + rec->size);
+
+			emit_trace_event(impl, (struct trace_event *) buffer);
+		}
+		if ((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) > 0)
+			fprintf(stderr, "[W][%s:%i %s()] " NAME " %p: %u trace messages dropped\n",
+				base_name(__FILE__), __LINE__, __func__, impl, dropped);
+	}
+	if (impl->trace_file)
+		fflush(impl->trace_file);
+}
+
 static void on_trace_event(struct spa_source *source)
 {
 	struct impl *impl = source->data;
@@ -121,6 +318,11 @@ static void on_trace_event(struct spa_source *source)
 	if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
 		fprintf(stderr, "failed to read event fd: %s", strerror(errno));
 
+	if (impl->binary) {
+		flush_trace_binary(impl);
+		return;
+	}
+
 	while ((avail = spa_ringbuffer_get_read_index(&impl->trace_rb, &index)) > 0) {
 		uint32_t offset, first;
 
@@ -139,6 +341,55 @@ static void on_trace_event(struct spa_source *source)
         }
 }
 
+/* without a main loop, the binary trace records are formatted in a
+ * low priority thread */
+static void *trace_thread(void *data)
+{
+	struct impl *impl = data;
+	uint64_t count;
+
+	while (impl->running) {
+		if (read(impl->source.fd, &count, sizeof(uint64_t)) != sizeof(uint64_t) &&
+		    errno != EINTR)
+			break;
+		flush_trace_binary(impl);
+	}
+	return NULL;
+}
+
+static int init_trace_binary(struct impl *impl, const char *filename)
+{
+	int res;
+
+	impl->rings = calloc(TRACE_RINGS, sizeof(struct trace_ring));
+	if (impl->rings == NULL)
+		return -ENOMEM;
+
+	if ((res = pthread_key_create(&impl->ring_key, release_ring)) != 0) {
+		free(impl->rings);
+		return -res;
+	}
+
+	if (filename) {
+		if ((impl->trace_file = fopen(filename, "we")) == NULL) {
+			res = -errno;
+			goto error;
+		}
+		fwrite(TRACE_FILE_MAGIC, strlen(TRACE_FILE_MAGIC), 1, impl->trace_file);
+	}
+	impl->binary = true;
+	return 0;
+
+      error:
+	if (impl->trace_file)
+		fclose(impl->trace_file);
+	impl->trace_file = NULL;
+	pthread_key_delete(impl->ring_key);
+	free(impl->rings);
+	impl->rings = NULL;
+	return res;
+}
+
 static const struct spa_log impl_log = {
 	SPA_VERSION_LOG,
 	NULL,
@@ -177,6 +428,21 @@ static int impl_clear(struct spa_handle *handle)
 		close(this->source.fd);
 		this->have_source = false;
 	}
+	if (this->have_thread) {
+		this->running = false;
+		signal_trace(this);
+		pthread_join(this->thread, NULL);
+		close(this->source.fd);
+		this->have_thread = false;
+	}
+	if (this->binary) {
+		flush_trace_binary(this);
+		this->binary = false;
+		pthread_key_delete(this->ring_key);
+		free(this->rings);
+		if (this->trace_file)
+			fclose(this->trace_file);
+	}
 	return 0;
 }
 
@@ -190,6 +456,8 @@ impl_init(const struct spa_handle_factory *factory,
 	struct impl *this;
 	uint32_t i;
 	struct spa_loop *loop = NULL;
+	const char *str;
+	int res;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -213,6 +481,13 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	init_type(&this->type, this->map);
 
+	if (info && (str = spa_dict_lookup(info, "log.trace.binary")) != NULL &&
+	    (strcmp(str, "true") == 0 || atoi(str) == 1)) {
+		if ((res = init_trace_binary(this, spa_dict_lookup(info, "log.trace.file"))) < 0)
+			spa_log_warn(&this->log, NAME " %p: can't enable binary trace: %s",
+					this, strerror(-res));
+	}
+
 	if (loop) {
 		this->source.func = on_trace_event;
 		this->source.data = this;
@@ -222,6 +497,15 @@ impl_init(const struct spa_handle_factory *factory,
 		spa_loop_add_source(loop, &this->source);
 		this->have_source = true;
 	}
+	else if (this->binary) {
+		this->source.fd = eventfd(0, EFD_CLOEXEC);
+		this->running = true;
+		if ((res = pthread_create(&this->thread, NULL, trace_thread, this)) == 0)
+			this->have_thread = true;
+		else
+			spa_log_warn(&this->log, NAME " %p: can't create trace thread: %s",
+					this, strerror(res));
+	}
 
 	spa_ringbuffer_init(&this->trace_rb);
 
@@ -0,0 +1,1254 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+#include <spa/support/loop.h>
+#include <spa/support/log.h>
+#include <spa/support/type-map.h>
+#include <spa/support/plugin.h>
+#include <spa/utils/list.h>
+
+#include "invoke-queue.h"
+
+#define NAME "loop-uring"
+
+/* number of submission queue entries, the completion queue is
+ * twice as large */
+#define RING_ENTRIES	256
+/* max number of completions handled in one iteration */
+#define MAX_EVENTS	64
+
+/* the low bits of the user_data of an sqe contain the operation, the
+ * other bits the struct entry it applies to */
+#define OP_POLL		0
+#define OP_READ		1
+#define OP_IGNORE	3
+#define OP_MASK		3
+
+/** \cond */
+
+struct type {
+	uint32_t loop;
+	uint32_t loop_control;
+	uint32_t loop_utils;
+};
+
+static void loop_signal_event(struct spa_source *source);
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	type->loop = spa_type_map_get_id(map, SPA_TYPE__Loop);
+	type->loop_control = spa_type_map_get_id(map, SPA_TYPE__LoopControl);
+	type->loop_utils = spa_type_map_get_id(map, SPA_TYPE__LoopUtils);
+}
+
+struct ring {
+	int fd;
+	uint32_t features;
+
+	void *sq_ptr;
+	size_t sq_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned sq_local_tail;		/**< tail of the sqes we prepared */
+
+	void *cq_ptr;
+	size_t cq_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/* the state of a source in the ring. Because the kernel keeps a
+ * reference to the entry in the user_data of the pending operations, an
+ * entry can only be freed when there are no more pending operations */
+struct entry {
+	struct spa_source *source;	/**< the source or NULL when removed */
+	struct spa_list link;		/**< link in the entry or destroy list */
+	struct spa_list arm_link;	/**< link in the arm list */
+	bool in_arm_list;
+	bool allocated;			/**< allocated by add_source */
+	uint32_t op;			/**< OP_POLL or OP_READ */
+	uint32_t pending;		/**< number of operations in flight */
+	uint64_t count;			/**< result of OP_READ */
+};
+
+struct impl {
+	struct spa_handle handle;
+	struct spa_loop loop;
+	struct spa_loop_control control;
+	struct spa_loop_utils utils;
+
+        struct spa_log *log;
+        struct type type;
+        struct spa_type_map *map;
+
+	struct spa_list source_list;
+	struct spa_list destroy_list;
+	struct spa_list entry_list;
+	struct spa_list entry_destroy_list;
+	struct spa_list arm_list;
+	struct spa_hook_list hooks_list;
+	bool has_hooks;
+
+	struct ring ring;
+	pthread_t thread;
+
+	struct spa_source *wakeup;
+
+	struct invoke_queue queue;
+};
+
+struct source_impl {
+	struct spa_source source;
+	struct entry entry;
+
+	struct impl *impl;
+	struct spa_list link;
+
+	bool close;
+	union {
+		spa_source_io_func_t io;
+		spa_source_idle_func_t idle;
+		spa_source_event_func_t event;
+		spa_source_timer_func_t timer;
+		spa_source_signal_func_t signal;
+	} func;
+	int signal_number;
+	bool enabled;
+};
+/** \endcond */
+
+static const uint64_t one = 1;
+
+static int ring_setup(struct ring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	spa_zero(p);
+	p.flags = IORING_SETUP_CLAMP;
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -errno;
+
+	/* we need NODROP so that we never lose completions that reference
+	 * entries and EXT_ARG for the timeout */
+	ring->features = p.features;
+	if ((p.features & (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) !=
+	    (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) {
+		close(ring->fd);
+		return -ENOTSUP;
+	}
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_size = ring->cq_size = SPA_MAX(ring->sq_size, ring->cq_size);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto error;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			goto error_sq;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto error_cq;
+
+	ring->sq_head = SPA_MEMBER(ring->sq_ptr, p.sq_off.head, unsigned);
+	ring->sq_tail = SPA_MEMBER(ring->sq_ptr, p.sq_off.tail, unsigned);
+	ring->sq_mask = SPA_MEMBER(ring->sq_ptr, p.sq_off.ring_mask, unsigned);
+	ring->sq_entries = SPA_MEMBER(ring->sq_ptr, p.sq_off.ring_entries, unsigned);
+	ring->sq_array = SPA_MEMBER(ring->sq_ptr, p.sq_off.array, unsigned);
+	ring->sq_local_tail = *ring->sq_tail;
+
+	ring->cq_head = SPA_MEMBER(ring->cq_ptr, p.cq_off.head, unsigned);
+	ring->cq_tail = SPA_MEMBER(ring->cq_ptr, p.cq_off.tail, unsigned);
+	ring->cq_mask = SPA_MEMBER(ring->cq_ptr, p.cq_off.ring_mask, unsigned);
+	ring->cqes = SPA_MEMBER(ring->cq_ptr, p.cq_off.cqes, struct io_uring_cqe);
+
+	return 0;
+
+      error_cq:
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+      error_sq:
+	munmap(ring->sq_ptr, ring->sq_size);
+      error:
+	close(ring->fd);
+	return -ENOMEM;
+}
+
+static void ring_clear(struct ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+static int ring_enter(struct ring *ring, unsigned min_complete, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned flags = 0, to_submit;
+	int res;
+
+	/* the kernel moves the head when it consumed the sqes */
+	to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit > 0)
+		__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000LL;
+			spa_zero(arg);
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+	} else if (to_submit == 0)
+		return 0;
+
+	res = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags,
+		      flags & IORING_ENTER_EXT_ARG ? (void*)&arg : NULL,
+		      flags & IORING_ENTER_EXT_ARG ? sizeof(arg) : _NSIG / 8);
+	if (res < 0) {
+		res = -errno;
+		/* a timeout is not an error */
+		if (res == -ETIME)
+			res = 0;
+	}
+	return res;
+}
+
+static inline int ring_submit(struct ring *ring)
+{
+	return ring_enter(ring, 0, 0);
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head, idx;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sq_local_tail - head >= *ring->sq_entries) {
+		/* full, flush what we have so far */
+		if (ring_submit(ring) < 0)
+			return NULL;
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (ring->sq_local_tail - head >= *ring->sq_entries)
+			return NULL;
+	}
+	idx = ring->sq_local_tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	ring->sq_local_tail++;
+
+	return sqe;
+}
+
+static inline uint64_t entry_user_data(struct entry *e, uint32_t op)
+{
+	return (uint64_t)(uintptr_t)e | op;
+}
+
+static inline uint32_t spa_io_to_poll(enum spa_io mask)
+{
+	uint32_t events = 0;
+
+	if (mask & SPA_IO_IN)
+		events |= POLLIN;
+	if (mask & SPA_IO_OUT)
+		events |= POLLOUT;
+	if (mask & SPA_IO_ERR)
+		events |= POLLERR;
+	if (mask & SPA_IO_HUP)
+		events |= POLLHUP;
+
+	return events;
+}
+
+static inline enum spa_io spa_poll_to_io(uint32_t events)
+{
+	enum spa_io mask = 0;
+
+	if (events & POLLIN)
+		mask |= SPA_IO_IN;
+	if (events & POLLOUT)
+		mask |= SPA_IO_OUT;
+	if (events & POLLHUP)
+		mask |= SPA_IO_HUP;
+	if (events & POLLERR)
+		mask |= SPA_IO_ERR;
+
+	return mask;
+}
+
+static inline bool in_loop_thread(struct impl *impl)
+{
+	return impl->thread == 0 || pthread_equal(impl->thread, pthread_self());
+}
+
+static void entry_schedule_arm(struct impl *impl, struct entry *e)
+{
+	if (!e->in_arm_list) {
+		spa_list_append(&impl->arm_list, &e->arm_link);
+		e->in_arm_list = true;
+	}
+}
+
+static void entry_unschedule_arm(struct entry *e)
+{
+	if (e->in_arm_list) {
+		spa_list_remove(&e->arm_link);
+		e->in_arm_list = false;
+	}
+}
+
+static int entry_arm(struct impl *impl, struct entry *e)
+{
+	struct spa_source *s = e->source;
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = ring_get_sqe(&impl->ring)) == NULL)
+		return -EBUSY;
+
+	if (e->op == OP_READ) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = s->fd;
+		sqe->addr = (uint64_t)(uintptr_t)&e->count;
+		sqe->len = sizeof(uint64_t);
+		sqe->off = -1;
+	} else {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = s->fd;
+		sqe->poll32_events = spa_io_to_poll(s->mask);
+	}
+	sqe->user_data = entry_user_data(e, e->op);
+	e->pending++;
+
+	return 0;
+}
+
+static void entry_cancel(struct impl *impl, struct entry *e)
+{
+	struct io_uring_sqe *sqe;
+
+	if (e->pending == 0)
+		return;
+
+	if ((sqe = ring_get_sqe(&impl->ring)) == NULL) {
+		spa_log_warn(impl->log, NAME " %p: can't cancel entry %p", impl, e);
+		return;
+	}
+	sqe->opcode = e->op == OP_POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = entry_user_data(e, e->op);
+	sqe->user_data = entry_user_data(NULL, OP_IGNORE);
+}
+
+static struct entry *find_entry(struct impl *impl, struct spa_source *source)
+{
+	struct entry *e;
+
+	/* sources added with spa_loop_add_source have no place to store our
+	 * state, look it up. This is not a hot path, io updates are rare
+	 * compared to dispatch */
+	spa_list_for_each(e, &impl->entry_list, link) {
+		if (e->source == source)
+			return e;
+	}
+	return NULL;
+}
+
+static void entry_add(struct impl *impl, struct entry *e, struct spa_source *source, uint32_t op)
+{
+	e->source = source;
+	e->op = op;
+	e->pending = 0;
+	e->in_arm_list = false;
+	spa_list_append(&impl->entry_list, &e->link);
+	entry_schedule_arm(impl, e);
+}
+
+static void entry_remove(struct impl *impl, struct entry *e)
+{
+	entry_unschedule_arm(e);
+	entry_cancel(impl, e);
+	e->source = NULL;
+	spa_list_remove(&e->link);
+	spa_list_append(&impl->entry_destroy_list, &e->link);
+
+	/* make sure the cancel and anything referencing the fd is submitted
+	 * before the caller closes the fd */
+	ring_submit(&impl->ring);
+}
+
+struct source_op {
+	struct spa_source *source;
+	int cmd;
+#define CMD_ADD		0
+#define CMD_UPDATE	1
+#define CMD_REMOVE	2
+};
+
+static int do_add_source(struct impl *impl, struct spa_source *source)
+{
+	struct entry *e;
+
+	if (source->fd == -1)
+		return 0;
+
+	if ((e = calloc(1, sizeof(struct entry))) == NULL)
+		return -ENOMEM;
+
+	e->allocated = true;
+	entry_add(impl, e, source, OP_POLL);
+
+	return 0;
+}
+
+static int do_update_source(struct impl *impl, struct spa_source *source)
+{
+	struct entry *e;
+
+	if (source->fd == -1 || (e = find_entry(impl, source)) == NULL)
+		return 0;
+
+	/* cancel the old poll, the completion of the cancel will rearm
+	 * with the new mask */
+	if (e->op == OP_POLL) {
+		if (e->pending > 0)
+			entry_cancel(impl, e);
+		else
+			entry_schedule_arm(impl, e);
+	}
+	return 0;
+}
+
+static void do_remove_source(struct impl *impl, struct spa_source *source)
+{
+	struct entry *e;
+
+	if (source->fd != -1 && (e = find_entry(impl, source)) != NULL)
+		entry_remove(impl, e);
+}
+
+static int
+do_source_op(struct spa_loop *loop, bool async, uint32_t seq,
+	     const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	const struct source_op *op = data;
+
+	switch (op->cmd) {
+	case CMD_ADD:
+		return do_add_source(impl, op->source);
+	case CMD_UPDATE:
+		return do_update_source(impl, op->source);
+	case CMD_REMOVE:
+		do_remove_source(impl, op->source);
+		break;
+	}
+	return 0;
+}
+
+/* the submission queue can only be used from the loop thread. When
+ * sources are changed from another thread while the loop is running,
+ * invoke the change in the loop thread */
+static int source_op(struct impl *impl, struct spa_source *source, int cmd)
+{
+	struct source_op op = { source, cmd };
+
+	if (in_loop_thread(impl))
+		return do_source_op(&impl->loop, false, SPA_ID_INVALID, &op, sizeof(op), impl);
+
+	return spa_loop_invoke(&impl->loop, do_source_op, SPA_ID_INVALID, &op, sizeof(op), true, impl);
+}
+
+static int loop_add_source(struct spa_loop *loop, struct spa_source *source)
+{
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+
+	source->loop = loop;
+
+	return source_op(impl, source, CMD_ADD);
+}
+
+static int loop_update_source(struct spa_source *source)
+{
+	struct spa_loop *loop = source->loop;
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+
+	return source_op(impl, source, CMD_UPDATE);
+}
+
+static void loop_remove_source(struct spa_source *source)
+{
+	struct spa_loop *loop = source->loop;
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+
+	source_op(impl, source, CMD_REMOVE);
+
+	source->loop = NULL;
+}
+
+static int
+loop_invoke(struct spa_loop *loop,
+	    spa_invoke_func_t func,
+	    uint32_t seq,
+	    const void *data,
+	    size_t size,
+	    bool block,
+	    void *user_data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+	bool in_thread = pthread_equal(impl->thread, pthread_self());
+	struct invoke_completion completion;
+	bool wakeup;
+	int res;
+
+	if (in_thread) {
+		res = func(loop, false, seq, data, size, user_data);
+	} else {
+		if (block)
+			invoke_completion_init(&completion);
+
+		res = invoke_queue_push(&impl->queue, func, seq, data, size, user_data,
+					block ? &completion : NULL, &wakeup);
+		if (res == -EPIPE) {
+			spa_log_warn(impl->log, NAME " %p: queue full", impl);
+			return res;
+		}
+		else if (res < 0 && !block)
+			return res;
+
+		/* when the loop was already woken up for earlier items, it
+		 * will also pick up this one */
+		if (wakeup)
+			spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+
+		if (block) {
+			/* the hooks are for the thread that owns the loop lock,
+			 * calling them iterates the list with a cursor so don't
+			 * touch the list when nobody ever added hooks; several
+			 * threads might be waiting here at the same time */
+			bool hooks = impl->has_hooks;
+
+			if (hooks)
+				spa_loop_control_hook_before(&impl->hooks_list);
+
+			res = invoke_completion_wait(&completion);
+
+			if (hooks)
+				spa_loop_control_hook_after(&impl->hooks_list);
+		}
+		else if (seq != SPA_ID_INVALID)
+			res = SPA_RESULT_RETURN_ASYNC(seq);
+		else
+			res = 0;
+	}
+	return res;
+}
+
+/* write to an eventfd. From the loop thread this is queued in the ring
+ * and submitted together with the next wait */
+static void queue_write_event(struct impl *impl, int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (pthread_equal(impl->thread, pthread_self()) &&
+	    (sqe = ring_get_sqe(&impl->ring)) != NULL) {
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)&one;
+		sqe->len = sizeof(uint64_t);
+		sqe->off = -1;
+		sqe->user_data = entry_user_data(NULL, OP_IGNORE);
+		return;
+	}
+	if (write(fd, &one, sizeof(uint64_t)) != sizeof(uint64_t))
+		spa_log_warn(impl->log, NAME " %p: failed to write event fd %d: %s",
+				impl, fd, strerror(errno));
+}
+
+static void wakeup_func(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	invoke_queue_dispatch(&impl->queue, &impl->loop);
+}
+
+static void arm_entries(struct impl *impl);
+
+static int loop_get_fd(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+
+	/* the ring fd only becomes readable for operations that are
+	 * submitted, make sure everything is armed */
+	arm_entries(impl);
+	ring_submit(&impl->ring);
+
+	return impl->ring.fd;
+}
+
+static void
+loop_add_hooks(struct spa_loop_control *ctrl,
+	       struct spa_hook *hook,
+	       const struct spa_loop_control_hooks *hooks,
+	       void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+
+	spa_hook_list_append(&impl->hooks_list, hook, hooks, data);
+	impl->has_hooks = true;
+}
+
+static void loop_enter(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+	impl->thread = pthread_self();
+}
+
+static void loop_leave(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+
+	/* flush queued acks and arming operations */
+	ring_submit(&impl->ring);
+	impl->thread = 0;
+}
+
+static void process_destroy(struct impl *impl)
+{
+	struct source_impl *source, *tmp;
+	struct entry *e, *t;
+
+	spa_list_for_each_safe(e, t, &impl->entry_destroy_list, link) {
+		if (e->pending > 0)
+			continue;
+		spa_list_remove(&e->link);
+		if (e->allocated)
+			free(e);
+	}
+	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link) {
+		/* the entry is still referenced by the ring */
+		if (source->entry.pending > 0)
+			continue;
+		spa_list_remove(&source->link);
+		free(source);
+	}
+}
+
+static void arm_entries(struct impl *impl)
+{
+	struct entry *e, *t;
+
+	spa_list_for_each_safe(e, t, &impl->arm_list, arm_link) {
+		if (e->pending > 0)
+			continue;
+		if (entry_arm(impl, e) < 0)
+			break;
+		entry_unschedule_arm(e);
+	}
+}
+
+static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+	struct spa_loop *loop = &impl->loop;
+	struct ring *ring = &impl->ring;
+	struct spa_source *sources[MAX_EVENTS];
+	unsigned head, tail, min_complete;
+	int i, n, res;
+
+	arm_entries(impl);
+
+	/* don't wait when there are still completions from the previous
+	 * iteration */
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	min_complete = (head == tail && timeout != 0) ? 1 : 0;
+
+	spa_loop_control_hook_before(&impl->hooks_list);
+
+	res = ring_enter(ring, min_complete, timeout);
+
+	spa_loop_control_hook_after(&impl->hooks_list);
+
+	if (SPA_UNLIKELY(res < 0 && res != -EINTR && res != -EBUSY))
+		return -res;
+
+	/* first we set all the rmasks, then call the callbacks. The reason is that
+	 * some callback might also want to look at other sources it manages and
+	 * can then reset the rmask to suppress the callback */
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (n = 0, head = *ring->cq_head; head != tail && n < MAX_EVENTS; head++) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		struct entry *e = (struct entry *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+		uint32_t op = cqe->user_data & OP_MASK;
+		struct spa_source *s;
+
+		if (e == NULL || op == OP_IGNORE)
+			continue;
+
+		e->pending--;
+		if ((s = e->source) == NULL)
+			continue;
+
+		/* oneshot, rearm before the next wait */
+		entry_schedule_arm(impl, e);
+
+		if (cqe->res == -ECANCELED)
+			continue;
+
+		if (op == OP_READ) {
+			if (cqe->res != sizeof(uint64_t)) {
+				/* fall back to poll, the callback will then do the read */
+				spa_log_debug(impl->log, NAME " %p: read on fd %d failed %d, using poll",
+						impl, s->fd, cqe->res);
+				e->op = OP_POLL;
+				continue;
+			}
+			s->rmask = SPA_IO_IN;
+		}
+		else if (cqe->res < 0)
+			s->rmask = SPA_IO_ERR;
+		else
+			s->rmask = spa_poll_to_io(cqe->res);
+
+		sources[n++] = s;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	for (i = 0; i < n; i++) {
+		struct spa_source *s = sources[i];
+		if (s->rmask && s->fd != -1 && s->loop == loop)
+			s->func(s);
+	}
+	process_destroy(impl);
+
+	return 0;
+}
+
+static void source_io_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.io(source->data, source->fd, source->rmask);
+}
+
+static struct source_impl *alloc_source(struct impl *impl, spa_source_func_t func,
+					void *data, int fd, enum spa_io mask)
+{
+	struct source_impl *source;
+
+	source = calloc(1, sizeof(struct source_impl));
+	if (source == NULL)
+		return NULL;
+
+	source->source.loop = &impl->loop;
+	source->source.func = func;
+	source->source.data = data;
+	source->source.fd = fd;
+	source->source.mask = mask;
+	source->impl = impl;
+	source->close = true;
+
+	return source;
+}
+
+struct add_source_impl {
+	struct source_impl *source;
+	uint32_t op;
+};
+
+/* sources allocated by us have room for the entry, there is no need to
+ * allocate and look it up */
+static int do_add_source_impl(struct spa_loop *loop, bool async, uint32_t seq,
+			      const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	const struct add_source_impl *d = data;
+
+	if (d->source->source.fd != -1)
+		entry_add(impl, &d->source->entry, &d->source->source, d->op);
+	return 0;
+}
+
+/* event and timer fds are added with OP_READ, the ring then reads the
+ * counter for us and saves a read syscall per wakeup */
+static void add_source_impl(struct impl *impl, struct source_impl *source, uint32_t op)
+{
+	struct add_source_impl d = { source, op };
+
+	if (in_loop_thread(impl))
+		do_add_source_impl(&impl->loop, false, SPA_ID_INVALID, &d, sizeof(d), impl);
+	else
+		spa_loop_invoke(&impl->loop, do_add_source_impl, SPA_ID_INVALID,
+				&d, sizeof(d), true, impl);
+
+	spa_list_insert(&impl->source_list, &source->link);
+}
+
+static struct spa_source *loop_add_io(struct spa_loop_utils *utils,
+				      int fd,
+				      enum spa_io mask,
+				      bool close, spa_source_io_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	source = alloc_source(impl, source_io_func, data, fd, mask);
+	if (source == NULL)
+		return NULL;
+
+	source->close = close;
+	source->func.io = func;
+
+	add_source_impl(impl, source, OP_POLL);
+
+	return &source->source;
+}
+
+static int loop_update_io(struct spa_source *source, enum spa_io mask)
+{
+	source->mask = mask;
+	return spa_loop_update_source(source->loop, source);
+}
+
+
+static void source_idle_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.idle(source->data);
+}
+
+static struct spa_source *loop_add_idle(struct spa_loop_utils *utils,
+					bool enabled, spa_source_idle_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	source = alloc_source(impl, source_idle_func, data,
+			      eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), SPA_IO_IN);
+	if (source == NULL)
+		return NULL;
+
+	source->func.idle = func;
+
+	add_source_impl(impl, source, OP_POLL);
+
+	if (enabled)
+		spa_loop_utils_enable_idle(&impl->utils, &source->source, true);
+
+	return &source->source;
+}
+
+static void loop_enable_idle(struct spa_source *source, bool enabled)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t count;
+
+	if (enabled && !impl->enabled) {
+		count = 1;
+		if (write(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+			spa_log_warn(impl->impl->log, NAME " %p: failed to write idle fd %d: %s",
+					source, source->fd, strerror(errno));
+	} else if (!enabled && impl->enabled) {
+		if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+			spa_log_warn(impl->impl->log, NAME " %p: failed to read idle fd %d: %s",
+					source, source->fd, strerror(errno));
+	}
+	impl->enabled = enabled;
+}
+
+static void source_event_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t count;
+
+	if (impl->entry.op == OP_READ)
+		count = impl->entry.count;
+	else if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t)) {
+		spa_log_warn(impl->impl->log, NAME " %p: failed to read event fd %d: %s",
+				source, source->fd, strerror(errno));
+		return;
+	}
+
+	impl->func.event(source->data, count);
+}
+
+static struct spa_source *loop_add_event(struct spa_loop_utils *utils,
+					 spa_source_event_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	/* not nonblocking, the ring would complete the read with -EAGAIN
+	 * instead of waiting for the counter */
+	source = alloc_source(impl, source_event_func, data,
+			      eventfd(0, EFD_CLOEXEC), SPA_IO_IN);
+	if (source == NULL)
+		return NULL;
+
+	source->func.event = func;
+
+	add_source_impl(impl, source, OP_READ);
+
+	return &source->source;
+}
+
+static void loop_signal_event(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	queue_write_event(impl->impl, source->fd);
+}
+
+static void source_timer_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t expirations;
+
+	if (impl->entry.op == OP_READ)
+		expirations = impl->entry.count;
+	else if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t)) {
+		spa_log_warn(impl->impl->log, NAME " %p: failed to read timer fd %d: %s",
+				source, source->fd, strerror(errno));
+		return;
+	}
+
+	impl->func.timer(source->data, expirations);
+}
+
+static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
+					 spa_source_timer_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	source = alloc_source(impl, source_timer_func, data,
+			      timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC), SPA_IO_IN);
+	if (source == NULL)
+		return NULL;
+
+	source->func.timer = func;
+
+	add_source_impl(impl, source, OP_READ);
+
+	return &source->source;
+}
+
+static int
+loop_update_timer(struct spa_source *source,
+		  struct timespec *value, struct timespec *interval, bool absolute)
+{
+	struct itimerspec its;
+	int flags = 0;
+
+	spa_zero(its);
+	if (value) {
+		its.it_value = *value;
+	} else if (interval) {
+		its.it_value = *interval;
+		absolute = true;
+	}
+	if (interval)
+		its.it_interval = *interval;
+	if (absolute)
+		flags |= TFD_TIMER_ABSTIME;
+
+	if (timerfd_settime(source->fd, flags, &its, NULL) < 0)
+		return errno;
+
+	return 0;
+}
+
+static void source_signal_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct signalfd_siginfo signal_info;
+	int len;
+
+	len = read(source->fd, &signal_info, sizeof signal_info);
+	if (!(len == -1 && errno == EAGAIN) && len != sizeof signal_info)
+		spa_log_warn(impl->impl->log, NAME " %p: failed to read signal fd %d: %s",
+				source, source->fd, strerror(errno));
+
+	impl->func.signal(source->data, impl->signal_number);
+}
+
+static struct spa_source *loop_add_signal(struct spa_loop_utils *utils,
+					  int signal_number,
+					  spa_source_signal_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, signal_number);
+
+	source = alloc_source(impl, source_signal_func, data,
+			      signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK), SPA_IO_IN);
+	if (source == NULL)
+		return NULL;
+
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	source->func.signal = func;
+	source->signal_number = signal_number;
+
+	add_source_impl(impl, source, OP_POLL);
+
+	return &source->source;
+}
+
+static void loop_destroy_source(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	spa_list_remove(&impl->link);
+
+	if (source->loop) {
+		if (source->fd != -1)
+			entry_remove(impl->impl, &impl->entry);
+		source->loop = NULL;
+	}
+
+	if (source->fd != -1 && impl->close) {
+		close(source->fd);
+		source->fd = -1;
+	}
+	spa_list_insert(&impl->impl->destroy_list, &impl->link);
+}
+
+static const struct spa_loop impl_loop = {
+	SPA_VERSION_LOOP,
+	loop_add_source,
+	loop_update_source,
+	loop_remove_source,
+	loop_invoke,
+};
+
+static const struct spa_loop_control impl_loop_control = {
+	SPA_VERSION_LOOP_CONTROL,
+	loop_get_fd,
+	loop_add_hooks,
+	loop_enter,
+	loop_leave,
+	loop_iterate,
+};
+
+static const struct spa_loop_utils impl_loop_utils = {
+	SPA_VERSION_LOOP_UTILS,
+	loop_add_io,
+	loop_update_io,
+	loop_add_idle,
+	loop_enable_idle,
+	loop_add_event,
+	loop_signal_event,
+	loop_add_timer,
+	loop_update_timer,
+	loop_add_signal,
+	loop_destroy_source,
+};
+
+static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id, void **interface)
+{
+	struct impl *impl;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+	spa_return_val_if_fail(interface != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	if (interface_id == impl->type.loop)
+		*interface = &impl->loop;
+	else if (interface_id == impl->type.loop_control)
+		*interface = &impl->control;
+	else if (interface_id == impl->type.loop_utils)
+		*interface = &impl->utils;
+	else
+		return -ENOENT;
+
+	return 0;
+}
+
+static int impl_clear(struct spa_handle *handle)
+{
+	struct impl *impl;
+	struct source_impl *source, *tmp;
+	struct entry *e, *t;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	spa_list_for_each_safe(source, tmp, &impl->source_list, link)
+		loop_destroy_source(&source->source);
+	spa_list_for_each_safe(e, t, &impl->entry_list, link)
+		entry_remove(impl, e);
+
+	/* closing the ring cancels everything that is still pending, after
+	 * that nothing references the entries anymore */
+	ring_clear(&impl->ring);
+
+	spa_list_for_each(e, &impl->entry_destroy_list, link)
+		e->pending = 0;
+	spa_list_for_each(source, &impl->destroy_list, link)
+		source->entry.pending = 0;
+
+	process_destroy(impl);
+
+	invoke_queue_clear(&impl->queue);
+
+	return 0;
+}
+
+static int
+impl_init(const struct spa_handle_factory *factory,
+	  struct spa_handle *handle,
+	  const struct spa_dict *info,
+	  const struct spa_support *support,
+	  uint32_t n_support)
+{
+	struct impl *impl;
+	uint32_t i;
+	int res;
+
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	handle->get_interface = impl_get_interface;
+	handle->clear = impl_clear;
+
+	impl = (struct impl *) handle;
+	impl->loop = impl_loop;
+	impl->control = impl_loop_control;
+	impl->utils = impl_loop_utils;
+
+	for (i = 0; i < n_support; i++) {
+		if (strcmp(support[i].type, SPA_TYPE__TypeMap) == 0)
+			impl->map = support[i].data;
+		else if (strcmp(support[i].type, SPA_TYPE__Log) == 0)
+			impl->log = support[i].data;
+	}
+	if (impl->map == NULL) {
+		spa_log_error(impl->log, NAME " %p: a type-map is needed", impl);
+		return -EINVAL;
+	}
+	init_type(&impl->type, impl->map);
+
+	if ((res = ring_setup(&impl->ring, RING_ENTRIES)) < 0) {
+		spa_log_info(impl->log, NAME " %p: can't setup io_uring: %s",
+				impl, strerror(-res));
+		return res;
+	}
+
+	spa_list_init(&impl->source_list);
+	spa_list_init(&impl->destroy_list);
+	spa_list_init(&impl->entry_list);
+	spa_list_init(&impl->entry_destroy_list);
+	spa_list_init(&impl->arm_list);
+	spa_hook_list_init(&impl->hooks_list);
+
+	invoke_queue_init(&impl->queue);
+
+	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
+
+	spa_log_debug(impl->log, NAME " %p: initialized", impl);
+
+	return 0;
+}
+
+static const struct spa_interface_info impl_interfaces[] = {
+	{SPA_TYPE__Loop,},
+	{SPA_TYPE__LoopControl,},
+	{SPA_TYPE__LoopUtils,},
+};
+
+static int
+impl_enum_interface_info(const struct spa_handle_factory *factory,
+			 const struct spa_interface_info **info,
+			 uint32_t *index)
+{
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(info != NULL, -EINVAL);
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+
+	if (*index >= SPA_N_ELEMENTS(impl_interfaces))
+		return 0;
+
+	*info = &impl_interfaces[(*index)++];
+	return 1;
+}
+
+static const struct spa_handle_factory loop_uring_factory = {
+	SPA_VERSION_HANDLE_FACTORY,
+	NAME,
+	NULL,
+	sizeof(struct impl),
+	impl_init,
+	impl_enum_interface_info
+};
+
+int spa_handle_factory_register(const struct spa_handle_factory *factory);
+
+static void reg(void) __attribute__ ((constructor));
+static void reg(void)
+{
+	spa_handle_factory_register(&loop_uring_factory);
+}
@@ -34,25 +34,13 @@
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
 #include <spa/utils/list.h>
-#include <spa/utils/ringbuffer.h>
 
-#define NAME "loop"
+#include "invoke-queue.h"
 
-#define DATAS_SIZE (4096 * 8)
+#define NAME "loop"
 
 /** \cond */
 
-struct invoke_item {
-	size_t item_size;
-	spa_invoke_func_t func;
-	uint32_t seq;
-	void *data;
-	size_t size;
-	bool block;
-	void *user_data;
-	int res;
-};
-
 struct type {
 	uint32_t loop;
 	uint32_t loop_control;
@@ -81,15 +69,14 @@ struct impl {
 	struct spa_list source_list;
 	struct spa_list destroy_list;
 	struct spa_hook_list hooks_list;
+	bool has_hooks;
 
 	int epoll_fd;
 	pthread_t thread;
 
 	struct spa_source *wakeup;
-	int ack_fd;
 
-	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	struct invoke_queue queue;
 };
 
 struct source_impl {
@@ -202,70 +189,49 @@ loop_invoke(struct spa_loop *loop,
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
-	struct invoke_item *item;
+	struct invoke_completion completion;
+	bool wakeup;
 	int res;
 
 	if (in_thread) {
 		res = func(loop, false, seq, data, size, user_data);
 	} else {
-		int32_t filled, avail;
-		uint32_t idx, offset, l0;
-
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
-			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
+		if (block)
+			invoke_completion_init(&completion);
+
+		res = invoke_queue_push(&impl->queue, func, seq, data, size, user_data,
+					block ? &completion : NULL, &wakeup);
+		if (res == -EPIPE) {
+			spa_log_warn(impl->log, NAME " %p: queue full", impl);
+			return res;
 		}
-		offset = idx & (DATAS_SIZE - 1);
-
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
-		item->func = func;
-		item->seq = seq;
-		item->size = size;
-		item->block = block;
-		item->user_data = user_data;
-
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
-		memcpy(item->data, data, size);
-
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
+		else if (res < 0 && !block)
+			return res;
 
-		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+		/* when the loop was already woken up for earlier items, it
+		 * will also pick up this one */
+		if (wakeup)
+			spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
 
 		if (block) {
-			uint64_t count = 1;
-
-			spa_loop_control_hook_before(&impl->hooks_list);
+			/* the hooks are for the thread that owns the loop lock,
+			 * calling them iterates the list with a cursor so don't
+			 * touch the list when nobody ever added hooks; several
+			 * threads might be waiting here at the same time */
+			bool hooks = impl->has_hooks;
 
-			if (read(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, strerror(errno));
+			if (hooks)
+				spa_loop_control_hook_before(&impl->hooks_list);
 
-			spa_loop_control_hook_after(&impl->hooks_list);
+			res = invoke_completion_wait(&completion);
 
-			res = item->res;
-		}
-		else {
-			if (seq != SPA_ID_INVALID)
-				res = SPA_RESULT_RETURN_ASYNC(seq);
-			else
-				res = 0;
+			if (hooks)
+				spa_loop_control_hook_after(&impl->hooks_list);
 		}
+		else if (seq != SPA_ID_INVALID)
+			res = SPA_RESULT_RETURN_ASYNC(seq);
+		else
+			res = 0;
 	}
 	return res;
 }
@@ -273,21 +239,7 @@ loop_invoke(struct spa_loop *loop,
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
-	uint32_t index;
-	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
-		struct invoke_item *item =
-		    SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		item->res = item->func(&impl->loop, true, item->seq, item->data, item->size,
-			   item->user_data);
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
-
-		if (item->block) {
-			uint64_t count = 1;
-			if (write(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, strerror(errno));
-		}
-	}
+	invoke_queue_dispatch(&impl->queue, &impl->loop);
 }
 
 static int loop_get_fd(struct spa_loop_control *ctrl)
@@ -306,6 +258,7 @@ loop_add_hooks(struct spa_loop_control *ctrl,
 	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
 
 	spa_hook_list_append(&impl->hooks_list, hook, hooks, data);
+	impl->has_hooks = true;
 }
 
 static void loop_enter(struct spa_loop_control *ctrl)
@@ -697,7 +650,7 @@ static int impl_clear(struct spa_handle *handle)
 
 	process_destroy(impl);
 
-	close(impl->ack_fd);
+	invoke_queue_clear(&impl->queue);
 	close(impl->epoll_fd);
 
 	return 0;
@@ -744,10 +697,9 @@ impl_init(const struct spa_handle_factory *factory,
 	spa_list_init(&impl->destroy_list);
 	spa_hook_list_init(&impl->hooks_list);
 
-	spa_ringbuffer_init(&impl->buffer);
+	invoke_queue_init(&impl->queue);
 
 	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
-	impl->ack_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
 
 	spa_log_debug(impl->log, NAME " %p: initialized", impl);
 
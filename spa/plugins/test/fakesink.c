@@ -119,6 +119,7 @@ struct impl {
 
 	uint64_t buffer_count;
 	struct spa_list ready;
+	bool underrun;
 };
 
 #define CHECK_PORT(this,d,p)  ((d) == SPA_DIRECTION_INPUT && (p) < MAX_PORTS)
@@ -252,10 +253,17 @@ static int consume_buffer(struct impl *this)
 
 	if (spa_list_is_empty(&this->ready)) {
 		io->status = SPA_STATUS_NEED_BUFFER;
-		if (this->callbacks->need_input)
+		if (this->callbacks && this->callbacks->need_input)
 			this->callbacks->need_input(this->callbacks_data);
 	}
 	if (spa_list_is_empty(&this->ready)) {
+		if (this->callbacks && this->callbacks->need_input) {
+			/* async upstream, the timer is restarted from
+			 * process_input when the buffer arrives */
+			spa_log_trace(this->log, NAME " %p: underrun", this);
+			this->underrun = true;
+			return SPA_STATUS_NEED_BUFFER;
+		}
 		spa_log_error(this->log, NAME " %p: no buffers", this);
 		return -EPIPE;
 	}
@@ -324,6 +332,7 @@ static int impl_node_send_command(struct spa_node *node, const struct spa_comman
 			this->start_time = 0;
 		this->buffer_count = 0;
 		this->elapsed_time = 0;
+		this->underrun = false;
 
 		this->started = true;
 		set_timer(this, true);
@@ -439,7 +448,16 @@ static int port_enum_formats(struct spa_node *node,
 			     struct spa_pod **param,
 			     struct spa_pod_builder *builder)
 {
-	return 0;
+	struct impl *this = SPA_CONTAINER_OF(node, struct impl, node);
+
+	/* we accept anything, once configured only the current format
+	 * is offered so that it can be negotiated with a peer */
+	if (!this->have_format || *index > 0)
+		return 0;
+
+	*param = SPA_MEMBER(this->format_buffer, 0, struct spa_pod);
+
+	return 1;
 }
 
 static int port_get_format(struct spa_node *node,
@@ -733,8 +751,12 @@ static int impl_node_process_input(struct spa_node *node)
 	}
 	if (this->callbacks == NULL || this->callbacks->need_input == NULL)
 		return consume_buffer(this);
-	else
-		return SPA_STATUS_OK;
+
+	if (this->underrun && !spa_list_is_empty(&this->ready)) {
+		this->underrun = false;
+		set_timer(this, true);
+	}
+	return SPA_STATUS_OK;
 }
 
 static int impl_node_process_output(struct spa_node *node)
@@ -18,6 +18,11 @@
  */
 
 #include <errno.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 typedef enum {
 	GRAY = 0,
@@ -67,14 +72,19 @@ static Pixel colors[N_COLORS] = {
 
 typedef struct _DrawingData DrawingData;
 
-typedef void (*DrawPixelFunc) (DrawingData * dd, int x, Pixel * pixel);
+typedef void (*DrawSpanFunc) (DrawingData * dd, int x, int length, const Pixel * color);
+typedef void (*DrawSnowFunc) (DrawingData * dd, int x, int length);
 
 struct _DrawingData {
-	char *line;
+	struct impl *impl;
+	uint8_t *planes[MAX_PLANES];	/* first line of the planes */
+	uint8_t *lines[MAX_PLANES];	/* current line of the planes */
+	int strides[MAX_PLANES];
+	int n_planes;
 	int width;
 	int height;
-	int stride;
-	DrawPixelFunc draw_pixel;
+	DrawSpanFunc draw_span;
+	DrawSnowFunc draw_snow;
 };
 
 static inline void update_yuv(Pixel * pixel)
@@ -110,151 +120,450 @@ static void init_colors(void)
 	}
 }
 
-static void draw_pixel_rgb(DrawingData * dd, int x, Pixel * color)
+/* fill n bytes of dst with a repeating pattern of size bytes, size must
+ * be a divisor of 48 */
+static void fill_pattern(uint8_t *dst, const uint8_t *pattern, int size, int n)
+{
+	uint8_t block[48];
+	int i;
+
+	if (size == 1) {
+		memset(dst, pattern[0], n);
+		return;
+	}
+	for (i = 0; i < 48; i++)
+		block[i] = pattern[i % size];
+
+#if defined(__SSE2__)
+	{
+		__m128i b0 = _mm_loadu_si128((__m128i*)&block[0]);
+		__m128i b1 = _mm_loadu_si128((__m128i*)&block[16]);
+		__m128i b2 = _mm_loadu_si128((__m128i*)&block[32]);
+
+		for (; n >= 48; n -= 48, dst += 48) {
+			_mm_storeu_si128((__m128i*)&dst[0], b0);
+			_mm_storeu_si128((__m128i*)&dst[16], b1);
+			_mm_storeu_si128((__m128i*)&dst[32], b2);
+		}
+	}
+#else
+	for (; n >= 48; n -= 48, dst += 48)
+		memcpy(dst, block, 48);
+#endif
+	memcpy(dst, block, n);
+}
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* fill n bytes of dst with random values */
+static void random_bytes(DrawingData * dd, uint8_t *dst, int n)
+{
+	uint32_t *seed = dd->impl->seed, x;
+
+#if defined(__SSE2__)
+	{
+		/* 4 xorshift32 generators in parallel */
+		__m128i s = _mm_loadu_si128((__m128i*)seed);
+
+		for (; n >= 16; n -= 16, dst += 16) {
+			s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+			s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+			s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+			_mm_storeu_si128((__m128i*)dst, s);
+		}
+		_mm_storeu_si128((__m128i*)seed, s);
+	}
+#endif
+	for (; n >= 4; n -= 4, dst += 4) {
+		x = xorshift32(&seed[0]);
+		memcpy(dst, &x, 4);
+	}
+	if (n > 0) {
+		x = xorshift32(&seed[0]);
+		memcpy(dst, &x, n);
+	}
+}
+
+/* set the bytes at offset, offset + 2, ... of dst to 128 */
+static void set_neutral_chroma(uint8_t *dst, int offset, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	{
+		const __m128i keep = _mm_set1_epi16(offset ? 0x00ff : 0xff00);
+		const __m128i chroma = _mm_set1_epi16(offset ? 0x8000 : 0x0080);
+		__m128i v;
+
+		for (; i + 16 <= n; i += 16) {
+			v = _mm_loadu_si128((__m128i*)&dst[i]);
+			v = _mm_or_si128(_mm_and_si128(v, keep), chroma);
+			_mm_storeu_si128((__m128i*)&dst[i], v);
+		}
+	}
+#endif
+	for (i += offset; i < n; i += 2)
+		dst[i] = 128;
+}
+
+static void draw_span_rgb(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	uint8_t p[3] = { color->R, color->G, color->B };
+	fill_pattern(dd->lines[0] + 3 * x, p, 3, 3 * length);
+}
+
+static void draw_span_bgrx(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	uint8_t p[4] = { color->B, color->G, color->R, 0xff };
+	fill_pattern(dd->lines[0] + 4 * x, p, 4, 4 * length);
+}
+
+/* draw a 4:2:2 packed span, p is a macro pixel with the luma samples at
+ * byte y0 and y1 and the chroma samples at byte c0 and c1 */
+static inline void draw_span_422(DrawingData * dd, int x, int length, const uint8_t *p,
+				 int y0, int y1, int c0, int c1)
+{
+	uint8_t *line = dd->lines[0];
+
+	if (length <= 0)
+		return;
+	if (x & 1) {
+		/* odd pixel */
+		line[2 * x - 2 + y1] = p[y1];
+		x++;
+		length--;
+	}
+	fill_pattern(line + 2 * x, p, 4, 4 * (length / 2));
+	if (length & 1) {
+		/* even pixel */
+		line += 2 * (x + length - 1);
+		line[y0] = p[y0];
+		line[c0] = p[c0];
+		line[c1] = p[c1];
+	}
+}
+
+static void draw_span_uyvy(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	uint8_t p[4] = { color->U, color->Y, color->V, color->Y };
+	draw_span_422(dd, x, length, p, 1, 3, 0, 2);
+}
+
+static void draw_span_yuy2(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	uint8_t p[4] = { color->Y, color->U, color->Y, color->V };
+	draw_span_422(dd, x, length, p, 0, 2, 1, 3);
+}
+
+static void draw_span_nv12(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	uint8_t p[2] = { color->U, color->V };
+	int cx = x / 2, cend = (x + length + 1) / 2;
+
+	memset(dd->lines[0] + x, color->Y, length);
+	fill_pattern(dd->lines[1] + 2 * cx, p, 2, 2 * (cend - cx));
+}
+
+static void draw_span_i420(DrawingData * dd, int x, int length, const Pixel * color)
+{
+	int cx = x / 2, cend = (x + length + 1) / 2;
+
+	memset(dd->lines[0] + x, color->Y, length);
+	memset(dd->lines[1] + cx, color->U, cend - cx);
+	memset(dd->lines[2] + cx, color->V, cend - cx);
+}
+
+#define SNOW_BLOCK	256
+
+static void draw_snow_rgb(DrawingData * dd, int x, int length)
+{
+	uint8_t rnd[SNOW_BLOCK], *d = dd->lines[0] + 3 * x;
+	int i, n;
+
+	for (; length > 0; length -= n) {
+		n = SPA_MIN(length, SNOW_BLOCK);
+		random_bytes(dd, rnd, n);
+		for (i = 0; i < n; i++, d += 3)
+			d[0] = d[1] = d[2] = rnd[i];
+	}
+}
+
+static void draw_snow_bgrx(DrawingData * dd, int x, int length)
 {
-	dd->line[3 * x + 0] = color->R;
-	dd->line[3 * x + 1] = color->G;
-	dd->line[3 * x + 2] = color->B;
+	uint8_t rnd[SNOW_BLOCK], *d = dd->lines[0] + 4 * x;
+	int i, n;
+
+	for (; length > 0; length -= n) {
+		n = SPA_MIN(length, SNOW_BLOCK);
+		random_bytes(dd, rnd, n);
+		for (i = 0; i < n; i++, d += 4) {
+			d[0] = d[1] = d[2] = rnd[i];
+			d[3] = 0xff;
+		}
+	}
 }
 
-static void draw_pixel_uyvy(DrawingData * dd, int x, Pixel * color)
+/* gray snow has neutral chroma, fill the macro pixels with random values
+ * and then reset the chroma bytes */
+static inline void draw_snow_422(DrawingData * dd, int x, int length,
+				 int y0, int y1, int c0, int c1)
 {
+	uint8_t *line = dd->lines[0];
+	int n_pairs;
+
+	if (length <= 0)
+		return;
 	if (x & 1) {
 		/* odd pixel */
-		dd->line[2 * (x - 1) + 3] = color->Y;
-	} else {
+		random_bytes(dd, &line[2 * x - 2 + y1], 1);
+		x++;
+		length--;
+	}
+	n_pairs = length / 2;
+	line += 2 * x;
+	random_bytes(dd, line, 4 * n_pairs);
+	set_neutral_chroma(line, c0 & 1, 4 * n_pairs);
+	if (length & 1) {
 		/* even pixel */
-		dd->line[2 * x + 0] = color->U;
-		dd->line[2 * x + 1] = color->Y;
-		dd->line[2 * x + 2] = color->V;
+		line += 4 * n_pairs;
+		random_bytes(dd, &line[y0], 1);
+		line[c0] = line[c1] = 128;
+	}
+}
+
+static void draw_snow_uyvy(DrawingData * dd, int x, int length)
+{
+	draw_snow_422(dd, x, length, 1, 3, 0, 2);
+}
+
+static void draw_snow_yuy2(DrawingData * dd, int x, int length)
+{
+	draw_snow_422(dd, x, length, 0, 2, 1, 3);
+}
+
+static void draw_snow_nv12(DrawingData * dd, int x, int length)
+{
+	int cx = x / 2, cend = (x + length + 1) / 2;
+
+	random_bytes(dd, dd->lines[0] + x, length);
+	memset(dd->lines[1] + 2 * cx, 128, 2 * (cend - cx));
+}
+
+static void draw_snow_i420(DrawingData * dd, int x, int length)
+{
+	int cx = x / 2, cend = (x + length + 1) / 2;
+
+	random_bytes(dd, dd->lines[0] + x, length);
+	memset(dd->lines[1] + cx, 128, cend - cx);
+	memset(dd->lines[2] + cx, 128, cend - cx);
+}
+
+static const struct draw_funcs {
+	DrawSpanFunc draw_span;
+	DrawSnowFunc draw_snow;
+} draw_funcs[] = {
+	[DRAW_FORMAT_RGB] = { draw_span_rgb, draw_snow_rgb },
+	[DRAW_FORMAT_BGRx] = { draw_span_bgrx, draw_snow_bgrx },
+	[DRAW_FORMAT_UYVY] = { draw_span_uyvy, draw_snow_uyvy },
+	[DRAW_FORMAT_YUY2] = { draw_span_yuy2, draw_snow_yuy2 },
+	[DRAW_FORMAT_NV12] = { draw_span_nv12, draw_snow_nv12 },
+	[DRAW_FORMAT_I420] = { draw_span_i420, draw_snow_i420 },
+};
+
+/* compute the layout of the planes for format, this is only changed when
+ * the format is supported */
+static int drawing_setup(struct impl *this, const struct spa_video_info_raw *info)
+{
+	struct spa_type_video_format *vf = &this->type.video_format;
+	int i, width = info->size.width, height = info->size.height;
+	int heights[MAX_PLANES], strides[MAX_PLANES], n_planes = 1;
+	uint32_t draw_format;
+	size_t size;
+
+	if (width <= 0 || height <= 0)
+		return -EINVAL;
+
+	heights[0] = height;
+	heights[1] = heights[2] = (height + 1) / 2;
+
+	if (info->format == vf->RGB) {
+		draw_format = DRAW_FORMAT_RGB;
+		strides[0] = SPA_ROUND_UP_N(3 * width, 4);
+	} else if (info->format == vf->BGRx) {
+		draw_format = DRAW_FORMAT_BGRx;
+		strides[0] = 4 * width;
+	} else if (info->format == vf->UYVY) {
+		draw_format = DRAW_FORMAT_UYVY;
+		strides[0] = SPA_ROUND_UP_N(2 * width, 4);
+	} else if (info->format == vf->YUY2) {
+		draw_format = DRAW_FORMAT_YUY2;
+		strides[0] = SPA_ROUND_UP_N(2 * width, 4);
+	} else if (info->format == vf->NV12) {
+		draw_format = DRAW_FORMAT_NV12;
+		n_planes = 2;
+		strides[0] = SPA_ROUND_UP_N(width, 4);
+		strides[1] = strides[0];
+	} else if (info->format == vf->I420) {
+		draw_format = DRAW_FORMAT_I420;
+		n_planes = 3;
+		strides[0] = SPA_ROUND_UP_N(width, 4);
+		strides[1] = SPA_ROUND_UP_N((width + 1) / 2, 4);
+		strides[2] = strides[1];
+	} else
+		return -EINVAL;
+
+	this->draw_format = draw_format;
+	this->n_planes = n_planes;
+	size = 0;
+	for (i = 0; i < n_planes; i++) {
+		this->offsets[i] = size;
+		this->strides[i] = strides[i];
+		size += strides[i] * heights[i];
 	}
+	this->size = size;
+	this->stride = strides[0];
+
+	return 0;
 }
 
 static int drawing_data_init(DrawingData * dd, struct impl *this, char *data)
 {
 	struct spa_video_info *format = &this->current_format;
 	struct spa_rectangle *size = &format->info.raw.size;
+	int i;
 
 	if ((format->media_type != this->type.media_type.video) ||
 	    (format->media_subtype != this->type.media_subtype.raw))
 		return -ENOTSUP;
 
-	if (format->info.raw.format == this->type.video_format.RGB) {
-		dd->draw_pixel = draw_pixel_rgb;
-	} else if (format->info.raw.format == this->type.video_format.UYVY) {
-		dd->draw_pixel = draw_pixel_uyvy;
-	} else
-		return -ENOTSUP;
-
-	dd->line = data;
+	dd->impl = this;
+	dd->draw_span = draw_funcs[this->draw_format].draw_span;
+	dd->draw_snow = draw_funcs[this->draw_format].draw_snow;
+	dd->n_planes = this->n_planes;
+	for (i = 0; i < dd->n_planes; i++) {
+		dd->planes[i] = (uint8_t *) data + this->offsets[i];
+		dd->strides[i] = this->strides[i];
+	}
 	dd->width = size->width;
 	dd->height = size->height;
-	dd->stride = this->stride;
 
 	return 0;
 }
 
-static inline void draw_pixels(DrawingData * dd, int offset, Color color, int length)
+static inline void set_line(DrawingData * dd, int y)
 {
-	int x;
+	int i;
 
-	for (x = offset; x < offset + length; x++) {
-		dd->draw_pixel(dd, x, &colors[color]);
-	}
+	dd->lines[0] = dd->planes[0] + y * dd->strides[0];
+	/* the chroma planes are subsampled vertically */
+	for (i = 1; i < dd->n_planes; i++)
+		dd->lines[i] = dd->planes[i] + (y / 2) * dd->strides[i];
 }
 
-static inline void next_line(DrawingData * dd)
+/* copy line from to the lines [start, end) */
+static void replicate_line(DrawingData * dd, int from, int start, int end)
 {
-	dd->line += dd->stride;
+	uint8_t *src, *dst;
+	int i, y;
+
+	src = dd->planes[0] + from * dd->strides[0];
+	for (y = start; y < end; y++) {
+		dst = dd->planes[0] + y * dd->strides[0];
+		memcpy(dst, src, dd->strides[0]);
+	}
+	for (i = 1; i < dd->n_planes; i++) {
+		src = dd->planes[i] + (from / 2) * dd->strides[i];
+		for (y = SPA_ROUND_UP_N(start, 2); y < end; y += 2) {
+			dst = dd->planes[i] + (y / 2) * dd->strides[i];
+			if (dst != src)
+				memcpy(dst, src, dd->strides[i]);
+		}
+	}
 }
 
 static void draw_smpte_snow(DrawingData * dd)
 {
 	int h, w;
 	int y1, y2;
-	int i, j;
+	int i, j, x;
 
 	w = dd->width;
 	h = dd->height;
 	y1 = 2 * h / 3;
 	y2 = 3 * h / 4;
 
-	for (i = 0; i < y1; i++) {
+	/* draw the first line of each band and copy it to the other lines */
+	if (y1 > 0) {
+		set_line(dd, 0);
 		for (j = 0; j < 7; j++) {
 			int x1 = j * w / 7;
 			int x2 = (j + 1) * w / 7;
-			draw_pixels(dd, x1, j, x2 - x1);
+			dd->draw_span(dd, x1, x2 - x1, &colors[j]);
 		}
-		next_line(dd);
+		replicate_line(dd, 0, 1, y1);
 	}
 
-	for (i = y1; i < y2; i++) {
+	if (y2 > y1) {
+		set_line(dd, y1);
 		for (j = 0; j < 7; j++) {
 			int x1 = j * w / 7;
 			int x2 = (j + 1) * w / 7;
 			Color c = (j & 1) ? BLACK : BLUE - j;
 
-			draw_pixels(dd, x1, c, x2 - x1);
+			dd->draw_span(dd, x1, x2 - x1, &colors[c]);
 		}
-		next_line(dd);
+		replicate_line(dd, y1, y1 + 1, y2);
 	}
 
-	for (i = y2; i < h; i++) {
-		int x = 0;
+	if (h > y2) {
+		set_line(dd, y2);
+		x = 0;
 
 		/* negative I */
-		draw_pixels(dd, x, NEG_I, w / 6);
+		dd->draw_span(dd, x, w / 6, &colors[NEG_I]);
 		x += w / 6;
 
 		/* white */
-		draw_pixels(dd, x, WHITE, w / 6);
+		dd->draw_span(dd, x, w / 6, &colors[WHITE]);
 		x += w / 6;
 
 		/* positive Q */
-		draw_pixels(dd, x, POS_Q, w / 6);
+		dd->draw_span(dd, x, w / 6, &colors[POS_Q]);
 		x += w / 6;
 
 		/* pluge */
-		draw_pixels(dd, x, DARK_BLACK, w / 12);
+		dd->draw_span(dd, x, w / 12, &colors[DARK_BLACK]);
 		x += w / 12;
-		draw_pixels(dd, x, BLACK, w / 12);
+		dd->draw_span(dd, x, w / 12, &colors[BLACK]);
 		x += w / 12;
-		draw_pixels(dd, x, LIGHT_BLACK, w / 12);
+		dd->draw_span(dd, x, w / 12, &colors[LIGHT_BLACK]);
 		x += w / 12;
 
+		replicate_line(dd, y2, y2 + 1, h);
+
 		/* war of the ants (a.k.a. snow) */
-		for (j = x; j < w; j++) {
-			Pixel p;
-			unsigned char r = rand();
-
-			p.R = r;
-			p.G = r;
-			p.B = r;
-			update_yuv(&p);
-			dd->draw_pixel(dd, j, &p);
+		for (i = y2; i < h; i++) {
+			set_line(dd, i);
+			dd->draw_snow(dd, x, w - x);
 		}
-
-		next_line(dd);
 	}
 }
 
 static void draw_snow(DrawingData * dd)
 {
-	int x, y;
+	int y;
 
 	for (y = 0; y < dd->height; y++) {
-		for (x = 0; x < dd->width; x++) {
-			Pixel p;
-			unsigned char r = rand();
-
-			p.R = r;
-			p.G = r;
-			p.B = r;
-			update_yuv(&p);
-			dd->draw_pixel(dd, x, &p);
-		}
-
-		next_line(dd);
+		set_line(dd, y);
+		dd->draw_snow(dd, 0, dd->width);
 	}
 }
 
@@ -106,11 +106,23 @@ static void reset_props(struct props *props)
 
 #define MAX_BUFFERS 16
 #define MAX_PORTS 1
+#define MAX_PLANES 3
+
+enum draw_format {
+	DRAW_FORMAT_RGB,
+	DRAW_FORMAT_BGRx,
+	DRAW_FORMAT_UYVY,
+	DRAW_FORMAT_YUY2,
+	DRAW_FORMAT_NV12,
+	DRAW_FORMAT_I420,
+};
 
 struct buffer {
 	struct spa_buffer *outbuf;
 	bool outstanding;
 	struct spa_meta_header *h;
+	struct spa_meta *damage;
+	struct spa_meta_timing *timing;
 	struct spa_list link;
 };
 
@@ -138,8 +150,13 @@ struct impl {
 
 	bool have_format;
 	struct spa_video_info current_format;
-	size_t bpp;
+	uint32_t draw_format;
 	int stride;
+	int n_planes;
+	int offsets[MAX_PLANES];
+	int strides[MAX_PLANES];
+	size_t size;
+	uint32_t seed[4];
 
 	struct buffer buffers[MAX_BUFFERS];
 	uint32_t n_buffers;
@@ -273,6 +290,8 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 
 static int fill_buffer(struct impl *this, struct buffer *b)
 {
+	if (b->outbuf->datas[0].maxsize < this->size)
+		return -ENOSPC;
 	return draw(this, b->outbuf->datas[0].data);
 }
 
@@ -311,6 +330,7 @@ static int make_buffer(struct impl *this)
 	struct buffer *b;
 	struct spa_io_buffers *io = this->io;
 	uint32_t n_bytes;
+	int res;
 
 	read_timer(this);
 
@@ -323,11 +343,19 @@ static int make_buffer(struct impl *this)
 	spa_list_remove(&b->link);
 	b->outstanding = true;
 
-	n_bytes = b->outbuf->datas[0].maxsize;
+	n_bytes = this->size;
 
 	spa_log_trace(this->log, NAME " %p: dequeue buffer %d", this, b->outbuf->id);
 
-	fill_buffer(this, b);
+	if ((res = fill_buffer(this, b)) < 0) {
+		spa_log_error(this->log, NAME " %p: can't fill buffer %d: %s",
+			      this, b->outbuf->id, spa_strerror(res));
+		b->outbuf->datas[0].chunk->size = 0;
+		b->outstanding = false;
+		spa_list_append(&this->empty, &b->link);
+		set_timer(this, false);
+		return res;
+	}
 
 	b->outbuf->datas[0].chunk->offset = 0;
 	b->outbuf->datas[0].chunk->size = n_bytes;
@@ -338,6 +366,19 @@ static int make_buffer(struct impl *this)
 		b->h->pts = this->start_time + this->elapsed_time;
 		b->h->dts_offset = 0;
 	}
+	if (b->damage && spa_meta_n_regions(b->damage) > 0) {
+		/* the patterns are redrawn completely */
+		struct spa_meta_region *r = b->damage->data;
+		r->region = SPA_REGION(0, 0, this->current_format.info.raw.size.width,
+					     this->current_format.info.raw.size.height);
+		if (spa_meta_n_regions(b->damage) > 1)
+			r[1].region = SPA_REGION(0, 0, 0, 0);
+	}
+	if (b->timing) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		spa_meta_timing_create(b->timing, SPA_TIMESPEC_TO_TIME(&now));
+	}
 
 	this->frame_count++;
 	this->elapsed_time = FRAMES_TO_TIME(this, this->frame_count);
@@ -508,8 +549,12 @@ static int port_enum_formats(struct spa_node *node,
 			"I", t->media_type.video,
 			"I", t->media_subtype.raw,
 			":", t->format_video.format,    "Ieu", t->video_format.RGB,
-				SPA_POD_PROP_ENUM(2, t->video_format.RGB,
-						     t->video_format.UYVY),
+				SPA_POD_PROP_ENUM(6, t->video_format.RGB,
+						     t->video_format.BGRx,
+						     t->video_format.UYVY,
+						     t->video_format.YUY2,
+						     t->video_format.NV12,
+						     t->video_format.I420),
 			":", t->format_video.size,      "Rru", &SPA_RECTANGLE(320, 240),
 				SPA_POD_PROP_MIN_MAX(&SPA_RECTANGLE(1, 1),
 						     &SPA_RECTANGLE(INT32_MAX, INT32_MAX)),
@@ -597,8 +642,6 @@ impl_node_port_enum_params(struct spa_node *node,
 			return res;
 	}
 	else if (id == t->param.idBuffers) {
-		struct spa_video_info_raw *raw_info = &this->current_format.info.raw;
-
 		if (!this->have_format)
 			return -EIO;
 		if (*index > 0)
@@ -606,7 +649,7 @@ impl_node_port_enum_params(struct spa_node *node,
 
 		param = spa_pod_builder_object(&b,
 			id, t->param_buffers.Buffers,
-			":", t->param_buffers.size,    "i", this->stride * raw_info->size.height,
+			":", t->param_buffers.size,    "i", this->size,
 			":", t->param_buffers.stride,  "i", this->stride,
 			":", t->param_buffers.buffers, "ir", 2,
 				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
@@ -623,6 +666,18 @@ impl_node_port_enum_params(struct spa_node *node,
 				":", t->param_meta.type, "I", t->meta.Header,
 				":", t->param_meta.size, "i", sizeof(struct spa_meta_header));
 			break;
+		case 1:
+			param = spa_pod_builder_object(&b,
+				id, t->param_meta.Meta,
+				":", t->param_meta.type, "I", t->meta.VideoDamage,
+				":", t->param_meta.size, "i", sizeof(struct spa_meta_region));
+			break;
+		case 2:
+			param = spa_pod_builder_object(&b,
+				id, t->param_meta.Meta,
+				":", t->param_meta.type, "I", t->meta.Timing,
+				":", t->param_meta.size, "i", sizeof(struct spa_meta_timing));
+			break;
 
 		default:
 			return 0;
@@ -675,22 +730,13 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_video_raw_parse(format, &info.info.raw, &this->type.format_video) < 0)
 			return -EINVAL;
 
-		if (info.info.raw.format == this->type.video_format.RGB)
-			this->bpp = 3;
-		else if (info.info.raw.format == this->type.video_format.UYVY)
-			this->bpp = 2;
-		else
+		if (drawing_setup(this, &info.info.raw) < 0)
 			return -EINVAL;
 
 		this->current_format = info;
 		this->have_format = true;
 	}
 
-	if (this->have_format) {
-		struct spa_video_info_raw *raw_info = &this->current_format.info.raw;
-		this->stride = SPA_ROUND_UP_N(this->bpp * raw_info->size.width, 4);
-	}
-
 	return 0;
 }
 
@@ -746,6 +792,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 		b->outbuf = buffers[i];
 		b->outstanding = false;
 		b->h = spa_buffer_find_meta(buffers[i], this->type.meta.Header);
+		b->damage = spa_buffer_get_meta(buffers[i], this->type.meta.VideoDamage);
+		b->timing = spa_buffer_find_meta(buffers[i], this->type.meta.Timing);
 
 		if ((d[0].type == this->type.data.MemPtr ||
 		     d[0].type == this->type.data.MemFd ||
@@ -1027,6 +1075,9 @@ impl_init(const struct spa_handle_factory *factory,
 	this->clock = impl_clock;
 	reset_props(&this->props);
 
+	for (i = 0; i < 4; i++)
+		this->seed[i] = 0x9e3779b9 * (i + 1);
+
 	spa_list_init(&this->empty);
 
 	this->timer_source.func = on_output;
@@ -0,0 +1,556 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Drives the packet ring and the link controller of the a2dp sink over a
+ * socketpair that stands in for the L2CAP socket of the transport. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+
+/* the controller reads the unsent bytes of the socket with TIOCOUTQ, which
+ * counts the kernel overhead of a unix socket as well, answer it with the
+ * bytes that the peer of the link can read */
+static int link_ioctl(int fd, unsigned long request, ...);
+#define ioctl link_ioctl
+#include "../plugins/bluez5/a2dp-sink.c"
+#undef ioctl
+
+#define MTU		895
+#define PACKET_SIZE	600
+
+#define STEP		(10 * SPA_NSEC_PER_MSEC)
+#define RATE		44100
+#define MAX_PENDING	4096
+
+struct test {
+	struct impl impl;
+	struct spa_bt_transport transport;
+	a2dp_sbc_t conf;
+	int fds[2];
+	uint16_t seqnum;		/* next sequence number the peer expects */
+	uint32_t received;		/* packets received by the peer */
+
+	uint64_t now;			/* simulated time */
+	uint32_t pending;		/* samples waiting to be encoded */
+	double budget;			/* bytes the link can take */
+
+	/* of the last link_run() */
+	uint32_t dropped;		/* samples dropped in overruns */
+	int low;			/* lowest bitpool */
+	int high;			/* highest bitpool */
+	uint32_t max_outq;		/* highest socket queue */
+};
+
+static struct test *link_test;
+
+static int link_ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+
+	if (link_test && request == TIOCOUTQ && fd == link_test->transport.fd)
+		return ioctl(link_test->fds[1], FIONREAD, arg);
+
+	return ioctl(fd, request, arg);
+}
+
+static void test_init(struct test *t, int type)
+{
+	spa_zero(*t);
+
+	if (type == 0)
+		spa_assert_se(pipe2(t->fds, O_NONBLOCK) == 0);
+	else
+		spa_assert_se(socketpair(AF_UNIX, type | SOCK_NONBLOCK, 0, t->fds) == 0);
+
+	/* fds[1] is the sending side, like the transport fd */
+	t->transport.fd = t->fds[type == 0 ? 1 : 0];
+	t->transport.read_mtu = MTU;
+	t->transport.write_mtu = MTU;
+
+	t->impl.transport = &t->transport;
+	t->impl.props.batch = MAX_PACKETS - 1;
+	t->impl.use_sendmmsg = true;
+	reset_buffer(&t->impl);
+}
+
+static void test_clear(struct test *t)
+{
+	close(t->fds[0]);
+	close(t->fds[1]);
+}
+
+static int peer_fd(struct test *t)
+{
+	return t->fds[0] == t->transport.fd ? t->fds[1] : t->fds[0];
+}
+
+/* queue complete packets with a recognizable payload */
+static void queue_packets(struct test *t, uint32_t n_packets)
+{
+	struct impl *this = &t->impl;
+	uint32_t i;
+
+	for (i = 0; i < n_packets; i++) {
+		struct packet *p = current_packet(this);
+		uint32_t offset = p->size;
+
+		p->size = PACKET_SIZE;
+		memset(p->data + offset, this->seqnum & 0xff, p->size - offset);
+		p->frame_count = 1;
+		finish_packet(this);
+	}
+}
+
+/* check the packets that arrived at the peer, in order and complete */
+static uint32_t receive_packets(struct test *t)
+{
+	uint8_t data[MAX_PACKET_SIZE];
+	uint32_t n_packets = 0;
+	ssize_t len;
+
+	while ((len = read(peer_fd(t), data, sizeof(data))) > 0) {
+		struct rtp_header *header = (struct rtp_header *) data;
+		size_t hdr = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+
+		spa_assert_se(len == PACKET_SIZE);
+		spa_assert_se(ntohs(header->sequence_number) == t->seqnum);
+		spa_assert_se(data[hdr] == (t->seqnum & 0xff));
+		spa_assert_se(data[len - 1] == (t->seqnum & 0xff));
+		t->seqnum++;
+		n_packets++;
+	}
+	spa_assert_se(len < 0 && errno == EAGAIN);
+
+	t->received += n_packets;
+	return n_packets;
+}
+
+/* a byte stream peer, only the amount of data can be checked */
+static uint32_t receive_bytes(struct test *t)
+{
+	uint8_t data[MAX_PACKET_SIZE];
+	uint32_t n_bytes = 0;
+	ssize_t len;
+
+	while ((len = read(peer_fd(t), data, sizeof(data))) > 0)
+		n_bytes += len;
+	spa_assert_se(len < 0 && errno == EAGAIN);
+
+	return n_bytes;
+}
+
+/* a batch that fits in the socket goes out with one sendmmsg */
+static void test_batch(void)
+{
+	struct test t;
+	struct impl *this;
+	int res;
+
+	printf("batch\n");
+
+	test_init(&t, SOCK_SEQPACKET);
+	this = &t.impl;
+
+	queue_packets(&t, 4);
+	res = send_packets(this);
+	spa_assert_se(res == 4 * PACKET_SIZE);
+	spa_assert_se(this->packet_read == this->packet_write);
+	spa_assert_se(this->stats.send_calls == 1);
+	spa_assert_se(this->stats.sent_packets == 4);
+	spa_assert_se(this->ctl.sent_bytes == 4 * PACKET_SIZE);
+	spa_assert_se(this->use_sendmmsg);
+
+	spa_assert_se(receive_packets(&t) == 4);
+
+	test_clear(&t);
+}
+
+/* sendmmsg sends part of the batch when the socket fills up, the rest
+ * stays queued and goes out in order when the socket drains */
+static void test_partial(void)
+{
+	struct test t;
+	struct impl *this;
+	uint32_t queued = MAX_PACKETS - 1, sent, total = 0;
+	int res, val;
+
+	printf("partial sendmmsg\n");
+
+	test_init(&t, SOCK_SEQPACKET);
+	this = &t.impl;
+
+	/* room for a few packets only */
+	val = 3 * MTU;
+	spa_assert_se(setsockopt(t.transport.fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) == 0);
+
+	queue_packets(&t, queued);
+
+	res = send_packets(this);
+	spa_assert_se(res == -EAGAIN);
+	sent = this->packet_read;
+	printf("  %u of %u packets sent\n", sent, queued);
+	spa_assert_se(sent > 0 && sent < queued);
+	spa_assert_se(this->packet_write - this->packet_read == queued - sent);
+	spa_assert_se(this->stats.sent_packets == sent);
+	spa_assert_se(this->ctl.sent_bytes == sent * PACKET_SIZE);
+
+	/* nothing fits while the peer doesn't read, nothing is lost */
+	res = send_packets(this);
+	spa_assert_se(res == -EAGAIN);
+	spa_assert_se(this->packet_read == sent);
+	spa_assert_se(this->stats.sent_packets == sent);
+
+	spa_assert_se(receive_packets(&t) == sent);
+
+	/* the rest goes out over the next flushes */
+	while (this->packet_read != this->packet_write) {
+		uint32_t before = this->packet_read;
+
+		res = send_packets(this);
+		spa_assert_se(res == -EAGAIN || res > 0);
+		spa_assert_se(this->packet_read > before);
+		if (res > 0) {
+			spa_assert_se(this->packet_read == this->packet_write);
+			total = res;
+		}
+		receive_packets(&t);
+	}
+	spa_assert_se(total > 0 && total % PACKET_SIZE == 0);
+	spa_assert_se(t.received == queued);
+	spa_assert_se(this->stats.sent_packets == queued);
+	spa_assert_se(this->ctl.sent_bytes == queued * PACKET_SIZE);
+
+	/* new packets continue after the old ones */
+	queue_packets(&t, 2);
+	spa_assert_se(send_packets(this) == 2 * PACKET_SIZE);
+	spa_assert_se(receive_packets(&t) == 2);
+
+	test_clear(&t);
+}
+
+/* without sendmmsg the packets are written one by one, and the ones
+ * that don't fit stay queued */
+static void test_write(void)
+{
+	struct test t;
+	struct impl *this;
+	uint32_t queued = MAX_PACKETS - 1, sent;
+	int res, val;
+
+	printf("write\n");
+
+	test_init(&t, SOCK_SEQPACKET);
+	this = &t.impl;
+	this->use_sendmmsg = false;
+
+	val = 3 * MTU;
+	spa_assert_se(setsockopt(t.transport.fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) == 0);
+
+	queue_packets(&t, queued);
+
+	res = send_packets(this);
+	spa_assert_se(res == -EAGAIN);
+	sent = this->packet_read;
+	spa_assert_se(sent > 0 && sent < queued);
+	spa_assert_se(this->stats.send_calls == sent + 1);
+
+	while (this->packet_read != this->packet_write) {
+		receive_packets(&t);
+		res = send_packets(this);
+		spa_assert_se(res == -EAGAIN || res > 0);
+	}
+	receive_packets(&t);
+	spa_assert_se(t.received == queued);
+
+	test_clear(&t);
+}
+
+/* a transport fd that is not a socket falls back to write */
+static void test_no_socket(void)
+{
+	struct test t;
+	struct impl *this;
+
+	printf("no socket\n");
+
+	test_init(&t, 0);
+	this = &t.impl;
+
+	queue_packets(&t, 4);
+	spa_assert_se(send_packets(this) == 4 * PACKET_SIZE);
+	spa_assert_se(!this->use_sendmmsg);
+	spa_assert_se(this->packet_read == this->packet_write);
+	spa_assert_se(this->stats.sent_packets == 4);
+	spa_assert_se(receive_bytes(&t) == 4 * PACKET_SIZE);
+
+	test_clear(&t);
+}
+
+/* a stream socket so that the peer can drain any number of bytes, like
+ * a link with a given throughput */
+static void link_init(struct test *t)
+{
+	struct impl *this = &t->impl;
+
+	test_init(t, SOCK_STREAM);
+	link_test = t;
+
+	t->conf.frequency = SBC_SAMPLING_FREQ_44100;
+	t->conf.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+	t->conf.subbands = SBC_SUBBANDS_8;
+	t->conf.allocation_method = SBC_ALLOCATION_LOUDNESS;
+	t->conf.block_length = SBC_BLOCK_LENGTH_16;
+	t->conf.min_bitpool = 2;
+	t->conf.max_bitpool = 53;
+	t->transport.configuration = &t->conf;
+	t->transport.configuration_len = sizeof(t->conf);
+
+	this->props.batch = default_batch;
+	this->props.adaptive = true;
+	this->current_format.info.raw.rate = RATE;
+	this->current_format.info.raw.channels = 2;
+	this->frame_size = 4;
+
+	spa_assert_se(init_sbc(this) == 0);
+	controller_reset(this);
+	set_send_buffer(this);
+	reset_buffer(this);
+
+	t->now = SPA_NSEC_PER_SEC;
+}
+
+static void link_clear(struct test *t)
+{
+	link_test = NULL;
+	test_clear(t);
+}
+
+/* let the link take the bytes of its budget out of the socket */
+static void link_drain(struct test *t)
+{
+	uint8_t data[4096];
+	ssize_t len;
+
+	while (t->budget >= 1.0) {
+		len = read(t->fds[1], data, SPA_MIN(sizeof(data), (size_t) t->budget));
+		if (len <= 0) {
+			/* an idle link can't save up throughput */
+			spa_assert_se(len < 0 && errno == EAGAIN);
+			t->budget = 0.0;
+			break;
+		}
+		t->budget -= len;
+	}
+}
+
+/* run the sink against a link that takes \a throughput bytes per second
+ * for \a duration nsec, one flush every STEP like the timer of the sink */
+static void link_run(struct test *t, double throughput, uint64_t duration)
+{
+	static const uint8_t samples[MAX_PENDING * 4];
+	struct impl *this = &t->impl;
+	uint64_t end = t->now + duration;
+	int res;
+
+	t->dropped = 0;
+	t->low = t->high = this->sbc.bitpool;
+	t->max_outq = 0;
+
+	while (t->now < end) {
+		t->now += STEP;
+
+		t->budget += throughput * STEP / SPA_NSEC_PER_SEC;
+		link_drain(t);
+
+		/* samples that don't fit in the ring wait, the oldest are
+		 * dropped like in an overrun */
+		t->pending += RATE * STEP / SPA_NSEC_PER_SEC;
+		if (t->pending > MAX_PENDING) {
+			t->dropped += t->pending - MAX_PENDING;
+			t->pending = MAX_PENDING;
+		}
+		res = add_data(this, samples, t->pending * this->frame_size);
+		t->pending -= res / this->frame_size;
+
+		res = send_packets(this);
+		spa_assert_se(res >= 0 || res == -EAGAIN);
+
+		controller_update(this, t->now, res == -EAGAIN);
+
+		t->low = SPA_MIN(t->low, this->sbc.bitpool);
+		t->high = SPA_MAX(t->high, this->sbc.bitpool);
+		t->max_outq = SPA_MAX(t->max_outq, this->ctl.outq);
+	}
+	printf("  %f bytes/sec: bitpool %d (%d-%d) throughput %f max outq %u dropped %u\n",
+			throughput, this->sbc.bitpool, t->low, t->high,
+			this->ctl.throughput, t->max_outq, t->dropped);
+}
+
+/* the bitpool goes down when the link can't keep up and back up when it
+ * recovers */
+static void test_congestion(void)
+{
+	struct test t;
+	struct impl *this;
+	double need, slow;
+	uint32_t limit;
+
+	printf("congestion\n");
+
+	link_init(&t);
+	this = &t.impl;
+
+	need = bitpool_throughput(this, this->max_bitpool);
+	slow = need / 2;
+	limit = (this->ctl.fill_frames + this->props.batch) * this->transport->write_mtu;
+
+	link_run(&t, need * 2, 2 * SPA_NSEC_PER_SEC);
+	spa_assert_se(t.low == this->max_bitpool);
+	spa_assert_se(t.dropped == 0);
+
+	/* the bitpool goes down within a second */
+	link_run(&t, slow, SPA_NSEC_PER_SEC);
+	spa_assert_se(this->sbc.bitpool < this->max_bitpool);
+	spa_assert_se(bitpool_throughput(this, this->sbc.bitpool) <= slow);
+
+	/* and stays around what the link can take, probing up now and then
+	 * without filling the socket */
+	link_run(&t, slow, 30 * SPA_NSEC_PER_SEC);
+	spa_assert_se(bitpool_throughput(this, t.high) <= slow * 1.1);
+	spa_assert_se(bitpool_throughput(this, t.low) >= slow * 0.7);
+	spa_assert_se(t.max_outq <= 2 * limit);
+	spa_assert_se(t.dropped < RATE * 30 / 100);
+
+	/* it goes back up when the link recovers */
+	link_run(&t, need * 2, 120 * SPA_NSEC_PER_SEC);
+	spa_assert_se(this->sbc.bitpool == this->max_bitpool);
+	spa_assert_se(t.dropped == 0);
+
+	link_clear(&t);
+}
+
+/* the extra fill level goes back after CONTROLLER_FILL_HOLD, also while
+ * the bitpool changes are held back by congestion */
+static void test_fill_decay(void)
+{
+	struct test t;
+	struct impl *this;
+	uint64_t last_underrun;
+
+	printf("fill decay\n");
+
+	link_init(&t);
+	this = &t.impl;
+
+	link_run(&t, bitpool_throughput(this, this->max_bitpool) * 2, SPA_NSEC_PER_SEC);
+
+	controller_underrun(this, t.now);
+	link_run(&t, bitpool_throughput(this, this->max_bitpool) * 2, CONTROLLER_DOWN_HOLD);
+	controller_underrun(this, t.now);
+	last_underrun = t.now;
+	spa_assert_se(this->ctl.fill_frames == FILL_FRAMES + 2);
+
+	/* congested for all of the hold time */
+	link_run(&t, bitpool_throughput(this, this->min_bitpool) / 2,
+			CONTROLLER_FILL_HOLD - STEP);
+	spa_assert_se(this->ctl.fill_frames == FILL_FRAMES + 2);
+
+	/* a congested update shortly after a bitpool change */
+	this->ctl.last_change = t.now;
+	t.now += 2 * STEP;
+	controller_update(this, t.now, true);
+	printf("  fill level %d after %d msec\n", this->ctl.fill_frames,
+			(int) ((t.now - last_underrun) / SPA_NSEC_PER_MSEC));
+	spa_assert_se(this->ctl.fill_frames == FILL_FRAMES + 1);
+	spa_assert_se(this->ctl.last_underrun == t.now);
+
+	link_clear(&t);
+}
+
+/* a packet that was started with a lower bitpool is finished when the
+ * longer frames of the new bitpool don't fit in it anymore */
+static void test_bitpool_increase(void)
+{
+	static const uint8_t samples[16 * 512];
+	struct test t;
+	struct impl *this;
+	uint32_t frame_length;
+	int res;
+
+	printf("bitpool increase\n");
+
+	link_init(&t);
+	this = &t.impl;
+
+	/* with MTU 895, 12 frames of bitpool 26 leave room for one more frame
+	 * of 65 bytes but not for one of 67 bytes with bitpool 27 */
+	set_bitpool(this, 26);
+	frame_length = this->frame_length;
+	res = add_data(this, samples, 12 * this->codesize);
+	spa_assert_se(res == 12 * this->codesize);
+	spa_assert_se(this->packet_write == 0);
+	spa_assert_se(this->packets[0].frame_count == 12);
+	spa_assert_se(this->packets[0].size + frame_length <= this->write_size);
+
+	set_bitpool(this, 27);
+	spa_assert_se(this->packets[0].size + this->frame_length > this->write_size);
+
+	/* the old packet is completed and waits in the batch */
+	add_data(this, samples, sizeof(samples));
+	spa_assert_se(this->packet_write == 1);
+	spa_assert_se(this->packets[0].frame_count == 12);
+	spa_assert_se(this->packets[0].size <= this->write_size);
+
+	/* the packets keep going out with the new bitpool */
+	spa_assert_se(send_packets(this) == (int) this->packets[0].size);
+	res = add_data(this, samples, sizeof(samples));
+	spa_assert_se(res > 0);
+	spa_assert_se(this->packet_write == 2);
+	spa_assert_se(this->packets[1].size > this->packets[0].size);
+	spa_assert_se(send_packets(this) == (int) this->packets[1].size);
+
+	link_clear(&t);
+}
+
+int main(int argc, char *argv[])
+{
+	test_batch();
+	test_partial();
+	test_write();
+	test_no_socket();
+	test_congestion();
+	test_fill_decay();
+	test_bitpool_increase();
+
+	printf("all tests passed\n");
+
+	return 0;
+}
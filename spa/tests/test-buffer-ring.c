@@ -0,0 +1,195 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks the spa_io_buffer_ring helpers: the limits of a ring and that buffer
+ * ids pushed by a producer are popped in order by a consumer. Popped ids go
+ * back to the producer with a second ring and a producer may only reuse an
+ * id after it came back.
+ *
+ * Only the helpers are used, the client-node and the stream code that pass
+ * buffers with these rings are not. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <spa/utils/defs.h>
+#include <spa/node/io.h>
+
+#define N_BUFFERS	8
+#define N_CYCLES	1000
+
+struct direction {
+	struct spa_io_buffer_ring ring;		/* producer -> consumer */
+	struct spa_io_buffer_ring reuse;	/* consumer -> producer */
+
+	uint32_t data[N_BUFFERS];
+	uint32_t free[N_BUFFERS];
+	uint32_t n_free;
+
+	uint32_t held[N_BUFFERS];
+	uint32_t held_seq[N_BUFFERS];
+	uint32_t n_held;
+
+	uint32_t produced;
+	uint32_t consumed;
+	uint32_t max_avail;
+};
+
+static void direction_init(struct direction *d)
+{
+	uint32_t i;
+
+	memset(d, 0, sizeof(*d));
+	spa_ringbuffer_init(&d->ring.ring);
+	spa_ringbuffer_init(&d->reuse.ring);
+	for (i = 0; i < N_BUFFERS; i++)
+		d->free[d->n_free++] = i;
+}
+
+/* queue up to max buffers, returns the number of queued buffers */
+static uint32_t produce(struct direction *d, uint32_t max)
+{
+	uint32_t id, n = 0;
+
+	while ((id = spa_io_buffer_ring_pop(&d->reuse)) != SPA_ID_INVALID)
+		d->free[d->n_free++] = id;
+
+	while (n < max && d->n_free > 0) {
+		id = d->free[--d->n_free];
+		d->data[id] = d->produced++;
+		spa_assert_se(spa_io_buffer_ring_push(&d->ring, id) == 0);
+		n++;
+	}
+	if (spa_io_buffer_ring_avail(&d->ring) > d->max_avail)
+		d->max_avail = spa_io_buffer_ring_avail(&d->ring);
+
+	return n;
+}
+
+/* give back all but the last keep buffers, they must not have been
+ * touched by the producer while we held them */
+static void release(struct direction *d, uint32_t keep)
+{
+	uint32_t i, n;
+
+	if (d->n_held <= keep)
+		return;
+
+	n = d->n_held - keep;
+	for (i = 0; i < n; i++) {
+		spa_assert_se(d->data[d->held[i]] == d->held_seq[i]);
+		spa_assert_se(spa_io_buffer_ring_push(&d->reuse, d->held[i]) == 0);
+	}
+	memmove(d->held, &d->held[n], keep * sizeof(uint32_t));
+	memmove(d->held_seq, &d->held_seq[n], keep * sizeof(uint32_t));
+	d->n_held = keep;
+}
+
+/* take up to max buffers, returns the number of taken buffers */
+static uint32_t consume(struct direction *d, uint32_t max)
+{
+	uint32_t id, n = 0;
+
+	while (n < max && (id = spa_io_buffer_ring_pop(&d->ring)) != SPA_ID_INVALID) {
+		spa_assert_se(id < N_BUFFERS);
+		spa_assert_se(d->data[id] == d->consumed);
+		spa_assert_se(d->n_held < N_BUFFERS);
+
+		d->held[d->n_held] = id;
+		d->held_seq[d->n_held++] = d->consumed++;
+		n++;
+	}
+	return n;
+}
+
+static void test_limits(void)
+{
+	struct spa_io_buffer_ring ring;
+	uint32_t i;
+
+	spa_ringbuffer_init(&ring.ring);
+	spa_assert_se(spa_io_buffer_ring_pop(&ring) == SPA_ID_INVALID);
+
+	for (i = 0; i < SPA_IO_BUFFER_RING_SIZE; i++)
+		spa_assert_se(spa_io_buffer_ring_push(&ring, i) == 0);
+	spa_assert_se(spa_io_buffer_ring_push(&ring, i) == -ENOSPC);
+	spa_assert_se(spa_io_buffer_ring_avail(&ring) == SPA_IO_BUFFER_RING_SIZE);
+
+	for (i = 0; i < SPA_IO_BUFFER_RING_SIZE; i++)
+		spa_assert_se(spa_io_buffer_ring_pop(&ring) == i);
+	spa_assert_se(spa_io_buffer_ring_pop(&ring) == SPA_ID_INVALID);
+	spa_assert_se(spa_io_buffer_ring_avail(&ring) == 0);
+}
+
+/* the producer pushes one id per cycle, the consumer pops everything every
+ * few cycles and holds on to the last ids for a while */
+static void test_input(void)
+{
+	struct direction d;
+	uint32_t cycle;
+
+	direction_init(&d);
+
+	for (cycle = 0; cycle < N_CYCLES; cycle++) {
+		produce(&d, 1);
+		if (cycle % 4 == 3) {
+			consume(&d, N_BUFFERS);
+			release(&d, 2);
+		}
+	}
+	consume(&d, N_BUFFERS);
+	release(&d, 0);
+
+	spa_assert_se(d.max_avail > 1);
+	spa_assert_se(d.consumed == d.produced);
+	spa_assert_se(d.consumed > N_CYCLES / 2);
+}
+
+/* the producer pushes ahead as far as its ids go, the consumer pops one id
+ * per cycle and gives it back in the next cycle */
+static void test_output(void)
+{
+	struct direction d;
+	uint32_t cycle;
+
+	direction_init(&d);
+
+	for (cycle = 0; cycle < N_CYCLES; cycle++) {
+		if (spa_io_buffer_ring_avail(&d.ring) < N_BUFFERS / 2)
+			produce(&d, N_BUFFERS);
+		release(&d, 0);
+		consume(&d, 1);
+	}
+	release(&d, 0);
+
+	spa_assert_se(d.max_avail > 1);
+	spa_assert_se(d.consumed == N_CYCLES);
+	spa_assert_se(d.produced - d.consumed == spa_io_buffer_ring_avail(&d.ring));
+}
+
+int main(int argc, char *argv[])
+{
+	test_limits();
+	test_input();
+	test_output();
+
+	printf("buffer ring tests passed\n");
+
+	return 0;
+}
@@ -0,0 +1,555 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Runs videotestsrc -> ffenc_mpeg4 -> ffdec_mpeg4 -> fakesink and checks
+ * that the decoder produces frames of the size of the raw video. The
+ * encoder and the decoder run their codec in a worker thread and wake up
+ * the data loop of the test when buffers are done. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+
+#include <spa/support/log-impl.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/param/param.h>
+#include <spa/param/props.h>
+#include <spa/param/buffers.h>
+#include <spa/param/video/format-utils.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+#define WIDTH		320
+#define HEIGHT		240
+#define N_BUFFERS	8
+#define N_FRAMES	50
+#define MAX_SOURCES	16
+
+struct type {
+	uint32_t node;
+	uint32_t props;
+	uint32_t format;
+	uint32_t props_live;
+	struct spa_type_io io;
+	struct spa_type_param param;
+	struct spa_type_meta meta;
+	struct spa_type_data data;
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_media_subtype_video media_subtype_video;
+	struct spa_type_format_video format_video;
+	struct spa_type_video_format video_format;
+	struct spa_type_param_buffers param_buffers;
+	struct spa_type_command_node command_node;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	type->node = spa_type_map_get_id(map, SPA_TYPE__Node);
+	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
+	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
+	type->props_live = spa_type_map_get_id(map, SPA_TYPE_PROPS__live);
+	spa_type_io_map(map, &type->io);
+	spa_type_param_map(map, &type->param);
+	spa_type_meta_map(map, &type->meta);
+	spa_type_data_map(map, &type->data);
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_media_subtype_video_map(map, &type->media_subtype_video);
+	spa_type_format_video_map(map, &type->format_video);
+	spa_type_video_format_map(map, &type->video_format);
+	spa_type_param_buffers_map(map, &type->param_buffers);
+	spa_type_command_node_map(map, &type->command_node);
+}
+
+struct buffer {
+	struct spa_buffer buffer;
+	struct spa_meta metas[1];
+	struct spa_meta_header header;
+	struct spa_data datas[1];
+	struct spa_chunk chunks[1];
+};
+
+/* the buffers and the io area between an output and an input port */
+struct link {
+	struct spa_io_buffers io;
+	struct spa_buffer *bufs[N_BUFFERS];
+	struct buffer buffers[N_BUFFERS];
+};
+
+struct data {
+	struct spa_type_map *map;
+	struct spa_log *log;
+	struct spa_loop data_loop;
+	struct type type;
+
+	struct spa_support support[4];
+	uint32_t n_support;
+
+	const char *plugin_dir;
+
+	struct spa_node *source;
+	struct spa_node *enc;
+	struct spa_node *dec;
+	struct spa_node *sink;
+
+	struct link source_enc;
+	struct link enc_dec;
+	struct link dec_sink;
+
+	uint32_t source_outstanding;	/**< source buffers held by the encoder */
+	uint32_t n_frames;		/**< decoded frames */
+
+	struct spa_source sources[MAX_SOURCES];
+	uint32_t n_sources;
+};
+
+static int make_node(struct data *data, struct spa_node **node, const char *lib, const char *name)
+{
+	struct spa_handle *handle;
+	int res;
+	void *hnd;
+	spa_handle_factory_enum_func_t enum_func;
+	uint32_t i;
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", data->plugin_dir, lib);
+
+	if ((hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", path, dlerror());
+		return -ENOENT;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -ENOENT;
+	}
+
+	for (i = 0;;) {
+		const struct spa_handle_factory *factory;
+		void *iface;
+
+		if ((res = enum_func(&factory, &i)) <= 0) {
+			if (res != 0)
+				printf("can't enumerate factories: %s\n", spa_strerror(res));
+			break;
+		}
+		if (strcmp(factory->name, name))
+			continue;
+
+		handle = calloc(1, factory->size);
+		if ((res = spa_handle_factory_init(factory, handle, NULL,
+						   data->support, data->n_support)) < 0) {
+			printf("can't make factory instance %s: %d\n", name, res);
+			return res;
+		}
+		if ((res = spa_handle_get_interface(handle, data->type.node, &iface)) < 0) {
+			printf("can't get interface %d\n", res);
+			return res;
+		}
+		*node = iface;
+		return 0;
+	}
+	printf("can't find factory %s\n", name);
+	return -EBADF;
+}
+
+static int do_add_source(struct spa_loop *loop, struct spa_source *source)
+{
+	struct data *data = SPA_CONTAINER_OF(loop, struct data, data_loop);
+
+	if (data->n_sources >= MAX_SOURCES)
+		return -ENOSPC;
+
+	data->sources[data->n_sources++] = *source;
+	return 0;
+}
+
+static int do_update_source(struct spa_source *source)
+{
+	return 0;
+}
+
+static void do_remove_source(struct spa_source *source)
+{
+}
+
+static int
+do_invoke(struct spa_loop *loop,
+	  spa_invoke_func_t func, uint32_t seq, const void *data, size_t size, bool block, void *user_data)
+{
+	return func(loop, false, seq, data, size, user_data);
+}
+
+/* dispatch the sources of the data loop that are ready within timeout msec */
+static void iterate(struct data *data, int timeout)
+{
+	struct pollfd fds[MAX_SOURCES];
+	uint32_t i;
+
+	for (i = 0; i < data->n_sources; i++) {
+		fds[i].fd = data->sources[i].fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	if (poll(fds, data->n_sources, timeout) <= 0)
+		return;
+
+	for (i = 0; i < data->n_sources; i++) {
+		struct spa_source *s = &data->sources[i];
+
+		if (fds[i].revents & POLLIN) {
+			s->rmask = SPA_IO_IN;
+			s->func(s);
+		}
+	}
+}
+
+static void on_enc_reuse_buffer(void *_data, uint32_t port_id, uint32_t buffer_id)
+{
+	struct data *data = _data;
+
+	data->source_outstanding--;
+	spa_node_port_reuse_buffer(data->source, 0, buffer_id);
+}
+
+static void on_enc_have_output(void *_data)
+{
+	struct data *data = _data;
+
+	spa_node_process_input(data->dec);
+}
+
+static const struct spa_node_callbacks enc_callbacks = {
+	SPA_VERSION_NODE_CALLBACKS,
+	.have_output = on_enc_have_output,
+	.reuse_buffer = on_enc_reuse_buffer,
+};
+
+static void on_dec_reuse_buffer(void *_data, uint32_t port_id, uint32_t buffer_id)
+{
+	struct data *data = _data;
+
+	spa_node_port_reuse_buffer(data->enc, 0, buffer_id);
+}
+
+/* check the decoded frames and give them to the sink, the sink gives
+ * them back in the io area right away */
+static void on_dec_have_output(void *_data)
+{
+	struct data *data = _data;
+	struct spa_io_buffers *io = &data->dec_sink.io;
+	struct spa_buffer *b;
+	uint8_t *y;
+
+	while (io->status == SPA_STATUS_HAVE_BUFFER) {
+		spa_assert_se(io->buffer_id < N_BUFFERS);
+
+		b = data->dec_sink.bufs[io->buffer_id];
+		spa_assert_se(b->datas[0].chunk->size >= WIDTH * HEIGHT * 3 / 2);
+
+		/* the white and the blue bar of the test pattern survive any
+		 * encoding */
+		y = SPA_MEMBER(b->datas[0].data, b->datas[0].chunk->offset, uint8_t);
+		spa_assert_se(y[0] > y[WIDTH - 1] + 64);
+		data->n_frames++;
+
+		spa_assert_se(spa_node_process_input(data->sink) == SPA_STATUS_NEED_BUFFER);
+		spa_assert_se(io->buffer_id == b->id);
+		spa_node_process_output(data->dec);
+	}
+}
+
+static const struct spa_node_callbacks dec_callbacks = {
+	SPA_VERSION_NODE_CALLBACKS,
+	.have_output = on_dec_have_output,
+	.reuse_buffer = on_dec_reuse_buffer,
+};
+
+static int make_nodes(struct data *data)
+{
+	struct type *t = &data->type;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[256];
+	struct spa_pod *props;
+	int res;
+
+	if ((res = make_node(data, &data->source,
+			     "videotestsrc/libspa-videotestsrc.so", "videotestsrc")) < 0 ||
+	    (res = make_node(data, &data->enc,
+			     "ffmpeg/libspa-ffmpeg.so", "ffenc_mpeg4")) < 0 ||
+	    (res = make_node(data, &data->dec,
+			     "ffmpeg/libspa-ffmpeg.so", "ffdec_mpeg4")) < 0 ||
+	    (res = make_node(data, &data->sink,
+			     "test/libspa-test.so", "fakesink")) < 0)
+		return res;
+
+	spa_node_set_callbacks(data->enc, &enc_callbacks, data);
+	spa_node_set_callbacks(data->dec, &dec_callbacks, data);
+
+	/* the test pulls the frames from the source */
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	props = spa_pod_builder_object(&b,
+		0, t->props,
+		":", t->props_live, "b", false);
+	if ((res = spa_node_set_param(data->source, t->param.idProps, 0, props)) < 0)
+		return res;
+
+	data->source_enc.io = SPA_IO_BUFFERS_INIT;
+	data->enc_dec.io = SPA_IO_BUFFERS_INIT;
+	data->dec_sink.io = SPA_IO_BUFFERS_INIT;
+
+	spa_node_port_set_io(data->source, SPA_DIRECTION_OUTPUT, 0, t->io.Buffers,
+			     &data->source_enc.io, sizeof(data->source_enc.io));
+	spa_node_port_set_io(data->enc, SPA_DIRECTION_INPUT, 0, t->io.Buffers,
+			     &data->source_enc.io, sizeof(data->source_enc.io));
+	spa_node_port_set_io(data->enc, SPA_DIRECTION_OUTPUT, 0, t->io.Buffers,
+			     &data->enc_dec.io, sizeof(data->enc_dec.io));
+	spa_node_port_set_io(data->dec, SPA_DIRECTION_INPUT, 0, t->io.Buffers,
+			     &data->enc_dec.io, sizeof(data->enc_dec.io));
+	spa_node_port_set_io(data->dec, SPA_DIRECTION_OUTPUT, 0, t->io.Buffers,
+			     &data->dec_sink.io, sizeof(data->dec_sink.io));
+	spa_node_port_set_io(data->sink, SPA_DIRECTION_INPUT, 0, t->io.Buffers,
+			     &data->dec_sink.io, sizeof(data->dec_sink.io));
+
+	return 0;
+}
+
+static int set_format(struct data *data, struct spa_node *node, enum spa_direction direction,
+		      uint32_t subtype)
+{
+	struct type *t = &data->type;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[256];
+	struct spa_pod *format;
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	if (subtype == t->media_subtype.raw)
+		format = spa_pod_builder_object(&b,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", t->media_subtype.raw,
+			":", t->format_video.format,    "I", t->video_format.I420,
+			":", t->format_video.size,      "R", &SPA_RECTANGLE(WIDTH, HEIGHT),
+			":", t->format_video.framerate, "F", &SPA_FRACTION(25, 1));
+	else
+		format = spa_pod_builder_object(&b,
+			t->param.idFormat, t->format,
+			"I", t->media_type.video,
+			"I", subtype,
+			":", t->format_video.size,      "R", &SPA_RECTANGLE(WIDTH, HEIGHT),
+			":", t->format_video.framerate, "F", &SPA_FRACTION(25, 1));
+
+	return spa_node_port_set_param(node, direction, 0, t->param.idFormat, 0, format);
+}
+
+/* the size and stride that a port wants for its buffers */
+static int port_buffer_size(struct data *data, struct spa_node *node, enum spa_direction direction,
+			    uint32_t *size, uint32_t *stride)
+{
+	struct type *t = &data->type;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[1024];
+	struct spa_pod *param;
+	uint32_t state = 0;
+	int32_t s = 0, st = 0;
+	int res;
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	if ((res = spa_node_port_enum_params(node, direction, 0, t->param.idBuffers,
+					     &state, NULL, &param, &b)) <= 0)
+		return res < 0 ? res : -EIO;
+
+	spa_pod_object_parse(param,
+		":", t->param_buffers.size,   "i", &s,
+		":", t->param_buffers.stride, "?i", &st, NULL);
+
+	*size = SPA_MAX(*size, (uint32_t) s);
+	if (direction == SPA_DIRECTION_OUTPUT)
+		*stride = st;
+	return 0;
+}
+
+/* allocate buffers that are large enough for both ports of the link */
+static int use_buffers(struct data *data, struct link *l,
+		       struct spa_node *output, struct spa_node *input)
+{
+	struct type *t = &data->type;
+	uint32_t i, size = 0, stride = 0;
+	int res;
+
+	if ((res = port_buffer_size(data, output, SPA_DIRECTION_OUTPUT, &size, &stride)) < 0 ||
+	    (res = port_buffer_size(data, input, SPA_DIRECTION_INPUT, &size, &stride)) < 0)
+		return res;
+
+	for (i = 0; i < N_BUFFERS; i++) {
+		struct buffer *b = &l->buffers[i];
+
+		l->bufs[i] = &b->buffer;
+
+		b->buffer.id = i;
+		b->buffer.metas = b->metas;
+		b->buffer.n_metas = 1;
+		b->buffer.datas = b->datas;
+		b->buffer.n_datas = 1;
+
+		b->metas[0].type = t->meta.Header;
+		b->metas[0].data = &b->header;
+		b->metas[0].size = sizeof(b->header);
+
+		b->datas[0].type = t->data.MemPtr;
+		b->datas[0].flags = 0;
+		b->datas[0].fd = -1;
+		b->datas[0].mapoffset = 0;
+		b->datas[0].maxsize = size;
+		b->datas[0].data = calloc(1, size);
+		b->datas[0].chunk = &b->chunks[0];
+		b->datas[0].chunk->offset = 0;
+		b->datas[0].chunk->size = 0;
+		b->datas[0].chunk->stride = stride;
+	}
+
+	if ((res = spa_node_port_use_buffers(output, SPA_DIRECTION_OUTPUT, 0,
+					     l->bufs, N_BUFFERS)) < 0 ||
+	    (res = spa_node_port_use_buffers(input, SPA_DIRECTION_INPUT, 0,
+					     l->bufs, N_BUFFERS)) < 0)
+		return res;
+
+	return 0;
+}
+
+static int negotiate(struct data *data)
+{
+	struct type *t = &data->type;
+	uint32_t raw = t->media_subtype.raw, mpeg4 = t->media_subtype_video.mpeg4;
+	int res;
+
+	if ((res = set_format(data, data->source, SPA_DIRECTION_OUTPUT, raw)) < 0 ||
+	    (res = set_format(data, data->enc, SPA_DIRECTION_INPUT, raw)) < 0 ||
+	    (res = set_format(data, data->enc, SPA_DIRECTION_OUTPUT, mpeg4)) < 0 ||
+	    (res = set_format(data, data->dec, SPA_DIRECTION_INPUT, mpeg4)) < 0 ||
+	    (res = set_format(data, data->dec, SPA_DIRECTION_OUTPUT, raw)) < 0 ||
+	    (res = set_format(data, data->sink, SPA_DIRECTION_INPUT, raw)) < 0)
+		return res;
+
+	if ((res = use_buffers(data, &data->source_enc, data->source, data->enc)) < 0 ||
+	    (res = use_buffers(data, &data->enc_dec, data->enc, data->dec)) < 0 ||
+	    (res = use_buffers(data, &data->dec_sink, data->dec, data->sink)) < 0)
+		return res;
+
+	return 0;
+}
+
+static int send_command(struct data *data, uint32_t command)
+{
+	struct spa_command cmd = SPA_COMMAND_INIT(command);
+	int res;
+
+	if ((res = spa_node_send_command(data->source, &cmd)) < 0 ||
+	    (res = spa_node_send_command(data->enc, &cmd)) < 0 ||
+	    (res = spa_node_send_command(data->dec, &cmd)) < 0 ||
+	    (res = spa_node_send_command(data->sink, &cmd)) < 0)
+		return res;
+	return 0;
+}
+
+/* feed the encoder while the source has free buffers and pull the
+ * buffers that were done while the io areas were full */
+static void run(struct data *data)
+{
+	struct spa_io_buffers *io = &data->source_enc.io;
+	uint32_t n_iter;
+
+	for (n_iter = 0; n_iter < 100 * N_FRAMES && data->n_frames < N_FRAMES; n_iter++) {
+		if (data->source_outstanding < N_BUFFERS) {
+			io->status = SPA_STATUS_NEED_BUFFER;
+			if (spa_node_process_output(data->source) == SPA_STATUS_HAVE_BUFFER) {
+				data->source_outstanding++;
+				spa_assert_se(spa_node_process_input(data->enc) >= 0);
+				spa_assert_se(io->status == SPA_STATUS_OK);
+			}
+		}
+		if (data->enc_dec.io.status != SPA_STATUS_HAVE_BUFFER &&
+		    spa_node_process_output(data->enc) == SPA_STATUS_HAVE_BUFFER)
+			spa_node_process_input(data->dec);
+
+		iterate(data, 10);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { NULL };
+	const char *str;
+	int res;
+
+	data.map = &default_map.map;
+	data.log = &default_log.log;
+	data.data_loop.version = SPA_VERSION_LOOP;
+	data.data_loop.add_source = do_add_source;
+	data.data_loop.update_source = do_update_source;
+	data.data_loop.remove_source = do_remove_source;
+	data.data_loop.invoke = do_invoke;
+
+	if ((str = getenv("SPA_DEBUG")))
+		data.log->level = atoi(str);
+
+	data.plugin_dir = argc > 1 ? argv[1] : "build/spa/plugins";
+
+	data.support[0].type = SPA_TYPE__TypeMap;
+	data.support[0].data = data.map;
+	data.support[1].type = SPA_TYPE__Log;
+	data.support[1].data = data.log;
+	data.support[2].type = SPA_TYPE_LOOP__DataLoop;
+	data.support[2].data = &data.data_loop;
+	data.support[3].type = SPA_TYPE_LOOP__MainLoop;
+	data.support[3].data = &data.data_loop;
+	data.n_support = 4;
+
+	init_type(&data.type, data.map);
+
+	if ((res = make_nodes(&data)) < 0) {
+		printf("can't make nodes: %s\n", spa_strerror(res));
+		return 1;
+	}
+	if ((res = negotiate(&data)) < 0) {
+		printf("can't negotiate: %s\n", spa_strerror(res));
+		return 1;
+	}
+	if ((res = send_command(&data, data.type.command_node.Start)) < 0) {
+		printf("can't start: %s\n", spa_strerror(res));
+		return 1;
+	}
+
+	run(&data);
+	printf("decoded %u frames\n", data.n_frames);
+	spa_assert_se(data.n_frames >= N_FRAMES);
+
+	spa_assert_se(send_command(&data, data.type.command_node.Pause) >= 0);
+
+	return 0;
+}
@@ -23,8 +23,10 @@
 #include <unistd.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <limits.h>
+#include <getopt.h>
 #include <pthread.h>
-#include <poll.h>
+#include <time.h>
 
 #include <spa/support/log-impl.h>
 #include <spa/support/loop.h>
@@ -36,57 +38,83 @@
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/format-utils.h>
 #include <spa/graph/graph.h>
+
+/* the scheduler under test is selected at build time, the scheduler
+ * headers can't be combined in one compilation unit */
+#ifndef GRAPH_SCHEDULER
+#define GRAPH_SCHEDULER	6
+#endif
+
+#if GRAPH_SCHEDULER == 1
 #include <spa/graph/graph-scheduler1.h>
+#elif GRAPH_SCHEDULER == 3
+#include <spa/graph/graph-scheduler3.h>
+#elif GRAPH_SCHEDULER == 4
+#include <spa/graph/graph-scheduler4.h>
+#elif GRAPH_SCHEDULER == 6
+#include <spa/graph/graph-scheduler6.h>
+#else
+#error "unsupported GRAPH_SCHEDULER"
+#endif
+
+#if GRAPH_SCHEDULER != 3
+#define HAVE_GRAPH_DATA
+#endif
+#if GRAPH_SCHEDULER == 1
+/* have_output() calls process_output on the node itself */
+#define HAVE_OUTPUT_PROCESSES_NODE
+#endif
 
 #define MODE_SYNC_PUSH          (1<<0)
 #define MODE_SYNC_PULL          (1<<1)
-#define MODE_ASYNC_PUSH         (1<<2)
-#define MODE_ASYNC_PULL         (1<<3)
-#define MODE_ASYNC_BOTH         (MODE_ASYNC_PUSH|MODE_ASYNC_PULL)
 #define MODE_DIRECT             (1<<4)
 
+enum shape {
+	SHAPE_CHAIN,		/**< fakesrc -> volume x N -> fakesink */
+	SHAPE_FAN_IN,		/**< fakesrc x N -> audiomixer -> fakesink */
+	SHAPE_FAN_OUT,		/**< (fakesrc -> volume -> fakesink) x N */
+};
+
+static const char *shape_names[] = {
+	[SHAPE_CHAIN] = "chain",
+	[SHAPE_FAN_IN] = "fan-in",
+	[SHAPE_FAN_OUT] = "fan-out",
+};
+
 static SPA_TYPE_MAP_IMPL(default_map, 4096);
 static SPA_LOG_IMPL(default_log);
 
 struct type {
 	uint32_t node;
-	uint32_t props;
 	uint32_t format;
-	uint32_t props_device;
-	uint32_t props_freq;
-	uint32_t props_volume;
-	uint32_t props_min_latency;
-	uint32_t props_live;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_meta meta;
 	struct spa_type_data data;
 	struct spa_type_media_type media_type;
 	struct spa_type_media_subtype media_subtype;
-	struct spa_type_event_node event_node;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
 	struct spa_type_command_node command_node;
 };
 
 static inline void init_type(struct type *type, struct spa_type_map *map)
 {
 	type->node = spa_type_map_get_id(map, SPA_TYPE__Node);
-	type->props = spa_type_map_get_id(map, SPA_TYPE__Props);
 	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
-	type->props_device = spa_type_map_get_id(map, SPA_TYPE_PROPS__device);
-	type->props_freq = spa_type_map_get_id(map, SPA_TYPE_PROPS__frequency);
-	type->props_volume = spa_type_map_get_id(map, SPA_TYPE_PROPS__volume);
-	type->props_min_latency = spa_type_map_get_id(map, SPA_TYPE_PROPS__minLatency);
-	type->props_live = spa_type_map_get_id(map, SPA_TYPE_PROPS__live);
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
 	spa_type_meta_map(map, &type->meta);
 	spa_type_data_map(map, &type->data);
 	spa_type_media_type_map(map, &type->media_type);
 	spa_type_media_subtype_map(map, &type->media_subtype);
-	spa_type_event_node_map(map, &type->event_node);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
 	spa_type_command_node_map(map, &type->command_node);
 }
 
+#define N_BUFFERS	2
+
 struct buffer {
 	struct spa_buffer buffer;
 	struct spa_meta metas[1];
@@ -95,49 +123,82 @@ struct buffer {
 	struct spa_chunk chunks[1];
 };
 
-struct data {
-	struct spa_type_map *map;
-	struct spa_log *log;
-	struct spa_loop data_loop;
-	struct type type;
-
-	int mode;
+struct node {
+	struct graph *graph;
+	struct spa_handle *handle;
+	struct spa_node *node;
+	struct spa_graph_node gnode;
 
-	struct spa_support support[4];
-	uint32_t n_support;
+	struct spa_node wrap;		/**< implementation used for sources and sinks */
+	uint64_t consumed;		/**< buffers consumed by the sink */
+};
 
-	int iterations;
+/* an io area between an output port and an input port */
+struct link {
+	struct spa_io_buffers io;
+	struct spa_graph_port out;
+	struct spa_graph_port in;
+	struct spa_buffer *bufs[N_BUFFERS];
+	struct buffer buffers[N_BUFFERS];
+};
 
-	struct spa_graph graph;
-	struct spa_graph_data graph_data;
-	struct spa_graph_node source_node;
-	struct spa_graph_port source_out;
-	struct spa_graph_port sink_in;
-	struct spa_graph_node sink_node;
+struct plugin {
+	const char *name;
+	void *hnd;
+};
 
-	struct spa_node *sink;
-	struct spa_io_buffers source_sink_io[1];
+struct data;
 
-	struct spa_node *source;
-	struct spa_buffer *source_buffers[1];
-	struct buffer source_buffer[1];
+/* one graph is built for each thread */
+struct graph {
+	struct data *data;
 
-	bool running;
+	struct spa_graph graph;
+#ifdef HAVE_GRAPH_DATA
+	struct spa_graph_data graph_data;
+#endif
+	struct node *nodes;
+	uint32_t n_nodes;
+	struct link *links;
+	uint32_t n_links;
+
+	struct node **sources;
+	uint32_t n_sources;
+	struct node **sinks;
+	uint32_t n_sinks;
+
+	uint64_t *cycles;
+	uint64_t start;
+	uint64_t end;
 	pthread_t thread;
+};
 
-	struct spa_source sources[16];
-	unsigned int n_sources;
-
-	bool rebuild_fds;
-	struct pollfd fds[16];
-	unsigned int n_fds;
+struct data {
+	struct spa_type_map *map;
+	struct spa_log *log;
+	struct spa_loop data_loop;
+	struct type type;
 
-	void *hnd;
-};
+	struct spa_support support[4];
+	uint32_t n_support;
 
-#define MIN_LATENCY     64
+	const char *plugin_dir;
+	struct plugin plugins[3];
 
-#define BUFFER_SIZE    MIN_LATENCY
+	int mode;
+	enum shape shape;
+	uint32_t n_elements;
+	uint32_t buffer_size;
+	uint32_t iterations;
+	uint32_t warmup;
+	uint32_t n_threads;
+
+	struct graph *graphs;
+	pthread_barrier_t barrier;
+	uint64_t elapsed;
+	uint64_t consumed;
+	bool stalled;
+};
 
 static void
 init_buffer(struct data *data, struct spa_buffer **bufs, struct buffer *ba, int n_buffers,
@@ -168,7 +229,7 @@ init_buffer(struct data *data, struct spa_buffer **bufs, struct buffer *ba, int
 		b->datas[0].fd = -1;
 		b->datas[0].mapoffset = 0;
 		b->datas[0].maxsize = size;
-		b->datas[0].data = malloc(size);
+		b->datas[0].data = calloc(1, size);
 		b->datas[0].chunk = &b->chunks[0];
 		b->datas[0].chunk->offset = 0;
 		b->datas[0].chunk->size = size;
@@ -176,22 +237,54 @@ init_buffer(struct data *data, struct spa_buffer **bufs, struct buffer *ba, int
 	}
 }
 
-static int make_node(struct data *data, struct spa_node **node, const char *lib, const char *name)
+static void clear_buffer(struct buffer *ba, int n_buffers)
 {
+	int i;
+
+	for (i = 0; i < n_buffers; i++)
+		free(ba[i].datas[0].data);
+}
+
+static void *load_plugin(struct data *data, const char *lib)
+{
+	struct plugin *p;
+	char path[PATH_MAX];
+	uint32_t i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(data->plugins); i++) {
+		p = &data->plugins[i];
+		if (p->name == NULL)
+			break;
+		if (strcmp(p->name, lib) == 0)
+			return p->hnd;
+	}
+	if (i == SPA_N_ELEMENTS(data->plugins))
+		return NULL;
+
+	snprintf(path, sizeof(path), "%s/%s", data->plugin_dir, lib);
+	if ((p->hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		fprintf(stderr, "can't load %s: %s\n", path, dlerror());
+		return NULL;
+	}
+	p->name = lib;
+	return p->hnd;
+}
+
+static int make_node(struct graph *g, struct node *node, const char *lib, const char *name)
+{
+	struct data *data = g->data;
 	struct spa_handle *handle;
 	int res;
 	spa_handle_factory_enum_func_t enum_func;
 	uint32_t i;
+	void *hnd;
 
-	if (data->hnd == NULL) {
-		if ((data->hnd = dlopen(lib, RTLD_NOW)) == NULL) {
-			printf("can't load %s: %s\n", lib, dlerror());
-			return -errno;
-		}
-	}
-	if ((enum_func = dlsym(data->hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
-		printf("can't find enum function\n");
-		return -errno;
+	if ((hnd = load_plugin(data, lib)) == NULL)
+		return -ENOENT;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		fprintf(stderr, "can't find enum function\n");
+		return -ENOENT;
 	}
 
 	for (i = 0;;) {
@@ -200,7 +293,7 @@ static int make_node(struct data *data, struct spa_node **node, const char *lib,
 
 		if ((res = enum_func(&factory, &i)) <= 0) {
 			if (res != 0)
-				printf("can't enumerate factories: %s\n", spa_strerror(res));
+				fprintf(stderr, "can't enumerate factories: %s\n", spa_strerror(res));
 			break;
 		}
 		if (strcmp(factory->name, name))
@@ -210,343 +303,535 @@ static int make_node(struct data *data, struct spa_node **node, const char *lib,
 		if ((res =
 		     spa_handle_factory_init(factory, handle, NULL, data->support,
 					     data->n_support)) < 0) {
-			printf("can't make factory instance: %d\n", res);
+			fprintf(stderr, "can't make factory instance: %d\n", res);
+			free(handle);
 			return res;
 		}
 		if ((res = spa_handle_get_interface(handle, data->type.node, &iface)) < 0) {
-			printf("can't get interface %d\n", res);
+			fprintf(stderr, "can't get interface %d\n", res);
+			spa_handle_clear(handle);
+			free(handle);
 			return res;
 		}
-		*node = iface;
+		node->graph = g;
+		node->handle = handle;
+		node->node = iface;
+
+		spa_graph_node_init(&node->gnode);
+		spa_graph_node_set_implementation(&node->gnode, node->node);
+		spa_graph_node_add(&g->graph, &node->gnode);
 		return 0;
 	}
 	return -EBADF;
 }
 
-static void on_sink_pull(struct data *data)
+/* fakesink asks for the next buffer after consuming one, which makes
+ * the schedulers pull again immediately. Like a driver, end the cycle
+ * when the sink has consumed the buffer. When pushing, the request is
+ * passed upstream and the source ends the cycle instead. */
+static int sink_process_input(struct spa_node *node)
 {
-	spa_log_trace(data->log, "do sink pull");
-	data->sink_node.state = SPA_STATUS_NEED_BUFFER;
-	if (data->mode & MODE_DIRECT) {
-		spa_node_process_output(data->source);
-		spa_node_process_input(data->sink);
-	} else {
-		spa_graph_need_input(&data->graph, &data->sink_node);
-	}
-}
+	struct node *n = SPA_CONTAINER_OF(node, struct node, wrap);
+	int res;
 
-static void on_source_push(struct data *data)
-{
-	spa_log_trace(data->log, "do source push");
-	if (data->mode & MODE_DIRECT) {
-		spa_node_process_output(data->source);
-		spa_node_process_input(data->sink);
-	} else {
-		spa_graph_have_output(&data->graph, &data->source_node);
+	if ((res = spa_node_process_input(n->node)) == SPA_STATUS_NEED_BUFFER) {
+		n->consumed++;
+		if (!(n->graph->data->mode & MODE_SYNC_PUSH))
+			res = SPA_STATUS_OK;
 	}
+	return res;
 }
 
-static void on_sink_done(void *_data, int seq, int res)
+#ifndef HAVE_OUTPUT_PROCESSES_NODE
+/* when pushing, sources behave like async nodes and only produce a
+ * buffer at the start of the cycle */
+static int source_process_output(struct spa_node *node)
 {
-	struct data *data = _data;
-	spa_log_trace(data->log, "got sink done %d %d", seq, res);
+	return SPA_STATUS_OK;
 }
+#endif
 
-static void on_sink_event(void *_data, struct spa_event *event)
+static int make_source(struct graph *g, struct node *node)
 {
-	struct data *data = _data;
-	spa_log_trace(data->log, "got sink event %d", SPA_EVENT_TYPE(event));
-}
+	int res;
 
-static void on_sink_need_input(void *_data)
-{
-	struct data *data = _data;
-	spa_log_trace(data->log, "need input");
-	on_sink_pull(data);
-	if (--data->iterations == 0)
-		data->running = false;
+	if ((res = make_node(g, node, "test/libspa-test.so", "fakesrc")) < 0)
+		return res;
+
+#ifndef HAVE_OUTPUT_PROCESSES_NODE
+	if (g->data->mode & MODE_SYNC_PUSH) {
+		node->wrap = *node->node;
+		node->wrap.process_output = source_process_output;
+		spa_graph_node_set_implementation(&node->gnode, &node->wrap);
+	}
+#endif
+	return 0;
 }
 
-static void
-on_sink_reuse_buffer(void *_data, uint32_t port_id, uint32_t buffer_id)
+static int make_sink(struct graph *g, struct node *node)
 {
-	struct data *data = _data;
+	int res;
 
-	data->source_sink_io[0].buffer_id = buffer_id;
-}
+	if ((res = make_node(g, node, "test/libspa-test.so", "fakesink")) < 0)
+		return res;
 
-static const struct spa_node_callbacks sink_callbacks = {
-	SPA_VERSION_NODE_CALLBACKS,
-	.done = on_sink_done,
-	.event = on_sink_event,
-	.need_input = on_sink_need_input,
-	.reuse_buffer = on_sink_reuse_buffer
-};
+	node->wrap = *node->node;
+	node->wrap.process_input = sink_process_input;
+	spa_graph_node_set_implementation(&node->gnode, &node->wrap);
 
-static void on_source_done(void *_data, int seq, int res)
-{
-	struct data *data = _data;
-	spa_log_trace(data->log, "got source done %d %d", seq, res);
+	return 0;
 }
 
-static void on_source_event(void *_data, struct spa_event *event)
+static int link_nodes(struct graph *g, struct link *l,
+		      struct node *out, uint32_t out_port,
+		      struct node *in, uint32_t in_port)
 {
-	struct data *data = _data;
-	spa_log_trace(data->log, "got source event %d", SPA_EVENT_TYPE(event));
-}
+	struct data *data = g->data;
+	struct type *t = &data->type;
+	struct spa_pod *format;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[256];
+	int res;
 
-static void on_source_have_output(void *_data)
-{
-	struct data *data = _data;
-	spa_log_trace(data->log, "have_output");
-	on_source_push(data);
-	if (--data->iterations == 0)
-		data->running = false;
-}
+	l->io = SPA_IO_BUFFERS_INIT;
 
-static const struct spa_node_callbacks source_callbacks = {
-	SPA_VERSION_NODE_CALLBACKS,
-	.done = on_source_done,
-	.event = on_source_event,
-	.have_output = on_source_have_output
-};
+	spa_node_port_set_io(out->node, SPA_DIRECTION_OUTPUT, out_port,
+			     t->io.Buffers, &l->io, sizeof(l->io));
+	spa_node_port_set_io(in->node, SPA_DIRECTION_INPUT, in_port,
+			     t->io.Buffers, &l->io, sizeof(l->io));
 
+	spa_graph_port_init(&l->out, SPA_DIRECTION_OUTPUT, out_port, 0, &l->io);
+	spa_graph_port_add(&out->gnode, &l->out);
+	spa_graph_port_init(&l->in, SPA_DIRECTION_INPUT, in_port, 0, &l->io);
+	spa_graph_port_add(&in->gnode, &l->in);
+	spa_graph_port_link(&l->out, &l->in);
 
-static int do_add_source(struct spa_loop *loop, struct spa_source *source)
-{
-	struct data *data = SPA_CONTAINER_OF(loop, struct data, data_loop);
+	/* all elements understand S16 audio, fakesrc and fakesink accept
+	 * any format */
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	format = spa_pod_builder_object(&b,
+		0, t->format,
+		"I", t->media_type.audio,
+		"I", t->media_subtype.raw,
+		":", t->format_audio.format,   "I", t->audio_format.S16,
+		":", t->format_audio.layout,   "i", SPA_AUDIO_LAYOUT_INTERLEAVED,
+		":", t->format_audio.rate,     "i", 48000,
+		":", t->format_audio.channels, "i", 2);
+
+	if ((res = spa_node_port_set_param(in->node, SPA_DIRECTION_INPUT, in_port,
+					   t->param.idFormat, 0, format)) < 0)
+		return res;
+	if ((res = spa_node_port_set_param(out->node, SPA_DIRECTION_OUTPUT, out_port,
+					   t->param.idFormat, 0, format)) < 0)
+		return res;
+
+	init_buffer(data, l->bufs, l->buffers, N_BUFFERS, data->buffer_size);
 
-	data->sources[data->n_sources] = *source;
-	data->n_sources++;
-	data->rebuild_fds = true;
+	if ((res = spa_node_port_use_buffers(in->node, SPA_DIRECTION_INPUT, in_port,
+					     l->bufs, N_BUFFERS)) < 0)
+		return res;
+	if ((res = spa_node_port_use_buffers(out->node, SPA_DIRECTION_OUTPUT, out_port,
+					     l->bufs, N_BUFFERS)) < 0)
+		return res;
+
+	/* some nodes reset the io area in use_buffers, start the first
+	 * cycle by requesting a buffer */
+	l->io.status = SPA_STATUS_NEED_BUFFER;
 
 	return 0;
 }
 
-static int do_update_source(struct spa_source *source)
+static int make_graph(struct data *data, struct graph *g)
 {
+	uint32_t i, n = data->n_elements;
+	struct node *src, *sink, *mix, *prev;
+	int res;
+
+	g->data = data;
+	spa_graph_init(&g->graph);
+#ifdef HAVE_GRAPH_DATA
+	spa_graph_data_init(&g->graph_data, &g->graph);
+	spa_graph_set_callbacks(&g->graph, &spa_graph_impl_default, &g->graph_data);
+#else
+	spa_graph_set_callbacks(&g->graph, &spa_graph_impl_default, &g->graph);
+#endif
+
+	switch (data->shape) {
+	case SHAPE_CHAIN:
+		g->n_nodes = n + 2;
+		g->n_links = n + 1;
+		g->n_sources = g->n_sinks = 1;
+		break;
+	case SHAPE_FAN_IN:
+		g->n_nodes = n + 2;
+		g->n_links = n + 1;
+		g->n_sources = n;
+		g->n_sinks = 1;
+		break;
+	case SHAPE_FAN_OUT:
+		g->n_nodes = 3 * n;
+		g->n_links = 2 * n;
+		g->n_sources = g->n_sinks = n;
+		break;
+	}
+	g->nodes = calloc(g->n_nodes, sizeof(struct node));
+	g->links = calloc(g->n_links, sizeof(struct link));
+	g->sources = calloc(g->n_sources, sizeof(struct node *));
+	g->sinks = calloc(g->n_sinks, sizeof(struct node *));
+	g->cycles = calloc(data->iterations, sizeof(uint64_t));
+	if (g->nodes == NULL || g->links == NULL || g->sources == NULL ||
+	    g->sinks == NULL || g->cycles == NULL)
+		return -ENOMEM;
+
+	switch (data->shape) {
+	case SHAPE_CHAIN:
+		src = prev = &g->nodes[0];
+		if ((res = make_source(g, src)) < 0)
+			return res;
+		for (i = 0; i < n; i++) {
+			struct node *vol = &g->nodes[i + 1];
+			if ((res = make_node(g, vol, "volume/libspa-volume.so", "volume")) < 0)
+				return res;
+			if ((res = link_nodes(g, &g->links[i], prev, 0, vol, 0)) < 0)
+				return res;
+			prev = vol;
+		}
+		sink = &g->nodes[n + 1];
+		if ((res = make_sink(g, sink)) < 0)
+			return res;
+		if ((res = link_nodes(g, &g->links[n], prev, 0, sink, 0)) < 0)
+			return res;
+		g->sources[0] = src;
+		g->sinks[0] = sink;
+		break;
+
+	case SHAPE_FAN_IN:
+		mix = &g->nodes[n];
+		if ((res = make_node(g, mix, "audiomixer/libspa-audiomixer.so", "audiomixer")) < 0)
+			return res;
+		for (i = 0; i < n; i++) {
+			src = &g->nodes[i];
+			if ((res = make_source(g, src)) < 0)
+				return res;
+			if ((res = spa_node_add_port(mix->node, SPA_DIRECTION_INPUT, i)) < 0)
+				return res;
+			if ((res = link_nodes(g, &g->links[i], src, 0, mix, i)) < 0)
+				return res;
+			g->sources[i] = src;
+		}
+		sink = &g->nodes[n + 1];
+		if ((res = make_sink(g, sink)) < 0)
+			return res;
+		if ((res = link_nodes(g, &g->links[n], mix, 0, sink, 0)) < 0)
+			return res;
+		g->sinks[0] = sink;
+		break;
+
+	case SHAPE_FAN_OUT:
+		/* graph ports have exactly one peer so each output is a
+		 * separate branch, one cycle drives all of them */
+		for (i = 0; i < n; i++) {
+			struct node *vol = &g->nodes[3 * i + 1];
+
+			src = &g->nodes[3 * i];
+			sink = &g->nodes[3 * i + 2];
+			if ((res = make_source(g, src)) < 0)
+				return res;
+			if ((res = make_node(g, vol, "volume/libspa-volume.so", "volume")) < 0)
+				return res;
+			if ((res = make_sink(g, sink)) < 0)
+				return res;
+			if ((res = link_nodes(g, &g->links[2 * i], src, 0, vol, 0)) < 0)
+				return res;
+			if ((res = link_nodes(g, &g->links[2 * i + 1], vol, 0, sink, 0)) < 0)
+				return res;
+			g->sources[i] = src;
+			g->sinks[i] = sink;
+		}
+		break;
+	}
 	return 0;
 }
 
-static void do_remove_source(struct spa_source *source)
+static void free_graph(struct graph *g)
 {
-}
+	uint32_t i;
 
-static int
-do_invoke(struct spa_loop *loop,
-	  spa_invoke_func_t func, uint32_t seq, const void *data, size_t size, bool block, void *user_data)
-{
-	return func(loop, false, seq, data, size, user_data);
+	for (i = 0; i < g->n_nodes; i++) {
+		if (g->nodes[i].handle) {
+			spa_handle_clear(g->nodes[i].handle);
+			free(g->nodes[i].handle);
+		}
+	}
+	for (i = 0; i < g->n_links; i++)
+		clear_buffer(g->links[i].buffers, N_BUFFERS);
+
+	free(g->nodes);
+	free(g->links);
+	free(g->sources);
+	free(g->sinks);
+	free(g->cycles);
 }
 
-static int make_nodes(struct data *data)
+static void send_command(struct graph *g, uint32_t id)
 {
+	struct spa_command cmd = SPA_COMMAND_INIT(id);
+	uint32_t i;
 	int res;
 
-	if ((res = make_node(data, &data->sink,
-			     "build/spa/plugins/test/libspa-test.so", "fakesink")) < 0) {
-		printf("can't create fakesink: %d\n", res);
-		return res;
+	for (i = 0; i < g->n_nodes; i++) {
+		if ((res = spa_node_send_command(g->nodes[i].node, &cmd)) < 0)
+			fprintf(stderr, "node %d: command error %s\n", i, spa_strerror(res));
 	}
+}
 
-	if (data->mode & MODE_ASYNC_PULL)
-		spa_node_set_callbacks(data->sink, &sink_callbacks, data);
+static void direct_pull(struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+	int res;
 
-	if ((res = make_node(data, &data->source,
-			     "build/spa/plugins/test/libspa-test.so", "fakesrc")) < 0) {
-		printf("can't create fakesrc: %d\n", res);
-		return res;
-	}
+	res = spa_node_process_output(node->implementation);
+	if (res != SPA_STATUS_NEED_BUFFER)
+		return;
 
-	if (data->mode & MODE_ASYNC_PUSH)
-		spa_node_set_callbacks(data->source, &source_callbacks, data);
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (p->peer && p->io->status == SPA_STATUS_NEED_BUFFER)
+			direct_pull(p->peer->node);
+	}
+	spa_node_process_input(node->implementation);
+}
 
-	data->source_sink_io[0] = SPA_IO_BUFFERS_INIT;
-	data->source_sink_io[0].status = SPA_STATUS_NEED_BUFFER;
+/* run one cycle of the graph */
+static inline void run_cycle(struct graph *g)
+{
+	struct data *data = g->data;
+	uint32_t i;
 
-	spa_node_port_set_io(data->source,
-			     SPA_DIRECTION_OUTPUT, 0,
-			     data->type.io.Buffers,
-			     &data->source_sink_io[0], sizeof(data->source_sink_io[0]));
-	spa_node_port_set_io(data->sink,
-			     SPA_DIRECTION_INPUT, 0,
-			     data->type.io.Buffers,
-			     &data->source_sink_io[0], sizeof(data->source_sink_io[0]));
+	if (data->mode & MODE_DIRECT) {
+		/* call the nodes without the scheduler, this is the
+		 * baseline for the scheduler overhead */
+		for (i = 0; i < g->n_sinks; i++) {
+			struct spa_graph_node *sink = &g->sinks[i]->gnode;
+			struct spa_graph_port *p;
+
+			spa_list_for_each(p, &sink->ports[SPA_DIRECTION_INPUT], link)
+				direct_pull(p->peer->node);
+			spa_node_process_input(sink->implementation);
+		}
+	} else if (data->mode & MODE_SYNC_PULL) {
+		for (i = 0; i < g->n_sinks; i++) {
+			g->sinks[i]->gnode.state = SPA_STATUS_NEED_BUFFER;
+			spa_graph_need_input(&g->graph, &g->sinks[i]->gnode);
+		}
+	} else {
+		for (i = 0; i < g->n_sources; i++) {
+			struct node *src = g->sources[i];
+#ifdef HAVE_OUTPUT_PROCESSES_NODE
+			spa_graph_have_output(&g->graph, &src->gnode);
+#else
+			src->gnode.state = spa_node_process_output(src->node);
+			if (src->gnode.state == SPA_STATUS_HAVE_BUFFER)
+				spa_graph_have_output(&g->graph, &src->gnode);
+#endif
+		}
+	}
+}
 
-	spa_graph_node_init(&data->source_node);
-	spa_graph_node_set_implementation(&data->source_node, data->source);
-	spa_graph_node_add(&data->graph, &data->source_node);
+static inline uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
 
-	data->source_node.flags = (data->mode & MODE_ASYNC_PUSH) ? SPA_GRAPH_NODE_FLAG_ASYNC : 0;
-	spa_graph_port_init( &data->source_out, SPA_DIRECTION_OUTPUT, 0, 0, &data->source_sink_io[0]);
-	spa_graph_port_add(&data->source_node, &data->source_out);
+static void *run_graph(void *user_data)
+{
+	struct graph *g = user_data;
+	struct data *data = g->data;
+	uint64_t t1, t2;
+	uint32_t i;
 
-	spa_graph_node_init(&data->sink_node);
-	spa_graph_node_set_implementation(&data->sink_node, data->sink);
-	spa_graph_node_add(&data->graph, &data->sink_node);
+	for (i = 0; i < data->warmup; i++)
+		run_cycle(g);
 
-	data->sink_node.flags = (data->mode & MODE_ASYNC_PULL) ? SPA_GRAPH_NODE_FLAG_ASYNC : 0;
-	spa_graph_port_init(&data->sink_in, SPA_DIRECTION_INPUT, 0, 0, &data->source_sink_io[0]);
-	spa_graph_port_add(&data->sink_node, &data->sink_in);
+	pthread_barrier_wait(&data->barrier);
 
-	spa_graph_port_link(&data->source_out, &data->sink_in);
+	g->start = t1 = get_time();
+	for (i = 0; i < data->iterations; i++) {
+		run_cycle(g);
+		t2 = get_time();
+		g->cycles[i] = t2 - t1;
+		t1 = t2;
+	}
+	g->end = t1;
 
-	return res;
+	return NULL;
 }
 
-static int negotiate_formats(struct data *data)
+static int run(struct data *data)
 {
-	int res;
-	struct spa_pod *format;
-	struct spa_pod_builder b = { 0 };
-	uint8_t buffer[256];
+	uint32_t i, j;
+	uint64_t start = UINT64_MAX, end = 0;
+	int err;
 
-	spa_pod_builder_init(&b, buffer, sizeof(buffer));
-	format = spa_pod_builder_object(&b,
-			0, data->type.format,
-			"I", data->type.media_type.binary,
-			"I", data->type.media_subtype.raw);
-
-	if ((res = spa_node_port_set_param(data->sink,
-					   SPA_DIRECTION_INPUT, 0,
-					   data->type.param.idFormat, 0,
-					   format)) < 0)
-		return res;
-
-	if ((res = spa_node_port_set_param(data->source,
-					   SPA_DIRECTION_OUTPUT, 0,
-					   data->type.param.idFormat, 0,
-					   format)) < 0)
-		return res;
+	for (i = 0; i < data->n_threads; i++)
+		send_command(&data->graphs[i], data->type.command_node.Start);
 
-	init_buffer(data, data->source_buffers, data->source_buffer, 1, BUFFER_SIZE);
+	pthread_barrier_init(&data->barrier, NULL, data->n_threads + 1);
 
-	if ((res =
-	     spa_node_port_use_buffers(data->sink, SPA_DIRECTION_INPUT, 0, data->source_buffers,
-				       1)) < 0)
-		return res;
-	if ((res =
-	     spa_node_port_use_buffers(data->source, SPA_DIRECTION_OUTPUT, 0, data->source_buffers,
-				       1)) < 0)
-		return res;
+	for (i = 0; i < data->n_threads; i++) {
+		if ((err = pthread_create(&data->graphs[i].thread, NULL,
+					  run_graph, &data->graphs[i])) != 0) {
+			fprintf(stderr, "can't create thread: %d %s\n", err, strerror(err));
+			return -err;
+		}
+	}
+	pthread_barrier_wait(&data->barrier);
 
-	return 0;
-}
+	for (i = 0; i < data->n_threads; i++) {
+		struct graph *g = &data->graphs[i];
 
-static void *loop(void *user_data)
-{
-	struct data *data = user_data;
-
-	printf("enter thread %d\n", data->n_sources);
-	while (data->running) {
-		int i, r;
-
-		/* rebuild */
-		if (data->rebuild_fds) {
-			for (i = 0; i < data->n_sources; i++) {
-				struct spa_source *p = &data->sources[i];
-				data->fds[i].fd = p->fd;
-				data->fds[i].events = p->mask;
-			}
-			data->n_fds = data->n_sources;
-			data->rebuild_fds = false;
-		}
+		pthread_join(g->thread, NULL);
 
-		r = poll(data->fds, data->n_fds, -1);
-		if (r < 0) {
-			if (errno == EINTR)
-				continue;
-			break;
-		}
-		if (r == 0) {
-			fprintf(stderr, "select timeout");
-			break;
-		}
+		start = SPA_MIN(start, g->start);
+		end = SPA_MAX(end, g->end);
 
-		/* after */
-		for (i = 0; i < data->n_sources; i++) {
-			struct spa_source *p = &data->sources[i];
-			p->rmask = 0;
-			if (data->fds[i].revents & POLLIN)
-				p->rmask |= SPA_IO_IN;
-			if (data->fds[i].revents & POLLOUT)
-				p->rmask |= SPA_IO_OUT;
-			if (data->fds[i].revents & POLLHUP)
-				p->rmask |= SPA_IO_HUP;
-			if (data->fds[i].revents & POLLERR)
-				p->rmask |= SPA_IO_ERR;
-		}
-		for (i = 0; i < data->n_sources; i++) {
-			struct spa_source *p = &data->sources[i];
-			if (p->rmask)
-				p->func(p);
+		/* check that data actually flowed to all the sinks */
+		for (j = 0; j < g->n_sinks; j++) {
+			data->consumed += g->sinks[j]->consumed;
+			if (g->sinks[j]->consumed < data->warmup + data->iterations)
+				data->stalled = true;
 		}
 	}
-	printf("leave thread\n");
+	data->elapsed = end - start;
 
-	return NULL;
+	pthread_barrier_destroy(&data->barrier);
+
+	for (i = 0; i < data->n_threads; i++)
+		send_command(&data->graphs[i], data->type.command_node.Pause);
+
+	return 0;
 }
 
-static void run_graph(struct data *data)
+static int do_add_source(struct spa_loop *loop, struct spa_source *source)
 {
-	int res;
-	int err, i;
-	struct timespec now;
-	int64_t start, stop;
-
-	{
-		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Start);
-		if ((res = spa_node_send_command(data->source, &cmd)) < 0)
-			printf("got source error %d\n", res);
-		if ((res = spa_node_send_command(data->sink, &cmd)) < 0)
-			printf("got sink error %d\n", res);
-	}
+	return -ENOTSUP;
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	start = SPA_TIMESPEC_TO_TIME(&now);
+static int do_update_source(struct spa_source *source)
+{
+	return 0;
+}
 
-	printf("running\n");
+static void do_remove_source(struct spa_source *source)
+{
+}
 
-	if (data->mode & MODE_SYNC_PUSH) {
-		for (i = 0; i < data->iterations; i++)
-			on_source_push(data);
-	} else if (data->mode & MODE_SYNC_PULL) {
-		for (i = 0; i < data->iterations; i++)
-			on_sink_pull(data);
-	} else {
-		data->running = true;
-		if ((err = pthread_create(&data->thread, NULL, loop, data)) != 0) {
-			printf("can't create thread: %d %s", err, strerror(err));
-			data->running = false;
-		}
-		if (data->running) {
-			pthread_join(data->thread, NULL);
-		}
-	}
+static int
+do_invoke(struct spa_loop *loop,
+	  spa_invoke_func_t func, uint32_t seq, const void *data, size_t size, bool block, void *user_data)
+{
+	return func(loop, false, seq, data, size, user_data);
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	stop = SPA_TIMESPEC_TO_TIME(&now);
+static int compare_time(const void *a, const void *b)
+{
+	uint64_t ta = *(const uint64_t *) a, tb = *(const uint64_t *) b;
+	return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
 
-	printf("stopping, elapsed %" PRIi64 "\n", stop - start);
+static uint64_t percentile(const uint64_t *sorted, uint32_t n, double p)
+{
+	uint32_t idx = (uint32_t) (p * (n - 1) / 100.0 + 0.5);
+	return sorted[SPA_MIN(idx, n - 1)];
+}
 
-	{
-		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Pause);
-		if ((res = spa_node_send_command(data->sink, &cmd)) < 0)
-			printf("got error %d\n", res);
-		if ((res = spa_node_send_command(data->source, &cmd)) < 0)
-			printf("got source error %d\n", res);
-	}
+static void report(struct data *data)
+{
+	uint32_t i, n_cycles = data->iterations * data->n_threads;
+	uint32_t n_nodes = data->graphs[0].n_nodes;
+	uint64_t *all, total = 0;
+	double mean;
+	const char *mode;
+
+	all = malloc(n_cycles * sizeof(uint64_t));
+	for (i = 0; i < data->n_threads; i++)
+		memcpy(&all[i * data->iterations], data->graphs[i].cycles,
+		       data->iterations * sizeof(uint64_t));
+	for (i = 0; i < n_cycles; i++)
+		total += all[i];
+	qsort(all, n_cycles, sizeof(uint64_t), compare_time);
+
+	mean = (double) total / n_cycles;
+	mode = data->mode & MODE_DIRECT ? "direct" :
+	       data->mode & MODE_SYNC_PULL ? "pull" : "push";
+
+	printf("{\n");
+	printf("  \"scheduler\": %d,\n", GRAPH_SCHEDULER);
+	printf("  \"shape\": \"%s\",\n", shape_names[data->shape]);
+	printf("  \"mode\": \"%s\",\n", mode);
+	printf("  \"elements\": %u,\n", data->n_elements);
+	printf("  \"nodes\": %u,\n", n_nodes);
+	printf("  \"threads\": %u,\n", data->n_threads);
+	printf("  \"buffer_size\": %u,\n", data->buffer_size);
+	printf("  \"iterations\": %u,\n", data->iterations);
+	printf("  \"elapsed_ns\": %" PRIu64 ",\n", data->elapsed);
+	printf("  \"buffers\": %" PRIu64 ",\n", data->consumed);
+	printf("  \"stalled\": %s,\n", data->stalled ? "true" : "false");
+	printf("  \"cycles_per_sec\": %.1f,\n", n_cycles * 1e9 / data->elapsed);
+	printf("  \"ns_per_node\": %.2f,\n", mean / n_nodes);
+	printf("  \"cycle_ns\": {\n");
+	printf("    \"min\": %" PRIu64 ",\n", all[0]);
+	printf("    \"mean\": %.1f,\n", mean);
+	printf("    \"p50\": %" PRIu64 ",\n", percentile(all, n_cycles, 50.0));
+	printf("    \"p90\": %" PRIu64 ",\n", percentile(all, n_cycles, 90.0));
+	printf("    \"p99\": %" PRIu64 ",\n", percentile(all, n_cycles, 99.0));
+	printf("    \"p999\": %" PRIu64 ",\n", percentile(all, n_cycles, 99.9));
+	printf("    \"max\": %" PRIu64 "\n", all[n_cycles - 1]);
+	printf("  }\n");
+	printf("}\n");
+
+	free(all);
+}
+
+static void show_help(const char *name)
+{
+	fprintf(stdout, "%s [options]\n"
+		"  -h, --help                            Show this help\n"
+		"  -s, --shape=chain|fan-in|fan-out      Graph shape (default chain)\n"
+		"  -n, --elements=N                      Volume nodes in a chain, sources\n"
+		"                                        of a fan-in or branches of a\n"
+		"                                        fan-out (default 1)\n"
+		"  -m, --mode=pull|push|direct           Scheduling mode (default pull)\n"
+		"  -b, --buffer-size=BYTES               Buffer size (default 256)\n"
+		"  -i, --iterations=N                    Measured cycles per thread\n"
+		"                                        (default 100000)\n"
+		"  -w, --warmup=N                        Unmeasured cycles (default 1000)\n"
+		"  -t, --threads=N                       Independent graphs, one per\n"
+		"                                        thread (default 1)\n"
+		"  -p, --plugin-dir=DIR                  Plugin directory\n"
+		"                                        (default build/spa/plugins)\n",
+		name);
 }
 
 int main(int argc, char *argv[])
 {
 	struct data data = { NULL };
-	int res;
+	int res, c;
+	uint32_t i;
 	const char *str;
-
-	spa_graph_init(&data.graph);
-	spa_graph_data_init(&data.graph_data, &data.graph);
-	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+	static const struct option long_options[] = {
+		{"help",	0, NULL, 'h'},
+		{"shape",	1, NULL, 's'},
+		{"elements",	1, NULL, 'n'},
+		{"mode",	1, NULL, 'm'},
+		{"buffer-size",	1, NULL, 'b'},
+		{"iterations",	1, NULL, 'i'},
+		{"warmup",	1, NULL, 'w'},
+		{"threads",	1, NULL, 't'},
+		{"plugin-dir",	1, NULL, 'p'},
+		{NULL,		0, NULL, 0}
+	};
 
 	data.map = &default_map.map;
 	data.log = &default_log.log;
@@ -559,10 +844,72 @@ int main(int argc, char *argv[])
 	if ((str = getenv("SPA_DEBUG")))
 		data.log->level = atoi(str);
 
-	data.mode = argc > 1 ? atoi(argv[1]) : MODE_SYNC_PUSH;
-	data.iterations = argc > 2 ? atoi(argv[2]) : 100000;
-
-	printf("mode %08x\n", data.mode);
+	data.mode = MODE_SYNC_PULL;
+	data.shape = SHAPE_CHAIN;
+	data.n_elements = 1;
+	data.buffer_size = 256;
+	data.iterations = 100000;
+	data.warmup = 1000;
+	data.n_threads = 1;
+	data.plugin_dir = getenv("SPA_PLUGIN_DIR");
+	if (data.plugin_dir == NULL)
+		data.plugin_dir = "build/spa/plugins";
+
+	while ((c = getopt_long(argc, argv, "hs:n:m:b:i:w:t:p:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 's':
+			for (i = 0; i < SPA_N_ELEMENTS(shape_names); i++)
+				if (strcmp(optarg, shape_names[i]) == 0)
+					break;
+			if (i == SPA_N_ELEMENTS(shape_names)) {
+				fprintf(stderr, "unknown shape %s\n", optarg);
+				return -1;
+			}
+			data.shape = i;
+			break;
+		case 'n':
+			data.n_elements = atoi(optarg);
+			break;
+		case 'm':
+			if (strcmp(optarg, "pull") == 0)
+				data.mode = MODE_SYNC_PULL;
+			else if (strcmp(optarg, "push") == 0)
+				data.mode = MODE_SYNC_PUSH;
+			else if (strcmp(optarg, "direct") == 0)
+				data.mode = MODE_DIRECT;
+			else {
+				fprintf(stderr, "unknown mode %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			data.buffer_size = atoi(optarg);
+			break;
+		case 'i':
+			data.iterations = atoi(optarg);
+			break;
+		case 'w':
+			data.warmup = atoi(optarg);
+			break;
+		case 't':
+			data.n_threads = atoi(optarg);
+			break;
+		case 'p':
+			data.plugin_dir = optarg;
+			break;
+		default:
+			show_help(argv[0]);
+			return -1;
+		}
+	}
+	if (data.n_elements == 0 || data.iterations == 0 || data.n_threads == 0 ||
+	    data.buffer_size < 4) {
+		fprintf(stderr, "invalid arguments\n");
+		return -1;
+	}
 
 	data.support[0].type = SPA_TYPE__TypeMap;
 	data.support[0].data = data.map;
@@ -576,14 +923,27 @@ int main(int argc, char *argv[])
 
 	init_type(&data.type, data.map);
 
-	if ((res = make_nodes(&data)) < 0) {
-		printf("can't make nodes: %d\n", res);
-		return -1;
+	data.graphs = calloc(data.n_threads, sizeof(struct graph));
+	for (i = 0; i < data.n_threads; i++) {
+		if ((res = make_graph(&data, &data.graphs[i])) < 0) {
+			fprintf(stderr, "can't make graph: %s\n", spa_strerror(res));
+			return -1;
+		}
 	}
-	if ((res = negotiate_formats(&data)) < 0) {
-		printf("can't negotiate nodes: %d\n", res);
+
+	if ((res = run(&data)) < 0)
 		return -1;
-	}
 
-	run_graph(&data);
+	report(&data);
+	if (data.stalled)
+		fprintf(stderr, "graph stalled, not all sinks received data\n");
+
+	for (i = 0; i < data.n_threads; i++)
+		free_graph(&data.graphs[i]);
+	free(data.graphs);
+	for (i = 0; i < SPA_N_ELEMENTS(data.plugins); i++)
+		if (data.plugins[i].hnd)
+			dlclose(data.plugins[i].hnd);
+
+	return data.stalled ? -1 : 0;
 }
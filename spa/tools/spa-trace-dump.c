@@ -0,0 +1,109 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "log-trace.h"
+
+/* Format the binary trace records written by the logger in binary trace
+ * mode, see PIPEWIRE_TRACE */
+
+struct data {
+	uint64_t first_time;
+};
+
+static void dump_event(struct data *data, struct trace_event *ev)
+{
+	const char *fmt, *file, *func;
+	char text[1024];
+	uint64_t time;
+	int offset;
+
+	if ((offset = trace_event_location(ev, &fmt, &file, &func)) < 0) {
+		fprintf(stderr, "invalid event record\n");
+		return;
+	}
+	trace_format(text, sizeof(text), fmt, SPA_MEMBER(ev, offset, uint8_t),
+		     ev->record.size - offset);
+
+	if (data->first_time == 0)
+		data->first_time = ev->time;
+	time = ev->time - data->first_time;
+
+	if (strrchr(file, '/'))
+		file = strrchr(file, '/') + 1;
+
+	printf("[%" PRIu64 ".%09" PRIu64 "][%s:%u %s()] %s\n",
+		(uint64_t) (time / SPA_NSEC_PER_SEC), (uint64_t) (time % SPA_NSEC_PER_SEC),
+		file, ev->line, func, text);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0, };
+	uint64_t buffer[TRACE_MAX_RECORD / sizeof(uint64_t)];
+	struct trace_record *rec = (struct trace_record *) buffer;
+	char magic[sizeof(TRACE_FILE_MAGIC) - 1];
+	FILE *f;
+	int res = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace-file>\n", argv[0]);
+		return -1;
+	}
+
+	if ((f = fopen(argv[1], "r")) == NULL) {
+		fprintf(stderr, "can't open %s: %s\n", argv[1], strerror(errno));
+		return -1;
+	}
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s is not a trace file\n", argv[1]);
+		res = -1;
+		goto exit;
+	}
+
+	while (fread(rec, sizeof(*rec), 1, f) == 1) {
+		if (rec->size < sizeof(*rec) || rec->size > sizeof(buffer)) {
+			fprintf(stderr, "invalid record size %u\n", rec->size);
+			res = -1;
+			break;
+		}
+		if (fread(SPA_MEMBER(rec, sizeof(*rec), void), rec->size - sizeof(*rec), 1, f) != 1)
+			break;
+
+		switch (rec->type) {
+		case TRACE_RECORD_EVENT:
+			if (rec->size >= sizeof(struct trace_event))
+				dump_event(&data, (struct trace_event *) rec);
+			break;
+		default:
+			break;
+		}
+	}
+
+      exit:
+	fclose(f);
+
+	return res;
+}
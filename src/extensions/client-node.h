@@ -27,6 +27,7 @@ extern "C" {
 #include <spa/utils/defs.h>
 #include <spa/param/param.h>
 #include <spa/node/node.h>
+#include <spa/node/io.h>
 
 #include <pipewire/proxy.h>
 
@@ -44,6 +45,26 @@ struct pw_client_node_area {
 	uint32_t n_input_ports;		/**< number of input ports of the node */
 	uint32_t max_output_ports;	/**< max output ports of the node */
 	uint32_t n_output_ports;	/**< number of output ports of the node */
+	struct spa_io_clock clock;	/**< clock of the driver, updated every cycle */
+};
+
+/** A control update in the control ring of the transport
+ *
+ * The client writes control updates into the ring, the server applies
+ * them at the start of the next cycle to all prop io areas of the node
+ * with \a id. Updates for the same id are applied in order so only the
+ * last value of a cycle is seen by the graph.
+ */
+struct pw_client_node_control {
+	uint32_t id;			/**< id of the io area, a SPA_TYPE_IO_PROP_BASE type */
+	uint32_t padding;
+	union {
+		struct spa_pod pod;
+		struct spa_pod_int int_value;
+		struct spa_pod_long long_value;
+		struct spa_pod_float float_value;
+		struct spa_pod_double double_value;
+	} value;			/**< the new value of the prop io area */
 };
 
 /** \class pw_client_node_transport
@@ -58,10 +79,17 @@ struct pw_client_node_transport {
 	struct pw_client_node_area *area;	/**< the transport area */
 	struct spa_io_buffers *inputs;		/**< array of buffer input io */
 	struct spa_io_buffers *outputs;		/**< array of buffer output io */
+	struct spa_io_buffer_ring *input_rings;	/**< array of input buffer rings, filled by
+						  *  the server when the client uses them */
+	struct spa_io_buffer_ring *output_rings;/**< array of output buffer rings, filled by
+						  *  the client when it uses them */
 	void *input_data;			/**< input memory for ringbuffer */
 	struct spa_ringbuffer *input_buffer;	/**< ringbuffer for input memory */
 	void *output_data;			/**< output memory for ringbuffer */
 	struct spa_ringbuffer *output_buffer;	/**< ringbuffer for output memory */
+	void *control_data;			/**< control memory for ringbuffer */
+	struct spa_ringbuffer *control_buffer;	/**< ringbuffer for control updates, from
+						  *  client to server */
 
 	/** Destroy a transport
 	 * \param trans a transport to destroy
@@ -100,12 +128,33 @@ struct pw_client_node_transport {
 	 * Use this function after \ref next_message().
 	 */
 	int (*parse_message) (struct pw_client_node_transport *trans, void *message);
+
+	/** Add a control update to the transport
+	 * \param trans the transport to add the control update to
+	 * \param control the control update
+	 * \return 0 on success, -ENOSPC when the ring is full
+	 *
+	 * Only the client can add control updates. This function can be
+	 * called from any thread but not concurrently.
+	 */
+	int (*add_control) (struct pw_client_node_transport *trans,
+			    const struct pw_client_node_control *control);
+
+	/** Get the next control update from the transport
+	 * \param trans the transport to read from
+	 * \param[out] control the control update
+	 * \return 1 when a control update was read, 0 when the ring is empty
+	 */
+	int (*next_control) (struct pw_client_node_transport *trans,
+			     struct pw_client_node_control *control);
 };
 
 #define pw_client_node_transport_destroy(t)		((t)->destroy((t)))
 #define pw_client_node_transport_add_message(t,m)	((t)->add_message((t), (m)))
 #define pw_client_node_transport_next_message(t,m)	((t)->next_message((t), (m)))
 #define pw_client_node_transport_parse_message(t,m)	((t)->parse_message((t), (m)))
+#define pw_client_node_transport_add_control(t,c)	((t)->add_control((t), (c)))
+#define pw_client_node_transport_next_control(t,c)	((t)->next_control((t), (c)))
 
 enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT,		/*< signal that the node has output */
@@ -0,0 +1,248 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PIPEWIRE_EXT_PROFILER_H__
+#define __PIPEWIRE_EXT_PROFILER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include <spa/utils/defs.h>
+
+#include <pipewire/proxy.h>
+#include <pipewire/resource.h>
+
+struct pw_profiler_proxy;
+
+#define PW_TYPE_INTERFACE__Profiler		PW_TYPE_INTERFACE_BASE "Profiler"
+
+#define PW_VERSION_PROFILER			0
+
+#define PW_PROFILER_MAX_NODES		256
+#define PW_PROFILER_HISTOGRAM_SIZE	64
+
+/** Timing statistics, all times are in nanoseconds
+ *
+ * The histogram has 2 buckets per power of 2, bucket 2n holds the
+ * values in [2^n, 1.5 * 2^n) and bucket 2n+1 the values in
+ * [1.5 * 2^n, 2^(n+1)). Use \ref pw_profiler_stats_percentile() to
+ * estimate percentiles from the histogram.
+ */
+struct pw_profiler_stats {
+	uint64_t count;		/**< number of samples */
+	uint64_t total;		/**< sum of all samples */
+	uint64_t min;		/**< smallest sample */
+	uint64_t max;		/**< largest sample */
+	uint64_t last;		/**< last sample */
+	uint32_t histogram[PW_PROFILER_HISTOGRAM_SIZE];
+};
+
+/** Timing of one node */
+struct pw_profiler_node {
+	uint32_t seq;		/**< odd while the data thread updates the node */
+	uint32_t id;		/**< global id of the node, SPA_ID_INVALID when unused */
+	char name[64];		/**< the name of the node */
+	uint64_t xruns;		/**< number of late cycles caused by this node */
+	struct pw_profiler_stats process;	/**< time of the process calls */
+};
+
+/** Shared memory area with the profiling data
+ *
+ * The area is written by the data thread of the server and can be read
+ * at any time by the clients. Use \ref pw_profiler_area_read_node() and
+ * \ref pw_profiler_area_read_cycle() to get a consistent copy of the data.
+ */
+struct pw_profiler_area {
+	uint32_t version;	/**< PW_VERSION_PROFILER */
+	uint32_t max_nodes;	/**< size of the nodes array */
+	uint32_t seq;		/**< odd while the data thread updates the cycle data */
+	uint32_t padding;
+	uint64_t cycles;	/**< number of completed cycles */
+	uint64_t xruns;		/**< number of cycles that took longer than the period */
+	uint64_t last_xrun_time;	/**< CLOCK_MONOTONIC time of the last xrun */
+	uint32_t last_xrun_node;	/**< global id of the node that caused the last xrun */
+	uint32_t padding2;
+	struct pw_profiler_stats cycle;		/**< time to complete a cycle */
+	struct pw_profiler_stats period;	/**< time between cycle starts */
+	struct pw_profiler_node nodes[0];
+};
+
+#define PW_PROFILER_AREA_SIZE(max_nodes)	\
+	(sizeof(struct pw_profiler_area) + (max_nodes) * sizeof(struct pw_profiler_node))
+
+static inline uint32_t pw_profiler_stats_bucket(uint64_t value)
+{
+	uint32_t n, b;
+
+	if (value < 2)
+		return 0;
+	n = 63 - __builtin_clzll(value);
+	b = 2 * n + ((value >> (n - 1)) & 1);
+	return SPA_MIN(b, PW_PROFILER_HISTOGRAM_SIZE - 1);
+}
+
+static inline void pw_profiler_stats_add(struct pw_profiler_stats *stats, uint64_t value)
+{
+	if (stats->count == 0 || value < stats->min)
+		stats->min = value;
+	if (value > stats->max)
+		stats->max = value;
+	stats->last = value;
+	stats->total += value;
+	stats->count++;
+	stats->histogram[pw_profiler_stats_bucket(value)]++;
+}
+
+/** Estimate a percentile from the histogram
+ * \param stats the stats
+ * \param percentile the percentile between 0 and 100
+ * \return the estimated value in nanoseconds */
+static inline uint64_t
+pw_profiler_stats_percentile(const struct pw_profiler_stats *stats, uint32_t percentile)
+{
+	uint64_t target, sum = 0, low;
+	uint32_t i;
+
+	if (stats->count == 0)
+		return 0;
+
+	target = (stats->count * percentile + 99) / 100;
+	for (i = 0; i < PW_PROFILER_HISTOGRAM_SIZE; i++) {
+		sum += stats->histogram[i];
+		if (sum >= target && sum > 0)
+			break;
+	}
+	if (i >= PW_PROFILER_HISTOGRAM_SIZE)
+		return stats->max;
+	if (i < 2)
+		return i;
+
+	/* middle of the bucket */
+	low = (1ULL << (i / 2)) + (i & 1) * (1ULL << (i / 2 - 1));
+	return SPA_CLAMP(low + (1ULL << (i / 2)) / 4, stats->min, stats->max);
+}
+
+static inline bool pw_profiler_read_begin(const uint32_t *seq, uint32_t *val)
+{
+	*val = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+	return (*val & 1) == 0;
+}
+
+static inline bool pw_profiler_read_end(const uint32_t *seq, uint32_t val)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) == val;
+}
+
+/** Copy a consistent snapshot of a node
+ * \return true when the copy succeeded */
+static inline bool
+pw_profiler_area_read_node(const struct pw_profiler_area *area, uint32_t index,
+			   struct pw_profiler_node *node)
+{
+	const struct pw_profiler_node *n = &area->nodes[index];
+	uint32_t seq;
+	int retry;
+
+	for (retry = 0; retry < 16; retry++) {
+		if (!pw_profiler_read_begin(&n->seq, &seq))
+			continue;
+		memcpy(node, n, sizeof(*node));
+		if (pw_profiler_read_end(&n->seq, seq))
+			return true;
+	}
+	return false;
+}
+
+/** Copy a consistent snapshot of the area header without the nodes
+ * \return true when the copy succeeded */
+static inline bool
+pw_profiler_area_read_cycle(const struct pw_profiler_area *area, struct pw_profiler_area *copy)
+{
+	uint32_t seq;
+	int retry;
+
+	for (retry = 0; retry < 16; retry++) {
+		if (!pw_profiler_read_begin(&area->seq, &seq))
+			continue;
+		memcpy(copy, area, sizeof(*copy));
+		if (pw_profiler_read_end(&area->seq, seq))
+			return true;
+	}
+	return false;
+}
+
+#define PW_PROFILER_PROXY_METHOD_RESET		0
+#define PW_PROFILER_PROXY_METHOD_NUM		1
+
+/** \ref pw_profiler methods */
+struct pw_profiler_proxy_methods {
+#define PW_VERSION_PROFILER_PROXY_METHODS	0
+	uint32_t version;
+
+	/** Reset the statistics */
+	void (*reset) (void *object);
+};
+
+static inline void
+pw_profiler_proxy_reset(struct pw_profiler_proxy *p)
+{
+        pw_proxy_do((struct pw_proxy*)p, struct pw_profiler_proxy_methods, reset);
+}
+
+#define PW_PROFILER_PROXY_EVENT_AREA		0
+#define PW_PROFILER_PROXY_EVENT_NUM		1
+
+/** \ref pw_profiler events */
+struct pw_profiler_proxy_events {
+#define PW_VERSION_PROFILER_PROXY_EVENTS	0
+	uint32_t version;
+	/**
+	 * Notify of the shared profiler area
+	 *
+	 * Sent when the client binds to the profiler. The area contains a
+	 * struct pw_profiler_area that is updated while the client is bound.
+	 *
+	 * \param memfd the fd of the memory
+	 * \param offset offset of the area in \a memfd
+	 * \param size size of the area
+	 */
+	void (*area) (void *object, int memfd, uint32_t offset, uint32_t size);
+};
+
+static inline void
+pw_profiler_proxy_add_listener(struct pw_profiler_proxy *p,
+			       struct spa_hook *listener,
+			       const struct pw_profiler_proxy_events *events,
+			       void *data)
+{
+        pw_proxy_add_proxy_listener((struct pw_proxy*)p, listener, events, data);
+}
+
+#define pw_profiler_resource_area(r,...)	\
+	pw_resource_notify(r,struct pw_profiler_proxy_events,area,__VA_ARGS__)
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __PIPEWIRE_EXT_PROFILER_H__ */
@@ -31,6 +31,16 @@ extern "C" {
 #define PW_TYPE_PROTOCOL__Native	PW_TYPE_PROTOCOL_BASE "Native"
 #define PW_TYPE_PROTOCOL_NATIVE_BASE	PW_TYPE_PROTOCOL__Native ":"
 
+/** Client property to announce that the client can parse batched messages.
+ * Servers will then batch registry and info events and replace queued info
+ * events of an object with newer ones before they are sent. */
+#define PW_PROTOCOL_NATIVE_PROP_BATCH	"pipewire.protocol.native.batch"
+
+/** Client property to announce that the client can parse messages with the
+ * number of fds in the header. The server then switches to them and the
+ * client follows. */
+#define PW_PROTOCOL_NATIVE_PROP_MESSAGE_FDS	"pipewire.protocol.native.message-fds"
+
 struct pw_protocol_native_demarshal {
 	int (*func) (void *object, void *data, size_t size);
 
@@ -41,7 +51,7 @@ struct pw_protocol_native_demarshal {
 
 /** \ref pw_protocol_native_ext methods */
 struct pw_protocol_native_ext {
-#define PW_VERSION_PROTOCOL_NATIVE_EXT	0
+#define PW_VERSION_PROTOCOL_NATIVE_EXT	1
 	uint32_t version;
 
 	struct spa_pod_builder * (*begin_proxy) (struct pw_proxy *proxy,
@@ -62,6 +72,13 @@ struct pw_protocol_native_ext {
 	void (*end_resource) (struct pw_resource *resource,
 			      struct spa_pod_builder *builder);
 
+	/** Start an event that can be batched. When \a prev is not NULL and
+	 * an event with the same opcode is still queued for \a resource, \a prev
+	 * is set to the queued event, which is dropped when the new event is
+	 * ended. Since version 1 */
+	struct spa_pod_builder * (*begin_resource_batch) (struct pw_resource *resource,
+							  uint8_t opcode,
+							  const struct spa_pod **prev);
 };
 
 #define pw_protocol_native_begin_proxy(p,...)		pw_protocol_ext(pw_proxy_get_protocol(p),struct pw_protocol_native_ext,begin_proxy,p,__VA_ARGS__)
@@ -73,6 +90,7 @@ struct pw_protocol_native_ext {
 #define pw_protocol_native_add_resource_fd(r,...)	pw_protocol_ext(pw_resource_get_protocol(r),struct pw_protocol_native_ext,add_resource_fd,r,__VA_ARGS__)
 #define pw_protocol_native_get_resource_fd(r,...)	pw_protocol_ext(pw_resource_get_protocol(r),struct pw_protocol_native_ext,get_resource_fd,r,__VA_ARGS__)
 #define pw_protocol_native_end_resource(r,...)		pw_protocol_ext(pw_resource_get_protocol(r),struct pw_protocol_native_ext,end_resource,r,__VA_ARGS__)
+#define pw_protocol_native_begin_resource_batch(r,...)	pw_protocol_ext(pw_resource_get_protocol(r),struct pw_protocol_native_ext,begin_resource_batch,r,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
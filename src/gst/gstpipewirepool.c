@@ -108,6 +108,8 @@ void gst_pipewire_pool_wrap_buffer (GstPipeWirePool *pool, struct pw_buffer *b)
   data->pool = gst_object_ref (pool);
   data->owner = NULL;
   data->header = spa_buffer_find_meta (b->buffer, t->meta.Header);
+  data->damage = spa_buffer_get_meta (b->buffer, t->meta.VideoDamage);
+  data->timing = spa_buffer_find_meta (b->buffer, t->meta.Timing);
   data->flags = GST_BUFFER_FLAGS (buf);
   data->b = b;
   data->buf = buf;
@@ -155,6 +157,38 @@ gst_pipewire_pool_remove_buffer (GstPipeWirePool *pool, GstBuffer *buffer)
 }
 #endif
 
+/* Wake up a thread blocked in acquire_buffer. This is called from the
+ * PipeWire thread whenever buffers are recycled and only takes the lock
+ * when there is a waiter. */
+void
+gst_pipewire_pool_wakeup (GstPipeWirePool *pool)
+{
+  /* order the queued buffer before reading the waiting counter, pairs with
+   * the increment in acquire_buffer */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (g_atomic_int_get (&pool->waiting) == 0)
+    return;
+
+  g_mutex_lock (&pool->lock);
+  g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&pool->lock);
+}
+
+static void
+update_video_meta (GstPipeWirePool *p, GstBuffer *buffer)
+{
+  GstVideoInfo *info = &p->video_info;
+  GstVideoMeta *meta;
+
+  if ((meta = gst_buffer_get_video_meta (buffer)) != NULL)
+    return;
+
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info),
+      info->offset, info->stride);
+}
+
 static GstFlowReturn
 acquire_buffer (GstBufferPool * pool, GstBuffer ** buffer,
         GstBufferPoolAcquireParams * params)
@@ -163,29 +197,42 @@ acquire_buffer (GstBufferPool * pool, GstBuffer ** buffer,
   GstPipeWirePoolData *data;
   struct pw_buffer *b;
 
-  GST_OBJECT_LOCK (pool);
-  while (TRUE) {
-    if (G_UNLIKELY (GST_BUFFER_POOL_IS_FLUSHING (pool)))
-      goto flushing;
-
-    if ((b = pw_stream_dequeue_buffer(p->stream)))
-      break;
+  /* the stream dequeue is a single consumer ringbuffer that is filled by
+   * the PipeWire thread, we can use it without the thread loop lock */
+  if (G_UNLIKELY ((b = pw_stream_dequeue_buffer (p->stream)) == NULL)) {
+    if (params && (params->flags & GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT))
+      return GST_FLOW_EOS;
+
+    GST_DEBUG_OBJECT (pool, "queue empty, waiting");
+
+    g_mutex_lock (&p->lock);
+    g_atomic_int_inc (&p->waiting);
+    while (TRUE) {
+      if (G_UNLIKELY (GST_BUFFER_POOL_IS_FLUSHING (pool)))
+        break;
+      if ((b = pw_stream_dequeue_buffer (p->stream)))
+        break;
+      g_cond_wait (&p->cond, &p->lock);
+    }
+    g_atomic_int_dec_and_test (&p->waiting);
+    g_mutex_unlock (&p->lock);
 
-    GST_WARNING ("queue empty");
-    g_cond_wait (&p->cond, GST_OBJECT_GET_LOCK (pool));
+    if (b == NULL)
+      goto flushing;
   }
 
   data = b->user_data;
   *buffer = data->buf;
 
-  GST_OBJECT_UNLOCK (pool);
-  GST_DEBUG ("acquire buffer %p", *buffer);
+  if (p->add_video_meta)
+    update_video_meta (p, *buffer);
+
+  GST_LOG_OBJECT (pool, "acquire buffer %p", *buffer);
 
   return GST_FLOW_OK;
 
 flushing:
   {
-    GST_OBJECT_UNLOCK (pool);
     return GST_FLOW_FLUSHING;
   }
 }
@@ -196,9 +243,36 @@ flush_start (GstBufferPool * pool)
   GstPipeWirePool *p = GST_PIPEWIRE_POOL (pool);
 
   GST_DEBUG ("flush start");
-  GST_OBJECT_LOCK (pool);
-  g_cond_signal (&p->cond);
-  GST_OBJECT_UNLOCK (pool);
+  g_mutex_lock (&p->lock);
+  g_cond_broadcast (&p->cond);
+  g_mutex_unlock (&p->lock);
+}
+
+static const gchar **
+get_options (GstBufferPool * pool)
+{
+  static const gchar *options[] = { GST_BUFFER_POOL_OPTION_VIDEO_META, NULL };
+  return options;
+}
+
+static gboolean
+set_config (GstBufferPool * pool, GstStructure * config)
+{
+  GstPipeWirePool *p = GST_PIPEWIRE_POOL (pool);
+  GstCaps *caps;
+  guint size, min_buffers, max_buffers;
+
+  if (!gst_buffer_pool_config_get_params (config, &caps, &size, &min_buffers, &max_buffers))
+    return FALSE;
+
+  p->have_video_info = caps && gst_video_info_from_caps (&p->video_info, caps);
+  p->add_video_meta = p->have_video_info &&
+      gst_buffer_pool_config_has_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+  GST_DEBUG_OBJECT (pool, "config size %u video %d meta %d", size,
+      p->have_video_info, p->add_video_meta);
+
+  return GST_BUFFER_POOL_CLASS (gst_pipewire_pool_parent_class)->set_config (pool, config);
 }
 
 static void
@@ -222,6 +296,8 @@ gst_pipewire_pool_finalize (GObject * object)
   GST_DEBUG_OBJECT (pool, "finalize");
   g_object_unref (pool->fd_allocator);
   g_object_unref (pool->dmabuf_allocator);
+  g_mutex_clear (&pool->lock);
+  g_cond_clear (&pool->cond);
 
   G_OBJECT_CLASS (gst_pipewire_pool_parent_class)->finalize (object);
 }
@@ -235,6 +311,8 @@ gst_pipewire_pool_class_init (GstPipeWirePoolClass * klass)
   gobject_class->finalize = gst_pipewire_pool_finalize;
 
   bufferpool_class->start = do_start;
+  bufferpool_class->get_options = get_options;
+  bufferpool_class->set_config = set_config;
   bufferpool_class->flush_start = flush_start;
   bufferpool_class->acquire_buffer = acquire_buffer;
   bufferpool_class->release_buffer = release_buffer;
@@ -254,5 +332,6 @@ gst_pipewire_pool_init (GstPipeWirePool * pool)
 {
   pool->fd_allocator = gst_fd_allocator_new ();
   pool->dmabuf_allocator = gst_dmabuf_allocator_new ();
+  g_mutex_init (&pool->lock);
   g_cond_init (&pool->cond);
 }
@@ -21,6 +21,7 @@
 #define __GST_PIPEWIRE_POOL_H__
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <pipewire/pipewire.h>
 
@@ -47,6 +48,8 @@ struct _GstPipeWirePoolData {
   GstPipeWirePool *pool;
   void *owner;
   struct spa_meta_header *header;
+  struct spa_meta *damage;
+  struct spa_meta_timing *timing;
   guint flags;
   goffset offset;
   struct pw_buffer *b;
@@ -62,7 +65,15 @@ struct _GstPipeWirePool {
   GstAllocator *fd_allocator;
   GstAllocator *dmabuf_allocator;
 
+  /* configured video layout, used for the buffer params and video meta */
+  gboolean have_video_info;
+  GstVideoInfo video_info;
+  gboolean add_video_meta;
+
+  /* only used when there are no buffers, see gst_pipewire_pool_wakeup() */
+  GMutex lock;
   GCond cond;
+  gint waiting;
 };
 
 struct _GstPipeWirePoolClass {
@@ -75,6 +86,8 @@ GstPipeWirePool *  gst_pipewire_pool_new           (void);
 
 void gst_pipewire_pool_wrap_buffer (GstPipeWirePool *pool, struct pw_buffer *buffer);
 
+void gst_pipewire_pool_wakeup (GstPipeWirePool *pool);
+
 GstPipeWirePoolData *gst_pipewire_pool_get_data (GstBuffer *buffer);
 
 //gboolean        gst_pipewire_pool_add_buffer    (GstPipeWirePool *pool, GstBuffer *buffer);
@@ -38,6 +38,8 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 
+#include <gst/video/video.h>
+
 #include "gstpipewireformat.h"
 
 GST_DEBUG_CATEGORY_STATIC (pipewire_sink_debug);
@@ -124,12 +126,29 @@ gst_pipewire_sink_finalize (GObject * object)
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+#define BUFFER_ALIGN	16
+
 static gboolean
 gst_pipewire_sink_propose_allocation (GstBaseSink * bsink, GstQuery * query)
 {
   GstPipeWireSink *pwsink = GST_PIPEWIRE_SINK (bsink);
+  GstAllocationParams params;
+  GstVideoInfo info;
+  GstCaps *caps;
+  guint size = 0;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps && gst_video_info_from_caps (&info, caps))
+    size = GST_VIDEO_INFO_SIZE (&info);
+
+  /* make upstream render directly into our PipeWire buffers */
+  gst_query_add_allocation_pool (query, GST_BUFFER_POOL_CAST (pwsink->pool), size, 0, 0);
+  gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+
+  gst_allocation_params_init (&params);
+  params.align = BUFFER_ALIGN - 1;
+  gst_query_add_allocation_param (query, NULL, &params);
 
-  gst_query_add_allocation_pool (query, GST_BUFFER_POOL_CAST (pwsink->pool), 0, 0, 0);
   return TRUE;
 }
 
@@ -241,12 +260,19 @@ pool_activated (GstPipeWirePool *pool, GstPipeWireSink *sink)
     spa_pod_builder_add (&b,
         ":", t->param_buffers.size, "ir", size, PROP_RANGE(size, INT32_MAX), NULL);
 
+  /* with a video layout, upstream writes with the stride of the caps */
+  if (pool->have_video_info)
+    spa_pod_builder_add (&b,
+        ":", t->param_buffers.stride, "i", GST_VIDEO_INFO_PLANE_STRIDE (&pool->video_info, 0), NULL);
+  else
+    spa_pod_builder_add (&b,
+        ":", t->param_buffers.stride, "iru", 0, PROP_RANGE(0, INT32_MAX), NULL);
+
   spa_pod_builder_add (&b,
-      ":", t->param_buffers.stride,  "iru", 0, PROP_RANGE(0, INT32_MAX),
       ":", t->param_buffers.buffers, "iru", min_buffers,
 						PROP_RANGE(min_buffers,
 							       max_buffers ? max_buffers : INT32_MAX),
-      ":", t->param_buffers.align,   "i", 16,
+      ":", t->param_buffers.align,   "i", BUFFER_ALIGN,
       NULL);
   port_params[0] = spa_pod_builder_pop (&b);
 
@@ -400,6 +426,7 @@ on_add_buffer (void *_data, struct pw_buffer *b)
 {
   GstPipeWireSink *pwsink = _data;
   gst_pipewire_pool_wrap_buffer (pwsink->pool, b);
+  gst_pipewire_pool_wakeup (pwsink->pool);
   pw_thread_loop_signal (pwsink->main_loop, FALSE);
 }
 
@@ -421,6 +448,7 @@ do_send_buffer (GstPipeWireSink *pwsink)
 {
   GstBuffer *buffer;
   GstPipeWirePoolData *data;
+  GstVideoMeta *meta;
   gboolean res;
   guint i;
   struct spa_buffer *b;
@@ -440,11 +468,14 @@ do_send_buffer (GstPipeWireSink *pwsink)
     data->header->pts = GST_BUFFER_PTS (buffer);
     data->header->dts_offset = GST_BUFFER_DTS (buffer);
   }
+  meta = gst_buffer_get_video_meta (buffer);
   for (i = 0; i < b->n_datas; i++) {
     struct spa_data *d = &b->datas[i];
     GstMemory *mem = gst_buffer_peek_memory (buffer, i);
     d->chunk->offset = mem->offset - data->offset;
     d->chunk->size = mem->size;
+    if (meta && i < meta->n_planes)
+      d->chunk->stride = meta->stride[i];
   }
 
   if ((res = pw_stream_queue_buffer (pwsink->stream, data->b)) < 0) {
@@ -465,7 +496,7 @@ on_process (void *data)
     return;
   }
 
-  g_cond_signal (&pwsink->pool->cond);
+  gst_pipewire_pool_wakeup (pwsink->pool);
 
   pwsink->need_ready++;
   GST_DEBUG ("need buffer %u", pwsink->need_ready);
@@ -569,12 +600,63 @@ start_error:
   }
 }
 
+/* configure the pool with the negotiated caps when upstream did not
+ * use it so that we get the right buffer size and stride */
+static void
+configure_pool (GstPipeWireSink *pwsink)
+{
+  GstBufferPool *pool = GST_BUFFER_POOL_CAST (pwsink->pool);
+  GstStructure *config;
+  GstVideoInfo info;
+  GstCaps *caps;
+  guint size = 0;
+
+  if ((caps = gst_pad_get_current_caps (GST_BASE_SINK_PAD (pwsink))) == NULL)
+    return;
+
+  if (gst_video_info_from_caps (&info, caps))
+    size = GST_VIDEO_INFO_SIZE (&info);
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, 0, 0);
+  if (!gst_buffer_pool_set_config (pool, config))
+    GST_WARNING_OBJECT (pwsink, "can't configure pool");
+
+  gst_caps_unref (caps);
+}
+
+/* copy with the strides of both buffers when the layout is known */
+static gboolean
+copy_video_frame (GstPipeWireSink *pwsink, GstBuffer *dest, GstBuffer *src)
+{
+  GstVideoInfo *info = &pwsink->pool->video_info;
+  GstVideoFrame sframe, dframe;
+  gboolean res;
+
+  if (!pwsink->pool->have_video_info)
+    return FALSE;
+
+  if (!gst_video_frame_map (&sframe, info, src, GST_MAP_READ))
+    return FALSE;
+  if (!gst_video_frame_map (&dframe, info, dest, GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&sframe);
+    return FALSE;
+  }
+  res = gst_video_frame_copy (&dframe, &sframe);
+
+  gst_video_frame_unmap (&dframe);
+  gst_video_frame_unmap (&sframe);
+
+  return res;
+}
+
 static GstFlowReturn
 gst_pipewire_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
 {
   GstPipeWireSink *pwsink;
   GstFlowReturn res = GST_FLOW_OK;
   const char *error = NULL;
+  enum pw_stream_state state;
 
   pwsink = GST_PIPEWIRE_SINK (bsink);
 
@@ -582,35 +664,47 @@ gst_pipewire_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
     goto not_negotiated;
 
   pw_thread_loop_lock (pwsink->main_loop);
-  if (pw_stream_get_state (pwsink->stream, &error) != PW_STREAM_STATE_STREAMING)
-    goto done;
+  state = pw_stream_get_state (pwsink->stream, &error);
+  pw_thread_loop_unlock (pwsink->main_loop);
+
+  if (state != PW_STREAM_STATE_STREAMING)
+    return res;
 
   if (buffer->pool != GST_BUFFER_POOL_CAST (pwsink->pool)) {
     GstBuffer *b = NULL;
     GstMapInfo info = { 0, };
 
-    if (!gst_buffer_pool_is_active (GST_BUFFER_POOL_CAST (pwsink->pool)))
+    /* upstream did not use our pool, copy into a PipeWire buffer. The
+     * acquire and copy don't need the thread loop lock. */
+    GST_LOG_OBJECT (pwsink, "copy buffer %p", buffer);
+
+    if (!gst_buffer_pool_is_active (GST_BUFFER_POOL_CAST (pwsink->pool))) {
+      configure_pool (pwsink);
       gst_buffer_pool_set_active (GST_BUFFER_POOL_CAST (pwsink->pool), TRUE);
+    }
 
     if ((res = gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (pwsink->pool), &b, NULL)) != GST_FLOW_OK)
-      goto done;
+      return res;
 
-    gst_buffer_map (b, &info, GST_MAP_WRITE);
-    gst_buffer_extract (buffer, 0, info.data, info.size);
-    gst_buffer_unmap (b, &info);
-    gst_buffer_resize (b, 0, gst_buffer_get_size (buffer));
+    if (!copy_video_frame (pwsink, b, buffer)) {
+      gst_buffer_map (b, &info, GST_MAP_WRITE);
+      gst_buffer_extract (buffer, 0, info.data, info.size);
+      gst_buffer_unmap (b, &info);
+      gst_buffer_resize (b, 0, gst_buffer_get_size (buffer));
+    }
+    gst_buffer_copy_into (b, buffer,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
     buffer = b;
   } else {
     gst_buffer_ref (buffer);
   }
 
   GST_DEBUG ("push buffer in queue");
+  pw_thread_loop_lock (pwsink->main_loop);
   g_queue_push_tail (&pwsink->queue, buffer);
 
   if (pwsink->mode == GST_PIPEWIRE_SINK_MODE_PROVIDE)
     do_send_buffer (pwsink);
-
-done:
   pw_thread_loop_unlock (pwsink->main_loop);
 
   return res;
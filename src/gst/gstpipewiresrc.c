@@ -38,6 +38,10 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <gst/net/gstnetclientclock.h>
@@ -62,6 +66,10 @@ enum
   PROP_STREAM_PROPERTIES,
   PROP_ALWAYS_COPY,
   PROP_FD,
+  PROP_QUEUE_DEPTH,
+  PROP_MAX_QUEUE_DEPTH,
+  PROP_AVG_LATENCY,
+  PROP_MAX_LATENCY,
 };
 
 
@@ -154,6 +162,33 @@ gst_pipewire_src_get_property (GObject * object, guint prop_id,
       g_value_set_int (value, pwsrc->fd);
       break;
 
+    case PROP_QUEUE_DEPTH:
+    {
+      uint32_t index;
+      g_value_set_uint (value,
+          MAX (spa_ringbuffer_get_read_index (&pwsrc->ring, &index), 0));
+      break;
+    }
+
+    case PROP_MAX_QUEUE_DEPTH:
+      GST_OBJECT_LOCK (pwsrc);
+      g_value_set_uint (value, pwsrc->max_queue_depth);
+      GST_OBJECT_UNLOCK (pwsrc);
+      break;
+
+    case PROP_AVG_LATENCY:
+      GST_OBJECT_LOCK (pwsrc);
+      g_value_set_uint64 (value, pwsrc->n_buffers ?
+          pwsrc->total_latency / pwsrc->n_buffers : 0);
+      GST_OBJECT_UNLOCK (pwsrc);
+      break;
+
+    case PROP_MAX_LATENCY:
+      GST_OBJECT_LOCK (pwsrc);
+      g_value_set_uint64 (value, pwsrc->max_buffer_latency);
+      GST_OBJECT_UNLOCK (pwsrc);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -187,11 +222,86 @@ clock_disabled:
   }
 }
 
+static guint64
+get_time_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+/* wake up the streaming thread, when @always is FALSE only when it
+ * is waiting for a buffer */
+static void
+wakeup (GstPipeWireSrc *pwsrc, gboolean always)
+{
+  uint64_t val = 1;
+
+  if (!always) {
+    /* pairs with setting waiting in gst_pipewire_src_create */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (g_atomic_int_get (&pwsrc->waiting) == 0)
+      return;
+  }
+  if (write (pwsrc->wakeup_fd, &val, sizeof (val)) != sizeof (val))
+    GST_WARNING_OBJECT (pwsrc, "wakeup failed: %s", strerror (errno));
+}
+
+/* called from the PipeWire thread */
+static void
+queue_push (GstPipeWireSrc *pwsrc, GstBuffer *buf)
+{
+  uint32_t index;
+  int32_t filled;
+  GstPipeWireSrcItem *item;
+
+  filled = spa_ringbuffer_get_write_index (&pwsrc->ring, &index);
+  if (filled >= GST_PIPEWIRE_SRC_QUEUE_SIZE) {
+    GST_WARNING_OBJECT (pwsrc, "queue full, dropping buffer %p", buf);
+    gst_buffer_unref (buf);
+    return;
+  }
+  item = &pwsrc->queue[index & GST_PIPEWIRE_SRC_QUEUE_MASK];
+  item->buffer = buf;
+  item->time = get_time_ns ();
+  spa_ringbuffer_write_update (&pwsrc->ring, index + 1);
+
+  wakeup (pwsrc, FALSE);
+}
+
+/* called from the streaming thread with the thread loop lock */
+static GstBuffer *
+queue_pop (GstPipeWireSrc *pwsrc, guint64 *time)
+{
+  uint32_t index;
+  int32_t avail;
+  GstPipeWireSrcItem *item;
+  GstBuffer *buf;
+
+  if ((avail = spa_ringbuffer_get_read_index (&pwsrc->ring, &index)) <= 0)
+    return NULL;
+
+  item = &pwsrc->queue[index & GST_PIPEWIRE_SRC_QUEUE_MASK];
+  buf = item->buffer;
+  *time = item->time;
+  spa_ringbuffer_read_update (&pwsrc->ring, index + 1);
+
+  GST_OBJECT_LOCK (pwsrc);
+  if (avail > (int32_t) pwsrc->max_queue_depth)
+    pwsrc->max_queue_depth = avail;
+  GST_OBJECT_UNLOCK (pwsrc);
+
+  return buf;
+}
+
 static void
 clear_queue (GstPipeWireSrc *pwsrc)
 {
-  g_queue_foreach (&pwsrc->queue, (GFunc) gst_mini_object_unref, NULL);
-  g_queue_clear (&pwsrc->queue);
+  GstBuffer *buf;
+  guint64 time;
+
+  while ((buf = queue_pop (pwsrc, &time)))
+    gst_buffer_unref (buf);
 }
 
 static void
@@ -200,6 +310,7 @@ gst_pipewire_src_finalize (GObject * object)
   GstPipeWireSrc *pwsrc = GST_PIPEWIRE_SRC (object);
 
   clear_queue (pwsrc);
+  close (pwsrc->wakeup_fd);
 
   pw_core_destroy (pwsrc->core);
   pwsrc->core = NULL;
@@ -282,6 +393,42 @@ gst_pipewire_src_class_init (GstPipeWireSrcClass * klass)
                                                       G_PARAM_READWRITE |
                                                       G_PARAM_STATIC_STRINGS));
 
+   g_object_class_install_property (gobject_class,
+                                    PROP_QUEUE_DEPTH,
+                                    g_param_spec_uint ("queue-depth",
+                                                       "Queue depth",
+                                                       "Number of buffers waiting to be pushed",
+                                                       0, G_MAXUINT, 0,
+                                                       G_PARAM_READABLE |
+                                                       G_PARAM_STATIC_STRINGS));
+
+   g_object_class_install_property (gobject_class,
+                                    PROP_MAX_QUEUE_DEPTH,
+                                    g_param_spec_uint ("max-queue-depth",
+                                                       "Max queue depth",
+                                                       "Largest number of buffers that were waiting",
+                                                       0, G_MAXUINT, 0,
+                                                       G_PARAM_READABLE |
+                                                       G_PARAM_STATIC_STRINGS));
+
+   g_object_class_install_property (gobject_class,
+                                    PROP_AVG_LATENCY,
+                                    g_param_spec_uint64 ("avg-latency",
+                                                         "Average latency",
+                                                         "Average time in ns between receiving a buffer and pushing it",
+                                                         0, G_MAXUINT64, 0,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+   g_object_class_install_property (gobject_class,
+                                    PROP_MAX_LATENCY,
+                                    g_param_spec_uint64 ("max-latency",
+                                                         "Max latency",
+                                                         "Largest time in ns between receiving a buffer and pushing it",
+                                                         0, G_MAXUINT64, 0,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
+
   gstelement_class->provide_clock = gst_pipewire_src_provide_clock;
   gstelement_class->change_state = gst_pipewire_src_change_state;
 
@@ -318,7 +465,8 @@ gst_pipewire_src_init (GstPipeWireSrc * src)
   src->always_copy = DEFAULT_ALWAYS_COPY;
   src->fd = -1;
 
-  g_queue_init (&src->queue);
+  spa_ringbuffer_init (&src->ring);
+  src->wakeup_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
 
   src->client_name = pw_get_client_name ();
 
@@ -371,23 +519,40 @@ on_remove_buffer (void *_data, struct pw_buffer *b)
   GstPipeWireSrc *pwsrc = _data;
   GstPipeWirePoolData *data = b->user_data;
   GstBuffer *buf = data->buf;
-  GList *walk;
 
   GST_LOG_OBJECT (pwsrc, "remove buffer %p", buf);
 
+  /* a queued buffer keeps a ref, it is dropped in create when it
+   * sees that the buffer was removed */
   GST_MINI_OBJECT_CAST (buf)->dispose = NULL;
 
-  walk = pwsrc->queue.head;
-  while (walk) {
-    GList *next = walk->next;
+  gst_buffer_unref (buf);
+}
 
-    if (walk->data == buf) {
-      gst_buffer_unref (buf);
-      g_queue_delete_link (&pwsrc->queue, walk);
-    }
-    walk = next;
+static gboolean
+remove_damage_meta (GstBuffer *buf, GstMeta **meta, gpointer user_data)
+{
+  if ((*meta)->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)
+    *meta = NULL;
+  return TRUE;
+}
+
+/* the buffers are reused, replace the regions of the previous frame with
+ * the damaged regions of this one */
+static void
+add_damage_meta (GstPipeWireSrc *pwsrc, GstBuffer *buf, struct spa_meta *damage)
+{
+  struct spa_meta_region *r;
+
+  gst_buffer_foreach_meta (buf, remove_damage_meta, NULL);
+
+  spa_meta_for_each_region (r, damage) {
+    GST_LOG_OBJECT (pwsrc, "damage %d,%d %ux%u", r->region.position.x,
+        r->region.position.y, r->region.size.width, r->region.size.height);
+    gst_buffer_add_video_region_of_interest_meta (buf, "damage",
+        r->region.position.x, r->region.position.y,
+        r->region.size.width, r->region.size.height);
   }
-  gst_buffer_unref (buf);
 }
 
 static void
@@ -420,6 +585,16 @@ on_process (void *_data)
     }
     GST_BUFFER_OFFSET (buf) = h->seq;
   }
+  if (data->damage)
+    add_damage_meta (pwsrc, buf, data->damage);
+
+  if (data->timing && data->timing->n_nodes > 0) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    GST_LOG_OBJECT (pwsrc, "buffer passed %u nodes in %" G_GINT64_FORMAT " ns",
+        data->timing->n_nodes, SPA_TIMESPEC_TO_TIME (&now) - data->timing->create_time);
+  }
   for (i = 0; i < b->buffer->n_datas; i++) {
     struct spa_data *d = &b->buffer->datas[i];
     GstMemory *mem = gst_buffer_peek_memory (buf, i);
@@ -429,11 +604,7 @@ on_process (void *_data)
   }
 
 
-  gst_buffer_ref (buf);
-  g_queue_push_tail (&pwsrc->queue, buf);
-
-  pw_thread_loop_signal (pwsrc->main_loop, FALSE);
-  return;
+  queue_push (pwsrc, gst_buffer_ref (buf));
 }
 
 static void
@@ -458,6 +629,7 @@ on_state_changed (void *data,
           ("stream error: %s", error), (NULL));
       break;
   }
+  wakeup (pwsrc, TRUE);
   pw_thread_loop_signal (pwsrc->main_loop, FALSE);
 }
 
@@ -680,6 +852,9 @@ connect_error:
 
 #define SPA_PROP_RANGE(min,max)	2,min,max
 
+#define MAX_DAMAGE_REGIONS	16
+#define DAMAGE_META_SIZE(n)	((n) * sizeof (struct spa_meta_region))
+
 static void
 on_format_changed (void *data,
                    const struct spa_pod *format)
@@ -702,7 +877,7 @@ on_format_changed (void *data,
   gst_caps_unref (caps);
 
   if (res) {
-    const struct spa_pod *params[2];
+    const struct spa_pod *params[4];
     struct spa_pod_builder b = { NULL };
     uint8_t buffer[512];
 
@@ -719,8 +894,19 @@ on_format_changed (void *data,
         ":", t->param_meta.type, "I", t->meta.Header,
         ":", t->param_meta.size, "i", sizeof (struct spa_meta_header));
 
+    params[2] = spa_pod_builder_object (&b,
+	t->param.idMeta, t->param_meta.Meta,
+        ":", t->param_meta.type, "I", t->meta.VideoDamage,
+        ":", t->param_meta.size, "ir", DAMAGE_META_SIZE (MAX_DAMAGE_REGIONS),
+		SPA_PROP_RANGE (DAMAGE_META_SIZE (1), DAMAGE_META_SIZE (MAX_DAMAGE_REGIONS)));
+
+    params[3] = spa_pod_builder_object (&b,
+	t->param.idMeta, t->param_meta.Meta,
+        ":", t->param_meta.type, "I", t->meta.Timing,
+        ":", t->param_meta.size, "i", sizeof (struct spa_meta_timing));
+
     GST_DEBUG_OBJECT (pwsrc, "doing finish format");
-    pw_stream_finish_format (pwsrc->stream, 0, params, 2);
+    pw_stream_finish_format (pwsrc->stream, 0, params, 4);
   } else {
     GST_WARNING_OBJECT (pwsrc, "finish format with error");
     pw_stream_finish_format (pwsrc->stream, -EINVAL, NULL, 0);
@@ -735,6 +921,7 @@ gst_pipewire_src_unlock (GstBaseSrc * basesrc)
   pw_thread_loop_lock (pwsrc->main_loop);
   GST_DEBUG_OBJECT (pwsrc, "setting flushing");
   pwsrc->flushing = TRUE;
+  wakeup (pwsrc, TRUE);
   pw_thread_loop_signal (pwsrc->main_loop, FALSE);
   pw_thread_loop_unlock (pwsrc->main_loop);
 
@@ -831,15 +1018,32 @@ gst_pipewire_src_create (GstPushSrc * psrc, GstBuffer ** buffer)
   GstClockTime pts, dts, base_time;
   const char *error = NULL;
   GstBuffer *buf;
+  guint64 time, latency;
+  uint32_t index;
 
   pwsrc = GST_PIPEWIRE_SRC (psrc);
 
   if (!pwsrc->negotiated)
     goto not_negotiated;
 
-  pw_thread_loop_lock (pwsrc->main_loop);
   while (TRUE) {
     enum pw_stream_state state;
+    struct pollfd pfd;
+    uint64_t val;
+
+    /* on_remove_buffer runs with the lock held, pop and check the buffer
+     * under the lock so that it can't be removed in between */
+    pw_thread_loop_lock (pwsrc->main_loop);
+    if ((buf = queue_pop (pwsrc, &time)) != NULL) {
+      /* skip buffers that were removed while queued */
+      if (GST_MINI_OBJECT_CAST (buf)->dispose == NULL) {
+        pw_thread_loop_unlock (pwsrc->main_loop);
+        gst_buffer_unref (buf);
+        continue;
+      }
+      pw_thread_loop_unlock (pwsrc->main_loop);
+      break;
+    }
 
     if (pwsrc->flushing)
       goto streaming_stopped;
@@ -854,15 +1058,33 @@ gst_pipewire_src_create (GstPushSrc * psrc, GstBuffer ** buffer)
     if (state != PW_STREAM_STATE_STREAMING)
       goto streaming_stopped;
 
-    buf = g_queue_pop_head (&pwsrc->queue);
-    GST_DEBUG ("popped buffer %p", buf);
-    if (buf != NULL)
-      break;
+    g_atomic_int_set (&pwsrc->waiting, 1);
+    pw_thread_loop_unlock (pwsrc->main_loop);
 
-    pw_thread_loop_wait (pwsrc->main_loop);
+    /* check again now that the PipeWire thread will wake us up */
+    if (spa_ringbuffer_get_read_index (&pwsrc->ring, &index) <= 0) {
+      GST_DEBUG_OBJECT (pwsrc, "waiting for buffer");
+      pfd.fd = pwsrc->wakeup_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (poll (&pfd, 1, -1) < 0 && errno != EINTR)
+        GST_WARNING_OBJECT (pwsrc, "poll failed: %s", strerror (errno));
+      if (read (pwsrc->wakeup_fd, &val, sizeof (val)) < 0 && errno != EAGAIN)
+        GST_WARNING_OBJECT (pwsrc, "read failed: %s", strerror (errno));
+    }
+    g_atomic_int_set (&pwsrc->waiting, 0);
   }
-  pw_thread_loop_unlock (pwsrc->main_loop);
+  GST_LOG_OBJECT (pwsrc, "popped buffer %p", buf);
+
+  latency = get_time_ns () - time;
+  GST_OBJECT_LOCK (pwsrc);
+  pwsrc->n_buffers++;
+  pwsrc->total_latency += latency;
+  if (latency > pwsrc->max_buffer_latency)
+    pwsrc->max_buffer_latency = latency;
+  GST_OBJECT_UNLOCK (pwsrc);
 
+  /* the ref of the queue, the buffer keeps the ref of the pool */
   gst_buffer_unref (buf);
 
   if (pwsrc->always_copy) {
@@ -1095,6 +1317,12 @@ gst_pipewire_src_change_state (GstElement * element, GstStateChange transition)
         goto open_failed;
       break;
     case GST_STATE_CHANGE_READY_TO_PAUSED:
+      GST_OBJECT_LOCK (this);
+      this->max_queue_depth = 0;
+      this->n_buffers = 0;
+      this->total_latency = 0;
+      this->max_buffer_latency = 0;
+      GST_OBJECT_UNLOCK (this);
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       /* uncork and start recording */
@@ -23,6 +23,8 @@
 #include <gst/gst.h>
 #include <gst/base/gstpushsrc.h>
 
+#include <spa/utils/ringbuffer.h>
+
 #include <pipewire/pipewire.h>
 #include <gst/gstpipewirepool.h>
 
@@ -44,6 +46,14 @@ G_BEGIN_DECLS
 typedef struct _GstPipeWireSrc GstPipeWireSrc;
 typedef struct _GstPipeWireSrcClass GstPipeWireSrcClass;
 
+#define GST_PIPEWIRE_SRC_QUEUE_SIZE	64
+#define GST_PIPEWIRE_SRC_QUEUE_MASK	(GST_PIPEWIRE_SRC_QUEUE_SIZE - 1)
+
+typedef struct {
+  GstBuffer *buffer;
+  guint64 time;		/* when the buffer was queued */
+} GstPipeWireSrcItem;
+
 /**
  * GstPipeWireSrc:
  *
@@ -80,7 +90,20 @@ struct _GstPipeWireSrc {
   GstStructure *properties;
 
   GstPipeWirePool *pool;
-  GQueue queue;
+
+  /* filled by the PipeWire thread, emptied by the streaming thread */
+  struct spa_ringbuffer ring;
+  GstPipeWireSrcItem queue[GST_PIPEWIRE_SRC_QUEUE_SIZE];
+  int wakeup_fd;
+  gint waiting;
+
+  /* queue stats, updated by the streaming thread, protected by the
+   * object lock */
+  guint max_queue_depth;
+  guint64 n_buffers;
+  guint64 total_latency;
+  guint64 max_buffer_latency;
+
   GstClock *clock;
   GstClockTime last_time;
 };
@@ -117,7 +117,8 @@ struct node {
 
 	int channels;
 	int sample_rate;
-	int buffer_size;
+	int buffer_size;		/**< frames per cycle without a graph quantum */
+	struct spa_io_quantum *quantum;
 
 	struct spa_node node_impl;
 
@@ -239,6 +240,11 @@ static struct buffer * dequeue_buffer(struct node *n, struct port *p)
         return b;
 }
 
+static uint32_t get_quantum(struct node *n)
+{
+	return spa_io_quantum_get(n->quantum, n->buffer_size);
+}
+
 static void conv_f32_s16(int16_t *out, float *in, int n_samples, int stride)
 {
 	int i;
@@ -277,6 +283,7 @@ static int node_process_input(struct spa_node *node)
 	struct spa_io_buffers *outio = outp->io;
 	struct buffer *out;
 	int16_t *op;
+	uint32_t n_frames;
 	int i;
 
 	pw_log_trace(NAME " %p: process input", this);
@@ -294,6 +301,8 @@ static int node_process_input(struct spa_node *node)
 	outio->status = SPA_STATUS_HAVE_BUFFER;
 
 	op = out->ptr;
+	n_frames = SPA_MIN(get_quantum(n),
+			out->outbuf->datas[0].maxsize / (sizeof(int16_t) * 2));
 
 	for (i = 0; i < n->n_in_ports; i++) {
 		struct port *inp = GET_IN_PORT(n, i);
@@ -302,18 +311,29 @@ static int node_process_input(struct spa_node *node)
 		int stride = 2;
 
 		if (inio->buffer_id < inp->n_buffers && inio->status == SPA_STATUS_HAVE_BUFFER) {
+			struct spa_data *d;
+			uint32_t n_samples, offs, size;
+
 			in = &inp->buffers[inio->buffer_id];
-			conv_f32_s16(op, in->ptr, n->buffer_size, stride);
+			d = &in->outbuf->datas[0];
+
+			/* only convert what the producer wrote, it can be less
+			 * than the quantum right after it changed */
+			offs = SPA_MIN(d->chunk->offset, d->maxsize);
+			size = SPA_MIN(d->chunk->size, d->maxsize - offs);
+			n_samples = SPA_MIN(n_frames, size / sizeof(float));
+			conv_f32_s16(op, SPA_MEMBER(in->ptr, offs, float), n_samples, stride);
+			fill_s16(op + n_samples * stride, n_frames - n_samples, stride);
 		}
 		else {
-			fill_s16(op, n->buffer_size, stride);
+			fill_s16(op, n_frames, stride);
 		}
 		op++;
 		inio->status = SPA_STATUS_NEED_BUFFER;
 	}
 
 	out->outbuf->datas[0].chunk->offset = 0;
-	out->outbuf->datas[0].chunk->size = n->buffer_size * sizeof(int16_t) * 2;
+	out->outbuf->datas[0].chunk->size = n_frames * sizeof(int16_t) * 2;
 	out->outbuf->datas[0].chunk->stride = 0;
 
 	return outio->status;
@@ -360,6 +380,8 @@ static int port_set_io(struct spa_node *node,
 
 	if (id == t->io.Buffers)
 		p->io = data;
+	else if (id == t->io.Quantum)
+		n->quantum = data;
 	else
 		return -ENOENT;
 
@@ -463,7 +485,7 @@ static int port_enum_params(struct spa_node *node,
 
 		param = spa_pod_builder_object(&b,
 			id, t->param_buffers.Buffers,
-			":", t->param_buffers.size,    "i", n->buffer_size * sizeof(float),
+			":", t->param_buffers.size,    "i", get_quantum(n) * sizeof(float),
 			":", t->param_buffers.stride,  "i", 0,
 			":", t->param_buffers.buffers, "ir", 2,
 				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dlfcn.h>
@@ -30,6 +31,7 @@
 
 #include <spa/node/node.h>
 #include <spa/pod/filter.h>
+#include <spa/pod/parser.h>
 
 #include "pipewire/pipewire.h"
 #include "pipewire/interfaces.h"
@@ -46,6 +48,7 @@
 #define MAX_OUTPUTS      64
 
 #define MAX_BUFFERS      64
+#define MAX_PROP_IO      8
 
 #define CHECK_IN_PORT_ID(this,d,p)       ((d) == SPA_DIRECTION_INPUT && (p) < MAX_INPUTS)
 #define CHECK_OUT_PORT_ID(this,d,p)      ((d) == SPA_DIRECTION_OUTPUT && (p) < MAX_OUTPUTS)
@@ -74,12 +77,19 @@ struct mem {
 struct buffer {
 	struct spa_buffer *outbuf;
 	struct spa_buffer buffer;
-	struct spa_meta metas[4];
+	struct spa_meta metas[8];
 	struct spa_data datas[4];
 	bool outstanding;
 	uint32_t memid;
 };
 
+struct prop_io {
+	uint32_t id;
+	uint32_t type;
+	void *data;
+	size_t size;
+};
+
 struct port {
 	bool valid;
 	struct spa_port_info info;
@@ -90,6 +100,9 @@ struct port {
 	struct spa_pod **params;
 	struct spa_io_buffers *io;
 
+	uint32_t n_prop_io;
+	struct prop_io prop_io[MAX_PROP_IO];
+
 	uint32_t n_buffers;
 	struct buffer buffers[MAX_BUFFERS];
 };
@@ -128,6 +141,8 @@ struct impl {
 	struct pw_client_node this;
 
 	bool client_reuse;
+	bool buffer_ring;
+	bool out_waiting;
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -136,6 +151,11 @@ struct impl {
 
 	struct pw_client_node_transport *transport;
 
+	/* the client gets its own copy of the graph quantum so that it
+	 * can't change the quantum of the other nodes */
+	struct pw_memblock *quantum_mem;
+	struct spa_io_quantum *quantum;
+
 	struct spa_hook node_listener;
 	struct spa_hook resource_listener;
 
@@ -441,6 +461,7 @@ clear_port(struct node *this,
 		       PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
 		       PW_CLIENT_NODE_PORT_UPDATE_INFO, 0, NULL, NULL);
 	clear_buffers(this, port);
+	port->n_prop_io = 0;
 }
 
 static void do_uninit_port(struct node *this, enum spa_direction direction, uint32_t port_id)
@@ -586,6 +607,61 @@ impl_node_port_set_param(struct spa_node *node,
 	return SPA_RESULT_RETURN_ASYNC(this->seq++);
 }
 
+struct prop_io_update {
+	struct port *port;
+	struct prop_io io;
+};
+
+static int do_update_prop_io(struct spa_loop *loop,
+			     bool async,
+			     uint32_t seq,
+			     const void *data,
+			     size_t size,
+			     void *user_data)
+{
+	const struct prop_io_update *u = data;
+	struct port *port = u->port;
+	uint32_t i;
+
+	for (i = 0; i < port->n_prop_io; i++) {
+		if (port->prop_io[i].id == u->io.id)
+			break;
+	}
+	if (u->io.data == NULL) {
+		if (i < port->n_prop_io)
+			port->prop_io[i] = port->prop_io[--port->n_prop_io];
+	}
+	else if (i < port->n_prop_io)
+		port->prop_io[i] = u->io;
+	else if (port->n_prop_io < MAX_PROP_IO)
+		port->prop_io[port->n_prop_io++] = u->io;
+
+	return 0;
+}
+
+/* find the pod type of the values in a prop io area from the
+ * Prop io params of the port */
+static uint32_t find_prop_io_type(struct impl *impl, struct port *port, uint32_t id)
+{
+	struct pw_type *t = impl->t;
+	struct spa_pod_prop *prop;
+	uint32_t i, io_id;
+
+	for (i = 0; i < port->n_params; i++) {
+		struct spa_pod *param = port->params[i];
+
+		if (!spa_pod_is_object_type(param, t->param_io.Prop))
+			continue;
+		if (spa_pod_object_parse(param,
+				":", t->param_io.id, "I", &io_id) < 0 || io_id != id)
+			continue;
+		if ((prop = spa_pod_find_prop(param, t->param.propType)) == NULL)
+			break;
+		return prop->body.value.type;
+	}
+	return SPA_POD_TYPE_INVALID;
+}
+
 static int
 impl_node_port_set_io(struct spa_node *node,
 		      enum spa_direction direction,
@@ -613,6 +689,9 @@ impl_node_port_set_io(struct spa_node *node,
 	if (!CHECK_PORT(this, direction, port_id))
 		return -EINVAL;
 
+	if (id == t->io.Quantum && data)
+		data = impl->quantum;
+
 	if (data) {
 		if ((mem = pw_memblock_find(data)) == NULL)
 			return -EINVAL;
@@ -631,6 +710,16 @@ impl_node_port_set_io(struct spa_node *node,
 		mem_offset = mem_size = 0;
 	}
 
+	if (id != t->io.Buffers && id != t->io.Quantum) {
+		/* remember the prop io areas so that the control updates
+		 * of the client can be applied to them */
+		struct port *port = GET_PORT(this, direction, port_id);
+		struct prop_io_update u = { port,
+			{ id, find_prop_io_type(impl, port, id), data, size } };
+		spa_loop_invoke(this->data_loop, do_update_prop_io, SPA_ID_INVALID,
+				&u, sizeof(u), true, NULL);
+	}
+
 	pw_client_node_resource_port_set_io(this->resource,
 					    this->seq,
 					    direction, port_id,
@@ -689,6 +778,9 @@ impl_node_port_use_buffers(struct spa_node *node,
 		size_t data_size, size;
 		void *baseptr;
 
+		if (buffers[i]->n_metas > SPA_N_ELEMENTS(b->metas))
+			return -EINVAL;
+
 		b->outbuf = buffers[i];
 		memcpy(&b->buffer, buffers[i], sizeof(struct spa_buffer));
 		b->buffer.datas = b->datas;
@@ -706,7 +798,7 @@ impl_node_port_use_buffers(struct spa_node *node,
 
 		data_size = 0;
 		for (j = 0; j < buffers[i]->n_metas; j++) {
-			data_size += buffers[i]->metas[j].size;
+			data_size += SPA_ROUND_UP_N(buffers[i]->metas[j].size, 8);
 		}
 		for (j = 0; j < buffers[i]->n_datas; j++) {
 			struct spa_data *d = buffers[i]->datas;
@@ -834,6 +926,120 @@ impl_node_port_send_command(struct spa_node *node,
 	return 0;
 }
 
+/* publish the clock of the driver in the transport so that the client can
+ * get the time without a roundtrip */
+static void update_clock(struct impl *impl)
+{
+	struct pw_node *node = impl->this.node;
+	struct spa_io_clock clock = { 0, };
+	struct timespec ts;
+
+	clock.scale = (1 << 16) | 1;
+	clock.rate = 1;
+
+	if (node->clock && node->live) {
+		clock.flags = SPA_IO_CLOCK_FLAG_LIVE;
+		if (spa_clock_get_time(node->clock, &clock.rate, &clock.ticks,
+				       &clock.monotonic_time) < 0)
+			return;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		clock.monotonic_time = SPA_TIMESPEC_TO_TIME(&ts);
+	}
+	spa_io_clock_write(&impl->transport->area->clock, &clock);
+}
+
+/* the server never reads the copy of the client, it is overwritten with
+ * the graph quantum in each cycle */
+static void update_quantum(struct impl *impl)
+{
+	impl->quantum->size = impl->core->quantum->size;
+}
+
+static void apply_control(struct node *this, struct pw_client_node_control *control)
+{
+	uint32_t i, j, size = SPA_POD_SIZE(&control->value.pod);
+	struct port *port;
+
+	if (size > sizeof(control->value))
+		return;
+
+	for (i = 0; i < MAX_INPUTS + MAX_OUTPUTS; i++) {
+		port = i < MAX_INPUTS ? &this->in_ports[i] : &this->out_ports[i - MAX_INPUTS];
+		if (!port->valid)
+			continue;
+
+		for (j = 0; j < port->n_prop_io; j++) {
+			struct prop_io *io = &port->prop_io[j];
+			if (io->id != control->id)
+				continue;
+			if (io->type != control->value.pod.type || io->size < size) {
+				pw_log_debug("client-node %p: control %u of type %u does not "
+					     "match io area of type %u", this->impl, control->id,
+					     control->value.pod.type, io->type);
+				continue;
+			}
+			memcpy(io->data, &control->value, size);
+		}
+	}
+}
+
+/* apply the control updates of the client before the graph reads the
+ * prop io areas in this cycle */
+static void process_controls(struct impl *impl)
+{
+	struct pw_client_node_control control;
+	uint32_t i;
+
+	/* the client can keep on writing while we read, only take what fits in
+	 * the ring so that a cycle can't be made to run for long */
+	for (i = 0; i < PW_CLIENT_NODE_MAX_CONTROLS; i++) {
+		if (pw_client_node_transport_next_control(impl->transport, &control) != 1)
+			break;
+		pw_log_trace("client-node %p: control %u", impl, control.id);
+		apply_control(&impl->node, &control);
+	}
+}
+
+/* queue the input buffers in the rings of the client. The client is only
+ * woken up when it has consumed everything it was given before, so it can
+ * take several buffers per wakeup. The client recycles the buffers with
+ * reuse_buffer messages when it is done with them */
+static int process_input_ring(struct impl *impl)
+{
+	struct node *this = &impl->node;
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p, *pp;
+	bool wakeup = false;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+		struct spa_io_buffers *io = p->io;
+		struct spa_io_buffer_ring *ring = &impl->transport->input_rings[p->port_id];
+
+		if (io->status != SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		if (spa_io_buffer_ring_avail(ring) == 0)
+			wakeup = true;
+
+		if (spa_io_buffer_ring_push(ring, io->buffer_id) < 0) {
+			pw_log_trace("client-node %p: input ring full, drop %d", impl, io->buffer_id);
+			if ((pp = p->peer))
+		                spa_node_port_reuse_buffer(pp->node->implementation,
+						pp->port_id, io->buffer_id);
+		}
+
+		io->status = SPA_STATUS_NEED_BUFFER;
+		io->buffer_id = SPA_ID_INVALID;
+	}
+	if (wakeup) {
+		pw_client_node_transport_add_message(impl->transport,
+			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+		do_flush(this);
+	}
+	return SPA_STATUS_OK;
+}
+
 static int impl_node_process_input(struct spa_node *node)
 {
 	struct node *this = SPA_CONTAINER_OF(node, struct node, node);
@@ -843,6 +1049,13 @@ static int impl_node_process_input(struct spa_node *node)
 	struct spa_graph_port *p, *pp;
 	int res;
 
+	update_clock(impl);
+	update_quantum(impl);
+	process_controls(impl);
+
+	if (impl->buffer_ring)
+		return process_input_ring(impl);
+
 	if (impl->input_ready == 0) {
 		/* the client is not ready to receive our buffers, recycle them */
 		pw_log_trace("node not ready, recycle buffers");
@@ -872,6 +1085,68 @@ static int impl_node_process_input(struct spa_node *node)
 	return res;
 }
 
+/* take the next buffer from the output rings for all ports that need
+ * one, returns true when all output ports have a buffer */
+static bool pop_output_rings(struct impl *impl)
+{
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p;
+	bool ready = true;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+		struct spa_io_buffers *io = p->io;
+		struct spa_io_buffer_ring *ring = &impl->transport->output_rings[p->port_id];
+		uint32_t id;
+
+		if (io->status == SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		if ((id = spa_io_buffer_ring_pop(ring)) == SPA_ID_INVALID) {
+			ready = false;
+			continue;
+		}
+		/* give the consumed buffer back to the client */
+		if (io->buffer_id != SPA_ID_INVALID)
+			pw_client_node_transport_add_message(impl->transport,
+				(struct pw_client_node_message *)
+				&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(p->port_id,
+					io->buffer_id));
+
+		io->buffer_id = id;
+		io->status = SPA_STATUS_HAVE_BUFFER;
+		pw_log_trace("client-node %p: pop %d, %d left", impl, id,
+				spa_io_buffer_ring_avail(ring));
+	}
+	return ready;
+}
+
+/* buffers the client rendered ahead are taken from the rings without a
+ * round trip, the client is asked for more when a ring is half empty */
+static int process_output_ring(struct impl *impl)
+{
+	struct node *this = &impl->node;
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p;
+	bool ready, low = false;
+
+	ready = pop_output_rings(impl);
+	impl->out_waiting = !ready;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+		if (spa_io_buffer_ring_avail(&impl->transport->output_rings[p->port_id]) <
+		    SPA_IO_BUFFER_RING_SIZE / 2)
+			low = true;
+	}
+	if (low && !impl->out_pending) {
+		impl->out_pending = true;
+		pw_client_node_transport_add_message(impl->transport,
+			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+	}
+	do_flush(this);
+
+	return ready ? SPA_STATUS_HAVE_BUFFER : SPA_STATUS_OK;
+}
+
 static int impl_node_process_output(struct spa_node *node)
 {
 	struct node *this;
@@ -883,6 +1158,13 @@ static int impl_node_process_output(struct spa_node *node)
 	impl = this->impl;
 	n = &impl->this.node->rt.node;
 
+	update_clock(impl);
+	update_quantum(impl);
+	process_controls(impl);
+
+	if (impl->buffer_ring)
+		return process_output_ring(impl);
+
 	if (impl->out_pending)
 		goto done;
 
@@ -916,18 +1198,36 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT:
-		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
-			*p->io = impl->transport->outputs[p->port_id];
-			pw_log_trace("have output %d %d", p->io->status, p->io->buffer_id);
+		if (impl->buffer_ring) {
+			/* the answer to our request only restarts the graph when
+			 * it stalled on an empty ring, other messages come from a
+			 * driving client */
+			bool requested = impl->out_pending;
+
+			impl->out_pending = false;
+			if (requested && !impl->out_waiting)
+				break;
+			if (!pop_output_rings(impl))
+				break;
+			impl->out_waiting = false;
+			do_flush(this);
+		}
+		else {
+			impl->out_pending = false;
+			spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+				*p->io = impl->transport->outputs[p->port_id];
+				pw_log_trace("have output %d %d", p->io->status, p->io->buffer_id);
+			}
 		}
-		impl->out_pending = false;
 		this->callbacks->have_output(this->callbacks_data);
 		break;
 
 	case PW_CLIENT_NODE_MESSAGE_NEED_INPUT:
-		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
-			*p->io = impl->transport->inputs[p->port_id];
-			pw_log_trace("need input %d %d", p->io->status, p->io->buffer_id);
+		if (!impl->buffer_ring) {
+			spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+				*p->io = impl->transport->inputs[p->port_id];
+				pw_log_trace("need input %d %d", p->io->status, p->io->buffer_id);
+			}
 		}
 		impl->input_ready++;
 		this->callbacks->need_input(this->callbacks_data);
@@ -1236,6 +1536,7 @@ static void node_free(void *data)
 
 	if (impl->transport)
 		pw_client_node_transport_destroy(impl->transport);
+	pw_memblock_free(impl->quantum_mem);
 
 	spa_hook_remove(&impl->node_listener);
 
@@ -1304,6 +1605,17 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 		name = "client-node";
 
 	this->resource = resource;
+
+	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+			      PW_MEMBLOCK_FLAG_MAP_READWRITE |
+			      PW_MEMBLOCK_FLAG_SEAL,
+			      sizeof(struct spa_io_quantum),
+			      &impl->quantum_mem) < 0)
+		goto error_no_mem;
+
+	impl->quantum = impl->quantum_mem->ptr;
+	impl->quantum->size = core->quantum->size;
+
 	this->node = pw_spa_node_new(core,
 				     pw_resource_get_client(this->resource),
 				     NULL,
@@ -1318,6 +1630,16 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.buffer-ring");
+	impl->buffer_ring = str && pw_properties_parse_bool(str);
+
+	/* the client can hold on to several buffers from the input rings,
+	 * only it knows when they can be recycled */
+	if (impl->buffer_ring && !impl->client_reuse) {
+		pw_log_warn("client-node %p: buffer-ring needs pipewire.client.reuse", impl);
+		impl->client_reuse = true;
+	}
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
@@ -1333,6 +1655,8 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	return this;
 
       error_no_node:
+	pw_memblock_free(impl->quantum_mem);
+      error_no_mem:
 	pw_resource_destroy(this->resource);
 	node_clear(&impl->node);
 	free(impl);
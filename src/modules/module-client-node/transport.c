@@ -32,6 +32,7 @@
 
 #define INPUT_BUFFER_SIZE       (1<<12)
 #define OUTPUT_BUFFER_SIZE      (1<<12)
+#define CONTROL_BUFFER_SIZE     PW_CLIENT_NODE_CONTROL_BUFFER_SIZE
 
 struct transport {
 	struct pw_client_node_transport trans;
@@ -50,10 +51,14 @@ static size_t area_get_size(struct pw_client_node_area *area)
 	size = sizeof(struct pw_client_node_area);
 	size += area->max_input_ports * sizeof(struct spa_io_buffers);
 	size += area->max_output_ports * sizeof(struct spa_io_buffers);
+	size += area->max_input_ports * sizeof(struct spa_io_buffer_ring);
+	size += area->max_output_ports * sizeof(struct spa_io_buffer_ring);
 	size += sizeof(struct spa_ringbuffer);
 	size += INPUT_BUFFER_SIZE;
 	size += sizeof(struct spa_ringbuffer);
 	size += OUTPUT_BUFFER_SIZE;
+	size += sizeof(struct spa_ringbuffer);
+	size += CONTROL_BUFFER_SIZE;
 	return size;
 }
 
@@ -70,6 +75,12 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 	trans->outputs = p;
 	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct spa_io_buffers), void);
 
+	trans->input_rings = p;
+	p = SPA_MEMBER(p, a->max_input_ports * sizeof(struct spa_io_buffer_ring), void);
+
+	trans->output_rings = p;
+	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct spa_io_buffer_ring), void);
+
 	trans->input_buffer = p;
 	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
 
@@ -81,6 +92,12 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 
 	trans->output_data = p;
 	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
+
+	trans->control_buffer = p;
+	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
+
+	trans->control_data = p;
+	p = SPA_MEMBER(p, CONTROL_BUFFER_SIZE, void);
 }
 
 static void transport_reset_area(struct pw_client_node_transport *trans)
@@ -91,13 +108,17 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 	for (i = 0; i < a->max_input_ports; i++) {
 		trans->inputs[i].status = SPA_STATUS_OK;
 		trans->inputs[i].buffer_id = SPA_ID_INVALID;
+		spa_ringbuffer_init(&trans->input_rings[i].ring);
 	}
 	for (i = 0; i < a->max_output_ports; i++) {
 		trans->outputs[i].status = SPA_STATUS_OK;
 		trans->outputs[i].buffer_id = SPA_ID_INVALID;
+		spa_ringbuffer_init(&trans->output_rings[i].ring);
 	}
 	spa_ringbuffer_init(trans->input_buffer);
 	spa_ringbuffer_init(trans->output_buffer);
+	spa_ringbuffer_init(trans->control_buffer);
+	memset(&a->clock, 0, sizeof(a->clock));
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -176,6 +197,58 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 	return 0;
 }
 
+static int add_control(struct pw_client_node_transport *trans,
+		       const struct pw_client_node_control *control)
+{
+	int32_t filled;
+	uint32_t index;
+
+	if (trans == NULL || control == NULL)
+		return -EINVAL;
+
+	filled = spa_ringbuffer_get_write_index(trans->control_buffer, &index);
+	if (filled < 0 || CONTROL_BUFFER_SIZE - filled < (int32_t) sizeof(struct pw_client_node_control))
+		return -ENOSPC;
+
+	spa_ringbuffer_write_data(trans->control_buffer,
+				  trans->control_data, CONTROL_BUFFER_SIZE,
+				  index & (CONTROL_BUFFER_SIZE - 1),
+				  control, sizeof(struct pw_client_node_control));
+	spa_ringbuffer_write_update(trans->control_buffer,
+				    index + sizeof(struct pw_client_node_control));
+
+	return 0;
+}
+
+static int next_control(struct pw_client_node_transport *trans,
+			struct pw_client_node_control *control)
+{
+	int32_t avail;
+	uint32_t index;
+
+	if (trans == NULL || control == NULL)
+		return -EINVAL;
+
+	avail = spa_ringbuffer_get_read_index(trans->control_buffer, &index);
+	if (avail < 0 || avail > CONTROL_BUFFER_SIZE) {
+		/* the writer is not a well behaved client, drop what it wrote */
+		pw_log_warn("transport %p: control ring corrupted, avail %d", trans, avail);
+		spa_ringbuffer_read_update(trans->control_buffer, index + avail);
+		return 0;
+	}
+	if (avail < (int32_t) sizeof(struct pw_client_node_control))
+		return 0;
+
+	spa_ringbuffer_read_data(trans->control_buffer,
+				 trans->control_data, CONTROL_BUFFER_SIZE,
+				 index & (CONTROL_BUFFER_SIZE - 1),
+				 control, sizeof(struct pw_client_node_control));
+	spa_ringbuffer_read_update(trans->control_buffer,
+				   index + sizeof(struct pw_client_node_control));
+
+	return 1;
+}
+
 /** Create a new transport
  * \param max_input_ports maximum number of input_ports
  * \param max_output_ports maximum number of output_ports
@@ -218,6 +291,8 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->add_control = add_control;
+	trans->next_control = next_control;
 
 	return trans;
 }
@@ -263,6 +338,8 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->add_control = add_control;
+	trans->next_control = next_control;
 
 	return trans;
 
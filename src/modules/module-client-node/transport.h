@@ -30,6 +30,12 @@ extern "C" {
 
 #include <pipewire/mem.h>
 
+/** size of the control ring, a cycle applies at most the number of
+ * updates that fit in it \memberof pw_client_node */
+#define PW_CLIENT_NODE_CONTROL_BUFFER_SIZE	(1<<12)
+#define PW_CLIENT_NODE_MAX_CONTROLS	\
+	(PW_CLIENT_NODE_CONTROL_BUFFER_SIZE / sizeof(struct pw_client_node_control))
+
 /** information about the transport region \memberof pw_client_node */
 struct pw_client_node_transport_info {
 	int memfd;		/**< the memfd of the transport area */
@@ -0,0 +1,529 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "pipewire/core.h"
+#include "pipewire/interfaces.h"
+#include "pipewire/log.h"
+#include "pipewire/module.h"
+#include "pipewire/private.h"
+
+#include "extensions/profiler.h"
+
+/* The profiler times the process calls of the nodes in the graph and
+ * the cycles started by the driver nodes. The results are written to a
+ * shared memory area that is passed to the clients that bind to the
+ * profiler global. Profiling is only enabled while clients are bound. */
+
+struct pw_protocol *pw_protocol_native_ext_profiler_init(struct pw_core *core);
+
+struct node_data {
+	struct spa_list link;
+	struct impl *impl;
+	struct pw_node *node;
+	struct pw_profiler_node *slot;	/**< slot in the shared area */
+	uint64_t start;			/**< start of the current process call */
+};
+
+struct impl {
+	struct pw_core *core;
+	struct pw_type *t;
+	struct pw_properties *properties;
+
+	struct spa_hook module_listener;
+	struct spa_hook core_listener;
+
+	struct pw_global *global;
+	struct spa_hook global_listener;
+	uint32_t type_profiler;
+
+	struct pw_memblock *mem;
+	struct pw_profiler_area *area;
+
+	struct spa_list resource_list;
+	struct spa_list node_list;
+
+	/* data thread only */
+	uint32_t depth;
+	uint64_t cycle_start;
+	uint64_t prev_cycle_start;
+	uint64_t cycle_max;
+	struct node_data *cycle_max_node;
+};
+
+struct resource_data {
+	struct impl *impl;
+	struct spa_hook resource_listener;
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static inline void write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static void profiler_cycle_start(void *data, struct spa_graph_node *driver)
+{
+	struct impl *impl = data;
+
+	if (impl->depth++ > 0)
+		return;
+
+	impl->prev_cycle_start = impl->cycle_start;
+	impl->cycle_start = get_time_ns();
+	impl->cycle_max = 0;
+	impl->cycle_max_node = NULL;
+}
+
+static void profiler_cycle_end(void *data, struct spa_graph_node *driver)
+{
+	struct impl *impl = data;
+	struct pw_profiler_area *area = impl->area;
+	struct node_data *nd;
+	uint64_t now, duration, period;
+
+	if (impl->depth == 0 || --impl->depth > 0)
+		return;
+
+	now = get_time_ns();
+	duration = now - impl->cycle_start;
+
+	write_begin(&area->seq);
+	area->cycles++;
+	pw_profiler_stats_add(&area->cycle, duration);
+	if (impl->prev_cycle_start != 0)
+		pw_profiler_stats_add(&area->period, impl->cycle_start - impl->prev_cycle_start);
+
+	/* a cycle that takes longer than the average period makes the next
+	 * cycle start late, blame the node that took the most time */
+	period = area->period.count > 0 ? area->period.total / area->period.count : 0;
+	if (period > 0 && duration > period) {
+		area->xruns++;
+		area->last_xrun_time = now;
+		area->last_xrun_node = SPA_ID_INVALID;
+		if ((nd = impl->cycle_max_node) != NULL) {
+			area->last_xrun_node = nd->slot->id;
+			write_begin(&nd->slot->seq);
+			nd->slot->xruns++;
+			write_end(&nd->slot->seq);
+		}
+	}
+	write_end(&area->seq);
+}
+
+static void profiler_process_start(void *data, struct spa_graph_node *node)
+{
+	struct node_data *nd = node->profiler_data;
+
+	if (nd)
+		nd->start = get_time_ns();
+}
+
+static void profiler_process_end(void *data, struct spa_graph_node *node, int status)
+{
+	struct impl *impl = data;
+	struct node_data *nd = node->profiler_data;
+	uint64_t elapsed;
+
+	if (nd == NULL || nd->start == 0)
+		return;
+
+	elapsed = get_time_ns() - nd->start;
+	nd->start = 0;
+
+	write_begin(&nd->slot->seq);
+	pw_profiler_stats_add(&nd->slot->process, elapsed);
+	write_end(&nd->slot->seq);
+
+	if (impl->depth > 0 && elapsed > impl->cycle_max) {
+		impl->cycle_max = elapsed;
+		impl->cycle_max_node = nd;
+	}
+}
+
+static const struct spa_graph_profiler graph_profiler = {
+	SPA_VERSION_GRAPH_PROFILER,
+	.cycle_start = profiler_cycle_start,
+	.cycle_end = profiler_cycle_end,
+	.process_start = profiler_process_start,
+	.process_end = profiler_process_end,
+};
+
+static int
+do_set_profiler(struct spa_loop *loop,
+		bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	bool enable = *(bool *) data;
+
+	impl->depth = 0;
+	impl->cycle_start = impl->prev_cycle_start = 0;
+	impl->cycle_max_node = NULL;
+
+	if (enable)
+		spa_graph_set_profiler(&impl->core->rt.graph, &graph_profiler, impl);
+	else
+		spa_graph_set_profiler(&impl->core->rt.graph, NULL, NULL);
+	return 0;
+}
+
+static void set_profiler(struct impl *impl, bool enable)
+{
+	pw_log_debug("module %p: %s profiler", impl, enable ? "enable" : "disable");
+	pw_loop_invoke(impl->core->data_loop, do_set_profiler, 1,
+		       &enable, sizeof(bool), true, impl);
+}
+
+static int
+do_reset(struct spa_loop *loop,
+	 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	struct pw_profiler_area *area = impl->area;
+	uint32_t i;
+
+	write_begin(&area->seq);
+	area->cycles = area->xruns = area->last_xrun_time = 0;
+	area->last_xrun_node = SPA_ID_INVALID;
+	spa_zero(area->cycle);
+	spa_zero(area->period);
+	write_end(&area->seq);
+
+	for (i = 0; i < area->max_nodes; i++) {
+		struct pw_profiler_node *n = &area->nodes[i];
+
+		write_begin(&n->seq);
+		n->xruns = 0;
+		spa_zero(n->process);
+		write_end(&n->seq);
+	}
+	impl->prev_cycle_start = 0;
+	return 0;
+}
+
+static void profiler_reset(void *object)
+{
+	struct pw_resource *resource = object;
+	struct resource_data *data = pw_resource_get_user_data(resource);
+	struct impl *impl = data->impl;
+
+	pw_log_debug("module %p: reset", impl);
+	pw_loop_invoke(impl->core->data_loop, do_reset, 1, NULL, 0, true, impl);
+}
+
+static const struct pw_profiler_proxy_methods profiler_methods = {
+	PW_VERSION_PROFILER_PROXY_METHODS,
+	.reset = profiler_reset,
+};
+
+static int
+do_set_node(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct node_data *nd = user_data;
+	bool add = *(bool *) data;
+
+	if (!add && nd->impl->cycle_max_node == nd)
+		nd->impl->cycle_max_node = NULL;
+	nd->start = 0;
+	nd->node->rt.node.profiler_data = add ? nd : NULL;
+	return 0;
+}
+
+static struct pw_profiler_node *alloc_slot(struct impl *impl)
+{
+	uint32_t i;
+
+	for (i = 0; i < impl->area->max_nodes; i++) {
+		if (impl->area->nodes[i].id == SPA_ID_INVALID)
+			return &impl->area->nodes[i];
+	}
+	return NULL;
+}
+
+static void free_slot(struct pw_profiler_node *slot)
+{
+	write_begin(&slot->seq);
+	slot->id = SPA_ID_INVALID;
+	slot->name[0] = '\0';
+	slot->xruns = 0;
+	spa_zero(slot->process);
+	write_end(&slot->seq);
+}
+
+static struct node_data *find_node_data(struct impl *impl, struct pw_node *node)
+{
+	struct node_data *nd;
+
+	spa_list_for_each(nd, &impl->node_list, link) {
+		if (nd->node == node)
+			return nd;
+	}
+	return NULL;
+}
+
+static void add_node(struct impl *impl, struct pw_node *node)
+{
+	struct pw_profiler_node *slot;
+	struct node_data *nd;
+	bool add = true;
+
+	if ((slot = alloc_slot(impl)) == NULL) {
+		pw_log_warn("module %p: no free slot for node %p", impl, node);
+		return;
+	}
+	if ((nd = calloc(1, sizeof(struct node_data))) == NULL)
+		return;
+
+	nd->impl = impl;
+	nd->node = node;
+	nd->slot = slot;
+
+	write_begin(&slot->seq);
+	slot->id = node->global ? pw_global_get_id(node->global) : SPA_ID_INVALID;
+	snprintf(slot->name, sizeof(slot->name), "%s", node->info.name ? node->info.name : "");
+	write_end(&slot->seq);
+
+	spa_list_append(&impl->node_list, &nd->link);
+
+	pw_loop_invoke(impl->core->data_loop, do_set_node, 1, &add, sizeof(bool), true, nd);
+
+	pw_log_debug("module %p: node %p added in slot %d", impl, node,
+			(int)(slot - impl->area->nodes));
+}
+
+static void remove_node(struct impl *impl, struct node_data *nd)
+{
+	bool add = false;
+
+	pw_loop_invoke(impl->core->data_loop, do_set_node, 1, &add, sizeof(bool), true, nd);
+
+	spa_list_remove(&nd->link);
+	free_slot(nd->slot);
+	free(nd);
+}
+
+static void
+core_global_added(void *data, struct pw_global *global)
+{
+	struct impl *impl = data;
+
+	if (pw_global_get_type(global) == impl->t->node)
+		add_node(impl, pw_global_get_object(global));
+}
+
+static void
+core_global_removed(void *data, struct pw_global *global)
+{
+	struct impl *impl = data;
+	struct node_data *nd;
+
+	if (pw_global_get_type(global) == impl->t->node &&
+	    (nd = find_node_data(impl, pw_global_get_object(global))))
+		remove_node(impl, nd);
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.global_added = core_global_added,
+	.global_removed = core_global_removed,
+};
+
+static void profiler_unbind_func(void *data)
+{
+	struct pw_resource *resource = data;
+	struct resource_data *d = pw_resource_get_user_data(resource);
+	struct impl *impl = d->impl;
+
+	spa_list_remove(&resource->link);
+
+	if (spa_list_is_empty(&impl->resource_list))
+		set_profiler(impl, false);
+}
+
+static const struct pw_resource_events resource_events = {
+	PW_VERSION_RESOURCE_EVENTS,
+	.destroy = profiler_unbind_func,
+};
+
+static void
+global_bind(void *_data, struct pw_client *client, uint32_t permissions,
+	    uint32_t version, uint32_t id)
+{
+	struct impl *impl = _data;
+	struct pw_resource *resource;
+	struct resource_data *data;
+
+	resource = pw_resource_new(client, id, permissions, impl->type_profiler,
+				   version, sizeof(*data));
+	if (resource == NULL)
+		goto no_mem;
+
+	data = pw_resource_get_user_data(resource);
+	data->impl = impl;
+	pw_resource_add_listener(resource, &data->resource_listener, &resource_events, resource);
+	pw_resource_set_implementation(resource, &profiler_methods, resource);
+
+	pw_log_debug("module %p: bound to %d", impl, pw_resource_get_id(resource));
+
+	if (spa_list_is_empty(&impl->resource_list))
+		set_profiler(impl, true);
+	spa_list_append(&impl->resource_list, &resource->link);
+
+	pw_profiler_resource_area(resource, impl->mem->fd, impl->mem->offset, impl->mem->size);
+
+	return;
+
+      no_mem:
+	pw_log_error("can't create profiler resource");
+	pw_core_resource_error(client->core_resource,
+			       client->core_resource->id, -ENOMEM, "no memory");
+}
+
+static void global_destroy(void *data)
+{
+	struct impl *impl = data;
+	spa_hook_remove(&impl->global_listener);
+	impl->global = NULL;
+}
+
+static const struct pw_global_events global_events = {
+	PW_VERSION_GLOBAL_EVENTS,
+	.destroy = global_destroy,
+	.bind = global_bind,
+};
+
+static void module_destroy(void *data)
+{
+	struct impl *impl = data;
+	struct pw_resource *resource, *tr;
+	struct node_data *nd, *tn;
+
+	spa_hook_remove(&impl->module_listener);
+	spa_hook_remove(&impl->core_listener);
+
+	if (impl->global)
+		pw_global_destroy(impl->global);
+
+	spa_list_for_each_safe(resource, tr, &impl->resource_list, link)
+		pw_resource_destroy(resource);
+
+	spa_list_for_each_safe(nd, tn, &impl->node_list, link)
+		remove_node(impl, nd);
+
+	pw_memblock_free(impl->mem);
+
+	if (impl->properties)
+		pw_properties_free(impl->properties);
+
+	free(impl);
+}
+
+static const struct pw_module_events module_events = {
+	PW_VERSION_MODULE_EVENTS,
+	.destroy = module_destroy,
+};
+
+static int module_init(struct pw_module *module, struct pw_properties *properties)
+{
+	struct pw_core *core = pw_module_get_core(module);
+	struct impl *impl;
+	struct pw_node *node;
+	uint32_t i;
+	int res;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		return -ENOMEM;
+
+	pw_log_debug("module %p: new", impl);
+
+	impl->core = core;
+	impl->t = pw_core_get_type(core);
+	impl->properties = properties;
+	impl->type_profiler = spa_type_map_get_id(impl->t->map, PW_TYPE_INTERFACE__Profiler);
+
+	spa_list_init(&impl->resource_list);
+	spa_list_init(&impl->node_list);
+
+	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				     PW_MEMBLOCK_FLAG_SEAL,
+				     PW_PROFILER_AREA_SIZE(PW_PROFILER_MAX_NODES),
+				     &impl->mem)) < 0)
+		goto error_free;
+
+	impl->area = impl->mem->ptr;
+	memset(impl->area, 0, impl->mem->size);
+	impl->area->version = PW_VERSION_PROFILER;
+	impl->area->max_nodes = PW_PROFILER_MAX_NODES;
+	impl->area->last_xrun_node = SPA_ID_INVALID;
+	for (i = 0; i < PW_PROFILER_MAX_NODES; i++)
+		impl->area->nodes[i].id = SPA_ID_INVALID;
+
+	pw_protocol_native_ext_profiler_init(core);
+
+	impl->global = pw_global_new(core, impl->type_profiler, PW_VERSION_PROFILER,
+				     NULL, impl);
+	if (impl->global == NULL) {
+		res = -ENOMEM;
+		goto error_free_mem;
+	}
+	pw_global_add_listener(impl->global, &impl->global_listener, &global_events, impl);
+	pw_global_register(impl->global, NULL, pw_module_get_global(module));
+
+	spa_list_for_each(node, &core->node_list, link) {
+		if (node->global)
+			add_node(impl, node);
+	}
+
+	pw_module_add_listener(module, &impl->module_listener, &module_events, impl);
+	pw_core_add_listener(core, &impl->core_listener, &core_events, impl);
+
+	return 0;
+
+      error_free_mem:
+	pw_memblock_free(impl->mem);
+      error_free:
+	free(impl);
+	return res;
+}
+
+int pipewire__module_init(struct pw_module *module, const char *args)
+{
+	return module_init(module, NULL);
+}
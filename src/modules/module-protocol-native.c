@@ -83,6 +83,7 @@ struct client {
 
         bool disconnecting;
 	bool flush_signaled;
+	bool need_flush;
         struct spa_source *flush_event;
 };
 
@@ -105,6 +106,7 @@ struct client_data {
 	struct spa_source *source;
 	struct pw_protocol_native_connection *connection;
 	bool busy;
+	bool need_flush;
 };
 
 static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
@@ -253,20 +255,44 @@ process_messages(struct client_data *data)
 	goto done;
 }
 
+static void update_io(struct client_data *c)
+{
+	struct pw_client *client = c->client;
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (!c->busy)
+		mask |= SPA_IO_IN;
+	if (c->need_flush)
+		mask |= SPA_IO_OUT;
+
+	pw_loop_update_io(client->core->main_loop, c->source, mask);
+}
+
+static void flush_client(struct client_data *c)
+{
+	int res;
+	bool need_flush;
+
+	res = pw_protocol_native_connection_flush(c->connection);
+
+	/* wait until the socket is writable again when the client is slow */
+	need_flush = res == -EAGAIN;
+	if (need_flush != c->need_flush) {
+		c->need_flush = need_flush;
+		update_io(c);
+	}
+}
+
 static void
 client_busy_changed(void *data, bool busy)
 {
 	struct client_data *c = data;
 	struct pw_client *client = c->client;
-	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
 
 	c->busy = busy;
 
-	if (!busy)
-		mask |= SPA_IO_IN;
-
 	pw_log_debug("protocol-native %p: busy changed %d", client->protocol, busy);
-	pw_loop_update_io(client->core->main_loop, c->source, mask);
+	update_io(c);
 
 	if (!busy)
 		process_messages(c);
@@ -285,6 +311,9 @@ connection_data(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
+	if (mask & SPA_IO_OUT)
+		flush_client(this);
+
 	if (mask & SPA_IO_IN)
 		process_messages(this);
 }
@@ -300,9 +329,27 @@ static void client_free(void *data)
 	pw_protocol_native_connection_destroy(this->connection);
 }
 
+static void client_info_changed(void *data, struct pw_client_info *info)
+{
+	struct client_data *this = data;
+	const char *str;
+
+	if ((info->change_mask & PW_CLIENT_CHANGE_MASK_PROPS) == 0)
+		return;
+
+	str = pw_properties_get(this->client->properties, PW_PROTOCOL_NATIVE_PROP_BATCH);
+	pw_protocol_native_connection_set_batch(this->connection,
+						str ? pw_properties_parse_bool(str) : false);
+
+	str = pw_properties_get(this->client->properties, PW_PROTOCOL_NATIVE_PROP_MESSAGE_FDS);
+	if (str && pw_properties_parse_bool(str))
+		pw_protocol_native_connection_enable_message_fds(this->connection);
+}
+
 static const struct pw_client_events client_events = {
 	PW_VERSION_CLIENT_EVENTS,
 	.free = client_free,
+	.info_changed = client_info_changed,
 	.busy_changed = client_busy_changed,
 };
 
@@ -513,6 +560,27 @@ static int impl_steal_fd(struct pw_protocol_client *client)
 	return fd;
 }
 
+static void flush_remote(struct client *impl)
+{
+	struct pw_remote *remote = impl->this.remote;
+	bool need_flush;
+	int res;
+
+	res = pw_protocol_native_connection_flush(impl->connection);
+	if (res < 0 && res != -EAGAIN) {
+		impl->this.disconnect(&impl->this);
+		return;
+	}
+	/* wait until the socket is writable again */
+	need_flush = res == -EAGAIN;
+	if (need_flush != impl->need_flush && impl->source) {
+		impl->need_flush = need_flush;
+		pw_loop_update_io(remote->core->main_loop, impl->source,
+				  SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR |
+				  (need_flush ? SPA_IO_OUT : 0));
+	}
+}
+
 static void
 on_remote_data(void *data, int fd, enum spa_io mask)
 {
@@ -529,6 +597,12 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 		return;
         }
 
+	if (mask & SPA_IO_OUT) {
+		flush_remote(impl);
+		if (impl->connection == NULL)
+			return;
+	}
+
         if (mask & SPA_IO_IN) {
                 uint8_t opcode;
                 uint32_t id;
@@ -591,8 +665,7 @@ static void do_flush_event(void *data, uint64_t count)
         struct client *impl = data;
 	impl->flush_signaled = false;
         if (impl->connection)
-                if (!pw_protocol_native_connection_flush(impl->connection))
-                        impl->this.disconnect(&impl->this);
+		flush_remote(impl);
 }
 
 static void on_need_flush(void *data)
@@ -617,6 +690,7 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 	struct pw_remote *remote = client->remote;
 
 	impl->disconnecting = false;
+	impl->need_flush = false;
 
 	impl->connection = pw_protocol_native_connection_new(remote->core, fd);
 	if (impl->connection == NULL)
@@ -691,6 +765,11 @@ impl_new_client(struct pw_protocol *protocol,
 
 	impl->properties = properties ? pw_properties_copy(properties) : NULL;
 
+	/* let the server know we can handle batched events and the number
+	 * of fds in the message header */
+	pw_properties_set(remote->properties, PW_PROTOCOL_NATIVE_PROP_BATCH, "1");
+	pw_properties_set(remote->properties, PW_PROTOCOL_NATIVE_PROP_MESSAGE_FDS, "1");
+
 	if (properties)
 		str = pw_properties_get(properties, "remote.intention");
 	if (str == NULL)
@@ -743,7 +822,7 @@ static void on_before_hook(void *_data)
 
 	spa_list_for_each_safe(client, tmp, &this->client_list, protocol_link) {
 		data = client->user_data;
-		pw_protocol_native_connection_flush(data->connection);
+		flush_client(data);
 	}
 }
 
@@ -866,6 +945,15 @@ static void impl_ext_end_resource(struct pw_resource *resource,
 	pw_protocol_native_connection_end(data->connection, builder);
 }
 
+static struct spa_pod_builder *
+impl_ext_begin_resource_batch(struct pw_resource *resource, uint8_t opcode,
+			      const struct spa_pod **prev)
+{
+	struct client_data *data = resource->client->user_data;
+	return pw_protocol_native_connection_begin_resource_batch(data->connection,
+								  resource, opcode, prev);
+}
+
 const static struct pw_protocol_native_ext protocol_ext_impl = {
 	PW_VERSION_PROTOCOL_NATIVE_EXT,
 	impl_ext_begin_proxy,
@@ -876,6 +964,7 @@ const static struct pw_protocol_native_ext protocol_ext_impl = {
 	impl_ext_add_resource_fd,
 	impl_ext_get_resource_fd,
 	impl_ext_end_resource,
+	impl_ext_begin_resource_batch,
 };
 
 static void module_destroy(void *data)
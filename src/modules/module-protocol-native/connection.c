@@ -33,14 +33,41 @@
 #include "connection.h"
 
 #define MAX_BUFFER_SIZE (1024 * 32)
+#define MIN_READ_SIZE (1024 * 4)
 #define MAX_FDS 28
+/* received fds that are not claimed by a message yet */
+#define MAX_QUEUED_FDS (MAX_FDS * 4)
+
+/* dest_id, opcode and size */
+#define HDR_SIZE 8
+/* dest_id, opcode and size, number of fds. Used for the messages after a
+ * MESSAGE_FDS control message, sent when the peer can parse them. */
+#define HDR_SIZE_FDS 12
+
+/* batches are closed when they grow beyond this size so that the size
+ * always fits in the 24 bits of the message header */
+#define MAX_BATCH_SIZE (1024 * 256)
+#define MAX_PENDING 256
+
+#define BATCH_ID		SPA_ID_INVALID
+#define BATCH_OPCODE_BEGIN	0
+#define BATCH_OPCODE_SKIP	1
+/* control message on the batch id, the messages that follow have a
+ * HDR_SIZE_FDS header */
+#define BATCH_OPCODE_MESSAGE_FDS	2
+#define NO_OFFSET		((size_t)-1)
 
 static bool debug_messages = 0;
 
+/* For output, fds holds the fds of all queued messages. For input with
+ * message fds, the received fds are queued in fd_queue and fds holds the fds
+ * of the current message. Without message fds, fds holds the fds of the last
+ * read, shared by the messages in it. */
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
 	size_t buffer_maxsize;
+	uint32_t hdr_size;		/**< HDR_SIZE or HDR_SIZE_FDS */
 	int fds[MAX_FDS];
 	uint32_t n_fds;
 
@@ -48,7 +75,17 @@ struct buffer {
 	void *data;
 	size_t size;
 
-	bool update;
+	int fd_queue[MAX_QUEUED_FDS];
+	uint32_t fd_head;
+	uint32_t fd_tail;
+};
+
+/* a message in the open batch that can be replaced by a newer one */
+struct pending {
+	uint32_t dest_id;
+	uint32_t opcode;
+	uint32_t gen;
+	size_t offset;
 };
 
 struct impl {
@@ -58,8 +95,17 @@ struct impl {
 
 	uint32_t dest_id;
 	uint8_t opcode;
+	uint32_t msg_fds;		/**< first fd of the message being built */
+	bool want_message_fds;		/**< switch the output to message fds */
 	struct spa_pod_builder builder;
 
+	bool batch;			/**< the peer understands batches */
+	bool in_batch;			/**< the message being built goes in a batch */
+	size_t batch_offset;		/**< offset of the open batch or NO_OFFSET */
+	size_t prev_offset;		/**< offset of the message to replace or NO_OFFSET */
+	uint32_t gen;			/**< incremented when the batch is closed */
+	struct pending pending[MAX_PENDING];
+
 	struct pw_core *core;
 };
 
@@ -68,7 +114,7 @@ struct impl {
 /** Get an fd from a connection
  *
  * \param conn the connection
- * \param index the index of the fd to get
+ * \param index the index of the fd in the current message
  * \return the fd at \a index or -1 when no such fd exists
  *
  * \memberof pw_protocol_native_connection
@@ -87,7 +133,11 @@ int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *c
  *
  * \param conn the connection
  * \param fd the fd to add
- * \return the index of the fd or -1 when an error occured
+ * \return the index of the fd in the message or -1 when an error occured
+ *
+ * The fds are sent along with the message that is being built. With
+ * message fds the index is relative to the fds of that message, otherwise
+ * to the fds of all the messages of the next flush.
  *
  * \memberof pw_protocol_native_connection
  */
@@ -96,9 +146,9 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t index, i;
 
-	for (i = 0; i < impl->out.n_fds; i++) {
+	for (i = impl->msg_fds; i < impl->out.n_fds; i++) {
 		if (impl->out.fds[i] == fd)
-			return i;
+			return i - impl->msg_fds;
 	}
 
 	index = impl->out.n_fds;
@@ -110,7 +160,7 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 	impl->out.fds[index] = fd;
 	impl->out.n_fds++;
 
-	return index;
+	return index - impl->msg_fds;
 }
 
 static void *connection_ensure_size(struct pw_protocol_native_connection *conn, struct buffer *buf, size_t size)
@@ -129,48 +179,150 @@ static void *connection_ensure_size(struct pw_protocol_native_connection *conn,
 	return (uint8_t *) buf->buffer_data + buf->buffer_size;
 }
 
-static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buffer *buf)
+static void queue_fds(struct pw_protocol_native_connection *conn, struct buffer *buf,
+		      const int *fds, uint32_t n_fds)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_fds; i++) {
+		if (buf->fd_tail - buf->fd_head >= MAX_QUEUED_FDS) {
+			pw_log_error("connection %p: fd queue full, closing fd %d", conn, fds[i]);
+			close(fds[i]);
+			continue;
+		}
+		buf->fd_queue[buf->fd_tail++ % MAX_QUEUED_FDS] = fds[i];
+	}
+}
+
+/* move the fds of the next message from the queue to the message */
+static void take_fds(struct pw_protocol_native_connection *conn, struct buffer *buf,
+		     uint32_t n_fds)
+{
+	uint32_t avail = buf->fd_tail - buf->fd_head;
+
+	if (n_fds > avail) {
+		pw_log_warn("connection %p: message needs %u fds, only %u received",
+			    conn, n_fds, avail);
+		n_fds = avail;
+	}
+	for (buf->n_fds = 0; buf->n_fds < SPA_MIN(n_fds, MAX_FDS); buf->n_fds++)
+		buf->fds[buf->n_fds] = buf->fd_queue[buf->fd_head++ % MAX_QUEUED_FDS];
+
+	/* more than we can hand out, not claimed by anyone */
+	for (; n_fds > MAX_FDS; n_fds--)
+		close(buf->fd_queue[buf->fd_head++ % MAX_QUEUED_FDS]);
+}
+
+static void close_fds(struct buffer *buf)
+{
+	uint32_t i;
+
+	for (i = 0; i < buf->n_fds; i++)
+		close(buf->fds[i]);
+	buf->n_fds = 0;
+}
+
+static void clear_fd_queue(struct buffer *buf)
+{
+	while (buf->fd_head != buf->fd_tail)
+		close(buf->fd_queue[buf->fd_head++ % MAX_QUEUED_FDS]);
+	buf->fd_head = buf->fd_tail = 0;
+}
+
+/* the peer sends message fds from now on. It switches with an empty output
+ * buffer and a read ends after the data that came with fds, so the fds of
+ * the last read belong to the messages after the switch. */
+static void switch_input(struct impl *impl)
+{
+	struct buffer *buf = &impl->in;
+
+	pw_log_debug("connection %p: input with message fds", &impl->this);
+
+	queue_fds(&impl->this, buf, buf->fds, buf->n_fds);
+	buf->n_fds = 0;
+	buf->hdr_size = HDR_SIZE_FDS;
+
+	/* the peer can parse them, switch our messages as well */
+	if (impl->out.hdr_size == HDR_SIZE)
+		impl->want_message_fds = true;
+}
+
+/* read more data after the unparsed data, \a need is the number of bytes
+ * the partial message at the read offset needs */
+static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buffer *buf,
+			  size_t need)
 {
 	ssize_t len;
+	size_t avail;
 	struct cmsghdr *cmsg;
 	struct msghdr msg = { 0 };
 	struct iovec iov[1];
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
 
+	/* the messages before the offset are consumed, move the partial message
+	 * to the start so that the buffer does not grow */
+	if (buf->offset > 0) {
+		avail = buf->buffer_size - buf->offset;
+		if (avail > 0)
+			memmove(buf->buffer_data, buf->buffer_data + buf->offset, avail);
+		buf->buffer_size = avail;
+		buf->offset = 0;
+	}
+	if (connection_ensure_size(conn, buf, SPA_MAX(need > buf->buffer_size ?
+					need - buf->buffer_size : 0, MIN_READ_SIZE)) == NULL)
+		return false;
+
 	iov[0].iov_base = buf->buffer_data + buf->buffer_size;
 	iov[0].iov_len = buf->buffer_maxsize - buf->buffer_size;
 	msg.msg_iov = iov;
 	msg.msg_iovlen = 1;
 	msg.msg_control = cmsgbuf;
 	msg.msg_controllen = sizeof(cmsgbuf);
-	msg.msg_flags = MSG_CMSG_CLOEXEC | MSG_DONTWAIT;
 
 	while (true) {
-		len = recvmsg(conn->fd, &msg, msg.msg_flags);
+		len = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
-			if (errno != EAGAIN || errno != EWOULDBLOCK)
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
 				goto recv_error;
 			return false;
 		}
 		break;
 	}
+	if (len == 0)
+		return false;
 
 	buf->buffer_size += len;
 
-	/* handle control messages */
-	buf->n_fds = 0;
+	/* with message fds, queue the fds, they are claimed by the messages in
+	 * the order they were sent. Otherwise the fds are for the messages of
+	 * this read. */
+	if (buf->hdr_size == HDR_SIZE)
+		buf->n_fds = 0;
+
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		int *fds = (int *) CMSG_DATA(cmsg);
+		uint32_t n_fds;
+
 		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
 			continue;
 
-		buf->n_fds =
-		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
-		memcpy(buf->fds, CMSG_DATA(cmsg), buf->n_fds * sizeof(int));
+		n_fds = (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
+		if (buf->hdr_size == HDR_SIZE_FDS) {
+			queue_fds(conn, buf, fds, n_fds);
+		} else {
+			buf->n_fds = SPA_MIN(n_fds, MAX_FDS);
+			memcpy(buf->fds, fds, buf->n_fds * sizeof(int));
+			for (; n_fds > MAX_FDS; n_fds--)
+				close(fds[n_fds - 1]);
+		}
 	}
-	pw_log_trace("connection %p: %d read %zd bytes and %d fds", conn, conn->fd, len,
-		     buf->n_fds);
+	if (msg.msg_flags & MSG_CTRUNC)
+		pw_log_error("connection %p: fds were truncated", conn);
+
+	pw_log_trace("connection %p: %d read %zd bytes and %u fds", conn, conn->fd, len,
+		     buf->hdr_size == HDR_SIZE_FDS ? buf->fd_tail - buf->fd_head : buf->n_fds);
 
 	return true;
 
@@ -215,10 +367,14 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(struct p
 
 	impl->out.buffer_data = malloc(MAX_BUFFER_SIZE);
 	impl->out.buffer_maxsize = MAX_BUFFER_SIZE;
+	impl->out.hdr_size = HDR_SIZE;
 	impl->in.buffer_data = malloc(MAX_BUFFER_SIZE);
 	impl->in.buffer_maxsize = MAX_BUFFER_SIZE;
-	impl->in.update = true;
+	impl->in.hdr_size = HDR_SIZE;
 	impl->core = core;
+	impl->batch_offset = NO_OFFSET;
+	impl->prev_offset = NO_OFFSET;
+	impl->gen = 1;
 
 	if (impl->out.buffer_data == NULL || impl->in.buffer_data == NULL)
 		goto no_mem;
@@ -246,6 +402,7 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy, 0);
 
+	clear_fd_queue(&impl->in);
 	free(impl->out.buffer_data);
 	free(impl->in.buffer_data);
 	free(impl);
@@ -261,7 +418,13 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
  * \return true on success
  *
  * Get the next packet in \a conn and store the opcode and destination
- * id as well as the packet data and size.
+ * id as well as the packet data and size. The data points into the receive
+ * buffer and stays valid until the next call. The fds of the packet are
+ * available with \ref pw_protocol_native_connection_get_fd.
+ *
+ * Data is read from the socket only when no complete packet is buffered, so
+ * that all the packets that are available can be handled in one go. false
+ * is returned when no more data can be read.
  *
  * \memberof pw_protocol_native_connection
  */
@@ -273,64 +436,76 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 		       uint32_t *sz)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	size_t len, size;
+	size_t len, size, need, hdr_size;
 	uint8_t *data;
 	struct buffer *buf;
 	uint32_t *p;
 
 	buf = &impl->in;
 
-	/* move to next packet */
+	/* move to next packet, the fds of the previous packet are now owned
+	 * by whoever took them */
 	buf->offset += buf->size;
+	buf->size = 0;
+	if (buf->hdr_size == HDR_SIZE_FDS)
+		buf->n_fds = 0;
 
-      again:
-	if (buf->update) {
-		if (!refill_buffer(conn, buf))
-			return false;
-		buf->update = false;
-	}
+	while (true) {
+		data = buf->buffer_data + buf->offset;
+		size = buf->buffer_size - buf->offset;
+		hdr_size = buf->hdr_size;
 
-	/* now read packet */
-	data = buf->buffer_data;
-	size = buf->buffer_size;
+		if (size < hdr_size) {
+			need = hdr_size;
+			goto refill;
+		}
+		p = (uint32_t *) data;
 
-	if (buf->offset >= size) {
-		clear_buffer(buf);
-		buf->update = true;
-		return false;
-	}
+		*dest_id = p[0];
+		*opcode = p[1] >> 24;
+		len = p[1] & 0xffffff;
+
+		/* the messages of a batch simply follow the batch header */
+		if (*dest_id == BATCH_ID && *opcode == BATCH_OPCODE_BEGIN) {
+			buf->offset += hdr_size;
+			continue;
+		}
+		if (hdr_size + len > size) {
+			need = hdr_size + len;
+			goto refill;
+		}
 
-	data += buf->offset;
-	size -= buf->offset;
+		if (*dest_id == BATCH_ID && *opcode == BATCH_OPCODE_MESSAGE_FDS) {
+			buf->offset += hdr_size + len;
+			if (hdr_size == HDR_SIZE)
+				switch_input(impl);
+			continue;
+		}
 
-	if (size < 8) {
-		if (connection_ensure_size(conn, buf, 8) == NULL)
-			return false;
-		buf->update = true;
-		goto again;
-	}
-	p = (uint32_t *) data;
-	data += 8;
-	size -= 8;
+		if (hdr_size == HDR_SIZE_FDS)
+			take_fds(conn, buf, p[2]);
 
-	*dest_id = p[0];
-	*opcode = p[1] >> 24;
-	len = p[1] & 0xffffff;
+		/* skip messages that were replaced by a newer one in the batch,
+		 * without message fds the fds of the read are shared */
+		if (*dest_id == BATCH_ID) {
+			if (hdr_size == HDR_SIZE_FDS)
+				close_fds(buf);
+			buf->offset += hdr_size + len;
+			continue;
+		}
+		buf->offset += hdr_size;
+		buf->size = len;
+		buf->data = data + hdr_size;
 
-	if (len > size) {
-		if (connection_ensure_size(conn, buf, len) == NULL)
-			return false;
-		buf->update = true;
-		goto again;
-	}
-	buf->size = len;
-	buf->data = data;
-	buf->offset += 8;
+		*dt = buf->data;
+		*sz = buf->size;
 
-	*dt = buf->data;
-	*sz = buf->size;
+		return true;
 
-	return true;
+	      refill:
+		if (!refill_buffer(conn, buf, need))
+			return false;
+	}
 }
 
 static inline void *begin_write(struct pw_protocol_native_connection *conn, uint32_t size)
@@ -338,11 +513,12 @@ static inline void *begin_write(struct pw_protocol_native_connection *conn, uint
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t *p;
 	struct buffer *buf = &impl->out;
-	/* 4 for dest_id, 1 for opcode, 3 for size and size for payload */
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	/* 4 for dest_id, 1 for opcode, 3 for size, optionally 4 for n_fds and
+	 * size for payload */
+	if ((p = connection_ensure_size(conn, buf, buf->hdr_size + size)) == NULL)
 		return NULL;
 
-	return p + 2;
+	return SPA_MEMBER(p, buf->hdr_size, void);
 }
 
 static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t size)
@@ -359,6 +535,37 @@ static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t
         return ref;
 }
 
+/* the first fd of the next message, without message fds the indexes are
+ * relative to the fds of the flush */
+static inline uint32_t message_fds(struct impl *impl)
+{
+	return impl->out.hdr_size == HDR_SIZE_FDS ? impl->out.n_fds : 0;
+}
+
+static void begin_message(struct impl *impl, uint32_t dest_id, uint8_t opcode)
+{
+	struct buffer *buf = &impl->out;
+	uint32_t *p;
+
+	/* switch at the start of a flush so that the peer can tell the fds
+	 * of the old and the new messages apart */
+	if (impl->want_message_fds && buf->buffer_size == 0 && buf->n_fds == 0 &&
+	    (p = connection_ensure_size(&impl->this, buf, HDR_SIZE)) != NULL) {
+		pw_log_debug("connection %p: output with message fds", &impl->this);
+		*p++ = BATCH_ID;
+		*p++ = BATCH_OPCODE_MESSAGE_FDS << 24;
+		buf->buffer_size += HDR_SIZE;
+		buf->hdr_size = HDR_SIZE_FDS;
+		impl->want_message_fds = false;
+	}
+
+	impl->dest_id = dest_id;
+	impl->opcode = opcode;
+	impl->msg_fds = message_fds(impl);
+	impl->in_batch = false;
+	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
+}
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connection *conn,
 					     struct pw_resource *resource,
@@ -381,13 +588,87 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
 		pw_core_resource_update_types(client->core_resource, base, types, diff);
 	}
 
-	impl->dest_id = resource->id;
-	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
+	begin_message(impl, resource->id, opcode);
 
 	return &impl->builder;
 }
 
+static inline struct pending *find_pending(struct impl *impl, uint32_t dest_id, uint8_t opcode)
+{
+	return &impl->pending[((dest_id * 31) + opcode) & (MAX_PENDING - 1)];
+}
+
+static void close_batch(struct impl *impl)
+{
+	impl->batch_offset = NO_OFFSET;
+	impl->gen++;
+}
+
+/** Start a message for a resource that can be batched
+ *
+ * \param conn the connection
+ * \param resource the resource
+ * \param opcode the event opcode
+ * \param prev result of a previous message for the same resource and
+ *        opcode that will be replaced by this message or NULL when
+ *        the message can't replace other messages
+ * \return a builder for the message
+ *
+ * When the peer supports batches, the message is added to the open batch
+ * of messages. When \a prev is not NULL and a message for the same resource
+ * and opcode is still queued in the batch, \a prev is set to the body of
+ * that message and the old message is dropped when the new message is
+ * ended. The new message should then include the changes of the old
+ * message. \a prev is only valid until the builder is used.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+struct spa_pod_builder *
+pw_protocol_native_connection_begin_resource_batch(struct pw_protocol_native_connection *conn,
+						   struct pw_resource *resource,
+						   uint8_t opcode,
+						   const struct spa_pod **prev)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct buffer *buf = &impl->out;
+	struct spa_pod_builder *builder;
+	struct pending *pending;
+	uint32_t *p;
+
+	if (prev)
+		*prev = NULL;
+
+	builder = pw_protocol_native_connection_begin_resource(conn, resource, opcode);
+
+	if (!impl->batch)
+		return builder;
+
+	if (impl->batch_offset != NO_OFFSET &&
+	    buf->buffer_size - impl->batch_offset > MAX_BATCH_SIZE)
+		close_batch(impl);
+
+	if (impl->batch_offset == NO_OFFSET) {
+		if ((p = connection_ensure_size(conn, buf, buf->hdr_size)) == NULL)
+			return builder;
+		*p++ = BATCH_ID;
+		*p++ = BATCH_OPCODE_BEGIN << 24;
+		if (buf->hdr_size == HDR_SIZE_FDS)
+			*p++ = 0;
+		impl->batch_offset = buf->buffer_size;
+		buf->buffer_size += buf->hdr_size;
+	}
+	impl->in_batch = true;
+	impl->prev_offset = NO_OFFSET;
+
+	pending = find_pending(impl, impl->dest_id, opcode);
+	if (prev && pending->gen == impl->gen &&
+	    pending->dest_id == impl->dest_id && pending->opcode == opcode) {
+		impl->prev_offset = pending->offset;
+		*prev = SPA_MEMBER(buf->buffer_data, pending->offset + buf->hdr_size, struct spa_pod);
+	}
+	return builder;
+}
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *conn,
 					  struct pw_proxy *proxy,
@@ -410,9 +691,7 @@ pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *
 	        pw_core_proxy_update_types(remote->core_proxy, base, types, diff);
 	}
 
-	impl->dest_id = proxy->id;
-	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
+	begin_message(impl, proxy->id, opcode);
 
 	return &impl->builder;
 }
@@ -422,16 +701,56 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 				  struct spa_pod_builder *builder)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	uint32_t *p, size = builder->state.offset;
+	uint32_t *p, size = builder->state.offset, hdr_size;
 	struct buffer *buf = &impl->out;
+	struct pending *pending;
 
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	hdr_size = buf->hdr_size;
+	if ((p = connection_ensure_size(conn, buf, hdr_size + size)) == NULL)
 		return;
 
 	*p++ = impl->dest_id;
 	*p++ = (impl->opcode << 24) | (size & 0xffffff);
+	if (hdr_size == HDR_SIZE_FDS)
+		*p++ = buf->n_fds - impl->msg_fds;
+
+	if (impl->in_batch) {
+		uint32_t *b = SPA_MEMBER(buf->buffer_data, impl->batch_offset, uint32_t);
+
+		b[1] += hdr_size + size;
+
+		if (impl->prev_offset != NO_OFFSET) {
+			uint32_t *o = SPA_MEMBER(buf->buffer_data, impl->prev_offset, uint32_t);
+			uint32_t prev_size = o[1] & 0xffffff;
+
+			/* a skipped message keeps its fds so that the peer can
+			 * drop them */
+			if (impl->prev_offset + hdr_size + prev_size == buf->buffer_size &&
+			    (hdr_size == HDR_SIZE || o[2] == 0)) {
+				/* the old message is the last one, overwrite it */
+				memmove(o, p - hdr_size / 4, hdr_size + size);
+				b[1] -= hdr_size + prev_size;
+				buf->buffer_size = impl->prev_offset;
+				p = o + hdr_size / 4;
+			} else {
+				o[0] = BATCH_ID;
+				o[1] = (BATCH_OPCODE_SKIP << 24) | prev_size;
+			}
+		}
+		pending = find_pending(impl, impl->dest_id, impl->opcode);
+		pending->dest_id = impl->dest_id;
+		pending->opcode = impl->opcode;
+		pending->gen = impl->gen;
+		pending->offset = buf->buffer_size;
+
+		impl->in_batch = false;
+		impl->prev_offset = NO_OFFSET;
+	} else if (impl->batch_offset != NO_OFFSET) {
+		close_batch(impl);
+	}
 
-	buf->buffer_size += 8 + size;
+	buf->buffer_size += hdr_size + size;
+	impl->msg_fds = message_fds(impl);
 
 	if (debug_messages) {
 		printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
@@ -441,16 +760,59 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 			struct pw_protocol_native_connection_events, need_flush, 0);
 }
 
+/** Enable batches on a connection
+ *
+ * \param conn the connection
+ * \param batch if the peer can handle batches
+ *
+ * Only enable batches when the peer has announced that it can parse them
+ * with \ref PW_PROTOCOL_NATIVE_PROP_BATCH.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+void pw_protocol_native_connection_set_batch(struct pw_protocol_native_connection *conn, bool batch)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+
+	if (impl->batch_offset != NO_OFFSET)
+		close_batch(impl);
+	impl->batch = batch;
+}
+
+/** Send the number of fds in the message headers
+ *
+ * \param conn the connection
+ *
+ * Messages carry the number of fds that belong to them, so that the fds
+ * of messages that arrive in several reads are kept apart. The peer is
+ * told with a control message before the first message in the new format,
+ * which makes it switch its own messages as well.
+ *
+ * Only enable this when the peer has announced that it can parse these
+ * messages with \ref PW_PROTOCOL_NATIVE_PROP_MESSAGE_FDS.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+void pw_protocol_native_connection_enable_message_fds(struct pw_protocol_native_connection *conn)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+
+	if (impl->out.hdr_size == HDR_SIZE)
+		impl->want_message_fds = true;
+}
+
 /** Flush the connection object
  *
  * \param conn the connection object
- * \return true on success
+ * \return 0 on success, -EAGAIN when not all data could be written or
+ *         a negative errno on error
  *
- * Write the queued messages on the connection to the socket
+ * Write the queued messages on the connection to the socket. When -EAGAIN
+ * is returned, flush again when the socket is writable.
  *
  * \memberof pw_protocol_native_connection
  */
-bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
+int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	ssize_t len;
@@ -461,11 +823,12 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	int *cm;
 	uint32_t i, fds_len;
 	struct buffer *buf;
+	int res;
 
 	buf = &impl->out;
 
 	if (buf->buffer_size == 0)
-		return true;
+		return 0;
 
 	fds_len = buf->n_fds * sizeof(int);
 
@@ -495,6 +858,8 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return -EAGAIN;
 			else
 				goto send_error;
 		}
@@ -503,15 +868,28 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
 		     buf->n_fds);
 
-	buf->buffer_size -= len;
+	/* the open batch is (partially) sent and can't be changed anymore */
+	if (impl->batch_offset != NO_OFFSET)
+		close_batch(impl);
+
+	/* the fds are sent with the first byte */
 	buf->n_fds = 0;
+	impl->msg_fds = message_fds(impl);
 
-	return true;
+	if ((size_t) len < buf->buffer_size) {
+		memmove(buf->buffer_data, buf->buffer_data + len, buf->buffer_size - len);
+		buf->buffer_size -= len;
+		return -EAGAIN;
+	}
+	buf->buffer_size = 0;
+
+	return 0;
 
 	/* ERRORS */
       send_error:
+	res = -errno;
 	pw_log_error("could not sendmsg: %s", strerror(errno));
-	return false;
+	return res;
 }
 
 /** Clear the connection object
@@ -529,7 +907,10 @@ bool pw_protocol_native_connection_clear(struct pw_protocol_native_connection *c
 
 	clear_buffer(&impl->out);
 	clear_buffer(&impl->in);
-	impl->in.update = true;
+	clear_fd_queue(&impl->in);
+	impl->msg_fds = 0;
+	impl->batch_offset = NO_OFFSET;
+	impl->gen++;
 
 	return true;
 }
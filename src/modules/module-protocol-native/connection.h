@@ -81,6 +81,12 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
                                              struct pw_resource *resource,
                                              uint8_t opcode);
 
+struct spa_pod_builder *
+pw_protocol_native_connection_begin_resource_batch(struct pw_protocol_native_connection *conn,
+                                                   struct pw_resource *resource,
+                                                   uint8_t opcode,
+                                                   const struct spa_pod **prev);
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *conn,
                                           struct pw_proxy *proxy,
@@ -89,7 +95,13 @@ void
 pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
                                   struct spa_pod_builder *builder);
 
-bool
+void
+pw_protocol_native_connection_set_batch(struct pw_protocol_native_connection *conn, bool batch);
+
+void
+pw_protocol_native_connection_enable_message_fds(struct pw_protocol_native_connection *conn);
+
+int
 pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn);
 
 bool
@@ -284,20 +284,45 @@ static int core_demarshal_update_types_client(void *object, void *data, size_t s
 	return 0;
 }
 
+/* get the change_mask of a queued info event that is replaced by a new one */
+static uint64_t prev_change_mask(const struct spa_pod *prev)
+{
+	struct spa_pod_parser prs;
+	uint32_t id;
+	uint64_t change_mask;
+
+	if (prev == NULL)
+		return 0;
+
+	spa_pod_parser_pod(&prs, prev);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &id,
+			"l", &change_mask, NULL) < 0)
+		return 0;
+
+	return change_mask;
+}
+
 static void core_marshal_info(void *object, struct pw_core_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_CORE_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_CORE_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_CORE_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "s", info->user_name,
 			    "s", info->host_name,
 			    "s", info->version,
@@ -547,7 +572,7 @@ static void registry_marshal_global(void *object, uint32_t id, uint32_t parent_i
 	struct spa_pod_builder *b;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_REGISTRY_PROXY_EVENT_GLOBAL);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_REGISTRY_PROXY_EVENT_GLOBAL, NULL);
 
 	n_items = props ? props->n_items : 0;
 
@@ -605,16 +630,21 @@ static void module_marshal_info(void *object, struct pw_module_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_MODULE_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_MODULE_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_MODULE_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "s", info->name,
 			    "s", info->filename,
 			    "s", info->args,
@@ -664,16 +694,21 @@ static void factory_marshal_info(void *object, struct pw_factory_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_FACTORY_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_FACTORY_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_FACTORY_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "s", info->name,
 			    "I", info->type,
 			    "i", info->version,
@@ -724,16 +759,21 @@ static void node_marshal_info(void *object, struct pw_node_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_NODE_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_NODE_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_NODE_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "s", info->name,
 			    "i", info->max_input_ports,
 			    "i", info->n_input_ports,
@@ -860,16 +900,21 @@ static void port_marshal_info(void *object, struct pw_port_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_PORT_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_PORT_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_PORT_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "s", info->name,
 			    "i", n_items, NULL);
 
@@ -984,16 +1029,21 @@ static void client_marshal_info(void *object, struct pw_client_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_CLIENT_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_CLIENT_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "i", n_items, NULL);
 
 	for (i = 0; i < n_items; i++) {
@@ -1038,16 +1088,21 @@ static void link_marshal_info(void *object, struct pw_link_info *info)
 {
 	struct pw_resource *resource = object;
 	struct spa_pod_builder *b;
+	const struct spa_pod *prev;
+	uint64_t change_mask;
 	uint32_t i, n_items;
 
-	b = pw_protocol_native_begin_resource(resource, PW_LINK_PROXY_EVENT_INFO);
+	b = pw_protocol_native_begin_resource_batch(resource, PW_LINK_PROXY_EVENT_INFO, &prev);
+	change_mask = info->change_mask | prev_change_mask(prev);
 
-	n_items = info->props ? info->props->n_items : 0;
+	/* only send the properties when they changed */
+	n_items = (change_mask & PW_LINK_CHANGE_MASK_PROPS) && info->props ?
+		info->props->n_items : 0;
 
 	spa_pod_builder_add(b,
 			    "[",
 			    "i", info->id,
-			    "l", info->change_mask,
+			    "l", change_mask,
 			    "i", info->output_node_id,
 			    "i", info->output_port_id,
 			    "i", info->input_node_id,
@@ -19,7 +19,9 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 
 #include "config.h"
 
@@ -29,6 +31,9 @@
 #include "pipewire/module.h"
 #include "pipewire/private.h"
 
+#define DEFAULT_TIMEOUT		3
+#define DEFAULT_WARM		true
+
 struct impl {
 	struct pw_core *core;
 	struct pw_type *t;
@@ -38,6 +43,9 @@ struct impl {
 	struct spa_hook core_listener;
 
 	struct spa_list node_list;
+
+	int timeout;		/**< default idle timeout in seconds */
+	bool warm;		/**< default to warm suspend */
 };
 
 struct node_info {
@@ -46,8 +54,40 @@ struct node_info {
 	struct pw_node *node;
 	struct spa_hook node_listener;
 	struct spa_source *idle_timeout;
+
+	int timeout;		/**< idle timeout in seconds, 0 never suspends */
+	bool warm;		/**< keep formats and buffers when suspending */
+	bool warm_suspended;	/**< the node is suspended with \ref pw_node_warm_suspend */
+
+	int64_t resume_start;	/**< time of the resume request or 0 */
+	uint32_t n_resumes;
+	int64_t resume_max;	/**< resume latencies in nanoseconds */
+	int64_t resume_total;
 };
 
+static int64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void update_config(struct node_info *info)
+{
+	const struct pw_properties *props = pw_node_get_properties(info->node);
+	const char *str;
+
+	if ((str = pw_properties_get(props, "node.suspend-timeout")))
+		info->timeout = atoi(str);
+	else
+		info->timeout = info->impl->timeout;
+
+	if ((str = pw_properties_get(props, "node.suspend-mode")))
+		info->warm = strcmp(str, "warm") == 0;
+	else
+		info->warm = info->impl->warm;
+}
+
 static struct node_info *find_node_info(struct impl *impl, struct pw_node *node)
 {
 	struct node_info *info;
@@ -78,17 +118,56 @@ static void node_info_free(struct node_info *info)
 static void idle_timeout(void *data, uint64_t expirations)
 {
 	struct node_info *info = data;
+	int res;
 
-	pw_log_debug("module %p: node %p idle timeout", info->impl, info->node);
+	pw_log_debug("module %p: node %p idle timeout, %s suspend", info->impl, info->node,
+			info->warm ? "warm" : "cold");
 	remove_idle_timeout(info);
+
+	if (info->warm) {
+		if ((res = pw_node_warm_suspend(info->node)) == 0) {
+			info->warm_suspended = true;
+			return;
+		}
+		pw_log_warn("module %p: node %p warm suspend failed: %s", info->impl,
+				info->node, spa_strerror(res));
+	}
 	pw_node_set_state(info->node, PW_NODE_STATE_SUSPENDED);
 }
 
+static void resume_done(struct node_info *info)
+{
+	struct impl *impl = info->impl;
+	int64_t latency = get_time_ns() - info->resume_start;
+	char val[32];
+	struct spa_dict_item items[1];
+
+	info->resume_start = 0;
+	info->n_resumes++;
+	info->resume_max = SPA_MAX(info->resume_max, latency);
+	info->resume_total += latency;
+
+	pw_log_info("module %p: node %p resumed in %" PRIi64 " us, max %" PRIi64
+			" us, avg %" PRIi64 " us over %u resumes", impl, info->node,
+			(int64_t) (latency / SPA_NSEC_PER_USEC),
+			(int64_t) (info->resume_max / SPA_NSEC_PER_USEC),
+			(int64_t) (info->resume_total / info->n_resumes / SPA_NSEC_PER_USEC),
+			info->n_resumes);
+
+	snprintf(val, sizeof(val), "%" PRIi64, (int64_t) (latency / SPA_NSEC_PER_USEC));
+	items[0] = SPA_DICT_ITEM_INIT("node.resume-latency", val);
+	pw_node_update_properties(info->node, &SPA_DICT_INIT(items, 1));
+}
+
 static void
 node_state_request(void *data, enum pw_node_state state)
 {
 	struct node_info *info = data;
 	remove_idle_timeout(info);
+
+	if (state == PW_NODE_STATE_RUNNING && info->resume_start == 0 &&
+	    (info->warm_suspended || info->node->info.state == PW_NODE_STATE_SUSPENDED))
+		info->resume_start = get_time_ns();
 }
 
 static void
@@ -97,24 +176,38 @@ node_state_changed(void *data, enum pw_node_state old, enum pw_node_state state,
 	struct node_info *info = data;
 	struct impl *impl = info->impl;
 
+	if (state == PW_NODE_STATE_RUNNING && info->resume_start != 0)
+		resume_done(info);
+
 	if (state != PW_NODE_STATE_IDLE) {
 		remove_idle_timeout(info);
-	} else {
+		info->warm_suspended = false;
+		if (state != PW_NODE_STATE_RUNNING)
+			info->resume_start = 0;
+	} else if (info->timeout > 0) {
 		struct timespec value;
 		struct pw_loop *main_loop = pw_core_get_main_loop(impl->core);
 
-		pw_log_debug("module %p: node %p became idle", impl, info->node);
+		pw_log_debug("module %p: node %p became idle, suspend in %d s", impl,
+				info->node, info->timeout);
+		remove_idle_timeout(info);
 		info->idle_timeout = pw_loop_add_timer(main_loop, idle_timeout, info);
-		value.tv_sec = 3;
+		value.tv_sec = info->timeout;
 		value.tv_nsec = 0;
 		pw_loop_update_timer(main_loop, info->idle_timeout, &value, NULL, false);
 	}
 }
 
+static void node_info_changed(void *data, struct pw_node_info *info)
+{
+	update_config(data);
+}
+
 static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.state_request = node_state_request,
 	.state_changed = node_state_changed,
+	.info_changed = node_info_changed,
 };
 
 static void
@@ -129,6 +222,7 @@ core_global_added(void *data, struct pw_global *global)
 		info = calloc(1, sizeof(struct node_info));
 		info->impl = impl;
 		info->node = node;
+		update_config(info);
 		spa_list_append(&impl->node_list, &info->link);
 
 		pw_node_add_listener(node, &info->node_listener, &node_events, info);
@@ -193,6 +287,7 @@ const struct pw_core_events core_events = {
 static int module_init(struct pw_module *module, struct pw_properties *properties)
 {
 	struct impl *impl;
+	const char *str;
 
 	impl = calloc(1, sizeof(struct impl));
 	if (impl == NULL)
@@ -204,6 +299,17 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 	impl->t = pw_core_get_type(impl->core);
 	impl->properties = properties;
 
+	impl->timeout = DEFAULT_TIMEOUT;
+	impl->warm = DEFAULT_WARM;
+	if (properties) {
+		if ((str = pw_properties_get(properties, "suspend.timeout")))
+			impl->timeout = atoi(str);
+		if ((str = pw_properties_get(properties, "suspend.mode")))
+			impl->warm = strcmp(str, "warm") == 0;
+	}
+	pw_log_debug("module %p: timeout %d s, %s suspend", impl, impl->timeout,
+			impl->warm ? "warm" : "cold");
+
 	spa_list_init(&impl->node_list);
 
 	pw_module_add_listener(module, &impl->module_listener, &module_events, impl);
@@ -214,5 +320,10 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 
 int pipewire__module_init(struct pw_module *module, const char *args)
 {
-	return module_init(module, NULL);
+	struct pw_properties *props = NULL;
+
+	if (args != NULL && (props = pw_properties_new_string(args)) == NULL)
+		return -ENOMEM;
+
+	return module_init(module, props);
 }
@@ -18,7 +18,6 @@
  */
 
 #include <stdio.h>
-#include <dlfcn.h>
 #include <errno.h>
 #include <poll.h>
 #include <string.h>
@@ -34,6 +33,7 @@
 #include <pipewire/log.h>
 #include <pipewire/type.h>
 #include <pipewire/node.h>
+#include <pipewire/pipewire.h>
 
 #include "spa-monitor.h"
 #include "spa-node.h"
@@ -52,7 +52,7 @@ struct impl {
 	struct pw_type *t;
 	struct pw_global *parent;
 
-	void *hnd;
+	struct pw_spa_plugin *plugin;
 
 	struct spa_list item_list;
 };
@@ -263,34 +263,19 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 	struct spa_handle *handle;
 	int res;
 	void *iface;
-	void *hnd;
+	struct pw_spa_plugin *plugin;
 	uint32_t index;
-	spa_handle_factory_enum_func_t enum_func;
 	const struct spa_handle_factory *factory;
-	char *filename;
 	const struct spa_support *support;
 	uint32_t n_support;
 	struct pw_type *t = pw_core_get_type(core);
 
-	asprintf(&filename, "%s/%s.so", dir, lib);
-
-	if ((hnd = dlopen(filename, RTLD_NOW)) == NULL) {
-		pw_log_error("can't load %s: %s", filename, dlerror());
+	if ((plugin = pw_spa_plugin_load(dir, lib)) == NULL)
 		goto open_failed;
-	}
-	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
-		pw_log_error("can't find enum function");
-		goto no_symbol;
-	}
 
-	for (index = 0;;) {
-		if ((res = enum_func(&factory, &index)) <= 0) {
-			if (res != 0)
-				pw_log_error("can't enumerate factories: %s", spa_strerror(res));
-			goto enum_failed;
-		}
-		if (strcmp(factory->name, factory_name) == 0)
-			break;
+	if ((factory = pw_spa_plugin_find_factory(plugin, factory_name)) == NULL) {
+		pw_log_error("can't find factory %s in %s", factory_name, lib);
+		goto enum_failed;
 	}
 	support = pw_core_get_support(core, &n_support);
 	handle = calloc(1, factory->size);
@@ -308,11 +293,11 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 	impl->core = core;
 	impl->t = t;
 	impl->parent = parent;
-	impl->hnd = hnd;
+	impl->plugin = plugin;
 
 	this = &impl->this;
 	this->monitor = iface;
-	this->lib = filename;
+	asprintf(&this->lib, "%s/%s.so", dir, lib);
 	this->factory_name = strdup(factory_name);
 	this->system_name = strdup(system_name);
 	this->handle = handle;
@@ -346,10 +331,8 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
       init_failed:
 	free(handle);
       enum_failed:
-      no_symbol:
-	dlclose(hnd);
+	pw_spa_plugin_unload(plugin);
       open_failed:
-	free(filename);
 	return NULL;
 
 }
@@ -370,6 +353,6 @@ void pw_spa_monitor_destroy(struct pw_spa_monitor *monitor)
 	free(monitor->factory_name);
 	free(monitor->system_name);
 
-	dlclose(impl->hnd);
+	pw_spa_plugin_unload(impl->plugin);
 	free(impl);
 }
@@ -23,7 +23,6 @@
 
 #include <string.h>
 #include <stdio.h>
-#include <dlfcn.h>
 
 #include <spa/node/node.h>
 #include <spa/param/props.h>
@@ -34,6 +33,7 @@
 #include "pipewire/port.h"
 #include "pipewire/log.h"
 #include "pipewire/private.h"
+#include "pipewire/pipewire.h"
 
 struct impl {
 	struct pw_node *this;
@@ -44,7 +44,7 @@ struct impl {
 	enum pw_spa_node_flags flags;
 	bool async_init;
 
-	void *hnd;
+	struct pw_spa_plugin *plugin;
         struct spa_handle *handle;
         struct spa_node *node;          /**< handle to SPA node */
 	char *lib;
@@ -69,8 +69,8 @@ static void pw_spa_node_destroy(void *data)
 	}
 	free(impl->lib);
 	free(impl->factory_name);
-	if (impl->hnd)
-		dlclose(impl->hnd);
+	if (impl->plugin)
+		pw_spa_plugin_unload(impl->plugin);
 }
 
 static void complete_init(struct impl *impl)
@@ -243,39 +243,19 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 	struct spa_node *spa_node;
 	int res;
 	struct spa_handle *handle;
-	void *hnd;
-	uint32_t index;
-	spa_handle_factory_enum_func_t enum_func;
+	struct pw_spa_plugin *plugin;
 	const struct spa_handle_factory *factory;
 	void *iface;
-	char *filename;
-	const char *dir;
 	const struct spa_support *support;
 	uint32_t n_support;
 	struct pw_type *t = pw_core_get_type(core);
 
-	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
-		dir = PLUGINDIR;
-
-	asprintf(&filename, "%s/%s.so", dir, lib);
-
-	if ((hnd = dlopen(filename, RTLD_NOW)) == NULL) {
-		pw_log_error("can't load %s: %s", filename, dlerror());
+	if ((plugin = pw_spa_plugin_load(NULL, lib)) == NULL)
 		goto open_failed;
-	}
-	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
-		pw_log_error("can't find enum function");
-		goto no_symbol;
-	}
 
-	for (index = 0;;) {
-		if ((res = enum_func(&factory, &index)) <= 0) {
-			if (res != 0)
-				pw_log_error("can't enumerate factories: %s", spa_strerror(res));
-			goto enum_failed;
-		}
-		if (strcmp(factory->name, factory_name) == 0)
-			break;
+	if ((factory = pw_spa_plugin_find_factory(plugin, factory_name)) == NULL) {
+		pw_log_error("can't find factory %s in %s", factory_name, lib);
+		goto enum_failed;
 	}
 
 	support = pw_core_get_support(core, &n_support);
@@ -308,9 +288,9 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 			       spa_node, handle, properties, user_data_size);
 
 	impl = this->user_data;
-	impl->hnd = hnd;
+	impl->plugin = plugin;
 	impl->handle = handle;
-	impl->lib = filename;
+	impl->lib = strdup(lib);
 	impl->factory_name = strdup(factory_name);
 
 	return this;
@@ -320,9 +300,7 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
       init_failed:
 	free(handle);
       enum_failed:
-      no_symbol:
-	dlclose(hnd);
+	pw_spa_plugin_unload(plugin);
       open_failed:
-	free(filename);
 	return NULL;
 }
@@ -51,10 +51,10 @@ find_permission(struct pw_client *client, struct pw_global *global)
 	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
 	struct permission *p;
 
-	if (!pw_array_check_index(&impl->permissions, global->id, struct permission))
+	if (!pw_array_check_index(&impl->permissions, pw_global_index(global), struct permission))
 		return NULL;
 
-	p = pw_array_get_unchecked(&impl->permissions, global->id, struct permission);
+	p = pw_array_get_unchecked(&impl->permissions, pw_global_index(global), struct permission);
 	if (p->permissions == -1)
 		return NULL;
 	else
@@ -390,11 +390,12 @@ static int do_permissions(void *data, struct pw_global *global)
 	struct pw_client *client = update->client;
 	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
 	struct permission *p;
+	uint32_t index = pw_global_index(global);
 	size_t len, i;
 
 	len = pw_array_get_len(&impl->permissions, struct permission);
-	if (len <= global->id) {
-		size_t diff = global->id - len + 1;
+	if (len <= index) {
+		size_t diff = index - len + 1;
 
 		p = pw_array_add(&impl->permissions, diff * sizeof(struct permission));
 		if (p == NULL)
@@ -404,7 +405,7 @@ static int do_permissions(void *data, struct pw_global *global)
 			p[i].permissions = -1;
 	}
 
-	p = pw_array_get_unchecked(&impl->permissions, global->id, struct permission);
+	p = pw_array_get_unchecked(&impl->permissions, index, struct permission);
 	if (p->permissions == -1)
 		p->permissions = impl->permissions_default;
 	else if (update->only_new)
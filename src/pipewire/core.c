@@ -17,6 +17,8 @@
  * Boston, MA 02110-1301, USA.
  */
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h>
@@ -38,6 +40,10 @@
 #include <spa/graph/graph-scheduler6.h>
 
 /** \cond */
+#define DEFAULT_QUANTUM	1024
+#define MIN_QUANTUM	16
+#define MAX_QUANTUM	8192
+
 struct resource_data {
 	struct spa_hook resource_listener;
 };
@@ -363,7 +369,7 @@ static const struct pw_global_events global_events = {
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
 	struct pw_core *this;
-	const char *name;
+	const char *name, *str;
 
 	this = calloc(1, sizeof(struct pw_core));
 	if (this == NULL)
@@ -386,7 +392,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	this->main_loop = main_loop;
 
 	pw_type_init(&this->type);
-	pw_map_init(&this->globals, 128, 32);
+	pw_map_init_tagged(&this->globals, 128, 32);
 
 	spa_graph_init(&this->rt.graph);
 	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
@@ -437,6 +443,19 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	this->sc_pagesize = sysconf(_SC_PAGESIZE);
 
+	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+			      PW_MEMBLOCK_FLAG_MAP_READWRITE |
+			      PW_MEMBLOCK_FLAG_SEAL,
+			      sizeof(struct spa_io_quantum),
+			      &this->quantum_mem) < 0)
+		goto no_mem;
+
+	this->quantum = this->quantum_mem->ptr;
+	this->quantum->size = DEFAULT_QUANTUM;
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_QUANTUM)) != NULL)
+		this->quantum->size = SPA_CLAMP(atoi(str), MIN_QUANTUM, MAX_QUANTUM);
+	pw_log_debug("core %p: quantum %u", this, this->quantum->size);
+
 	this->global = pw_global_new(this,
 				     this->type.core,
 				     PW_VERSION_CORE,
@@ -496,6 +515,8 @@ void pw_core_destroy(struct pw_core *core)
 
 	pw_data_loop_destroy(core->data_loop_impl);
 
+	pw_memblock_free(core->quantum_mem);
+
 	pw_release_spa_dbus(core->dbus_iface);
 
 	pw_properties_free(core->properties);
@@ -545,6 +566,61 @@ const struct pw_properties *pw_core_get_properties(struct pw_core *core)
 	return core->properties;
 }
 
+static int
+do_update_quantum(struct spa_loop *loop,
+		  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_core *core = user_data;
+	const uint32_t *quantum = data;
+	core->quantum->size = *quantum;
+	return 0;
+}
+
+static void update_quantum(struct pw_core *core, int quantum)
+{
+	uint32_t size = SPA_CLAMP(quantum, MIN_QUANTUM, MAX_QUANTUM);
+	struct pw_link *link;
+
+	if (size == core->quantum->size)
+		return;
+
+	pw_log_debug("core %p: quantum %u -> %u", core, core->quantum->size, size);
+
+	/* change the quantum between two cycles of the graph */
+	pw_loop_invoke(core->data_loop, do_update_quantum, SPA_ID_INVALID,
+		       &size, sizeof(size), true, core);
+
+	spa_list_for_each(link, &core->link_list, link)
+		pw_link_check_buffers(link);
+}
+
+/** Set the graph quantum
+ *
+ * \param core a core
+ * \param quantum the number of frames per cycle
+ *
+ * Nodes pick up the new quantum in their next cycle. Links with buffers
+ * that are too small for \a quantum get new buffers, the others keep
+ * their buffers.
+ *
+ * \memberof pw_core
+ */
+int pw_core_set_quantum(struct pw_core *core, uint32_t quantum)
+{
+	char val[16];
+	struct spa_dict_item items[1];
+
+	snprintf(val, sizeof(val), "%u", quantum);
+	items[0] = SPA_DICT_ITEM_INIT(PW_CORE_PROP_QUANTUM, val);
+
+	return pw_core_update_properties(core, &SPA_DICT_INIT(items, 1));
+}
+
+uint32_t pw_core_get_quantum(struct pw_core *core)
+{
+	return core->quantum->size;
+}
+
 /** Update core properties
  *
  * \param core a core
@@ -559,8 +635,15 @@ int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 	struct pw_resource *resource;
 	uint32_t i, changed = 0;
 
-	for (i = 0; i < dict->n_items; i++)
-		changed += pw_properties_set(core->properties, dict->items[i].key, dict->items[i].value);
+	for (i = 0; i < dict->n_items; i++) {
+		if (!pw_properties_set(core->properties, dict->items[i].key, dict->items[i].value))
+			continue;
+
+		changed++;
+		if (strcmp(dict->items[i].key, PW_CORE_PROP_QUANTUM) == 0)
+			update_quantum(core, dict->items[i].value ?
+					atoi(dict->items[i].value) : DEFAULT_QUANTUM);
+	}
 
 	pw_log_debug("core %p: updated %d properties", core, changed);
 
@@ -110,6 +110,8 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** The number of frames the graph processes in one cycle, default 1024 */
+#define PW_CORE_PROP_QUANTUM	"pipewire.quantum"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
@@ -138,6 +140,13 @@ const struct pw_properties *pw_core_get_properties(struct pw_core *core);
 /** Update the core properties */
 int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict);
 
+/** Change the quantum of the graph, links are rebuffered when their
+ * buffers are too small for the new quantum */
+int pw_core_set_quantum(struct pw_core *core, uint32_t quantum);
+
+/** Get the current quantum of the graph */
+uint32_t pw_core_get_quantum(struct pw_core *core);
+
 /** Get the core support objects */
 const struct spa_support *pw_core_get_support(struct pw_core *core, uint32_t *n_support);
 
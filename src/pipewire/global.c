@@ -241,6 +241,10 @@ void pw_global_destroy(struct pw_global *global)
 		}
 
 		pw_map_remove(&core->globals, global->id);
+		/* release the free ids at the end after a burst of removed globals */
+		if (pw_global_index(global) + 1 == pw_map_get_size(&core->globals) &&
+		    pw_map_get_n_items(&core->globals) < pw_map_get_size(&core->globals) / 4)
+			pw_map_compact(&core->globals);
 
 		spa_list_remove(&global->link);
 		pw_core_events_global_removed(core, global);
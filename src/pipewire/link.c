@@ -53,12 +53,17 @@ struct impl {
 	struct spa_hook input_node_listener;
 	struct spa_hook output_port_listener;
 	struct spa_hook output_node_listener;
+
+	size_t size;		/**< allocated size */
+	bool slab;		/**< allocated from the link slab */
 };
 
 struct resource_data {
 	struct spa_hook resource_listener;
 };
 
+static struct pw_slab link_slab = PW_SLAB_INIT(sizeof(struct impl));
+
 /** \endcond */
 
 static void pw_link_update_state(struct pw_link *link, enum pw_link_state state, char *error)
@@ -223,6 +228,12 @@ static int do_negotiate(struct pw_link *this, uint32_t in_state, uint32_t out_st
 	if (changed) {
 		this->info.change_mask |= PW_LINK_CHANGE_MASK_FORMAT;
 
+		if (this->properties) {
+			pw_properties_setf(this->properties, "link.memory", "%zu",
+					   pw_link_get_memory_size(this));
+			this->info.change_mask |= PW_LINK_CHANGE_MASK_PROPS;
+		}
+
 		pw_link_events_info_changed(this, &this->info);
 
 		spa_list_for_each(resource, &this->resource_list, link)
@@ -354,7 +365,9 @@ static int alloc_buffers(struct pw_link *this,
 
 			metas[n_metas].type = type;
 			metas[n_metas].size = size;
-			meta_size += metas[n_metas].size;
+			/* keep the next meta aligned, metas like VideoDamage and
+			 * Timing are arrays or contain 64 bits fields */
+			meta_size += SPA_ROUND_UP_N(size, 8);
 			n_metas++;
 			skel_size += sizeof(struct spa_meta);
 		}
@@ -369,13 +382,17 @@ static int alloc_buffers(struct pw_link *this,
 	}
 
 	buffers = calloc(n_buffers, skel_size + sizeof(struct spa_buffer *));
+	if (buffers == NULL)
+		return -ENOMEM;
 	/* pointer to buffer structures */
 	bp = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), struct spa_buffer);
 
 	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
 				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
-				     PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m)) < 0)
+				     PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m)) < 0) {
+		free(buffers);
 		return res;
+	}
 
 	for (i = 0; i < n_buffers; i++) {
 		int j;
@@ -395,7 +412,7 @@ static int alloc_buffers(struct pw_link *this,
 			m->type = metas[j].type;
 			m->size = metas[j].size;
 			m->data = p;
-			p += m->size;
+			p += SPA_ROUND_UP_N(m->size, 8);
 		}
 		/* pointer to data structure */
 		b->n_datas = n_datas;
@@ -429,6 +446,7 @@ static int alloc_buffers(struct pw_link *this,
 	allocation->mem = m;
 	allocation->n_buffers = n_buffers;
 	allocation->buffers = buffers;
+	allocation->size = n_buffers * (skel_size + sizeof(struct spa_buffer *)) + m->size;
 
 	return 0;
 }
@@ -659,6 +677,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 				pw_work_queue_add(impl->work, output->node, res, complete_paused, output);
 
 			move_allocation(&allocation, &output->allocation);
+			pw_port_update_memory(output);
 
 			pw_log_debug("link %p: allocated %d buffers %p from output port", this,
 				     allocation.n_buffers, allocation.buffers);
@@ -691,6 +710,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			pw_work_queue_add(impl->work, output->node, res, complete_paused, output);
 
 		move_allocation(&allocation, &output->allocation);
+		pw_port_update_memory(output);
 
 	} else if (in_flags & SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS) {
 		pw_log_debug("link %p: using %d buffers %p on input port", this,
@@ -1009,6 +1029,79 @@ int pw_link_deactivate(struct pw_link *this)
 	return 0;
 }
 
+static uint32_t query_buffer_size(struct pw_link *this)
+{
+	struct pw_type *t = &this->core->type;
+	uint8_t buffer[4096];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *param;
+	uint32_t size = 0;
+
+	if (param_filter(this, this->input, this->output, t->param.idBuffers, &b) <= 0)
+		return 0;
+
+	param = SPA_MEMBER(buffer, 0, struct spa_pod);
+	spa_pod_fixate(param);
+	spa_pod_object_parse(param,
+		":", t->param_buffers.size, "i", &size, NULL);
+
+	return size;
+}
+
+/** Check the buffers of a link against the current quantum
+ *
+ * \param this a link
+ * \return 0 when the buffers are kept or reallocated, < 0 on error
+ *
+ * The nodes are asked for their buffer requirements again. When the
+ * buffers on the link are large enough they are reused, else the buffers
+ * of the output port and all its links are cleared and allocation is
+ * done again.
+ *
+ * \memberof pw_link
+ */
+int pw_link_check_buffers(struct pw_link *this)
+{
+	struct pw_port *input = this->input, *output = this->output;
+	struct spa_buffer *buf;
+	struct pw_link *l;
+	uint32_t size;
+
+	if (input == NULL || output == NULL || output->allocation.n_buffers == 0)
+		return 0;
+
+	buf = output->allocation.buffers[0];
+	if (buf->n_datas == 0)
+		return 0;
+
+	size = query_buffer_size(this);
+	if (size <= buf->datas[0].maxsize) {
+		pw_log_debug("link %p: reuse buffers, size %u <= %u", this,
+				size, buf->datas[0].maxsize);
+		return 0;
+	}
+
+	pw_log_debug("link %p: reallocate buffers, size %u > %u", this,
+			size, buf->datas[0].maxsize);
+
+	/* the buffers of the output port are shared with all its links */
+	spa_list_for_each(l, &output->links, output_link) {
+		pw_loop_invoke(output->node->data_loop,
+			       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, l);
+		pw_port_use_buffers(l->input, NULL, 0);
+		pw_link_update_state(l, PW_LINK_STATE_ALLOCATING, NULL);
+	}
+	pw_port_use_buffers(output, NULL, 0);
+
+	spa_list_for_each(l, &output->links, output_link) {
+		struct impl *li = SPA_CONTAINER_OF(l, struct impl, this);
+		if (li->active)
+			pw_work_queue_add(li->work,
+					  l, -EBUSY, (pw_work_func_t) check_states, l);
+	}
+	return 0;
+}
+
 static void link_unbind_func(void *data)
 {
 	struct pw_resource *resource = data;
@@ -1107,10 +1200,17 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	if (pw_link_find(output, input))
 		goto link_exists;
 
-	impl = calloc(1, sizeof(struct impl) + user_data_size);
+	if (pw_slab_can_alloc(&link_slab, sizeof(struct impl) + user_data_size)) {
+		impl = pw_slab_alloc(&link_slab);
+		if (impl != NULL)
+			impl->slab = true;
+	} else
+		impl = calloc(1, sizeof(struct impl) + user_data_size);
 	if (impl == NULL)
 		goto no_mem;
 
+	impl->size = sizeof(struct impl) + user_data_size;
+
 	this = &impl->this;
 	pw_log_debug("link %p: new", this);
 
@@ -1275,6 +1375,24 @@ int pw_link_register(struct pw_link *link,
 	return 0;
 }
 
+/** Get the memory used by the link
+ *
+ * The buffers are owned by the ports, see \ref pw_port_get_memory_size().
+ *
+ * \memberof pw_link
+ */
+size_t pw_link_get_memory_size(struct pw_link *link)
+{
+	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
+	size_t size = impl->size;
+
+	if (impl->format_filter)
+		size += SPA_POD_SIZE(impl->format_filter);
+	if (link->info.format)
+		size += SPA_POD_SIZE(link->info.format);
+	return size;
+}
+
 void pw_link_destroy(struct pw_link *link)
 {
 	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
@@ -1314,7 +1432,10 @@ void pw_link_destroy(struct pw_link *link)
 	if (link->info.format)
 		free(link->info.format);
 
-	free(impl);
+	if (impl->slab)
+		pw_slab_free(&link_slab, impl);
+	else
+		free(impl);
 }
 
 void pw_link_add_listener(struct pw_link *link,
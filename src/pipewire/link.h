@@ -120,6 +120,9 @@ struct pw_port *pw_link_get_output(struct pw_link *link);
 /** Get the input port of the link */
 struct pw_port *pw_link_get_input(struct pw_link *link);
 
+/** Get the memory used by the link, also in the link.memory property */
+size_t pw_link_get_memory_size(struct pw_link *link);
+
 /** Find the link between 2 ports \memberof pw_link */
 struct pw_link *pw_link_find(struct pw_port *output, struct pw_port *input);
 
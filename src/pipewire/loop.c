@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 #include <spa/support/loop.h>
 #include <spa/support/type-map.h>
@@ -26,7 +28,7 @@
 #include <pipewire/loop.h>
 #include <pipewire/log.h>
 
-#define DATAS_SIZE (4096 * 8)
+#define DEFAULT_LOOP	"loop"
 
 /** \cond */
 
@@ -37,20 +39,58 @@ struct impl {
 };
 /** \endcond */
 
+static struct impl *
+make_loop(const char *factory_name, const struct spa_support *support, uint32_t n_support)
+{
+	int res;
+	struct impl *impl;
+	const struct spa_handle_factory *factory;
+
+	factory = pw_get_support_factory(factory_name);
+	if (factory == NULL) {
+		pw_log_warn("loop: can't find loop factory %s", factory_name);
+		return NULL;
+	}
+
+	impl = calloc(1, sizeof(struct impl) + factory->size);
+	if (impl == NULL)
+		return NULL;
+
+	impl->handle = SPA_MEMBER(impl, sizeof(struct impl), struct spa_handle);
+
+	if ((res = spa_handle_factory_init(factory,
+					   impl->handle,
+					   NULL,
+					   support,
+					   n_support)) < 0) {
+		pw_log_warn("loop: can't make %s instance: %s", factory_name, spa_strerror(res));
+		free(impl);
+		return NULL;
+	}
+	return impl;
+}
+
 /** Create a new loop
+ * \param properties optional properties, \ref PW_LOOP_PROP_FACTORY selects
+ *        the loop implementation
  * \returns a newly allocated loop
+ *
+ * When the requested loop implementation is not available, for example
+ * because the kernel does not support io_uring, the default epoll based
+ * implementation is used.
+ *
  * \memberof pw_loop
  */
 struct pw_loop *pw_loop_new(struct pw_properties *properties)
 {
 	int res;
-	struct impl *impl;
+	struct impl *impl = NULL;
 	struct pw_loop *this;
-	const struct spa_handle_factory *factory;
 	struct spa_type_map *map;
 	void *iface;
 	const struct spa_support *support;
 	uint32_t n_support;
+	const char *name = NULL;
 
 	support = pw_get_support(&n_support);
 	if (support == NULL)
@@ -60,27 +100,17 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	if (map == NULL)
 		return NULL;
 
-	factory = pw_get_support_factory("loop");
-	if (factory == NULL)
-		return NULL;
-
-	impl = calloc(1, sizeof(struct impl) + factory->size);
+	if (properties)
+		name = pw_properties_get(properties, PW_LOOP_PROP_FACTORY);
+	if (name != NULL && strcmp(name, DEFAULT_LOOP) != 0)
+		impl = make_loop(name, support, n_support);
+	if (impl == NULL)
+		impl = make_loop(DEFAULT_LOOP, support, n_support);
 	if (impl == NULL)
 		return NULL;
 
-	impl->handle = SPA_MEMBER(impl, sizeof(struct impl), struct spa_handle);
-
 	this = &impl->this;
 
-	if ((res = spa_handle_factory_init(factory,
-					   impl->handle,
-					   NULL,
-					   support,
-					   n_support)) < 0) {
-		fprintf(stderr, "can't make factory instance: %d\n", res);
-		goto failed;
-	}
-
         if ((res = spa_handle_get_interface(impl->handle,
 					    spa_type_map_get_id(map, SPA_TYPE__Loop),
 					    &iface)) < 0) {
@@ -108,6 +138,7 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	return this;
 
       failed:
+	spa_handle_clear(impl->handle);
 	free(impl);
 	return NULL;
 }
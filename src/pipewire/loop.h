@@ -40,6 +40,10 @@ struct pw_loop {
 	struct spa_loop_utils *utils;		/**< loop utils */
 };
 
+/** The name of the spa loop factory to use. "loop" is the default epoll
+ * implementation, "loop-uring" uses io_uring when the kernel supports it */
+#define PW_LOOP_PROP_FACTORY	"pipewire.loop.factory"
+
 struct pw_loop *
 pw_loop_new(struct pw_properties *properties);
 
@@ -32,6 +32,11 @@ extern "C" {
 /** \class pw_map
  *
  * A map that holds objects indexed by id
+ *
+ * A map made with \ref pw_map_init_tagged() stores a generation for each
+ * slot in the upper bits of the ids. The generation is incremented when
+ * an item is removed so that a stale id does not find the object that
+ * reused the slot.
  */
 
 /** An entry in the map \memberof pw_map */
@@ -44,16 +49,32 @@ union pw_map_item {
 struct pw_map {
 	struct pw_array items;	/**< an array with the map items */
 	uint32_t free_list;	/**< the free items */
+	uint32_t n_items;	/**< the number of used items */
+	bool tagged;		/**< ids contain a generation */
+	struct pw_array gens;	/**< generation per item of a tagged map */
 };
 
-#define PW_MAP_INIT(extend) (struct pw_map) { PW_ARRAY_INIT(extend), 0 }
+#define PW_MAP_INIT(extend) (struct pw_map) { PW_ARRAY_INIT(extend), SPA_ID_INVALID, 0, false, PW_ARRAY_INIT(0) }
+
+/** Bits of a tagged id used for the index \memberof pw_map */
+#define PW_MAP_ID_INDEX_BITS		24
+#define PW_MAP_ID_INDEX_MASK		((1u << PW_MAP_ID_INDEX_BITS) - 1)
+/** Mask of the generation, ids stay positive when used as int32_t \memberof pw_map */
+#define PW_MAP_ID_GEN_MASK		0x7fu
+/** Get the index of a tagged id \memberof pw_map */
+#define PW_MAP_ID_INDEX(id)		((id) & PW_MAP_ID_INDEX_MASK)
+/** Get the generation of a tagged id \memberof pw_map */
+#define PW_MAP_ID_GEN(id)		(((id) >> PW_MAP_ID_INDEX_BITS) & PW_MAP_ID_GEN_MASK)
+/** Make a tagged id from an index and a generation \memberof pw_map */
+#define PW_MAP_ID_MAKE(index,gen)	((index) | ((uint32_t)(gen) << PW_MAP_ID_INDEX_BITS))
 
 #define pw_map_get_size(m)            pw_array_get_len(&(m)->items, union pw_map_item)
-#define pw_map_get_item(m,id)         pw_array_get_unchecked(&(m)->items,id,union pw_map_item)
+#define pw_map_get_n_items(m)         ((m)->n_items)
+#define pw_map_get_item(m,id)         pw_array_get_unchecked(&(m)->items,pw_map_index(m,id),union pw_map_item)
 #define pw_map_item_is_free(item)     ((item)->next & 0x1)
 #define pw_map_id_is_free(m,id)       (pw_map_item_is_free(pw_map_get_item(m,id)))
-#define pw_map_check_id(m,id)         ((id) < pw_map_get_size(m))
-#define pw_map_has_item(m,id)         (pw_map_check_id(m,id) && !pw_map_id_is_free(m, id))
+#define pw_map_check_id(m,id)         (pw_map_index(m,id) < pw_map_get_size(m))
+#define pw_map_has_item(m,id)         (pw_map_lookup(m,id) != NULL)
 #define pw_map_lookup_unchecked(m,id) pw_map_get_item(m,id)->data
 
 /** Convert an id to a pointer that can be inserted into the map \memberof pw_map */
@@ -61,6 +82,25 @@ struct pw_map {
 /** Convert a pointer to an id that can be retrieved from the map \memberof pw_map */
 #define PW_MAP_PTR_TO_ID(p)           (SPA_PTR_TO_UINT32(p)>>1)
 
+/** Get the index of the item with \a id \memberof pw_map */
+static inline uint32_t pw_map_index(const struct pw_map *map, uint32_t id)
+{
+	return map->tagged ? PW_MAP_ID_INDEX(id) : id;
+}
+
+static inline uint8_t *pw_map_get_gen(struct pw_map *map, uint32_t index)
+{
+	size_t len = pw_array_get_len(&map->gens, uint8_t);
+
+	if (index >= len) {
+		uint8_t *g = (uint8_t *) pw_array_add(&map->gens, index - len + 1);
+		if (g == NULL)
+			return NULL;
+		memset(g, 0, index - len + 1);
+	}
+	return pw_array_get_unchecked(&map->gens, index, uint8_t);
+}
+
 /** Initialize a map
  * \param map the map to initialize
  * \param size the initial size of the map
@@ -72,6 +112,23 @@ static inline void pw_map_init(struct pw_map *map, size_t size, size_t extend)
 	pw_array_init(&map->items, extend);
 	pw_array_ensure_size(&map->items, size * sizeof(union pw_map_item));
 	map->free_list = SPA_ID_INVALID;
+	map->n_items = 0;
+	map->tagged = false;
+	pw_array_init(&map->gens, 0);
+}
+
+/** Initialize a map with generation tagged ids
+ * \param map the map to initialize
+ * \param size the initial size of the map
+ * \param extend the amount to bytes to grow the map with when needed
+ * \memberof pw_map
+ */
+static inline void pw_map_init_tagged(struct pw_map *map, size_t size, size_t extend)
+{
+	pw_map_init(map, size, extend);
+	map->tagged = true;
+	pw_array_init(&map->gens, SPA_MAX(extend / sizeof(union pw_map_item), 16u));
+	pw_array_ensure_size(&map->gens, size);
 }
 
 /** Clear a map
@@ -81,6 +138,18 @@ static inline void pw_map_init(struct pw_map *map, size_t size, size_t extend)
 static inline void pw_map_clear(struct pw_map *map)
 {
 	pw_array_clear(&map->items);
+	pw_array_clear(&map->gens);
+}
+
+static inline uint32_t pw_map_make_id(struct pw_map *map, uint32_t index)
+{
+	uint8_t *gen;
+
+	if (!map->tagged)
+		return index;
+	if (index > PW_MAP_ID_INDEX_MASK || (gen = pw_map_get_gen(map, index)) == NULL)
+		return SPA_ID_INVALID;
+	return PW_MAP_ID_MAKE(index, *gen);
 }
 
 /** Insert data in the map
@@ -92,26 +161,32 @@ static inline void pw_map_clear(struct pw_map *map)
 static inline uint32_t pw_map_insert_new(struct pw_map *map, void *data)
 {
 	union pw_map_item *start, *item;
-	uint32_t id;
+	uint32_t index, id;
 
 	if (map->free_list != SPA_ID_INVALID) {
 		start = (union pw_map_item *) map->items.data;
 		item = &start[map->free_list >> 1];
+		index = item - start;
+		if ((id = pw_map_make_id(map, index)) == SPA_ID_INVALID)
+			return SPA_ID_INVALID;
 		map->free_list = item->next;
 	} else {
+		index = pw_map_get_size(map);
+		if ((id = pw_map_make_id(map, index)) == SPA_ID_INVALID)
+			return SPA_ID_INVALID;
 		item = (union pw_map_item *) pw_array_add(&map->items, sizeof(union pw_map_item));
 		if (!item)
 			return SPA_ID_INVALID;
-		start = (union pw_map_item *) map->items.data;
 	}
 	item->data = data;
-	id = (item - start);
+	map->n_items++;
 	return id;
 }
 
 /** Insert data in the map at an index
  * \param map the map to inser into
- * \param id the index to insert at
+ * \param id the index to insert at, for a tagged map the generation of
+ *        the slot is set from the id
  * \param data the data to insert
  * \return true on success, false when the index is invalid
  * \memberof pw_map
@@ -119,28 +194,56 @@ static inline uint32_t pw_map_insert_new(struct pw_map *map, void *data)
 static inline bool pw_map_insert_at(struct pw_map *map, uint32_t id, void *data)
 {
 	size_t size = pw_map_get_size(map);
+	uint32_t index = pw_map_index(map, id);
 	union pw_map_item *item;
+	uint8_t *gen;
 
-	if (id > size)
+	if (index > size)
 		return false;
-	else if (id == size)
-		item = (union pw_map_item *) pw_array_add(&map->items, sizeof(union pw_map_item));
-	else
-		item = pw_map_get_item(map, id);
 
+	if (map->tagged) {
+		if ((gen = pw_map_get_gen(map, index)) == NULL)
+			return false;
+		*gen = PW_MAP_ID_GEN(id);
+	}
+	if (index == size) {
+		item = (union pw_map_item *) pw_array_add(&map->items, sizeof(union pw_map_item));
+		if (!item)
+			return false;
+		map->n_items++;
+	} else {
+		item = pw_array_get_unchecked(&map->items, index, union pw_map_item);
+		if (pw_map_item_is_free(item))
+			map->n_items++;
+	}
 	item->data = data;
 	return true;
 }
 
 /** Remove an item at index
  * \param map the map to remove from
- * \param id the index to remove
+ * \param id the index to remove, for a tagged map nothing is removed
+ *        when the generation of the id doesn't match the slot
  * \memberof pw_map
  */
 static inline void pw_map_remove(struct pw_map *map, uint32_t id)
 {
-	pw_map_get_item(map, id)->next = map->free_list;
-	map->free_list = (id << 1) | 1;
+	uint32_t index = pw_map_index(map, id);
+	union pw_map_item *item = pw_array_get_unchecked(&map->items, index, union pw_map_item);
+
+	if (pw_map_item_is_free(item))
+		return;
+
+	if (map->tagged) {
+		uint8_t *gen = pw_array_get_unchecked(&map->gens, index, uint8_t);
+		/* a stale id must not remove the item that reused the slot */
+		if (*gen != PW_MAP_ID_GEN(id))
+			return;
+		*gen = (*gen + 1) & PW_MAP_ID_GEN_MASK;
+	}
+	item->next = map->free_list;
+	map->free_list = (index << 1) | 1;
+	map->n_items--;
 }
 
 /** Find an item in the map
@@ -151,14 +254,57 @@ static inline void pw_map_remove(struct pw_map *map, uint32_t id)
  */
 static inline void *pw_map_lookup(struct pw_map *map, uint32_t id)
 {
-	if (SPA_LIKELY(pw_map_check_id(map, id))) {
-		union pw_map_item *item = pw_map_get_item(map, id);
-		if (!pw_map_item_is_free(item))
-			return item->data;
+	uint32_t index = pw_map_index(map, id);
+
+	if (SPA_LIKELY(index < pw_map_get_size(map))) {
+		union pw_map_item *item = pw_array_get_unchecked(&map->items, index, union pw_map_item);
+		if (pw_map_item_is_free(item))
+			return NULL;
+		if (map->tagged &&
+		    *pw_array_get_unchecked(&map->gens, index, uint8_t) != PW_MAP_ID_GEN(id))
+			return NULL;
+		return item->data;
 	}
 	return NULL;
 }
 
+/** Release the free items at the end of the map
+ *
+ * The free list is rebuilt so that the lowest free ids are reused first,
+ * which keeps the used items at the start of the map. Memory is released
+ * when less than half of the allocated items are used.
+ *
+ * \param map the map to compact
+ * \memberof pw_map
+ */
+static inline void pw_map_compact(struct pw_map *map)
+{
+	union pw_map_item *start = (union pw_map_item *) map->items.data;
+	uint32_t i, size = pw_map_get_size(map);
+	size_t alloc;
+	void *data;
+
+	while (size > 0 && pw_map_item_is_free(&start[size - 1]))
+		size--;
+	map->items.size = size * sizeof(union pw_map_item);
+
+	map->free_list = SPA_ID_INVALID;
+	for (i = size; i > 0; i--) {
+		if (pw_map_item_is_free(&start[i - 1])) {
+			start[i - 1].next = map->free_list;
+			map->free_list = ((i - 1) << 1) | 1;
+		}
+	}
+
+	alloc = SPA_MAX(map->items.size, map->items.extend);
+	if (map->items.alloc > 2 * alloc) {
+		if ((data = realloc(map->items.data, alloc)) != NULL) {
+			map->items.data = data;
+			map->items.alloc = alloc;
+		}
+	}
+}
+
 /** Iterate all map items
  * \param map the map to iterate
  * \param func the function to call for each item, the item data and \a data is
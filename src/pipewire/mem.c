@@ -268,6 +268,53 @@ void pw_memblock_free(struct pw_memblock *mem)
 	free(mem);
 }
 
+/** Release the pages of a memory range
+ * \param mem a memblock
+ * \param offset offset of the range in \a mem
+ * \param size size of the range
+ * \return 0 on success, < 0 on error
+ *
+ * Only the pages that are completely inside the range are released. The
+ * memory stays mapped and the fd stays valid, released pages read as
+ * zero when they are used again.
+ *
+ * \memberof pw_memblock
+ */
+int pw_memblock_release(struct pw_memblock *mem, off_t offset, size_t size)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	off_t start, end;
+
+	if (mem->ptr == NULL || offset + size > mem->size)
+		return -EINVAL;
+
+	if (mem->fd != -1) {
+		/* punch a hole in the file so that the pages are released
+		 * for all processes that map it */
+		start = SPA_ROUND_UP_N(mem->offset + offset, pagesize);
+		end = SPA_ROUND_DOWN_N(mem->offset + offset + size, pagesize);
+		if (end <= start)
+			return 0;
+
+		if (fallocate(mem->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      start, end - start) < 0)
+			return -errno;
+	} else {
+		uintptr_t ptr = (uintptr_t) mem->ptr + offset;
+
+		start = SPA_ROUND_UP_N(ptr, pagesize);
+		end = SPA_ROUND_DOWN_N(ptr + size, pagesize);
+		if (end <= start)
+			return 0;
+
+		if (madvise((void *) start, end - start, MADV_DONTNEED) < 0)
+			return -errno;
+	}
+	pw_log_debug("mem %p: released %zd bytes", mem, (ssize_t) (end - start));
+
+	return 0;
+}
+
 struct pw_memblock * pw_memblock_find(const void *ptr)
 {
 	struct memblock *m;
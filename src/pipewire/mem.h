@@ -62,6 +62,9 @@ pw_memblock_map(struct pw_memblock *mem);
 void
 pw_memblock_free(struct pw_memblock *mem);
 
+/** Release the pages of a range of \a mem, the memory stays mapped */
+int pw_memblock_release(struct pw_memblock *mem, off_t offset, size_t size);
+
 /** Find memblock for given \a ptr */
 struct pw_memblock * pw_memblock_find(const void *ptr);
 
@@ -527,14 +527,18 @@ static void node_need_input(void *data)
 	struct pw_node *node = data;
 	pw_log_trace("node %p: need input", node);
 	pw_node_events_need_input(node);
+	spa_graph_cycle_start(node->rt.graph, &node->rt.node);
 	spa_graph_need_input(node->rt.graph, &node->rt.node);
+	spa_graph_cycle_end(node->rt.graph, &node->rt.node);
 }
 
 static void node_have_output(void *data)
 {
 	struct pw_node *node = data;
 	pw_log_trace("node %p: have output", node);
+	spa_graph_cycle_start(node->rt.graph, &node->rt.node);
 	spa_graph_have_output(node->rt.graph, &node->rt.node);
+	spa_graph_cycle_end(node->rt.graph, &node->rt.node);
 	pw_node_events_have_output(node);
 }
 
@@ -849,6 +853,98 @@ static void node_activate(struct pw_node *this)
 	}
 }
 
+static void release_port_memory(struct pw_port *port)
+{
+	struct allocation *a = &port->allocation;
+	uint32_t i, j;
+	int res;
+
+	if (a->mem == NULL)
+		return;
+
+	for (i = 0; i < a->n_buffers; i++) {
+		struct spa_buffer *b = a->buffers[i];
+
+		for (j = 0; j < b->n_datas; j++) {
+			struct spa_data *d = &b->datas[j];
+
+			/* only the data, the metadata and chunks are kept */
+			if (d->data == NULL || d->fd != a->mem->fd)
+				continue;
+
+			if ((res = pw_memblock_release(a->mem, d->mapoffset, d->maxsize)) < 0)
+				pw_log_warn("port %p: can't release memory: %s", port,
+						spa_strerror(res));
+		}
+	}
+}
+
+/* the buffers of an output port are shared with all its links, they can only
+ * be released when no node on the port is running */
+static bool output_port_is_idle(struct pw_port *port)
+{
+	struct pw_link *link;
+
+	if (port->node->info.state == PW_NODE_STATE_RUNNING)
+		return false;
+
+	spa_list_for_each(link, &port->links, output_link) {
+		if (link->input->node->info.state == PW_NODE_STATE_RUNNING)
+			return false;
+	}
+	return true;
+}
+
+/** Suspend a node and keep its configuration
+ * \param node an idle \ref pw_node
+ * \return 0 on success < 0 on error
+ *
+ * The node is asked to release its device and the memory of the buffers
+ * on its ports is given back to the system. The buffers of an input port
+ * are allocated on the output port of the peer, they are released when
+ * no node linked to that output port is running. Unlike
+ * \ref PW_NODE_STATE_SUSPENDED, the formats and buffers stay configured
+ * so that the node can be started again without negotiation.
+ *
+ * \memberof pw_node
+ */
+int pw_node_warm_suspend(struct pw_node *node)
+{
+	struct pw_port *p;
+	int res;
+
+	if (node->info.state != PW_NODE_STATE_IDLE)
+		return -EBUSY;
+
+	pw_log_debug("node %p: warm suspend", node);
+
+	do_pause_node(node);
+
+	res = spa_node_send_command(node->node,
+				    &SPA_COMMAND_INIT(node->core->type.command_node.Suspend));
+	/* nodes without a device have nothing to release */
+	if (res < 0 && res != -ENOTSUP) {
+		pw_log_warn("node %p: suspend error %s", node, spa_strerror(res));
+		return res;
+	}
+
+	spa_list_for_each(p, &node->input_ports, link) {
+		struct pw_link *l;
+
+		release_port_memory(p);
+		spa_list_for_each(l, &p->links, input_link) {
+			if (output_port_is_idle(l->output))
+				release_port_memory(l->output);
+		}
+	}
+	spa_list_for_each(p, &node->output_ports, link) {
+		if (output_port_is_idle(p))
+			release_port_memory(p);
+	}
+
+	return 0;
+}
+
 /** Set th node state
  * \param node a \ref pw_node
  * \param state a \ref pw_node_state
@@ -28,6 +28,7 @@
 #include <pwd.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <spa/support/dbus.h>
 
@@ -38,14 +39,14 @@
 static char **categories = NULL;
 
 static struct support_info {
-	void *hnd;
-	spa_handle_factory_enum_func_t enum_func;
+	struct pw_spa_plugin *plugin;
 	struct spa_support support[16];
 	uint32_t n_support;
 } support_info;
 
 struct interface {
 	struct spa_list link;
+	struct pw_spa_plugin *plugin;	/**< plugin to unload with the interface */
 	struct spa_handle *handle;
 	uint32_t type;
 	void *iface;
@@ -57,58 +58,230 @@ struct registry {
 
 static struct registry global_registry;
 
-static bool
-open_support(const char *path,
-	     const char *lib,
-	     struct support_info *info)
+/** \cond */
+struct factory_entry {
+	uint32_t hash;
+	const struct spa_handle_factory *factory;
+};
+
+struct pw_spa_plugin {
+	struct spa_list link;
+	int ref;
+	char *filename;
+	void *hnd;
+	spa_handle_factory_enum_func_t enum_func;
+
+	bool indexed;			/**< factories are indexed */
+	uint32_t mask;			/**< size - 1 of the factories hash table */
+	struct factory_entry *factories;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct spa_list plugins;
+} plugin_registry = { PTHREAD_MUTEX_INITIALIZER, };
+/** \endcond */
+
+static uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (uint8_t) *name++) * 16777619u;
+	return hash;
+}
+
+/** make a hash table of all factories of the plugin, called with the lock */
+static int index_factories(struct pw_spa_plugin *plugin)
+{
+	const struct spa_handle_factory *factory;
+	uint32_t index, n_factories = 0, size, hash, i;
+	int res;
+
+	for (index = 0;;) {
+		if ((res = plugin->enum_func(&factory, &index)) <= 0) {
+			if (res != 0)
+				pw_log_error("can't enumerate factories: %s", spa_strerror(res));
+			break;
+		}
+		n_factories++;
+	}
+
+	for (size = 8; size < n_factories * 2; size <<= 1);
+
+	plugin->factories = calloc(size, sizeof(struct factory_entry));
+	if (plugin->factories == NULL)
+		return -ENOMEM;
+	plugin->mask = size - 1;
+
+	for (index = 0; n_factories > 0; n_factories--) {
+		if (plugin->enum_func(&factory, &index) <= 0)
+			break;
+
+		hash = hash_name(factory->name);
+		for (i = hash & plugin->mask;
+		     plugin->factories[i].factory != NULL;
+		     i = (i + 1) & plugin->mask);
+
+		plugin->factories[i].hash = hash;
+		plugin->factories[i].factory = factory;
+	}
+	__atomic_store_n(&plugin->indexed, true, __ATOMIC_RELEASE);
+
+	pw_log_debug("plugin %p: indexed factories of %s", plugin, plugin->filename);
+	return 0;
+}
+
+/** Load a SPA plugin
+ *
+ * \param dir the directory of the plugin or NULL to use the default
+ *        plugin directory
+ * \param lib the name of the plugin, without the .so extension
+ * \return a plugin or NULL on error
+ *
+ * Plugins are shared, a plugin that is already loaded is returned with an
+ * extra reference. Use \ref pw_spa_plugin_unload() to release the
+ * plugin.
+ *
+ * \memberof pw_pipewire
+ */
+struct pw_spa_plugin *pw_spa_plugin_load(const char *dir, const char *lib)
 {
+	struct pw_spa_plugin *plugin;
 	char *filename;
 
-        if (asprintf(&filename, "%s/%s.so", path, lib) < 0)
-		goto no_filename;
+	if (dir == NULL && (dir = getenv("SPA_PLUGIN_DIR")) == NULL)
+		dir = PLUGINDIR;
 
-        if ((info->hnd = dlopen(filename, RTLD_NOW)) == NULL) {
-                fprintf(stderr, "can't load %s: %s\n", filename, dlerror());
-                goto open_failed;
-        }
-        if ((info->enum_func = dlsym(info->hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
-                fprintf(stderr, "can't find enum function\n");
-                goto no_symbol;
-        }
-	free(filename);
-	return true;
+	if (asprintf(&filename, "%s/%s.so", dir, lib) < 0)
+		return NULL;
+
+	pthread_mutex_lock(&plugin_registry.lock);
+	if (plugin_registry.plugins.next == NULL)
+		spa_list_init(&plugin_registry.plugins);
+
+	spa_list_for_each(plugin, &plugin_registry.plugins, link) {
+		if (strcmp(plugin->filename, filename) == 0) {
+			plugin->ref++;
+			free(filename);
+			goto done;
+		}
+	}
+
+	plugin = calloc(1, sizeof(struct pw_spa_plugin));
+	if (plugin == NULL)
+		goto no_mem;
+
+	if ((plugin->hnd = dlopen(filename, RTLD_NOW)) == NULL) {
+		pw_log_error("can't load %s: %s", filename, dlerror());
+		goto open_failed;
+	}
+	if ((plugin->enum_func = dlsym(plugin->hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		pw_log_error("can't find enum function in %s", filename);
+		goto no_symbol;
+	}
+	plugin->ref = 1;
+	plugin->filename = filename;
+	spa_list_append(&plugin_registry.plugins, &plugin->link);
+
+	pw_log_debug("plugin %p: loaded %s", plugin, filename);
+
+      done:
+	pthread_mutex_unlock(&plugin_registry.lock);
+	return plugin;
 
-      no_filename:
-	return false;
       no_symbol:
-	dlclose(info->hnd);
+	dlclose(plugin->hnd);
       open_failed:
-        free(filename);
-	return false;
+	free(plugin);
+      no_mem:
+	pthread_mutex_unlock(&plugin_registry.lock);
+	free(filename);
+	return NULL;
 }
 
-static const struct spa_handle_factory *get_factory(struct support_info *info, const char *factory_name)
+/** Release a plugin
+ *
+ * \param plugin a plugin loaded with \ref pw_spa_plugin_load()
+ *
+ * The plugin is unloaded when the last reference is released.
+ *
+ * \memberof pw_pipewire
+ */
+void pw_spa_plugin_unload(struct pw_spa_plugin *plugin)
 {
-	int res;
-	uint32_t index;
-        const struct spa_handle_factory *factory;
+	pthread_mutex_lock(&plugin_registry.lock);
+	if (--plugin->ref > 0) {
+		pthread_mutex_unlock(&plugin_registry.lock);
+		return;
+	}
+	spa_list_remove(&plugin->link);
+	pthread_mutex_unlock(&plugin_registry.lock);
 
-        for (index = 0;;) {
-                if ((res = info->enum_func(&factory, &index)) <= 0) {
-                        if (res != 0)
-                                fprintf(stderr, "can't enumerate factories: %s\n", spa_strerror(res));
-                        break;
-                }
-                if (strcmp(factory->name, factory_name) == 0)
-                        return factory;
+	pw_log_debug("plugin %p: unload %s", plugin, plugin->filename);
+
+	dlclose(plugin->hnd);
+	free(plugin->factories);
+	free(plugin->filename);
+	free(plugin);
+}
+
+/** Find a factory in a plugin
+ *
+ * \param plugin a plugin
+ * \param factory_name the name of the factory
+ * \return the factory or NULL when the plugin has no factory with
+ *	\a factory_name. The factory is valid as long as the plugin is loaded.
+ *
+ * \memberof pw_pipewire
+ */
+const struct spa_handle_factory *
+pw_spa_plugin_find_factory(struct pw_spa_plugin *plugin, const char *factory_name)
+{
+	const struct spa_handle_factory *factory;
+	uint32_t hash, i;
+
+	if (!__atomic_load_n(&plugin->indexed, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&plugin_registry.lock);
+		if (!plugin->indexed)
+			index_factories(plugin);
+		pthread_mutex_unlock(&plugin_registry.lock);
+		if (plugin->factories == NULL)
+			return NULL;
+	}
+
+	hash = hash_name(factory_name);
+	for (i = hash & plugin->mask;
+	     (factory = plugin->factories[i].factory) != NULL;
+	     i = (i + 1) & plugin->mask) {
+		if (plugin->factories[i].hash == hash &&
+		    strcmp(factory->name, factory_name) == 0)
+			return factory;
 	}
 	return NULL;
 }
 
+static bool
+open_support(const char *lib,
+	     struct support_info *info)
+{
+	if (info->plugin == NULL)
+		info->plugin = pw_spa_plugin_load(NULL, lib);
+	return info->plugin != NULL;
+}
+
+static const struct spa_handle_factory *get_factory(struct support_info *info, const char *factory_name)
+{
+	if (info->plugin == NULL)
+		return NULL;
+	return pw_spa_plugin_find_factory(info->plugin, factory_name);
+}
+
 static struct interface *
 load_interface(struct support_info *info,
 	       const char *factory_name,
-	       const char *type)
+	       const char *type,
+	       const struct spa_dict *props)
 {
         int res;
         struct spa_handle *handle;
@@ -124,7 +297,7 @@ load_interface(struct support_info *info,
 
         handle = calloc(1, factory->size);
         if ((res = spa_handle_factory_init(factory,
-                                           handle, NULL, info->support, info->n_support)) < 0) {
+                                           handle, props, info->support, info->n_support)) < 0) {
                 fprintf(stderr, "can't make factory instance: %d\n", res);
                 goto init_failed;
         }
@@ -198,9 +371,9 @@ const struct spa_support *pw_get_support(uint32_t *n_support)
 void *pw_get_spa_dbus(struct pw_loop *loop)
 {
 	struct support_info dbus_support_info;
-	const char *str;
 	struct interface *iface;
 
+	dbus_support_info.plugin = NULL;
 	dbus_support_info.n_support = support_info.n_support;
 	memcpy(dbus_support_info.support, support_info.support,
 			sizeof(struct spa_support) * dbus_support_info.n_support);
@@ -208,13 +381,13 @@ void *pw_get_spa_dbus(struct pw_loop *loop)
 	dbus_support_info.support[dbus_support_info.n_support++] =
 			SPA_SUPPORT_INIT(SPA_TYPE__LoopUtils, loop->utils);
 
-	if ((str = getenv("SPA_PLUGIN_DIR")) == NULL)
-		str = PLUGINDIR;
-
-	if (open_support(str, "support/libspa-dbus", &dbus_support_info)) {
-		iface = load_interface(&dbus_support_info, "dbus", SPA_TYPE__DBus);
-		if (iface != NULL)
+	if (open_support("support/libspa-dbus", &dbus_support_info)) {
+		iface = load_interface(&dbus_support_info, "dbus", SPA_TYPE__DBus, NULL);
+		if (iface != NULL) {
+			iface->plugin = dbus_support_info.plugin;
 			return iface->iface;
+		}
+		pw_spa_plugin_unload(dbus_support_info.plugin);
 	}
 	return NULL;
 }
@@ -238,6 +411,8 @@ int pw_release_spa_dbus(void *dbus)
 	spa_list_remove(&iface->link);
 	spa_handle_clear(iface->handle);
 	free(iface->handle);
+	if (iface->plugin)
+		pw_spa_plugin_unload(iface->plugin);
 	free(iface);
 	return 0;
 }
@@ -252,6 +427,12 @@ int pw_release_spa_dbus(void *dbus)
  *
  * The environment variable \a PIPEWIRE_DEBUG
  *
+ * The environment variable \a PIPEWIRE_TRACE enables binary trace logging.
+ * Messages are then not formatted in the calling thread but stored in a
+ * per-thread ring and formatted later. When set to "1" or "true" the
+ * messages are written to stderr, any other value is used as the name of
+ * a file where the binary trace is written, use spa-trace-dump to read it.
+ *
  * \memberof pw_pipewire
  */
 void pw_init(int *argc, char **argv[])
@@ -259,24 +440,28 @@ void pw_init(int *argc, char **argv[])
 	const char *str;
 	struct interface *iface;
 	struct support_info *info = &support_info;
+	struct spa_dict_item items[2];
+	struct spa_dict log_props = SPA_DICT_INIT(items, 0);
 
 	if ((str = getenv("PIPEWIRE_DEBUG")))
 		configure_debug(str);
 
-	if ((str = getenv("SPA_PLUGIN_DIR")) == NULL)
-		str = PLUGINDIR;
-
 	if (support_info.n_support > 0)
 		return;
 
 	spa_list_init(&global_registry.interfaces);
 
-	if (open_support(str, "support/libspa-support", info)) {
-		iface = load_interface(info, "mapper", SPA_TYPE__TypeMap);
+	if (open_support("support/libspa-support", info)) {
+		iface = load_interface(info, "mapper", SPA_TYPE__TypeMap, NULL);
 		if (iface != NULL)
 			info->support[info->n_support++] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, iface->iface);
 
-		iface = load_interface(info, "logger", SPA_TYPE__Log);
+		if ((str = getenv("PIPEWIRE_TRACE")) != NULL) {
+			items[log_props.n_items++] = SPA_DICT_ITEM_INIT("log.trace.binary", "true");
+			if (strcmp(str, "1") != 0 && strcmp(str, "true") != 0)
+				items[log_props.n_items++] = SPA_DICT_ITEM_INIT("log.trace.file", str);
+		}
+		iface = load_interface(info, "logger", SPA_TYPE__Log, &log_props);
 		if (iface != NULL) {
 			info->support[info->n_support++] = SPA_SUPPORT_INIT(SPA_TYPE__Log, iface->iface);
 			pw_log_set(iface->iface);
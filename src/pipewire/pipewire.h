@@ -142,6 +142,17 @@ pw_get_support_factory(const char *factory_name);
 const struct spa_support *
 pw_get_support(uint32_t *n_support);
 
+struct pw_spa_plugin;
+
+struct pw_spa_plugin *
+pw_spa_plugin_load(const char *dir, const char *lib);
+
+void
+pw_spa_plugin_unload(struct pw_spa_plugin *plugin);
+
+const struct spa_handle_factory *
+pw_spa_plugin_find_factory(struct pw_spa_plugin *plugin, const char *factory_name);
+
 #ifdef __cplusplus
 }
 #endif
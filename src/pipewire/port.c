@@ -17,6 +17,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -30,6 +31,9 @@
 /** \cond */
 struct impl {
 	struct pw_port this;
+
+	size_t size;		/**< allocated size */
+	bool slab;		/**< allocated from the port slab */
 };
 
 struct resource_data {
@@ -37,6 +41,8 @@ struct resource_data {
 	struct pw_port *port;
 };
 
+static struct pw_slab port_slab = PW_SLAB_INIT(sizeof(struct impl));
+
 /** \endcond */
 
 
@@ -168,10 +174,17 @@ struct pw_port *pw_port_new(enum pw_direction direction,
 	struct impl *impl;
 	struct pw_port *this;
 
-	impl = calloc(1, sizeof(struct impl) + user_data_size);
+	if (pw_slab_can_alloc(&port_slab, sizeof(struct impl) + user_data_size)) {
+		impl = pw_slab_alloc(&port_slab);
+		if (impl != NULL)
+			impl->slab = true;
+	} else
+		impl = calloc(1, sizeof(struct impl) + user_data_size);
 	if (impl == NULL)
 		return NULL;
 
+	impl->size = sizeof(struct impl) + user_data_size;
+
 	this = &impl->this;
 	pw_log_debug("port %p: new %s %d", this,
 			pw_direction_as_string(direction), port_id);
@@ -211,7 +224,8 @@ struct pw_port *pw_port_new(enum pw_direction direction,
 				schedule_mix_node :
 				schedule_tee_node;
 	spa_graph_node_set_implementation(&this->rt.mix_node, &this->mix_node);
-	pw_map_init(&this->mix_port_map, 64, 64);
+	/* allocated when the port is linked */
+	pw_map_init(&this->mix_port_map, 0, 8 * sizeof(union pw_map_item));
 
 	spa_graph_port_init(&this->rt.mix_port,
 			    pw_direction_reverse(this->direction),
@@ -225,7 +239,10 @@ struct pw_port *pw_port_new(enum pw_direction direction,
 	return this;
 
        no_mem:
-	free(impl);
+	if (impl->slab)
+		pw_slab_free(&port_slab, impl);
+	else
+		free(impl);
 	return NULL;
 }
 
@@ -269,6 +286,32 @@ int pw_port_update_properties(struct pw_port *port, const struct spa_dict *dict)
 	return changed;
 }
 
+/** Get the memory used by the port
+ *
+ * This includes the buffers that the port owns and the mixer state.
+ *
+ * \memberof pw_port
+ */
+size_t pw_port_get_memory_size(struct pw_port *port)
+{
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
+
+	return impl->size + port->mix_port_map.items.alloc + port->allocation.size;
+}
+
+/** Update the port.memory property after the buffers of the port changed
+ * \memberof pw_port */
+void pw_port_update_memory(struct pw_port *port)
+{
+	struct spa_dict_item items[1];
+	char size[32];
+
+	snprintf(size, sizeof(size), "%zu", pw_port_get_memory_size(port));
+	items[0] = SPA_DICT_ITEM_INIT("port.memory", size);
+
+	pw_port_update_properties(port, &SPA_DICT_INIT(items, 1));
+}
+
 struct pw_node *pw_port_get_node(struct pw_port *port)
 {
 	return port->node;
@@ -434,6 +477,7 @@ int pw_port_add(struct pw_port *port, struct pw_node *node)
 		pw_properties_setf(port->properties, "port.name", "%s_%d", dir, port_id);
 	}
 	pw_properties_set(port->properties, "port.direction", dir);
+	pw_properties_setf(port->properties, "port.memory", "%zu", pw_port_get_memory_size(port));
 
 	if (SPA_FLAG_CHECK(port->spa_info->flags, SPA_PORT_INFO_FLAG_PHYSICAL))
 		pw_properties_set(port->properties, "port.physical", "1");
@@ -462,6 +506,11 @@ int pw_port_add(struct pw_port *port, struct pw_node *node)
 			     port->direction, port_id,
 			     t->io.Buffers,
 			     port->rt.port.io, sizeof(*port->rt.port.io));
+	/* not all nodes follow the graph quantum */
+	spa_node_port_set_io(node->node,
+			     port->direction, port_id,
+			     t->io.Quantum,
+			     core->quantum, sizeof(*core->quantum));
 
 	if (node->global)
 		pw_port_register(port, node->global->owner, node->global,
@@ -534,6 +583,7 @@ static void pw_port_remove(struct pw_port *port)
 
 void pw_port_destroy(struct pw_port *port)
 {
+	struct impl *impl = SPA_CONTAINER_OF(port, struct impl, this);
 	struct pw_node *node = port->node;
 	struct pw_control *control, *ctemp;
 	struct pw_resource *resource, *tmp;
@@ -567,7 +617,10 @@ void pw_port_destroy(struct pw_port *port)
 	if (port->properties)
 		pw_properties_free(port->properties);
 
-	free(port);
+	if (impl->slab)
+		pw_slab_free(&port_slab, impl);
+	else
+		free(impl);
 }
 
 static int
@@ -672,6 +725,7 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 	if (id == t->param.idFormat) {
 		if (param == NULL || res < 0) {
 			free_allocation(&port->allocation);
+			pw_port_update_memory(port);
 			port->allocated = false;
 			port_update_state (port, PW_PORT_STATE_CONFIGURE);
 		}
@@ -705,8 +759,10 @@ int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint3
 		buffers = NULL;
 	}
 
-	if (n_buffers == 0)
+	if (n_buffers == 0) {
+		pw_port_update_memory(port);
 		port_update_state (port, PW_PORT_STATE_READY);
+	}
 	else if (!SPA_RESULT_IS_ASYNC(res))
 		port_update_state (port, PW_PORT_STATE_PAUSED);
 
@@ -101,6 +101,9 @@ uint32_t pw_port_get_id(struct pw_port *port);
 /** Get the port parent node or NULL when not yet set */
 struct pw_node *pw_port_get_node(struct pw_port *port);
 
+/** Get the memory used by the port, also in the port.memory property */
+size_t pw_port_get_memory_size(struct pw_port *port);
+
 /** Add an event listener on the port */
 void pw_port_add_listener(struct pw_port *port,
 			  struct spa_hook *listener,
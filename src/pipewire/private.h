@@ -26,6 +26,7 @@ extern "C" {
 
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
+#include <pthread.h>
 
 
 #include "pipewire/mem.h"
@@ -146,6 +147,10 @@ struct pw_global {
 	void *object;			/**< object associated with the interface */
 };
 
+/** The index of the global in the core map, the id also contains a
+ * generation. Use this to index arrays with data per global. */
+#define pw_global_index(g)	PW_MAP_ID_INDEX((g)->id)
+
 #define pw_core_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_core_events, m, v, ##__VA_ARGS__)
 #define pw_core_events_destroy(c)		pw_core_events_emit(c, destroy, 0)
 #define pw_core_events_free(c)			pw_core_events_emit(c, free, 0)
@@ -192,6 +197,9 @@ struct pw_core {
 
 	long sc_pagesize;
 
+	struct pw_memblock *quantum_mem;	/**< memory of the quantum io area */
+	struct spa_io_quantum *quantum;		/**< graph quantum, shared with all ports */
+
 	struct {
 		struct spa_graph graph;
 	} rt;
@@ -223,10 +231,32 @@ struct pw_main_loop {
         bool running;
 };
 
+/** \class pw_slab
+ *
+ * A pool of objects of the same size, allocated in aligned chunks.
+ * Used for the ports and links, of which there can be many. */
+#define PW_SLAB_CHUNK_SIZE	16384
+
+struct pw_slab {
+	pthread_mutex_t lock;
+	size_t size;			/**< size of the objects */
+	struct spa_list partial;	/**< chunks with free objects */
+	struct spa_list full;		/**< chunks without free objects */
+	uint32_t n_chunks;		/**< number of chunks */
+	uint32_t n_used;		/**< number of allocated objects */
+};
+
+#define PW_SLAB_INIT(s)	{ PTHREAD_MUTEX_INITIALIZER, (s), }
+
+void *pw_slab_alloc(struct pw_slab *slab);
+void pw_slab_free(struct pw_slab *slab, void *obj);
+bool pw_slab_can_alloc(struct pw_slab *slab, size_t size);
+
 struct allocation {
 	struct pw_memblock *mem;	/**< allocated buffer memory */
 	struct spa_buffer **buffers;	/**< port buffers */
 	uint32_t n_buffers;		/**< number of port buffers */
+	size_t size;			/**< bytes of buffer skeletons and memory */
 };
 
 static inline void move_allocation(struct allocation *alloc, struct allocation *dest)
@@ -244,6 +274,7 @@ static inline void free_allocation(struct allocation *alloc)
 	alloc->mem = NULL;
 	alloc->buffers = NULL;
 	alloc->n_buffers = 0;
+	alloc->size = 0;
 }
 
 #define pw_link_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_link_events, m, v, ##__VA_ARGS__)
@@ -648,6 +679,8 @@ int pw_port_set_param(struct pw_port *port, uint32_t id, uint32_t flags,
 /** Use buffers on a port \memberof pw_port */
 int pw_port_use_buffers(struct pw_port *port, struct spa_buffer **buffers, uint32_t n_buffers);
 
+void pw_port_update_memory(struct pw_port *port);
+
 /** Allocate memory for buffers on a port \memberof pw_port */
 int pw_port_alloc_buffers(struct pw_port *port,
 			  struct spa_pod **params, uint32_t n_params,
@@ -659,6 +692,10 @@ int pw_port_send_command(struct pw_port *port, bool block, const struct spa_comm
 /** Change the state of the node */
 int pw_node_set_state(struct pw_node *node, enum pw_node_state state);
 
+/** Release the device and buffer memory of an idle node but keep its
+ * formats and buffers */
+int pw_node_warm_suspend(struct pw_node *node);
+
 /** Update the state of the node, mostly used by node implementations */
 void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *error);
 
@@ -672,6 +709,11 @@ int pw_link_activate(struct pw_link *link);
 /** Deactivate a link \memberof pw_link */
 int pw_link_deactivate(struct pw_link *link);
 
+/** Check the buffers of a link after a quantum change \memberof pw_link
+  * Buffers that are large enough are kept, smaller buffers are
+  * reallocated */
+int pw_link_check_buffers(struct pw_link *link);
+
 struct pw_control *
 pw_control_new(struct pw_core *core,
 	       struct pw_port *owner,		/**< can be NULL */
@@ -910,6 +910,17 @@ static void client_node_command(void *object, uint32_t seq, const struct spa_com
 		impl->last_monotonic = cu->body.monotonic_time.value;
 #endif
 	}
+	else if (SPA_COMMAND_TYPE(command) == remote->core->type.command_node.Suspend) {
+		pw_log_debug("node %p: suspend %d", proxy, seq);
+
+		res = spa_node_send_command(data->node->node, command);
+		if (res < 0 && res != -ENOTSUP)
+			pw_log_warn("node %p: suspend failed", proxy);
+		else
+			res = 0;
+
+		pw_client_node_proxy_done(data->node_proxy, seq, res);
+	}
 	else {
 		pw_log_warn("unhandled node command %d", SPA_COMMAND_TYPE(command));
 		pw_client_node_proxy_done(data->node_proxy, seq, -ENOTSUP);
@@ -1081,7 +1092,7 @@ client_node_port_use_buffers(void *object,
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
 			m->data = SPA_MEMBER(bid->ptr, offset, void);
-			offset += m->size;
+			offset += SPA_ROUND_UP_N(m->size, 8);
 		}
 
 		for (j = 0; j < b->n_datas; j++) {
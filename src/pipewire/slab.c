@@ -0,0 +1,156 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipewire/log.h"
+#include "pipewire/private.h"
+
+/** \cond */
+/* chunks are aligned to their size so that the chunk of an object can be
+ * found by masking the address */
+struct chunk {
+	struct spa_list link;
+	void *free;		/* list of free objects */
+	uint32_t n_used;	/* objects in use */
+	uint32_t n_init;	/* objects that were handed out at least once */
+};
+
+#define CHUNK_HEADER	SPA_ROUND_UP_N(sizeof(struct chunk), 16)
+#define CHUNK_OF(p)	((struct chunk *) ((uintptr_t)(p) & ~((uintptr_t)PW_SLAB_CHUNK_SIZE - 1)))
+/** \endcond */
+
+static uint32_t objects_per_chunk(struct pw_slab *slab)
+{
+	return (PW_SLAB_CHUNK_SIZE - CHUNK_HEADER) / slab->size;
+}
+
+static void ensure_init(struct pw_slab *slab)
+{
+	if (slab->partial.next == NULL) {
+		slab->size = SPA_ROUND_UP_N(slab->size, 16);
+		spa_list_init(&slab->partial);
+		spa_list_init(&slab->full);
+	}
+}
+
+static struct chunk *chunk_new(struct pw_slab *slab)
+{
+	struct chunk *c;
+
+	if (posix_memalign((void **) &c, PW_SLAB_CHUNK_SIZE, PW_SLAB_CHUNK_SIZE) != 0)
+		return NULL;
+
+	c->free = NULL;
+	c->n_used = 0;
+	c->n_init = 0;
+	spa_list_prepend(&slab->partial, &c->link);
+	slab->n_chunks++;
+
+	pw_log_debug("slab %p: new chunk %p, %u chunks", slab, c, slab->n_chunks);
+
+	return c;
+}
+
+/** Allocate a zeroed object from the slab
+ * \param slab a slab
+ * \return a new object or NULL when out of memory
+ * \memberof pw_slab
+ */
+void *pw_slab_alloc(struct pw_slab *slab)
+{
+	struct chunk *c;
+	void *obj;
+
+	pthread_mutex_lock(&slab->lock);
+	ensure_init(slab);
+
+	if (objects_per_chunk(slab) == 0) {
+		obj = NULL;
+		goto done;
+	}
+
+	if (spa_list_is_empty(&slab->partial)) {
+		if ((c = chunk_new(slab)) == NULL) {
+			obj = NULL;
+			goto done;
+		}
+	} else
+		c = spa_list_first(&slab->partial, struct chunk, link);
+
+	if ((obj = c->free) != NULL)
+		c->free = *(void **) obj;
+	else
+		obj = SPA_MEMBER(c, CHUNK_HEADER + c->n_init++ * slab->size, void);
+
+	c->n_used++;
+	slab->n_used++;
+
+	if (c->free == NULL && c->n_init == objects_per_chunk(slab)) {
+		spa_list_remove(&c->link);
+		spa_list_append(&slab->full, &c->link);
+	}
+	memset(obj, 0, slab->size);
+
+      done:
+	pthread_mutex_unlock(&slab->lock);
+	return obj;
+}
+
+/** Give an object back to the slab
+ * \param slab a slab
+ * \param obj an object from \ref pw_slab_alloc()
+ * \memberof pw_slab
+ */
+void pw_slab_free(struct pw_slab *slab, void *obj)
+{
+	struct chunk *c = CHUNK_OF(obj);
+	bool was_full;
+
+	pthread_mutex_lock(&slab->lock);
+
+	was_full = c->free == NULL && c->n_init == objects_per_chunk(slab);
+
+	*(void **) obj = c->free;
+	c->free = obj;
+	c->n_used--;
+	slab->n_used--;
+
+	if (c->n_used == 0 && slab->n_chunks > 1) {
+		/* keep one chunk around to avoid allocating for every object */
+		spa_list_remove(&c->link);
+		slab->n_chunks--;
+		pw_log_debug("slab %p: free chunk %p, %u chunks", slab, c, slab->n_chunks);
+		free(c);
+	}
+	else if (was_full) {
+		spa_list_remove(&c->link);
+		spa_list_prepend(&slab->partial, &c->link);
+	}
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/** Check if objects of \a size can be allocated from the slab
+ * \memberof pw_slab */
+bool pw_slab_can_alloc(struct pw_slab *slab, size_t size)
+{
+	return SPA_ROUND_UP_N(size, 16) <= SPA_ROUND_UP_N(slab->size, 16) &&
+	    SPA_ROUND_UP_N(slab->size, 16) <= (PW_SLAB_CHUNK_SIZE - CHUNK_HEADER) / 4;
+}
@@ -17,6 +17,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <string.h>
@@ -41,6 +42,7 @@
 #define MIN_QUEUED	1
 
 #define MAX_PORTS	1
+#define MAX_CONTROLS	16
 
 struct mem {
 	uint32_t id;
@@ -70,6 +72,13 @@ struct queue {
 	uint64_t outcount;
 };
 
+struct control {
+	uint32_t id;
+	uint32_t remote_id;
+	float value;
+	bool pending;
+};
+
 struct stream {
 	struct pw_stream this;
 
@@ -100,13 +109,12 @@ struct stream {
 
 	struct pw_client_node_transport *trans;
 
-	struct spa_source *timeout_source;
-
 	struct pw_array mem_ids;
 
 	struct spa_io_buffers *io;
 
 	bool client_reuse;
+	bool buffer_ring;
 	struct queue dequeue;
 	struct queue queue;
 	bool in_process;
@@ -114,7 +122,8 @@ struct stream {
 	struct buffer buffers[MAX_BUFFERS];
 	int n_buffers;
 
-	struct pw_time last_time;
+	struct control controls[MAX_CONTROLS];
+	uint32_t n_controls;
 };
 /** \endcond */
 
@@ -402,6 +411,15 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(props, PW_STREAM_PROP_BUFFER_RING);
+	impl->buffer_ring = str && pw_properties_parse_bool(str);
+
+	/* buffers in the input ring are only recycled when we tell the server */
+	if (impl->buffer_ring && !impl->client_reuse) {
+		pw_properties_set(props, "pipewire.client.reuse", "1");
+		impl->client_reuse = true;
+	}
+
 	spa_hook_list_init(&this->listener_list);
 
 	this->state = PW_STREAM_STATE_UNCONNECTED;
@@ -477,10 +495,6 @@ static void unhandle_socket(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
-	if (impl->timeout_source) {
-		pw_loop_destroy_source(stream->remote->core->main_loop, impl->timeout_source);
-		impl->timeout_source = NULL;
-	}
         pw_loop_invoke(stream->remote->core->data_loop,
                        do_remove_sources, 1, NULL, 0, true, impl);
 }
@@ -654,24 +668,6 @@ static void do_node_init(struct pw_stream *stream)
 		pw_client_node_proxy_set_active(impl->node_proxy, true);
 }
 
-static void add_request_clock_update(struct pw_stream *stream)
-{
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-
-	pw_client_node_proxy_event(impl->node_proxy, (struct spa_event *)
-				   &SPA_EVENT_NODE_REQUEST_CLOCK_UPDATE_INIT(stream->remote->core->type.
-									     event_node.
-									     RequestClockUpdate,
-									     SPA_EVENT_NODE_REQUEST_CLOCK_UPDATE_TIME,
-									     0, 0));
-}
-
-static void on_timeout(void *data, uint64_t expirations)
-{
-	struct pw_stream *stream = data;
-	add_request_clock_update(stream);
-}
-
 static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -684,11 +680,38 @@ static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 	}
 }
 
+/* consume all buffers the server queued since the last wakeup */
+static int process_input_ring(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	int i;
+
+	for (i = 0; i < impl->trans->area->n_input_ports; i++) {
+		struct spa_io_buffer_ring *ring = &impl->trans->input_rings[i];
+		struct buffer *b;
+		uint32_t buffer_id;
+
+		while ((buffer_id = spa_io_buffer_ring_pop(ring)) != SPA_ID_INVALID) {
+			pw_log_trace("stream %p: process input ring %d", stream, buffer_id);
+
+			if ((b = get_buffer(stream, buffer_id)) == NULL)
+				continue;
+
+			if (push_queue(impl, &impl->dequeue, b) >= 0)
+				call_process(impl);
+		}
+	}
+	return SPA_STATUS_NEED_BUFFER;
+}
+
 static int process_input(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	int i;
 
+	if (impl->buffer_ring)
+		return process_input_ring(stream);
+
 	for (i = 0; i < impl->trans->area->n_input_ports; i++) {
 		struct spa_io_buffers *input = &impl->trans->inputs[i];
 		struct buffer *b;
@@ -721,11 +744,45 @@ static int process_input(struct pw_stream *stream)
 	return SPA_STATUS_NEED_BUFFER;
 }
 
+/* hand over all queued buffers, the server takes them from the ring at
+ * the graph rate. Consumed buffers come back with reuse_buffer messages */
+static int process_output_ring(struct pw_stream *stream)
+{
+	int i, res = SPA_STATUS_NEED_BUFFER;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	for (i = 0; i < impl->trans->area->n_output_ports; i++) {
+		struct spa_io_buffer_ring *ring = &impl->trans->output_rings[i];
+		struct buffer *b;
+		uint32_t index;
+
+	      again:
+		while (spa_io_buffer_ring_avail(ring) < SPA_IO_BUFFER_RING_SIZE &&
+		    (b = pop_queue(impl, &impl->queue)) != NULL) {
+			spa_io_buffer_ring_push(ring, b->id);
+			pw_log_trace("stream %p: push %d", stream, b->id);
+		}
+
+		if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
+		    spa_io_buffer_ring_avail(ring) < SPA_IO_BUFFER_RING_SIZE) {
+			call_process(impl);
+			if (spa_ringbuffer_get_read_index(&impl->queue.ring, &index) >= MIN_QUEUED)
+				goto again;
+		}
+		if (spa_io_buffer_ring_avail(ring) > 0)
+			res = SPA_STATUS_HAVE_BUFFER;
+	}
+	return res;
+}
+
 static int process_output(struct pw_stream *stream)
 {
 	int i, res = 0;
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
+	if (impl->buffer_ring)
+		return process_output_ring(stream);
+
 	for (i = 0; i < impl->trans->area->n_output_ports; i++) {
 		struct spa_io_buffers *io = &impl->trans->outputs[i];
 		struct buffer *b;
@@ -831,7 +888,6 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct timespec interval;
 
 	impl->rtwritefd = rtwritefd;
 	impl->rtsocket_source = pw_loop_add_io(stream->remote->core->data_loop,
@@ -839,11 +895,6 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 					       SPA_IO_ERR | SPA_IO_HUP,
 					       true, on_rtsocket_condition, stream);
 
-	impl->timeout_source = pw_loop_add_timer(stream->remote->core->main_loop, on_timeout, stream);
-	interval.tv_sec = 0;
-	interval.tv_nsec = 100000000;
-	pw_loop_update_timer(stream->remote->core->main_loop, impl->timeout_source, NULL, &interval, false);
-
 	return;
 }
 
@@ -907,13 +958,11 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 					   PW_STREAM_PROP_LATENCY_MIN, "%" PRId64,
 					   cu->body.latency.value);
 		}
-		impl->last_time.now = cu->body.monotonic_time.value;
-		impl->last_time.ticks = cu->body.ticks.value;
-		impl->last_time.rate.num = 1;
-		impl->last_time.rate.denom = cu->body.rate.value;
-		impl->last_time.delay = 0;
-		pw_log_debug("clock update %ld %d %ld", impl->last_time.ticks,
-				impl->last_time.rate.denom, impl->last_time.now);
+		/* the time itself is read from the clock in the transport */
+	} else if (SPA_COMMAND_TYPE(command) == remote->core->type.command_node.Suspend) {
+		/* the stream has no device, the buffers stay configured */
+		pw_log_debug("stream %p: suspend %d", stream, seq);
+		add_async_complete(stream, seq, 0);
 	} else {
 		pw_log_warn("unhandled node command %d", SPA_COMMAND_TYPE(command));
 		add_async_complete(stream, seq, -ENOTSUP);
@@ -1079,7 +1128,7 @@ client_node_port_use_buffers(void *data,
 			struct spa_meta *m = &b->metas[j];
 			memcpy(m, &buffers[i].buffer->metas[j], sizeof(struct spa_meta));
 			m->data = SPA_MEMBER(bid->ptr, offset, void);
-			offset += m->size;
+			offset += SPA_ROUND_UP_N(m->size, 8);
 		}
 
 		for (j = 0; j < b->n_datas; j++) {
@@ -1140,6 +1189,175 @@ client_node_port_command(void *data,
 	pw_log_warn("port command not supported");
 }
 
+/* the control ring is read by the server, find the id the server uses for
+ * the io type with \a id */
+static uint32_t find_remote_type(struct pw_remote *remote, uint32_t id)
+{
+	uint32_t i, size = pw_map_get_size(&remote->types);
+	void *data;
+
+	for (i = 0; i < size; i++) {
+		if ((data = pw_map_lookup(&remote->types, i)) != NULL &&
+		    PW_MAP_PTR_TO_ID(data) == id)
+			return i;
+	}
+	return SPA_ID_INVALID;
+}
+
+static uint32_t find_control_type(struct pw_stream *stream, const char *name)
+{
+	struct spa_type_map *map = stream->remote->core->type.map;
+	char type[256];
+
+	snprintf(type, sizeof(type), "%s%s", SPA_TYPE_IO_PROP_BASE, name);
+	return spa_type_map_get_id(map, type);
+}
+
+static struct control *find_control(struct stream *impl, uint32_t id, bool create)
+{
+	struct control *c;
+	uint32_t i;
+
+	for (i = 0; i < impl->n_controls; i++) {
+		if (impl->controls[i].id == id)
+			return &impl->controls[i];
+	}
+	if (!create || impl->n_controls == MAX_CONTROLS)
+		return NULL;
+
+	c = &impl->controls[impl->n_controls++];
+	c->id = id;
+	c->remote_id = SPA_ID_INVALID;
+	c->value = 0.0;
+	c->pending = false;
+	return c;
+}
+
+/* send the controls that were set before the server could receive them */
+static int flush_controls(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_control update = { 0, };
+	uint32_t i;
+	int res;
+
+	if (impl->trans == NULL)
+		return 0;
+
+	for (i = 0; i < impl->n_controls; i++) {
+		struct control *c = &impl->controls[i];
+
+		if (!c->pending)
+			continue;
+
+		/* until the server has told us about the type, it has no prop io
+		 * area that the control can be applied to */
+		if (c->remote_id == SPA_ID_INVALID &&
+		    (c->remote_id = find_remote_type(stream->remote, c->id)) == SPA_ID_INVALID)
+			continue;
+
+		/* prop io areas hold doubles, the update is applied by the server at
+		 * the start of the next cycle */
+		update.id = c->remote_id;
+		update.value.double_value = SPA_POD_DOUBLE_INIT(c->value);
+		if ((res = pw_client_node_transport_add_control(impl->trans, &update)) < 0) {
+			pw_log_warn("stream %p: can't queue control %u: %s", stream, c->id,
+					spa_strerror(res));
+			return res;
+		}
+		c->pending = false;
+		pw_log_trace("stream %p: control %u %f", stream, c->id, c->value);
+	}
+	return 0;
+}
+
+/* the controls and the control ring have one producer, the data loop. The
+ * main loop and the application invoke the functions below there. */
+struct control_update {
+	uint32_t id;
+	float value;
+};
+
+static int
+do_set_control(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	const struct control_update *u = data;
+	struct control *c;
+
+	if ((c = find_control(impl, u->id, true)) == NULL)
+		return -ENOSPC;
+
+	c->value = u->value;
+	c->pending = true;
+
+	return flush_controls(&impl->this);
+}
+
+struct control_query {
+	uint32_t id;
+	float *value;
+};
+
+static int
+do_get_control(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	const struct control_query *q = data;
+	struct control *c;
+
+	if ((c = find_control(impl, q->id, false)) == NULL)
+		return -ENOENT;
+
+	*q->value = c->value;
+	return 0;
+}
+
+static int
+do_resend_control(struct spa_loop *loop,
+		  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct control *c;
+
+	if ((c = find_control(impl, *(uint32_t *) data, false)) != NULL)
+		c->pending = true;
+
+	return flush_controls(&impl->this);
+}
+
+static int
+do_set_transport(struct spa_loop *loop,
+		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_client_node_transport *transport = *(struct pw_client_node_transport **) data;
+	uint32_t i;
+
+	if (impl->trans)
+		pw_client_node_transport_destroy(impl->trans);
+	impl->trans = transport;
+
+	if (transport == NULL) {
+		/* a new node will not know the types and values */
+		for (i = 0; i < impl->n_controls; i++) {
+			impl->controls[i].remote_id = SPA_ID_INVALID;
+			impl->controls[i].pending = true;
+		}
+		return 0;
+	}
+	return flush_controls(&impl->this);
+}
+
+static void set_transport(struct pw_stream *stream, struct pw_client_node_transport *transport)
+{
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_set_transport, 1, &transport, sizeof(transport), true,
+		       SPA_CONTAINER_OF(stream, struct stream, this));
+}
+
 static void client_node_transport(void *data, uint32_t node_id,
 				  int readfd, int writefd,
 				  struct pw_client_node_transport *transport)
@@ -1149,12 +1367,10 @@ static void client_node_transport(void *data, uint32_t node_id,
 
 	stream->node_id = node_id;
 
-	if (impl->trans)
-		pw_client_node_transport_destroy(impl->trans);
-	impl->trans = transport;
+	set_transport(stream, transport);
 
 	pw_log_info("stream %p: create client transport %p with fds %d %d for node %u",
-			stream, impl->trans, readfd, writefd, node_id);
+			stream, transport, readfd, writefd, node_id);
 	handle_socket(stream, readfd, writefd);
 
 	stream_set_state(stream, PW_STREAM_STATE_CONFIGURE, NULL);
@@ -1198,6 +1414,11 @@ static void client_node_port_set_io(void *data,
 		impl->io = ptr;
 		pw_log_debug("stream %p: set io id %u %p", stream, id, ptr);
 	}
+	else if (ptr != NULL) {
+		/* a new prop io area, send it the last value of the control */
+		pw_loop_invoke(core->data_loop, do_resend_control, 1,
+			       &id, sizeof(id), true, impl);
+	}
 
 	res = 0;
 
@@ -1239,10 +1460,7 @@ static void on_node_proxy_destroy(void *data)
 		free(impl->format);
 		impl->format = NULL;
 	}
-	if (impl->trans) {
-		pw_client_node_transport_destroy(impl->trans);
-		impl->trans = NULL;
-	}
+	set_transport(this, NULL);
 
 	stream_set_state(this, PW_STREAM_STATE_UNCONNECTED, NULL);
 }
@@ -1361,11 +1579,21 @@ static inline int64_t get_queue_size(struct queue *queue)
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_clock clock;
 
-	if (impl->last_time.rate.denom == 0)
+	if (impl->trans == NULL)
 		return -EAGAIN;
 
-	*time = impl->last_time;
+	/* lock-free snapshot of what the driver published in the last cycle */
+	spa_io_clock_read(&impl->trans->area->clock, &clock);
+	if (clock.rate == 0)
+		return -EAGAIN;
+
+	time->now = clock.monotonic_time;
+	time->rate.num = 1;
+	time->rate.denom = clock.rate;
+	time->ticks = clock.ticks;
+	time->delay = clock.latency;
 	if (impl->direction == SPA_DIRECTION_INPUT)
 		time->queued = get_queue_size(&impl->dequeue);
 	else
@@ -1379,12 +1607,28 @@ int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
 
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value)
 {
-	return -ENOTSUP;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct control_update u;
+
+	if ((u.id = find_control_type(stream, name)) == SPA_ID_INVALID)
+		return -ENOSPC;
+	u.value = value;
+
+	return pw_loop_invoke(stream->remote->core->data_loop,
+			      do_set_control, 1, &u, sizeof(u), true, impl);
 }
 
 int pw_stream_get_control(struct pw_stream *stream, const char *name, float *value)
 {
-	return -ENOTSUP;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct control_query q;
+
+	if ((q.id = find_control_type(stream, name)) == SPA_ID_INVALID)
+		return -ENOENT;
+	q.value = value;
+
+	return pw_loop_invoke(stream->remote->core->data_loop,
+			      do_get_control, 1, &q, sizeof(q), true, impl);
 }
 
 struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
@@ -1415,7 +1659,8 @@ int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
 		return res;
 
 	if (impl->direction == SPA_DIRECTION_OUTPUT) {
-		if (res == 0 &&
+		/* with a buffer ring every buffer of a driver starts a cycle */
+		if ((res == 0 || impl->buffer_ring) &&
 		    SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
 		    process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
@@ -131,6 +131,12 @@ extern "C" {
  * The process event is emited when PipeWire has emptied a buffer that
  * can now be refilled.
  *
+ * By default one buffer is exchanged with the server per cycle. Streams
+ * that produce or consume in bursts can set the
+ * \ref PW_STREAM_PROP_BUFFER_RING property, several buffers are then kept
+ * in flight in a ring shared with the server and handed over in one
+ * wakeup.
+ *
  * \section sec_stream_disconnect Disconnect
  *
  * Use \ref pw_stream_disconnect() to disconnect a stream after use.
@@ -251,6 +257,10 @@ struct pw_remote *pw_stream_get_remote(struct pw_stream *stream);
 #define PW_STREAM_PROP_LATENCY_MIN	"pipewire.latency.min"
 /** The maximum latency of the stream, int default MAXINT */
 #define PW_STREAM_PROP_LATENCY_MAX	"pipewire.latency.max"
+/** Exchange buffers through a ring of buffer ids, boolean default false.
+ * Input streams then always recycle their buffers with reuse_buffer
+ * messages, as with pipewire.client.reuse */
+#define PW_STREAM_PROP_BUFFER_RING	"pipewire.client.buffer-ring"
 
 const struct pw_properties *pw_stream_get_properties(struct pw_stream *stream);
 
@@ -302,9 +312,17 @@ pw_stream_finish_format(struct pw_stream *stream,	/**< a \ref pw_stream */
 #define PW_STREAM_CONTROL_HUE		"hue"
 #define PW_STREAM_CONTROL_SATURATION	"saturation"
 
-/** Set a control value */
+/** Set a control value
+ *
+ * The value is sent to the server over shared memory and applied to the
+ * prop io areas of the stream at the start of the next cycle. This is cheap
+ * enough to be called for every cycle. Values set before the server knows
+ * about the control are kept and sent when it does.
+ *
+ * \return 0 on success, -ENOSPC when there are too many controls or
+ *	the shared memory ring is full */
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value);
-/** Get a control value */
+/** Get the last value set with \ref pw_stream_set_control */
 int pw_stream_get_control(struct pw_stream *stream, const char *name, float *value);
 
 /** Activate or deactivate the stream \memberof pw_stream */
@@ -324,7 +342,8 @@ struct pw_time {
 					     currently queued */
 };
 
-/** Query the time on the stream \memberof pw_stream */
+/** Query the time on the stream. This reads the clock that the driver
+ * publishes every cycle and can be called from any thread \memberof pw_stream */
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time);
 
 /** Get a buffer that can be filled for playback streams or consumed
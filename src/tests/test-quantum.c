@@ -0,0 +1,249 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Changes the graph quantum while a capture and a playback dsp node are
+ * linked and checks that the links get buffers for the new quantum and
+ * that a cycle after the change converts what the producer wrote. */
+
+#include "../modules/module-audio-dsp.c"
+
+#include <pipewire/pipewire.h>
+
+#define QUANTUM		1024
+#define N_CHANNELS	2
+#define N_LINKS		(N_CHANNELS + 1)
+
+struct test {
+	struct pw_main_loop *main_loop;
+	struct pw_loop *loop;
+	struct pw_core *core;
+
+	struct pw_module module;
+	struct impl impl;
+
+	struct pw_node *capture;
+	struct pw_node *playback;
+	struct pw_link *links[N_LINKS];
+};
+
+static struct pw_link *make_link(struct test *t, struct pw_node *output, uint32_t output_id,
+		struct pw_node *input, uint32_t input_id)
+{
+	struct pw_port *op, *ip;
+	struct pw_link *link;
+	char *error = NULL;
+
+	op = pw_node_find_port(output, PW_DIRECTION_OUTPUT, output_id);
+	ip = pw_node_find_port(input, PW_DIRECTION_INPUT, input_id);
+	spa_assert_se(op != NULL && ip != NULL);
+
+	link = pw_link_new(t->core, op, ip, NULL, NULL, &error, 0);
+	if (link == NULL)
+		fprintf(stderr, "can't link: %s\n", error);
+	spa_assert_se(link != NULL);
+	spa_assert_se(pw_link_register(link, NULL, NULL, NULL) >= 0);
+
+	return link;
+}
+
+static void test_init(struct test *t)
+{
+	struct pw_properties *props;
+	int i;
+
+	spa_zero(*t);
+
+	t->main_loop = pw_main_loop_new(NULL);
+	t->loop = pw_main_loop_get_loop(t->main_loop);
+	t->core = pw_core_new(t->loop,
+			pw_properties_new(PW_CORE_PROP_QUANTUM, "1024", NULL));
+	spa_assert_se(t->core != NULL);
+
+	/* the nodes are made like module-audio-dsp does for an alsa device */
+	t->module.core = t->core;
+	t->impl.core = t->core;
+	t->impl.t = pw_core_get_type(t->core);
+	t->impl.module = &t->module;
+	init_type(&t->impl.type, t->core->type.map);
+	spa_list_init(&t->impl.node_list);
+
+	props = pw_properties_new("alsa.device", "hw:0", "alsa.card", "0", NULL);
+	t->capture = make_node(&t->impl, props, PW_DIRECTION_INPUT);
+	t->playback = make_node(&t->impl, props, PW_DIRECTION_OUTPUT);
+	pw_properties_free(props);
+	spa_assert_se(t->capture != NULL && t->playback != NULL);
+
+	for (i = 0; i < N_CHANNELS; i++)
+		t->links[i] = make_link(t, t->capture, i, t->playback, i);
+	t->links[i] = make_link(t, t->playback, 0, t->capture, 0);
+
+	pw_loop_enter(t->loop);
+}
+
+static void test_clear(struct test *t)
+{
+	struct node *n, *tmp;
+	int i;
+
+	for (i = 0; i < N_LINKS; i++)
+		pw_link_destroy(t->links[i]);
+	spa_list_for_each_safe(n, tmp, &t->impl.node_list, link)
+		pw_node_destroy(n->node);
+
+	pw_loop_leave(t->loop);
+	pw_core_destroy(t->core);
+	pw_main_loop_destroy(t->main_loop);
+}
+
+/* run the main loop until all links have buffers again */
+static void wait_links(struct test *t)
+{
+	int i, n_iter;
+
+	for (n_iter = 0; n_iter < 100; n_iter++) {
+		for (i = 0; i < N_LINKS; i++) {
+			if (t->links[i]->state < PW_LINK_STATE_PAUSED)
+				break;
+		}
+		if (i == N_LINKS)
+			return;
+		pw_loop_iterate(t->loop, 10);
+	}
+	for (i = 0; i < N_LINKS; i++)
+		fprintf(stderr, "link %d: state %d %s\n", i, t->links[i]->state,
+				t->links[i]->error ? t->links[i]->error : "");
+	spa_assert_se(false);
+}
+
+static uint32_t link_buffer_size(struct pw_link *link)
+{
+	struct pw_port *output = link->output;
+
+	spa_assert_se(output->allocation.n_buffers > 0);
+	return output->allocation.buffers[0]->datas[0].maxsize;
+}
+
+struct cycle {
+	struct test *t;
+	uint32_t n_frames;	/**< frames written by the capture node */
+	int16_t *result;	/**< the output of the playback node */
+};
+
+/* one cycle of the capture to playback links, called from the data loop */
+static int do_cycle(struct spa_loop *loop,
+		    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	const struct cycle *c = data;
+	struct node *capture = pw_node_get_user_data(c->t->capture);
+	struct node *playback = pw_node_get_user_data(c->t->playback);
+	struct port *outp;
+	uint32_t i, j;
+
+	for (i = 0; i < N_CHANNELS; i++) {
+		struct port *p = GET_OUT_PORT(capture, i);
+		struct pw_port *port = pw_node_find_port(c->t->playback, PW_DIRECTION_INPUT, i);
+		struct spa_data *d;
+		struct buffer *b;
+		float *samples;
+
+		b = dequeue_buffer(capture, p);
+		spa_assert_se(b != NULL);
+
+		d = &b->outbuf->datas[0];
+		samples = d->data;
+		for (j = 0; j < d->maxsize / sizeof(float); j++)
+			samples[j] = j < c->n_frames ? 0.5f : 1.0f;
+		d->chunk->offset = 0;
+		d->chunk->size = c->n_frames * sizeof(float);
+
+		port->io.buffer_id = b->outbuf->id;
+		port->io.status = SPA_STATUS_HAVE_BUFFER;
+		recycle_buffer(capture, p, b->outbuf->id);
+	}
+
+	spa_assert_se(node_process_input(&playback->node_impl) == SPA_STATUS_HAVE_BUFFER);
+
+	outp = GET_OUT_PORT(playback, 0);
+	memcpy(c->result, playback->out_ports[0]->buffers[outp->io->buffer_id].ptr,
+			get_quantum(playback) * sizeof(int16_t) * N_CHANNELS);
+
+	/* the peer of the playback node consumed the output */
+	outp->io->status = SPA_STATUS_NEED_BUFFER;
+	spa_assert_se(node_process_output(&playback->node_impl) == SPA_STATUS_NEED_BUFFER);
+
+	return 0;
+}
+
+/* the producer wrote n_frames, the rest of the quantum must be silence */
+static void check_cycle(struct test *t, uint32_t n_frames)
+{
+	uint32_t i, quantum = pw_core_get_quantum(t->core);
+	int16_t result[4 * QUANTUM * N_CHANNELS];
+	struct cycle c = { t, n_frames, result };
+
+	pw_loop_invoke(t->core->data_loop, do_cycle, SPA_ID_INVALID,
+			&c, sizeof(c), true, NULL);
+
+	for (i = 0; i < quantum * N_CHANNELS; i++)
+		spa_assert_se(result[i] == (i < n_frames * N_CHANNELS ? 16384 : 0));
+}
+
+static void test_quantum_change(void)
+{
+	struct test t;
+	uint32_t i;
+
+	test_init(&t);
+	wait_links(&t);
+
+	spa_assert_se(pw_core_get_quantum(t.core) == QUANTUM);
+	for (i = 0; i < N_LINKS; i++)
+		spa_assert_se(link_buffer_size(t.links[i]) == QUANTUM * sizeof(float));
+	check_cycle(&t, QUANTUM);
+
+	/* larger buffers are needed, all links allocate again */
+	spa_assert_se(pw_core_set_quantum(t.core, 4 * QUANTUM) >= 0);
+	wait_links(&t);
+	spa_assert_se(pw_core_get_quantum(t.core) == 4 * QUANTUM);
+	for (i = 0; i < N_LINKS; i++)
+		spa_assert_se(link_buffer_size(t.links[i]) == 4 * QUANTUM * sizeof(float));
+	check_cycle(&t, 4 * QUANTUM);
+
+	/* the producer can still write the old quantum in the first cycle */
+	check_cycle(&t, QUANTUM);
+
+	/* the buffers are large enough for a smaller quantum and are kept */
+	spa_assert_se(pw_core_set_quantum(t.core, QUANTUM / 4) >= 0);
+	wait_links(&t);
+	for (i = 0; i < N_LINKS; i++)
+		spa_assert_se(link_buffer_size(t.links[i]) == 4 * QUANTUM * sizeof(float));
+	check_cycle(&t, QUANTUM / 4);
+	check_cycle(&t, QUANTUM / 8);
+
+	test_clear(&t);
+}
+
+int main(int argc, char *argv[])
+{
+	pw_init(&argc, &argv);
+
+	test_quantum_change();
+
+	return 0;
+}
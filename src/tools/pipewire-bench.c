@@ -0,0 +1,708 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <spa/support/type-map.h>
+#include <spa/param/format-utils.h>
+#include <spa/param/audio/format-utils.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/core.h>
+#include <pipewire/global.h>
+#include <pipewire/link.h>
+#include <pipewire/module.h>
+#include <pipewire/node.h>
+#include <pipewire/port.h>
+
+#include <extensions/profiler.h>
+
+/* set on the streams so that the server can match the client nodes */
+#define BENCH_PROP_INDEX	"pipewire.bench.index"
+#define BENCH_DRIVER_NAME	"bench-driver"
+
+#define MAX_CLIENTS	64
+
+struct type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
+}
+
+/** result of one client, sent from the server to the parent */
+struct result {
+	int32_t index;
+	uint64_t cycles;
+	struct pw_profiler_stats rtt;
+};
+
+struct bench_node {
+	struct spa_list link;
+	struct server *server;
+	struct pw_node *node;
+	struct spa_hook node_listener;
+
+	bool driver;
+	int index;
+
+	/* the driver of a client */
+	struct bench_node *peer;
+	/* start of the current cycle of a driver */
+	uint64_t cycle_start;
+
+	uint64_t cycles;
+	struct pw_profiler_stats rtt;
+};
+
+struct server {
+	struct data *data;
+	struct type type;
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct pw_type *t;
+	struct spa_hook core_listener;
+
+	struct spa_list nodes;
+};
+
+struct client {
+	struct data *data;
+	struct type type;
+	int index;
+
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+	struct pw_type *t;
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+
+	struct pw_stream *stream;
+	struct spa_hook stream_listener;
+	struct spa_source *timer;
+
+	bool streaming;
+};
+
+struct data {
+	char name[64];
+	uint32_t n_clients;
+	uint32_t duration;
+	uint32_t buffer_size;
+	uint32_t warmup;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static struct spa_pod *build_format(struct type *type, struct pw_type *t, uint32_t id,
+				    struct spa_pod_builder *b)
+{
+	return spa_pod_builder_object(b,
+		id, t->spa_format,
+		"I", type->media_type.audio,
+		"I", type->media_subtype.raw,
+		":", type->format_audio.format,   "I", type->audio_format.S16,
+		":", type->format_audio.layout,   "i", SPA_AUDIO_LAYOUT_INTERLEAVED,
+		":", type->format_audio.rate,     "i", 48000,
+		":", type->format_audio.channels, "i", 2);
+}
+
+/* the server: an in-process daemon that hooks the node events in the
+ * data thread to measure the time between the start of a cycle in the
+ * driver and the output of the client */
+static struct bench_node *find_node(struct server *s, struct pw_node *node)
+{
+	struct bench_node *n;
+
+	spa_list_for_each(n, &s->nodes, link)
+		if (n->node == node)
+			return n;
+	return NULL;
+}
+
+static void node_destroy(void *data)
+{
+	struct bench_node *n = data;
+
+	spa_hook_remove(&n->node_listener);
+	n->node = NULL;
+}
+
+static void node_need_input(void *data)
+{
+	struct bench_node *n = data;
+
+	if (n->driver)
+		n->cycle_start = get_time();
+}
+
+static void node_have_output(void *data)
+{
+	struct bench_node *n = data;
+	struct bench_node *d = n->peer;
+	struct server *s = n->server;
+
+	if (d == NULL || d->cycle_start == 0)
+		return;
+
+	if (n->cycles++ >= s->data->warmup)
+		pw_profiler_stats_add(&n->rtt, get_time() - d->cycle_start);
+	d->cycle_start = 0;
+}
+
+static const struct pw_node_events node_events = {
+	PW_VERSION_NODE_EVENTS,
+	.destroy = node_destroy,
+	.need_input = node_need_input,
+	.have_output = node_have_output,
+};
+
+static void add_node(struct server *s, struct pw_node *node)
+{
+	const struct pw_properties *props = pw_node_get_properties(node);
+	const struct pw_node_info *info = pw_node_get_info(node);
+	struct bench_node *n;
+	const char *str;
+	bool driver;
+	int index;
+
+	if (info->name && strncmp(info->name, BENCH_DRIVER_NAME, strlen(BENCH_DRIVER_NAME)) == 0) {
+		driver = true;
+		index = -1;
+	}
+	else if (props && (str = pw_properties_get(props, BENCH_PROP_INDEX)) != NULL) {
+		driver = false;
+		index = atoi(str);
+	}
+	else
+		return;
+
+	if ((n = calloc(1, sizeof(struct bench_node))) == NULL)
+		return;
+
+	n->server = s;
+	n->node = node;
+	n->driver = driver;
+	n->index = index;
+	spa_list_append(&s->nodes, &n->link);
+
+	pw_node_add_listener(node, &n->node_listener, &node_events, n);
+
+	if (driver) {
+		uint8_t buffer[1024];
+		struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+		struct spa_pod *format;
+		int res;
+
+		/* fakesink accepts any format, fix it so that it can be
+		 * negotiated with the streams */
+		format = build_format(&s->type, s->t, s->t->param.idFormat, &b);
+		if ((res = spa_node_port_set_param(pw_node_get_implementation(node),
+						   SPA_DIRECTION_INPUT, 0,
+						   s->t->param.idFormat, 0, format)) < 0)
+			fprintf(stderr, "can't set driver format: %s\n", spa_strerror(res));
+	}
+}
+
+static void add_link(struct server *s, struct pw_link *link)
+{
+	struct bench_node *out, *in;
+
+	out = find_node(s, pw_port_get_node(pw_link_get_output(link)));
+	in = find_node(s, pw_port_get_node(pw_link_get_input(link)));
+
+	if (out && in && !out->driver && in->driver)
+		out->peer = in;
+}
+
+static void core_global_added(void *data, struct pw_global *global)
+{
+	struct server *s = data;
+	uint32_t type = pw_global_get_type(global);
+
+	if (type == s->t->node)
+		add_node(s, pw_global_get_object(global));
+	else if (type == s->t->link)
+		add_link(s, pw_global_get_object(global));
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.global_added = core_global_added,
+};
+
+static void do_quit(void *data, int signal_number)
+{
+	struct pw_main_loop *loop = data;
+	pw_main_loop_quit(loop);
+}
+
+static int run_server(struct data *data, int fd)
+{
+	struct server s = { 0 };
+	struct bench_node *n, *t;
+	struct pw_properties *props;
+	struct result r;
+	char args[256];
+	uint32_t i;
+	int res = 0;
+
+	pw_init(NULL, NULL);
+
+	s.data = data;
+	spa_list_init(&s.nodes);
+
+	props = pw_properties_new(PW_CORE_PROP_NAME, data->name,
+				  PW_CORE_PROP_DAEMON, "1", NULL);
+
+	s.loop = pw_main_loop_new(NULL);
+	pw_loop_add_signal(pw_main_loop_get_loop(s.loop), SIGINT, do_quit, s.loop);
+	pw_loop_add_signal(pw_main_loop_get_loop(s.loop), SIGTERM, do_quit, s.loop);
+
+	s.core = pw_core_new(pw_main_loop_get_loop(s.loop), props);
+	s.t = pw_core_get_type(s.core);
+	init_type(&s.type, s.t->map);
+
+	pw_core_add_listener(s.core, &s.core_listener, &core_events, &s);
+
+	if (pw_module_load(s.core, "libpipewire-module-protocol-native", NULL, NULL, NULL, NULL) == NULL ||
+	    pw_module_load(s.core, "libpipewire-module-client-node", NULL, NULL, NULL, NULL) == NULL ||
+	    pw_module_load(s.core, "libpipewire-module-autolink", NULL, NULL, NULL, NULL) == NULL) {
+		fprintf(stderr, "can't load modules\n");
+		return -1;
+	}
+	/* fakesink has one input port, make a driver for each client */
+	for (i = 0; i < data->n_clients; i++) {
+		snprintf(args, sizeof(args), "test/libspa-test fakesink %s-%d",
+				BENCH_DRIVER_NAME, i);
+		if (pw_module_load(s.core, "libpipewire-module-spa-node", args, NULL, NULL, NULL) == NULL) {
+			fprintf(stderr, "can't load fakesink\n");
+			return -1;
+		}
+	}
+
+	/* tell the parent that the clients can connect */
+	if (write(fd, &res, sizeof(res)) != sizeof(res))
+		return -1;
+
+	pw_main_loop_run(s.loop);
+
+	spa_hook_remove(&s.core_listener);
+	pw_core_destroy(s.core);
+	pw_main_loop_destroy(s.loop);
+
+	/* the data thread is stopped now */
+	spa_list_for_each_safe(n, t, &s.nodes, link) {
+		if (!n->driver) {
+			r.index = n->index;
+			r.cycles = n->cycles;
+			r.rtt = n->rtt;
+			if (write(fd, &r, sizeof(r)) != sizeof(r))
+				res = -1;
+		}
+		spa_list_remove(&n->link);
+		free(n);
+	}
+	return res;
+}
+
+/* the clients: a pw_stream that produces a buffer in each cycle from
+ * the realtime thread */
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct client *c = data;
+	pw_main_loop_quit(c->loop);
+}
+
+static void on_stream_process(void *data)
+{
+	struct client *c = data;
+	struct pw_buffer *buf;
+	struct spa_buffer *b;
+
+	if ((buf = pw_stream_dequeue_buffer(c->stream)) == NULL)
+		return;
+
+	b = buf->buffer;
+	b->datas[0].chunk->offset = 0;
+	b->datas[0].chunk->size = b->datas[0].maxsize;
+	b->datas[0].chunk->stride = 4;
+
+	pw_stream_queue_buffer(c->stream, buf);
+}
+
+static void on_stream_format_changed(void *data, const struct spa_pod *format)
+{
+	struct client *c = data;
+	struct pw_type *t = c->t;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+
+	if (format == NULL) {
+		pw_stream_finish_format(c->stream, 0, NULL, 0);
+		return;
+	}
+	params[0] = spa_pod_builder_object(&b,
+		t->param.idBuffers, t->param_buffers.Buffers,
+		":", t->param_buffers.size,    "i", c->data->buffer_size,
+		":", t->param_buffers.stride,  "i", 4,
+		":", t->param_buffers.buffers, "iru", 2,
+			SPA_POD_PROP_MIN_MAX(2, 16),
+		":", t->param_buffers.align,   "i", 16);
+
+	pw_stream_finish_format(c->stream, 0, params, 1);
+}
+
+static void on_stream_state_changed(void *data, enum pw_stream_state old,
+				    enum pw_stream_state state, const char *error)
+{
+	struct client *c = data;
+	struct timespec value;
+
+	switch (state) {
+	case PW_STREAM_STATE_ERROR:
+		fprintf(stderr, "client %d: stream error: %s\n", c->index, error);
+		pw_main_loop_quit(c->loop);
+		break;
+	case PW_STREAM_STATE_STREAMING:
+		if (c->streaming)
+			break;
+		c->streaming = true;
+		value.tv_sec = c->data->duration;
+		value.tv_nsec = 0;
+		pw_loop_update_timer(pw_main_loop_get_loop(c->loop),
+				c->timer, &value, NULL, false);
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_stream_events stream_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_stream_state_changed,
+	.format_changed = on_stream_format_changed,
+	.process = on_stream_process,
+};
+
+static void on_state_changed(void *data, enum pw_remote_state old,
+			     enum pw_remote_state state, const char *error)
+{
+	struct client *c = data;
+	const struct spa_pod *params[1];
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	char name[64], index[16];
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+		fprintf(stderr, "client %d: remote error: %s\n", c->index, error);
+		pw_main_loop_quit(c->loop);
+		break;
+
+	case PW_REMOTE_STATE_CONNECTED:
+		snprintf(name, sizeof(name), "pw-bench-%d", c->index);
+		snprintf(index, sizeof(index), "%d", c->index);
+
+		c->stream = pw_stream_new(c->remote, name,
+				pw_properties_new(
+					PW_NODE_PROP_MEDIA, "Audio",
+					PW_NODE_PROP_CATEGORY, "Playback",
+					PW_NODE_PROP_ROLE, "Test",
+					BENCH_PROP_INDEX, index,
+					NULL));
+
+		params[0] = build_format(&c->type, c->t, c->t->param.idEnumFormat, &b);
+
+		pw_stream_add_listener(c->stream, &c->stream_listener, &stream_events, c);
+
+		pw_stream_connect(c->stream,
+				  PW_DIRECTION_OUTPUT,
+				  NULL,
+				  PW_STREAM_FLAG_AUTOCONNECT |
+				  PW_STREAM_FLAG_RT_PROCESS,
+				  params, 1);
+		break;
+
+	case PW_REMOTE_STATE_UNCONNECTED:
+		pw_main_loop_quit(c->loop);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_state_changed,
+};
+
+static int run_client(struct data *data, int index)
+{
+	struct client c = { 0 };
+
+	pw_init(NULL, NULL);
+
+	c.data = data;
+	c.index = index;
+	c.loop = pw_main_loop_new(NULL);
+	c.core = pw_core_new(pw_main_loop_get_loop(c.loop), NULL);
+	c.t = pw_core_get_type(c.core);
+	init_type(&c.type, c.t->map);
+	c.timer = pw_loop_add_timer(pw_main_loop_get_loop(c.loop), on_timeout, &c);
+
+	c.remote = pw_remote_new(c.core,
+			pw_properties_new(PW_REMOTE_PROP_REMOTE_NAME, data->name, NULL), 0);
+
+	pw_remote_add_listener(c.remote, &c.remote_listener, &remote_events, &c);
+	if (pw_remote_connect(c.remote) < 0)
+		return -1;
+
+	pw_main_loop_run(c.loop);
+
+	if (c.stream)
+		pw_stream_destroy(c.stream);
+	pw_remote_destroy(c.remote);
+	pw_core_destroy(c.core);
+	pw_main_loop_destroy(c.loop);
+
+	return c.streaming ? 0 : -1;
+}
+
+/* the parent: spawns the processes and reports */
+#define TV_TO_NS(tv)	((tv).tv_sec * SPA_NSEC_PER_SEC + (tv).tv_usec * SPA_NSEC_PER_USEC)
+
+struct child {
+	pid_t pid;
+	int status;
+	uint64_t start;
+	uint64_t wall;
+	uint64_t cpu;
+	struct result result;
+};
+
+static void wait_child(struct child *c)
+{
+	struct rusage ru;
+
+	if (wait4(c->pid, &c->status, 0, &ru) < 0) {
+		perror("wait4");
+		c->status = -1;
+		return;
+	}
+	c->wall = get_time() - c->start;
+	c->cpu = TV_TO_NS(ru.ru_utime) + TV_TO_NS(ru.ru_stime);
+}
+
+static void print_child(const char *indent, struct child *c)
+{
+	printf("%s\"pid\": %d, \"exit\": %d, \"wall_ns\": %" PRIu64 ", \"cpu_ns\": %" PRIu64
+			", \"cpu_percent\": %.2f",
+			indent, c->pid,
+			WIFEXITED(c->status) ? WEXITSTATUS(c->status) : -1,
+			c->wall, c->cpu,
+			c->wall ? 100.0 * c->cpu / c->wall : 0.0);
+}
+
+static void report(struct data *data, struct child *server, struct child *clients)
+{
+	uint32_t i;
+
+	printf("{\n");
+	printf("  \"clients\": %u,\n", data->n_clients);
+	printf("  \"duration_s\": %u,\n", data->duration);
+	printf("  \"buffer_size\": %u,\n", data->buffer_size);
+	printf("  \"warmup\": %u,\n", data->warmup);
+	printf("  \"server\": {");
+	print_child(" ", server);
+	printf(" },\n");
+	printf("  \"client\": [\n");
+	for (i = 0; i < data->n_clients; i++) {
+		struct child *c = &clients[i];
+		const struct pw_profiler_stats *rtt = &c->result.rtt;
+
+		printf("    {\n      \"index\": %u,\n", i);
+		print_child("      ", c);
+		printf(",\n      \"cycles\": %" PRIu64 ", \"cpu_ns_per_cycle\": %.1f,\n",
+				c->result.cycles,
+				c->result.cycles ? (double) c->cpu / c->result.cycles : 0.0);
+		printf("      \"rtt_ns\": { \"count\": %" PRIu64 ", \"min\": %" PRIu64
+				", \"mean\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64
+				", \"p99\": %" PRIu64 ", \"max\": %" PRIu64 " }\n",
+				rtt->count, rtt->min,
+				rtt->count ? rtt->total / rtt->count : 0,
+				pw_profiler_stats_percentile(rtt, 50),
+				pw_profiler_stats_percentile(rtt, 90),
+				pw_profiler_stats_percentile(rtt, 99),
+				rtt->max);
+		printf("    }%s\n", i + 1 < data->n_clients ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+static void show_help(const char *name)
+{
+	fprintf(stdout, "%s [options]\n"
+             "  -h, --help                            Show this help\n"
+             "  -c, --clients                         Number of clients (Default 1)\n"
+             "  -d, --duration                        Seconds to stream (Default 5)\n"
+             "  -b, --buffer-size                     Buffer size in bytes (Default 1024)\n"
+             "  -w, --warmup                          Cycles to skip (Default 100)\n"
+             "\n"
+             "Starts a server with a fakesink driver per client and the clients\n"
+             "in separate processes and prints the round-trip latency and CPU\n"
+             "usage of each client as JSON. The children are forked so the whole\n"
+             "run can be measured with perf stat.\n",
+	     name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct child server = { 0 }, *clients;
+	static const struct option long_options[] = {
+		{"help",	0, NULL, 'h'},
+		{"clients",	1, NULL, 'c'},
+		{"duration",	1, NULL, 'd'},
+		{"buffer-size",	1, NULL, 'b'},
+		{"warmup",	1, NULL, 'w'},
+		{NULL,		0, NULL, 0}
+	};
+	struct result r;
+	int c, fd[2], res = 0;
+	uint32_t i;
+
+	data.n_clients = 1;
+	data.duration = 5;
+	data.buffer_size = 1024;
+	data.warmup = 100;
+
+	while ((c = getopt_long(argc, argv, "hc:d:b:w:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 'c':
+			data.n_clients = atoi(optarg);
+			break;
+		case 'd':
+			data.duration = atoi(optarg);
+			break;
+		case 'b':
+			data.buffer_size = atoi(optarg);
+			break;
+		case 'w':
+			data.warmup = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return -1;
+		}
+	}
+	if (data.n_clients == 0 || data.n_clients > MAX_CLIENTS ||
+	    data.duration == 0 || data.buffer_size == 0) {
+		fprintf(stderr, "invalid arguments\n");
+		return -1;
+	}
+	snprintf(data.name, sizeof(data.name), "pipewire-bench-%d", getpid());
+
+	if ((clients = calloc(data.n_clients, sizeof(struct child))) == NULL)
+		return -1;
+
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(stdout);
+	server.start = get_time();
+	if ((server.pid = fork()) == 0) {
+		close(fd[0]);
+		exit(run_server(&data, fd[1]) < 0 ? 1 : 0);
+	}
+	close(fd[1]);
+
+	if (server.pid < 0 ||
+	    read(fd[0], &res, sizeof(res)) != sizeof(res)) {
+		fprintf(stderr, "server failed to start\n");
+		res = -1;
+		goto done;
+	}
+
+	for (i = 0; i < data.n_clients; i++) {
+		clients[i].start = get_time();
+		if ((clients[i].pid = fork()) == 0) {
+			close(fd[0]);
+			exit(run_client(&data, i) < 0 ? 1 : 0);
+		}
+		if (clients[i].pid < 0) {
+			perror("fork");
+			data.n_clients = i;
+			res = -1;
+			break;
+		}
+	}
+	for (i = 0; i < data.n_clients; i++) {
+		wait_child(&clients[i]);
+		if (!WIFEXITED(clients[i].status) || WEXITSTATUS(clients[i].status) != 0)
+			res = -1;
+	}
+
+	kill(server.pid, SIGTERM);
+	while (read(fd[0], &r, sizeof(r)) == sizeof(r)) {
+		if (r.index >= 0 && (uint32_t) r.index < data.n_clients)
+			clients[r.index].result = r;
+	}
+
+      done:
+	close(fd[0]);
+	if (server.pid > 0)
+		wait_child(&server);
+
+	report(&data, &server, clients);
+	free(clients);
+
+	return res;
+}
@@ -299,7 +299,7 @@ static void registry_event_global(void *data, uint32_t id, uint32_t parent_id,
 	print_global(global, NULL);
 
 	size = pw_map_get_size(&rd->globals);
-	while (id > size)
+	while (PW_MAP_ID_INDEX(id) > size)
 		pw_map_insert_at(&rd->globals, size++, NULL);
 	pw_map_insert_at(&rd->globals, id, global);
 }
@@ -412,7 +412,7 @@ static bool do_connect(struct data *data, const char *cmd, char *args, char **er
 	rd = pw_remote_get_user_data(remote);
 	rd->remote = remote;
 	rd->data = data;
-	pw_map_init(&rd->globals, 64, 16);
+	pw_map_init_tagged(&rd->globals, 64, 16);
 	rd->id = pw_map_insert_new(&data->vars, rd);
 	spa_list_append(&data->remotes, &rd->link);
 
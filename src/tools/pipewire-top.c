@@ -0,0 +1,271 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/interfaces.h>
+#include <pipewire/mem.h>
+#include <pipewire/type.h>
+
+#include <extensions/profiler.h>
+
+struct data {
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+
+	struct pw_core_proxy *core_proxy;
+
+	struct pw_registry_proxy *registry_proxy;
+	struct spa_hook registry_listener;
+
+	uint32_t type_profiler;
+	struct pw_profiler_proxy *profiler;
+	struct spa_hook profiler_listener;
+
+	struct pw_memblock *mem;
+	struct pw_profiler_area *area;
+
+	struct spa_source *timer;
+};
+
+#define US(v)	((double)(v) / 1000.0)
+
+static void print_stats_header(void)
+{
+	printf("%10s %10s %10s %10s %10s %10s",
+			"COUNT", "AVG(us)", "MIN(us)", "P50(us)", "P99(us)", "MAX(us)");
+}
+
+static void print_stats(const struct pw_profiler_stats *s)
+{
+	printf("%10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f",
+			s->count,
+			s->count ? US(s->total / s->count) : 0.0,
+			US(s->min),
+			US(pw_profiler_stats_percentile(s, 50)),
+			US(pw_profiler_stats_percentile(s, 99)),
+			US(s->max));
+}
+
+static void do_refresh(void *_data, uint64_t expirations)
+{
+	struct data *data = _data;
+	struct pw_profiler_area area;
+	struct pw_profiler_node node;
+	uint32_t i;
+
+	if (data->area == NULL)
+		return;
+
+	if (!pw_profiler_area_read_cycle(data->area, &area))
+		return;
+
+	/* clear the screen */
+	printf("\033[H\033[2J");
+
+	printf("cycles: %" PRIu64 "  xruns: %" PRIu64, area.cycles, area.xruns);
+	if (area.xruns > 0)
+		printf("  last xrun: node %d", area.last_xrun_node);
+	printf("\n\n%-8s ", "");
+	print_stats_header();
+	printf("\n%-8s ", "cycle");
+	print_stats(&area.cycle);
+	printf("\n%-8s ", "period");
+	print_stats(&area.period);
+	printf("\n\n%5s %-24s ", "ID", "NAME");
+	print_stats_header();
+	printf(" %8s\n", "XRUNS");
+
+	for (i = 0; i < area.max_nodes; i++) {
+		if (!pw_profiler_area_read_node(data->area, i, &node) ||
+		    node.id == SPA_ID_INVALID)
+			continue;
+
+		node.name[sizeof(node.name) - 1] = '\0';
+		printf("%5d %-24.24s ", node.id, node.name);
+		print_stats(&node.process);
+		printf(" %8" PRIu64 "\n", node.xruns);
+	}
+	fflush(stdout);
+}
+
+static void profiler_area(void *_data, int memfd, uint32_t offset, uint32_t size)
+{
+	struct data *data = _data;
+	struct pw_loop *l = pw_main_loop_get_loop(data->loop);
+	struct timespec value, interval;
+
+	if (data->mem)
+		pw_memblock_free(data->mem);
+	data->mem = NULL;
+	data->area = NULL;
+
+	if (pw_memblock_import(PW_MEMBLOCK_FLAG_MAP_READ,
+			       memfd, offset, size, &data->mem) < 0) {
+		fprintf(stderr, "can't map profiler area\n");
+		pw_main_loop_quit(data->loop);
+		return;
+	}
+	data->area = data->mem->ptr;
+
+	if (data->area->version != PW_VERSION_PROFILER ||
+	    size < PW_PROFILER_AREA_SIZE(data->area->max_nodes)) {
+		fprintf(stderr, "invalid profiler area\n");
+		data->area = NULL;
+		pw_main_loop_quit(data->loop);
+		return;
+	}
+
+	value.tv_sec = 0;
+	value.tv_nsec = 1;
+	interval.tv_sec = 1;
+	interval.tv_nsec = 0;
+	pw_loop_update_timer(l, data->timer, &value, &interval, false);
+}
+
+static const struct pw_profiler_proxy_events profiler_events = {
+	PW_VERSION_PROFILER_PROXY_EVENTS,
+	.area = profiler_area,
+};
+
+static void registry_event_global(void *_data, uint32_t id, uint32_t parent_id,
+				  uint32_t permissions, uint32_t type, uint32_t version,
+				  const struct spa_dict *props)
+{
+	struct data *data = _data;
+
+	if (type != data->type_profiler || data->profiler != NULL)
+		return;
+
+	data->profiler = pw_registry_proxy_bind(data->registry_proxy, id, type,
+						PW_VERSION_PROFILER, 0);
+	if (data->profiler == NULL) {
+		fprintf(stderr, "can't bind profiler\n");
+		return;
+	}
+	pw_profiler_proxy_add_listener(data->profiler, &data->profiler_listener,
+				       &profiler_events, data);
+}
+
+static const struct pw_registry_proxy_events registry_events = {
+	PW_VERSION_REGISTRY_PROXY_EVENTS,
+	.global = registry_event_global,
+};
+
+static void on_state_changed(void *_data, enum pw_remote_state old,
+			     enum pw_remote_state state, const char *error)
+{
+	struct data *data = _data;
+	struct pw_type *t = pw_core_get_type(data->core);
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+		fprintf(stderr, "remote error: %s\n", error);
+		pw_main_loop_quit(data->loop);
+		break;
+
+	case PW_REMOTE_STATE_CONNECTED:
+		data->core_proxy = pw_remote_get_core_proxy(data->remote);
+		data->registry_proxy = pw_core_proxy_get_registry(data->core_proxy,
+								  t->registry,
+								  PW_VERSION_REGISTRY, 0);
+		pw_registry_proxy_add_listener(data->registry_proxy,
+					       &data->registry_listener,
+					       &registry_events, data);
+		break;
+
+	case PW_REMOTE_STATE_UNCONNECTED:
+		pw_main_loop_quit(data->loop);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_state_changed,
+};
+
+static void do_quit(void *data, int signal_number)
+{
+	struct data *d = data;
+	pw_main_loop_quit(d->loop);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct pw_loop *l;
+	struct pw_type *t;
+	struct pw_properties *props = NULL;
+
+	pw_init(&argc, &argv);
+
+	data.loop = pw_main_loop_new(NULL);
+	if (data.loop == NULL)
+		return -1;
+
+	l = pw_main_loop_get_loop(data.loop);
+	pw_loop_add_signal(l, SIGINT, do_quit, &data);
+	pw_loop_add_signal(l, SIGTERM, do_quit, &data);
+	data.timer = pw_loop_add_timer(l, do_refresh, &data);
+
+	data.core = pw_core_new(l, NULL);
+	if (data.core == NULL)
+		return -1;
+
+	t = pw_core_get_type(data.core);
+	data.type_profiler = spa_type_map_get_id(t->map, PW_TYPE_INTERFACE__Profiler);
+
+	if (argc > 1)
+		props = pw_properties_new(PW_REMOTE_PROP_REMOTE_NAME, argv[1], NULL);
+
+	data.remote = pw_remote_new(data.core, props, 0);
+	if (data.remote == NULL)
+		return -1;
+
+	/* for the protocol marshal of the profiler interface */
+	if (pw_module_load(data.core, "libpipewire-module-profiler", NULL, NULL, NULL, NULL) == NULL) {
+		fprintf(stderr, "can't load profiler module\n");
+		return -1;
+	}
+
+	pw_remote_add_listener(data.remote, &data.remote_listener, &remote_events, &data);
+	if (pw_remote_connect(data.remote) < 0)
+		return -1;
+
+	pw_main_loop_run(data.loop);
+
+	if (data.mem)
+		pw_memblock_free(data.mem);
+	pw_remote_destroy(data.remote);
+	pw_core_destroy(data.core);
+	pw_main_loop_destroy(data.loop);
+
+	return 0;
+}